@@ -0,0 +1,366 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 30/10/2016
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "spdk/env.h"
+#include "nvfuse_core.h"
+#include "nvfuse_config.h"
+#include "nvfuse_api.h"
+#include "nvfuse_bp_tree.h"
+#include "nvfuse_inode_cache.h"
+#include "nvfuse_gettimeofday.h"
+#include "nvfuse_aio.h"
+#include "nvfuse_debug.h"
+
+#define DEINIT_IOM	1
+#define UMOUNT		1
+
+/* number of keys inserted into each b+tree */
+#define BP_PERF_NUM_KEYS	(10 * 1000 * 1000)
+/* number of keys inserted through a single master before dirty data is flushed */
+#define BP_PERF_INSERT_BATCH	(64 * 1024)
+/* every n-th key is looked up after loading */
+#define BP_PERF_VERIFY_STRIDE	1000
+/* in-memory nodes and lookups of the node search microbenchmark */
+#define BP_PERF_SEARCH_NODES	1024
+#define BP_PERF_SEARCH_LOOKUPS	(10 * 1000 * 1000)
+
+static struct nvfuse_ipc_context ipc_ctx;
+static struct nvfuse_params params;
+static struct nvfuse_handle *nvh;
+
+static int bp_perf_key_cmp(const void *k1, const void *k2)
+{
+	bkey_t key1 = *(const bkey_t *)k1;
+	bkey_t key2 = *(const bkey_t *)k2;
+
+	if (key1 > key2)
+		return 1;
+	else if (key1 < key2)
+		return -1;
+
+	return 0;
+}
+
+static inline u64 bp_perf_xorshift(u64 *state)
+{
+	u64 x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+
+	return x;
+}
+
+/*
+ * measure in-node key search of full leaves (lookups per second on this core):
+ * comparator based bp_bin_search() versus inlined bp_search_key()
+ */
+static s32 bp_perf_node_search(void)
+{
+	key_pair_t pair;
+	struct timeval tv;
+	bkey_t *keys;
+	bkey_t key;
+	u64 state;
+	s64 sum;
+	s32 node, i, j;
+
+	keys = malloc(sizeof(bkey_t) * FANOUT * BP_PERF_SEARCH_NODES);
+	if (keys == NULL) {
+		printf(" Error: malloc() \n");
+		return -1;
+	}
+
+	/* keys are sorted within each node */
+	for (node = 0; node < BP_PERF_SEARCH_NODES; node++) {
+		for (j = 0; j < FANOUT; j++)
+			keys[node * FANOUT + j] = ((bkey_t)node << 32) + (bkey_t)(j + 1) * 3;
+	}
+
+	printf(" Start: node search %d lookups (fanout = %d).\n", BP_PERF_SEARCH_LOOKUPS, (s32)FANOUT);
+
+	state = 0x2545F4914F6CDD1DULL;
+	sum = 0;
+	gettimeofday(&tv, NULL);
+	for (i = 0; i < BP_PERF_SEARCH_LOOKUPS; i++) {
+		node = bp_perf_xorshift(&state) % BP_PERF_SEARCH_NODES;
+		j = bp_perf_xorshift(&state) % FANOUT;
+		key = keys[node * FANOUT + j];
+
+		pair.i_key = keys + node * FANOUT;
+		sum += bp_bin_search(&key, &pair, FANOUT - 1, key_compare);
+	}
+	printf(" bp_bin_search: %.3f lookups/sec (sum = %ld)\n",
+	       BP_PERF_SEARCH_LOOKUPS / nvfuse_time_since_now(&tv), (long)sum);
+
+	state = 0x2545F4914F6CDD1DULL;
+	sum = 0;
+	gettimeofday(&tv, NULL);
+	for (i = 0; i < BP_PERF_SEARCH_LOOKUPS; i++) {
+		node = bp_perf_xorshift(&state) % BP_PERF_SEARCH_NODES;
+		j = bp_perf_xorshift(&state) % FANOUT;
+		key = keys[node * FANOUT + j];
+
+		sum += bp_search_key(keys + node * FANOUT, FANOUT, key);
+	}
+	printf(" bp_search_key: %.3f lookups/sec (sum = %ld)\n",
+	       BP_PERF_SEARCH_LOOKUPS / nvfuse_time_since_now(&tv), (long)sum);
+
+	free(keys);
+
+	return 0;
+}
+
+/* odd multiplier makes a bijection so that keys are unique, non-zero and unordered */
+static void bp_perf_make_keys(bkey_t *keys, bitem_t *items, s32 num)
+{
+	s32 i;
+
+	for (i = 0; i < num; i++) {
+		keys[i] = (bkey_t)(i + 1) * 0x9E3779B97F4A7C15ULL;
+		items[i] = (bitem_t)(i + 1);
+	}
+}
+
+static master_node_t *bp_perf_open_master(struct nvfuse_superblock *sb, inode_t bpino)
+{
+	master_node_t *master;
+
+	master = bp_init_master(sb);
+	master->m_ino = bpino;
+	master->m_sb = sb;
+	bp_read_master(master);
+
+	return master;
+}
+
+static void bp_perf_close_master(struct nvfuse_superblock *sb, master_node_t *master)
+{
+	bp_write_master(master);
+	bp_deinit_master(master);
+	nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_DELAY);
+}
+
+static void bp_perf_delete_tree(struct nvfuse_superblock *sb, inode_t bpino)
+{
+	struct nvfuse_inode_ctx *bp_ictx;
+
+	bp_ictx = nvfuse_read_inode(sb, NULL, bpino);
+	nvfuse_free_inode_size(sb, bp_ictx, 0);
+	nvfuse_relocate_delete_inode(sb, bp_ictx);
+	nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_FORCE);
+}
+
+static s32 bp_perf_verify(struct nvfuse_superblock *sb, inode_t bpino, bkey_t *keys, s32 num)
+{
+	master_node_t *master;
+	struct timeval tv;
+	bitem_t item;
+	s32 count = 0;
+	s32 i;
+
+	gettimeofday(&tv, NULL);
+
+	master = bp_perf_open_master(sb, bpino);
+	for (i = 0; i < num; i += BP_PERF_VERIFY_STRIDE) {
+		if (bp_find_key(master, &keys[i], &item) < 0 || item == 0) {
+			printf(" Error: key %lx not found \n", (unsigned long)keys[i]);
+			bp_perf_close_master(sb, master);
+			return -1;
+		}
+		count++;
+	}
+	bp_perf_close_master(sb, master);
+
+	printf(" lookup %d keys %.3f OPS (%.3f sec)\n", count, count / nvfuse_time_since_now(&tv),
+	       nvfuse_time_since_now(&tv));
+
+	return 0;
+}
+
+/* insert unordered keys one at a time through B_INSERT */
+static s32 bp_perf_insert(struct nvfuse_superblock *sb, bkey_t *keys, bitem_t *items, s32 num)
+{
+	struct nvfuse_inode inode;
+	master_node_t *master;
+	struct timeval tv;
+	s32 i, ret;
+
+	memset(&inode, 0x00, sizeof(struct nvfuse_inode));
+	if (nvfuse_create_bptree(sb, &inode)) {
+		printf(" Error: create b+tree \n");
+		return -1;
+	}
+
+	bp_perf_make_keys(keys, items, num);
+
+	printf(" Start: inserting %d keys one by one.\n", num);
+	gettimeofday(&tv, NULL);
+
+	master = bp_perf_open_master(sb, inode.i_bpino);
+	for (i = 0; i < num; i++) {
+		if (B_INSERT(master, &keys[i], &items[i], NULL, 0) < 0) {
+			printf(" Error: insert key %lx \n", (unsigned long)keys[i]);
+			break;
+		}
+
+		if ((i + 1) % BP_PERF_INSERT_BATCH == 0) {
+			bp_perf_close_master(sb, master);
+			master = bp_perf_open_master(sb, inode.i_bpino);
+		}
+	}
+	bp_perf_close_master(sb, master);
+	nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_FORCE);
+
+	printf(" Finish: inserting %d keys %.3f OPS (%.3f sec)\n", i, i / nvfuse_time_since_now(&tv),
+	       nvfuse_time_since_now(&tv));
+
+	ret = (i == num) ? bp_perf_verify(sb, inode.i_bpino, keys, num) : -1;
+
+	bp_perf_delete_tree(sb, inode.i_bpino);
+
+	return ret;
+}
+
+/* sort the same keys and build the tree bottom-up with bp_bulk_load() */
+static s32 bp_perf_bulk_load(struct nvfuse_superblock *sb, bkey_t *keys, bitem_t *items, s32 num)
+{
+	struct nvfuse_inode inode;
+	master_node_t *master;
+	key_pair_t pair;
+	struct timeval tv;
+	s32 i, ret;
+
+	memset(&inode, 0x00, sizeof(struct nvfuse_inode));
+	if (nvfuse_create_bptree(sb, &inode)) {
+		printf(" Error: create b+tree \n");
+		return -1;
+	}
+
+	bp_perf_make_keys(keys, items, num);
+
+	printf(" Start: bulk loading %d keys.\n", num);
+	gettimeofday(&tv, NULL);
+
+	/* the sort is part of the measured time */
+	qsort(keys, num, sizeof(bkey_t), bp_perf_key_cmp);
+	for (i = 0; i < num; i++)
+		items[i] = (bitem_t)(i + 1);
+
+	pair.i_key = keys;
+	pair.i_item = items;
+
+	master = bp_perf_open_master(sb, inode.i_bpino);
+	ret = bp_bulk_load(master, &pair, num);
+	bp_perf_close_master(sb, master);
+	nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_FORCE);
+
+	if (ret < 0) {
+		printf(" Error: bulk load \n");
+	} else {
+		printf(" Finish: bulk loading %d keys %.3f OPS (%.3f sec)\n", num,
+		       num / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+		ret = bp_perf_verify(sb, inode.i_bpino, keys, num);
+	}
+
+	bp_perf_delete_tree(sb, inode.i_bpino);
+
+	return ret;
+}
+
+static void bptree_perf_run(void *arg1, void *arg2)
+{
+	struct nvfuse_superblock *sb;
+	bkey_t *keys = NULL;
+	bitem_t *items = NULL;
+
+	/* create nvfuse_handle with user spcified parameters */
+	nvh = nvfuse_create_handle(&ipc_ctx, &params);
+	if (nvh == NULL) {
+		fprintf(stderr, "Error: nvfuse_create_handle()\n");
+		return;
+	}
+
+	sb = nvfuse_read_super(nvh);
+
+	if (bp_perf_node_search() < 0)
+		goto RET;
+
+	keys = malloc(sizeof(bkey_t) * BP_PERF_NUM_KEYS);
+	items = malloc(sizeof(bitem_t) * BP_PERF_NUM_KEYS);
+	if (keys == NULL || items == NULL) {
+		printf(" Error: malloc() \n");
+		goto RET;
+	}
+
+	if (bp_perf_insert(sb, keys, items, BP_PERF_NUM_KEYS) < 0)
+		goto RET;
+
+	if (bp_perf_bulk_load(sb, keys, items, BP_PERF_NUM_KEYS) < 0)
+		goto RET;
+
+RET:
+	;
+
+	free(keys);
+	free(items);
+
+	nvfuse_destroy_handle(nvh, DEINIT_IOM, UMOUNT);
+
+	spdk_app_stop(0);
+}
+
+static void reactor_run(void *arg1, void *arg2)
+{
+	struct spdk_event *event;
+	u32 i;
+
+	/* Send events to start all I/O */
+	SPDK_ENV_FOREACH_CORE(i) {
+		printf(" allocate event on lcore = %d \n", i);
+		if (i == 1) {
+			event = spdk_event_allocate(i, bptree_perf_run,
+						    NULL, NULL);
+			spdk_event_call(event);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	s32 ret;
+
+	ret = nvfuse_parse_args(argc, argv, &params);
+	if (ret < 0)
+		return -1;
+
+	ret = nvfuse_configure_spdk(&ipc_ctx, &params, NVFUSE_MAX_AIO_DEPTH);
+	if (ret < 0)
+		return -1;
+
+#ifndef NVFUSE_USE_CEPH_SPDK
+	spdk_app_start(&params.opts, reactor_run, NULL, NULL);
+#else
+	spdk_app_start(reactor_run, NULL, NULL);
+#endif
+
+	spdk_app_fini();
+
+	return 0;
+}
@@ -86,15 +86,25 @@ int primary_poll_core(struct nvfuse_handle *nvh, union nvfuse_ipc_msg *ipc_msg)
 	break;
 
 	case BUFFER_ALLOC_REQ:
-		ret = nvfuse_control_plane_buffer_alloc(nvh, ipc_msg->buffer_alloc_req.buffer_size);
+		ret = nvfuse_control_plane_buffer_alloc(nvh, ipc_msg->chan_id,
+							ipc_msg->buffer_alloc_req.buffer_size);
 		nvfuse_make_buffer_alloc_cpl(&ipc_msg->buffer_alloc_cpl, ret);
 		break;
 
 	case BUFFER_FREE_REQ:
-		ret = nvfuse_control_plane_buffer_free(nvh, ipc_msg->buffer_free_req.buffer_size);
+		ret = nvfuse_control_plane_buffer_free(nvh, ipc_msg->chan_id,
+						       ipc_msg->buffer_free_req.buffer_size);
 		nvfuse_make_buffer_free_cpl(&ipc_msg->buffer_free_cpl, ret);
 		break;
 
+	case BUFFER_STAT_REQ:
+		ret = nvfuse_control_plane_buffer_stat(nvh, ipc_msg->chan_id,
+						       ipc_msg->buffer_stat_req.buffer_size,
+						       ipc_msg->buffer_stat_req.misses,
+						       ipc_msg->buffer_stat_req.interval_ms);
+		nvfuse_make_buffer_stat_cpl(&ipc_msg->buffer_stat_cpl, ret);
+		break;
+
 	case CONTAINER_ALLOC_REQ:
 		ret = nvfuse_control_plane_container_alloc(nvh, ipc_msg->chan_id, ipc_msg->container_alloc_req.type,
 				ACQUIRED);
@@ -213,6 +223,7 @@ int primary_poll(struct nvfuse_handle *nvh)
 		case HEALTH_CHECK_REQ:
 		case BUFFER_ALLOC_REQ:
 		case BUFFER_FREE_REQ:
+		case BUFFER_STAT_REQ:
 			break;
 		default:
 			printf(" %ld Resv msg (%p:%d:%s) from secondary.\n",
@@ -231,6 +242,7 @@ int primary_poll(struct nvfuse_handle *nvh)
 		case HEALTH_CHECK_CPL:
 		case BUFFER_ALLOC_CPL:
 		case BUFFER_FREE_CPL:
+		case BUFFER_STAT_CPL:
 			break;
 		default:
 			printf(" %ld Send cpl (opcode = %d:%s) to core = %d via channel = %d\n\n",
@@ -32,6 +32,9 @@
 
 #define NUM_ELEMENTS(x) (sizeof(x)/sizeof(x[0]))
 
+/* number of files created by a single nvfuse_createfiles() call */
+#define RT_CREATE_BATCH	1024
+
 #define RT_TEST_TYPE MILL_TEST
 
 #define MAX_TEST    1
@@ -103,10 +106,12 @@ int rt_create_files(struct nvfuse_handle *nvh, u32 arg)
 {
 	struct timeval tv;
 	struct statvfs stat;
-	s8 buf[FNAME_SIZE];
+	s8 (*names)[FNAME_SIZE];
+	s8 *name_ptrs[RT_CREATE_BATCH];
 	s32 max_inodes;
-	s32 i;
-	s32 fd;
+	s32 batch;
+	s32 ret;
+	s32 i, j;
 
 	if (nvfuse_statvfs(nvh, NULL, &stat) < 0) {
 		printf(" statfs error \n");
@@ -138,21 +143,34 @@ int rt_create_files(struct nvfuse_handle *nvh, u32 arg)
 	nvh->nvh_sb.nvme_io_tsc = 0;
 	nvh->nvh_sb.nvme_io_count = 0;
 
-	/* create null files */
+	names = malloc(sizeof(*names) * RT_CREATE_BATCH);
+	if (names == NULL) {
+		printf(" Error: malloc() \n");
+		return -1;
+	}
+
+	for (j = 0; j < RT_CREATE_BATCH; j++)
+		name_ptrs[j] = names[j];
+
+	/* create null files in batches */
 	printf(" Start: creating null files (0x%x).\n", max_inodes);
-	for (i = 0; i < max_inodes; i++) {
-		sprintf(buf, "file%d\n", i);
+	for (i = 0; i < max_inodes; i += batch) {
+		batch = (max_inodes - i) < RT_CREATE_BATCH ? (max_inodes - i) : RT_CREATE_BATCH;
+
+		for (j = 0; j < batch; j++)
+			sprintf(names[j], "file%d\n", i + j);
 
-		fd = nvfuse_openfile_path(nvh, buf, O_RDWR | O_CREAT, 0);
-		if (fd == -1) {
-			printf(" Error: open() \n");
+		ret = nvfuse_createfiles(&nvh->nvh_sb, nvfuse_get_cwd_ino(nvh), name_ptrs, batch, NULL, 0);
+		if (ret != batch) {
+			printf(" Error: createfiles() (%d of %d files) \n", ret, batch);
+			free(names);
 			return -1;
 		}
-		nvfuse_closefile(nvh, fd);
 		/* update progress percent */
-		rt_progress_report(i, max_inodes);
+		rt_progress_report(i + batch - 1, max_inodes);
 	}
 	nvfuse_check_flush_dirty(&nvh->nvh_sb, 1);
+	free(names);
 
 	printf(" Finish: creating null files (0x%x) %.3f OPS (%.f sec).\n", max_inodes,
 	       max_inodes / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
@@ -68,7 +68,6 @@ struct spdk_fio_thread {
 	struct thread_data	*td;
 
 	struct io_u		**iocq;	// io completion queue
-	struct nvfuse_aio_req **aio_cq;
 	unsigned int		iocq_count;	// number of iocq entries filled by last getevents
 	unsigned int		iocq_size;	// number of iocq entries allocated
 	struct fio_file		*current_f;   // fio_file given by user
@@ -340,8 +339,6 @@ static int nvfuse_fio_setup(struct thread_data *td)
 	fio_thread->iocq_size = td->o.iodepth;
 	fio_thread->iocq = calloc(fio_thread->iocq_size, sizeof(struct io_u *));
 	assert(fio_thread->iocq != NULL);
-	fio_thread->aio_cq = calloc(fio_thread->iocq_size, sizeof(struct nvfuse_aio_req *));
-	assert(fio_thread->aio_cq != NULL);
 
 	//dprintf_info(FIO, " iodepth = %d \n", td->o.iodepth);
 	/* initialization of aio queue */
@@ -350,6 +347,10 @@ static int nvfuse_fio_setup(struct thread_data *td)
 		dprintf_error(FIO, " Error: aio queue init () with ret = %d\n ", ret);
 		return -1;
 	}
+	/* completions are handed to nvfuse_fio_completion_cb() by nvfuse_aio_poll() */
+	fio_thread->aioq.cpl_callback = 1;
+	/* direct requests queued between commits share jobs when adjacent */
+	fio_thread->aioq.merge = 1;
 
 	if (!spdk_env_initialized) {
 		spdk_env_initialized = true;
@@ -367,6 +368,7 @@ static int nvfuse_fio_open(struct thread_data *td, struct fio_file *f)
 {
 	int flags = O_RDWR | O_CREAT;
 
+	/* without direct=1 requests go through the buffer cache, still asynchronously */
 	flags |= td->o.odirect ? O_DIRECT : 0;
 
 	dprintf_info(FIO, " filename = %s (direct = %d)\n", f->file_name, td->o.odirect);
@@ -441,6 +443,23 @@ static int nvfuse_fio_prep(struct thread_data *td, struct io_u *io_u)
 	return 0;
 }
 
+static void nvfuse_fio_completion_cb(void *arg)
+{
+	struct nvfuse_aio_req *areq = (struct nvfuse_aio_req *)arg;
+	struct spdk_fio_request *fio_req;
+	struct spdk_fio_thread *fio_thread;
+
+	fio_req = container_of((void *)areq, struct spdk_fio_request, areq);
+	fio_thread = fio_req->fio_thread;
+
+	/* buffered reads stop short at the end of file */
+	fio_req->io->error = areq->error ? EIO : 0;
+	fio_req->io->resid = fio_req->io->xfer_buflen - areq->result;
+
+	assert(fio_thread->iocq_count < fio_thread->iocq_size);
+	fio_thread->iocq[fio_thread->iocq_count++] = fio_req->io;
+}
+
 static int nvfuse_fio_queue(struct thread_data *td, struct io_u *io_u)
 {
 	struct fio_file *f = io_u->file;
@@ -469,7 +488,7 @@ static int nvfuse_fio_queue(struct thread_data *td, struct io_u *io_u)
 	areq->offset = io_u->offset;
 	areq->error = 0;
 	INIT_LIST_HEAD(&areq->list);
-	areq->actx_cb_func = NULL;
+	areq->actx_cb_func = nvfuse_fio_completion_cb;
 	areq->sb = &nvh->nvh_sb;
 
 	fio_ro_check(td, io_u);
@@ -477,6 +496,8 @@ static int nvfuse_fio_queue(struct thread_data *td, struct io_u *io_u)
 	//dprintf_info(FIO, " queue aio request (offset %ld bytes = %ld)\n", areq->offset, areq->bytes);
 	/* aio submission */
 	ret = nvfuse_aio_queue_submission(nvh, &fio_thread->aioq, areq);
+	if (ret == -EAGAIN)
+		return FIO_Q_BUSY;
 	if (ret) {
 		dprintf_error(AIO, " Error: queue submision \n");
 		return -1;
@@ -485,6 +506,18 @@ static int nvfuse_fio_queue(struct thread_data *td, struct io_u *io_u)
 	return FIO_Q_QUEUED;
 }
 
+static int nvfuse_fio_commit(struct thread_data *td)
+{
+	struct spdk_fio_thread *fio_thread = td->io_ops_data;
+
+	if (nvfuse_aio_queue_commit(nvh, &fio_thread->aioq)) {
+		dprintf_error(AIO, " Error: queue commit \n");
+		return -1;
+	}
+
+	return 0;
+}
+
 static int nvfuse_fio_io_u_init(struct thread_data *td, struct io_u *io_u)
 {
 	struct spdk_fio_thread	*fio_thread = td->io_ops_data;
@@ -526,10 +559,8 @@ static int nvfuse_fio_getevents(struct thread_data *td, unsigned int min,
 			      unsigned int max, const struct timespec *t)
 {
 	struct spdk_fio_thread *fio_thread = td->io_ops_data;
-	struct nvfuse_aio_req *areq_list[256];
 	struct timespec t0, t1;
 	uint64_t timeout = 0;
-	int cnt;
 
 	if (t) {
 		timeout = t->tv_sec * 1000000000L + t->tv_nsec;
@@ -539,19 +570,12 @@ static int nvfuse_fio_getevents(struct thread_data *td, unsigned int min,
 	fio_thread->iocq_count = 0;
 
 	for (;;) {
-		int i;
-
-		cnt = nvfuse_io_getevents(&nvh->nvh_sb, &fio_thread->aioq, min, max - fio_thread->iocq_count, areq_list);
-
-		//dprintf_info(FIO, " completion count = %d \n", cnt);
-		for (i = 0; i < cnt; i++) {
-			struct spdk_fio_request *fio_req;
-			fio_req = container_of((void *)areq_list[i], struct spdk_fio_request, areq);
-			fio_thread->iocq[fio_thread->iocq_count++] = fio_req->io;
-			//dprintf_info(FIO, " io_u %p io_u->flags = %d \n", fio_req->io, fio_req->io->flags);
-		}
+		nvfuse_aio_poll(&nvh->nvh_sb, &fio_thread->aioq,
+				min > fio_thread->iocq_count ? min - fio_thread->iocq_count : 0,
+				max - fio_thread->iocq_count);
 
-		if (fio_thread->iocq_count >= min) {
+		//dprintf_info(FIO, " completion count = %d \n", fio_thread->iocq_count);
+		if (fio_thread->iocq_count >= min || fio_thread->iocq_count == max) {
 			goto OUT;
 		}
 
@@ -586,6 +610,7 @@ static struct ioengine_ops ioengine = {
 	.close_file		= nvfuse_fio_close,
 	.prep			= nvfuse_fio_prep,
 	.queue			= nvfuse_fio_queue,
+	.commit			= nvfuse_fio_commit,
 	.getevents		= nvfuse_fio_getevents,
 	.get_file_size	= nvfuse_file_size,
 	.invalidate		= nvfuse_fio_invalidate,
@@ -0,0 +1,267 @@
+/*
+*	NVFUSE (NVMe based File System in Userspace)
+*	Copyright (C) 2016 Yongseok Oh <yongseok.oh@sk.com>
+*	First Writing: 30/10/2016
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "spdk/env.h"
+#include "nvfuse_core.h"
+#include "nvfuse_config.h"
+#include "nvfuse_api.h"
+#include "nvfuse_inode_cache.h"
+#include "nvfuse_gettimeofday.h"
+#include "nvfuse_aio.h"
+#include "nvfuse_debug.h"
+
+#define DEINIT_IOM	1
+#define UMOUNT		1
+
+/* number of files looked up; kept below NVFUSE_ICTXC_SIZE so that lookups hit */
+#define GP_NUM_FILES		(16 * 1024)
+/* number of files created by a single nvfuse_createfiles() call */
+#define GP_CREATE_BATCH		1024
+/* lookups issued by each thread */
+#define GP_LOOKUPS_PER_THREAD	(4 * 1000 * 1000)
+#define GP_MAX_THREADS		8
+
+struct gp_thread {
+	pthread_t tid;
+	struct nvfuse_superblock *sb;
+	inode_t *inos;
+	u64 seed;
+	u64 sum;
+};
+
+static struct nvfuse_ipc_context ipc_ctx;
+static struct nvfuse_params params;
+static struct nvfuse_handle *nvh;
+
+static inline u64 gp_xorshift(u64 *state)
+{
+	u64 x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+
+	return x;
+}
+
+static s32 gp_create_files(struct nvfuse_superblock *sb, inode_t *inos)
+{
+	s8 (*names)[FNAME_SIZE];
+	s8 *name_ptrs[GP_CREATE_BATCH];
+	struct timeval tv;
+	s32 batch;
+	s32 ret;
+	s32 i, j;
+
+	names = malloc(sizeof(*names) * GP_CREATE_BATCH);
+	if (names == NULL) {
+		printf(" Error: malloc() \n");
+		return -1;
+	}
+
+	for (j = 0; j < GP_CREATE_BATCH; j++)
+		name_ptrs[j] = names[j];
+
+	gettimeofday(&tv, NULL);
+	for (i = 0; i < GP_NUM_FILES; i += batch) {
+		batch = (GP_NUM_FILES - i) < GP_CREATE_BATCH ? (GP_NUM_FILES - i) : GP_CREATE_BATCH;
+
+		for (j = 0; j < batch; j++)
+			sprintf(names[j], "gp_file%d", i + j);
+
+		ret = nvfuse_createfiles(sb, nvfuse_get_cwd_ino(nvh), name_ptrs, batch, inos + i, 0);
+		if (ret != batch) {
+			printf(" Error: createfiles() (%d of %d files) \n", ret, batch);
+			free(names);
+			return -1;
+		}
+	}
+	nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_FORCE);
+	free(names);
+
+	printf(" created %d files %.3f OPS (%.3f sec)\n", GP_NUM_FILES,
+	       GP_NUM_FILES / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+
+	return 0;
+}
+
+static void gp_remove_files(void)
+{
+	s8 name[FNAME_SIZE];
+	s32 i;
+
+	for (i = 0; i < GP_NUM_FILES; i++) {
+		sprintf(name, "gp_file%d", i);
+		if (nvfuse_rmfile_path(nvh, name))
+			printf(" rmfile = %s error \n", name);
+	}
+	nvfuse_check_flush_dirty(&nvh->nvh_sb, DIRTY_FLUSH_FORCE);
+}
+
+/* full path getattr through the handle, single thread */
+static s32 gp_getattr_path(void)
+{
+	struct stat st;
+	struct timeval tv;
+	s8 name[FNAME_SIZE];
+	s32 i;
+
+	gettimeofday(&tv, NULL);
+	for (i = 0; i < GP_NUM_FILES; i++) {
+		sprintf(name, "gp_file%d", i);
+		if (nvfuse_getattr(nvh, name, &st)) {
+			printf(" No such file %s\n", name);
+			return -1;
+		}
+	}
+
+	printf(" getattr (path) 1 thread: %.3f OPS\n", GP_NUM_FILES / nvfuse_time_since_now(&tv));
+
+	return 0;
+}
+
+/*
+ * inode context lookup and release done by getattr for an inode, issued from
+ * several threads on the same superblock
+ */
+static void *gp_getattr_worker(void *arg)
+{
+	struct gp_thread *thread = arg;
+	struct nvfuse_inode_ctx *ictx;
+	inode_t ino;
+	s32 i;
+
+	for (i = 0; i < GP_LOOKUPS_PER_THREAD; i++) {
+		ino = thread->inos[gp_xorshift(&thread->seed) % GP_NUM_FILES];
+
+		ictx = nvfuse_get_ictx(thread->sb, ino);
+		if (ictx == NULL || ictx->ictx_ino != ino) {
+			printf(" Error: ictx lookup ino = %d \n", ino);
+			break;
+		}
+		ictx->ictx_ref++;
+		thread->sum += ictx->ictx_ino;
+		nvfuse_release_ictx(thread->sb, ictx, NVF_CLEAN);
+	}
+
+	return NULL;
+}
+
+static void gp_getattr_threads(struct nvfuse_superblock *sb, inode_t *inos, s32 num_threads)
+{
+	struct gp_thread thread[GP_MAX_THREADS];
+	struct timeval tv;
+	s32 i;
+
+	gettimeofday(&tv, NULL);
+	for (i = 0; i < num_threads; i++) {
+		thread[i].sb = sb;
+		thread[i].inos = inos;
+		thread[i].seed = 0x2545F4914F6CDD1DULL * (i + 1);
+		thread[i].sum = 0;
+		pthread_create(&thread[i].tid, NULL, gp_getattr_worker, &thread[i]);
+	}
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(thread[i].tid, NULL);
+
+	printf(" getattr (ictx) %d threads: %.3f OPS\n", num_threads,
+	       (double)GP_LOOKUPS_PER_THREAD * num_threads / nvfuse_time_since_now(&tv));
+}
+
+static void getattr_perf_run(void *arg1, void *arg2)
+{
+	struct nvfuse_superblock *sb;
+	inode_t *inos;
+	s32 num_threads;
+
+	/* create nvfuse_handle with user spcified parameters */
+	nvh = nvfuse_create_handle(&ipc_ctx, &params);
+	if (nvh == NULL) {
+		fprintf(stderr, "Error: nvfuse_create_handle()\n");
+		return;
+	}
+
+	sb = nvfuse_read_super(nvh);
+
+	inos = malloc(sizeof(inode_t) * GP_NUM_FILES);
+	if (inos == NULL) {
+		printf(" Error: malloc() \n");
+		goto RET;
+	}
+
+	if (gp_create_files(sb, inos) < 0)
+		goto RET;
+
+	if (gp_getattr_path() < 0)
+		goto REMOVE;
+
+	for (num_threads = 1; num_threads <= GP_MAX_THREADS; num_threads *= 2)
+		gp_getattr_threads(sb, inos, num_threads);
+
+REMOVE:
+	gp_remove_files();
+RET:
+	;
+
+	free(inos);
+
+	nvfuse_destroy_handle(nvh, DEINIT_IOM, UMOUNT);
+
+	spdk_app_stop(0);
+}
+
+static void reactor_run(void *arg1, void *arg2)
+{
+	struct spdk_event *event;
+	u32 i;
+
+	/* Send events to start all I/O */
+	SPDK_ENV_FOREACH_CORE(i) {
+		printf(" allocate event on lcore = %d \n", i);
+		if (i == 1) {
+			event = spdk_event_allocate(i, getattr_perf_run,
+						    NULL, NULL);
+			spdk_event_call(event);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	s32 ret;
+
+	ret = nvfuse_parse_args(argc, argv, &params);
+	if (ret < 0)
+		return -1;
+
+	ret = nvfuse_configure_spdk(&ipc_ctx, &params, NVFUSE_MAX_AIO_DEPTH);
+	if (ret < 0)
+		return -1;
+
+#ifndef NVFUSE_USE_CEPH_SPDK
+	spdk_app_start(&params.opts, reactor_run, NULL, NULL);
+#else
+	spdk_app_start(reactor_run, NULL, NULL);
+#endif
+
+	spdk_app_fini();
+
+	return 0;
+}
@@ -17,6 +17,7 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "nvfuse_core.h"
 #include "nvfuse_api.h"
@@ -59,6 +60,8 @@ static struct nvfuse_params *g_params = &_g_params;
 
 static s32 last_percent;
 static s32 test_type = QUICK_TEST;
+/* max number of threads sharing one handle */
+static s32 num_threads = 4;
 
 void rt_progress_reset(void);
 void rt_progress_report(s32 curr, s32 max);
@@ -70,7 +73,15 @@ int rt_gen_aio_rw(struct nvfuse_handle *nvh, s64 file_size, s32 block_size, s32
 		  s32 qdepth);
 int rt_create_max_sized_file_aio_4KB(struct nvfuse_handle *nvh, u32 is_rand);
 int rt_create_max_sized_file_aio_128KB(struct nvfuse_handle *nvh, u32 is_rand);
+int rt_buffered_aio_4KB(struct nvfuse_handle *nvh, u32 is_rand);
+int rt_merged_aio_4KB(struct nvfuse_handle *nvh, u32 is_rand);
 int rt_create_4KB_files(struct nvfuse_handle *nvh, u32 arg);
+int rt_open_many_files(struct nvfuse_handle *nvh, u32 arg);
+int rt_mt_read_scaling(struct nvfuse_handle *nvh, u32 arg);
+int rt_vectored_rw(struct nvfuse_handle *nvh, u32 arg);
+int rt_direct_rw(struct nvfuse_handle *nvh, u32 arg);
+int rt_lend_read(struct nvfuse_handle *nvh, u32 arg);
+int rt_interleaved_append(struct nvfuse_handle *nvh, u32 arg);
 void rt_usage(char *cmd);
 static int rt_main(void *arg);
 static void print_stats(s32 num_cores, s32 num_tc);
@@ -687,6 +698,199 @@ int rt_create_max_sized_file_aio_128KB(struct nvfuse_handle *nvh, u32 is_rand)
 	return res;
 }
 
+int rt_buffered_aio_4KB(struct nvfuse_handle *nvh, u32 is_rand)
+{
+	struct statvfs statvfs_buf;
+	s32 direct;
+	s32 qdepth;
+	s64 file_size;
+	s32 block_size;
+	s32 res;
+
+	if (nvfuse_statvfs(nvh, NULL, &statvfs_buf) < 0) {
+		printf(" statfs error \n");
+		return -1;
+	}
+
+	/* sized to outgrow the buffer cache, so reads miss as well as hit */
+	switch (test_type) {
+	case MAX_TEST:
+	case MILL_TEST:
+		file_size = (s64)4 * GB;
+		break;
+	case QUICK_TEST:
+		file_size = 100 * MB;
+		break;
+	default:
+		printf(" Invalid test type = %d\n", test_type);
+		return -1;
+	}
+
+	file_size = (file_size > (s64)statvfs_buf.f_bfree * CLUSTER_SIZE) ?
+		    (s64)(statvfs_buf.f_bfree / 2) * CLUSTER_SIZE :
+		    (s64)file_size;
+
+	direct = 0;
+	qdepth = 128;
+	block_size = 4096;
+	res = rt_gen_aio_rw(nvh, file_size, block_size, is_rand, direct, qdepth);
+
+	return res;
+}
+
+#define RT_MERGE_QDEPTH	128
+
+/* fills or checks each 4KB block of buf with its block number in the file */
+static s32 rt_merged_aio_pattern(s8 *buf, s64 lblk, s32 nr_blocks, s32 check)
+{
+	s64 *word;
+	s32 i, j;
+
+	for (i = 0; i < nr_blocks; i++) {
+		word = (s64 *)(buf + (s64)i * CLUSTER_SIZE);
+		for (j = 0; j < CLUSTER_SIZE / (s32)sizeof(s64); j++) {
+			if (!check)
+				word[j] = lblk + i;
+			else if (word[j] != lblk + i)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* one pass of sequential 4KB requests over the file, RT_MERGE_QDEPTH at a time */
+static s32 rt_merged_aio_pass(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq, s32 fd,
+			      s8 *buf, s64 file_size, s32 opcode, s64 *nr_reqs)
+{
+	struct nvfuse_aio_req reqs[RT_MERGE_QDEPTH];
+	struct nvfuse_aio_req *list[RT_MERGE_QDEPTH];
+	s64 offset;
+	s32 nr, cnt;
+	s32 res;
+	s32 i;
+
+	for (offset = 0; offset < file_size; offset += (s64)nr * CLUSTER_SIZE) {
+		nr = MIN(RT_MERGE_QDEPTH, (file_size - offset) / CLUSTER_SIZE);
+
+		if (opcode == WRITE)
+			rt_merged_aio_pattern(buf, offset / CLUSTER_SIZE, nr, 0);
+		else
+			memset(buf, 0x00, (size_t)nr * CLUSTER_SIZE);
+
+		memset(reqs, 0x00, sizeof(reqs));
+		for (i = 0; i < nr; i++) {
+			reqs[i].fid = fd;
+			reqs[i].opcode = opcode;
+			reqs[i].buf = buf + (s64)i * CLUSTER_SIZE;
+			reqs[i].offset = offset + (s64)i * CLUSTER_SIZE;
+			reqs[i].bytes = CLUSTER_SIZE;
+			INIT_LIST_HEAD(&reqs[i].list);
+			reqs[i].sb = &nvh->nvh_sb;
+			list[i] = &reqs[i];
+		}
+
+		res = nvfuse_io_submit(nvh, aioq, nr, list);
+		if (res)
+			printf(" Error: aio submission offset = %ld\n", (long)offset);
+		*nr_reqs += nr;
+
+		/* reqs live on the stack, so everything in flight is reaped even on error */
+		do {
+			cnt = nvfuse_io_getevents(&nvh->nvh_sb, aioq, 1, RT_MERGE_QDEPTH, list);
+			for (i = 0; i < cnt; i++) {
+				if (list[i]->error) {
+					printf(" Error: aio offset = %ld\n", (long)list[i]->offset);
+					res = -1;
+				}
+			}
+		} while (cnt);
+
+		if (res)
+			return -1;
+
+		if (opcode == READ && rt_merged_aio_pattern(buf, offset / CLUSTER_SIZE, nr, 1)) {
+			printf(" Error: data mismatch near offset = %ld\n", (long)offset);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * sequential 4KB requests submitted together must come back with the data
+ * written and go out as fewer device jobs than requests.
+ */
+int rt_merged_aio_4KB(struct nvfuse_handle *nvh, u32 is_rand)
+{
+	struct nvfuse_aio_queue aioq;
+	struct statvfs statvfs_buf;
+	char str[FNAME_SIZE];
+	s64 file_size;
+	s64 nr_reqs = 0;
+	s8 *buf;
+	s32 fd;
+	s32 res = 0;
+
+	if (nvfuse_statvfs(nvh, NULL, &statvfs_buf) < 0) {
+		printf(" statfs error \n");
+		return -1;
+	}
+
+	file_size = 100 * MB;
+	file_size = (file_size > (s64)statvfs_buf.f_bfree * CLUSTER_SIZE) ?
+		    (s64)(statvfs_buf.f_bfree / 2) * CLUSTER_SIZE :
+		    (s64)file_size;
+
+	buf = nvfuse_alloc_aligned_buffer(RT_MERGE_QDEPTH * CLUSTER_SIZE);
+	if (buf == NULL) {
+		printf(" malloc error \n");
+		return -1;
+	}
+
+	sprintf(str, "merged_aio_test");
+	fd = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT | O_DIRECT, 0);
+	if (fd < 0) {
+		printf(" Error: file open or create \n");
+		nvfuse_free_aligned_buffer(buf);
+		return -1;
+	}
+	nvfuse_fallocate(nvh, str, 0, file_size);
+
+	if (nvfuse_aio_queue_init(nvh->nvh_target, &aioq, RT_MERGE_QDEPTH)) {
+		printf(" Error: aio queue init \n");
+		res = -1;
+		goto CLOSE_FD;
+	}
+	aioq.merge = 1;
+
+	printf(" Start: merged aio write and read (file %s size %ldMB).\n", str, (long)file_size / MB);
+	res = rt_merged_aio_pass(nvh, &aioq, fd, buf, file_size, WRITE, &nr_reqs);
+	if (!res)
+		res = rt_merged_aio_pass(nvh, &aioq, fd, buf, file_size, READ, &nr_reqs);
+
+	printf(" requests = %ld device jobs = %ld\n", (long)nr_reqs, (long)aioq.bio_job_issued);
+	if (!res && aioq.bio_job_issued >= nr_reqs) {
+		printf(" Error: no requests were merged\n");
+		res = -1;
+	}
+	printf(" Finish: merged aio write and read.\n");
+
+	nvfuse_aio_queue_deinit(nvh, &aioq);
+
+CLOSE_FD:
+	nvfuse_closefile(nvh, fd);
+	nvfuse_free_aligned_buffer(buf);
+
+	if (nvfuse_rmfile_path(nvh, str) < 0) {
+		printf(" Error: rmfile = %s\n", str);
+		res = -1;
+	}
+
+	return res;
+}
+
 int rt_create_4KB_files(struct nvfuse_handle *nvh, u32 arg)
 {
 	struct timeval tv;
@@ -793,6 +997,677 @@ int rt_create_4KB_files(struct nvfuse_handle *nvh, u32 arg)
 
 }
 
+/* keep many files open at once to exercise growth of the fd table */
+int rt_open_many_files(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct timeval tv;
+	char str[FNAME_SIZE];
+	s32 *fds;
+	s32 nr;
+	s32 res = 0;
+	int i;
+
+	switch (test_type) {
+	case MAX_TEST:
+	case MILL_TEST:
+		nr = MAX_OPEN_FILE - START_OPEN_FILE;
+		break;
+	case QUICK_TEST:
+		nr = 4 * NVFUSE_FILE_TABLE_CHUNK;
+		break;
+	default:
+		printf(" Invalid test type = %d\n", test_type);
+		return -1;
+	}
+
+	if (g_params->max_open_files && nr > g_params->max_open_files - START_OPEN_FILE)
+		nr = g_params->max_open_files - START_OPEN_FILE;
+
+	fds = malloc(sizeof(s32) * nr);
+	if (fds == NULL) {
+		printf(" malloc error \n");
+		return -1;
+	}
+
+	printf(" # of files = %d \n", nr);
+
+	/* reset progress percent */
+	rt_progress_reset();
+	gettimeofday(&tv, NULL);
+
+	printf(" Start: opening files (0x%x).\n", nr);
+	for (i = 0; i < nr; i++) {
+		sprintf(str, "open%d", i);
+		fds[i] = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0644);
+		if (fds[i] < 0) {
+			printf(" open error = %s\n", str);
+			nr = i;
+			res = -1;
+			break;
+		}
+
+		/* update progress percent */
+		rt_progress_report(i, nr);
+	}
+	printf(" Finish: opening files (0x%x) %.3f OPS (%0.3fs).\n", nr, nr / nvfuse_time_since_now(&tv),
+	       nvfuse_time_since_now(&tv));
+
+	/* every open file must hold its own descriptor */
+	for (i = 1; i < nr && !res; i++) {
+		if (fds[i] == fds[i - 1]) {
+			printf(" duplicated fd = %d\n", fds[i]);
+			res = -1;
+		}
+	}
+
+	/* reset progress percent */
+	rt_progress_reset();
+	gettimeofday(&tv, NULL);
+
+	printf(" Start: closing and deleting files (0x%x).\n", nr);
+	for (i = 0; i < nr; i++) {
+		nvfuse_closefile(nvh, fds[i]);
+
+		sprintf(str, "open%d", i);
+		if (nvfuse_rmfile_path(nvh, str) < 0) {
+			printf(" rmfile error = %s \n", str);
+			res = -1;
+		}
+
+		/* update progress percent */
+		rt_progress_report(i, nr);
+	}
+	printf(" Finish: closing and deleting files (0x%x) %.3f OPS (%0.3fs).\n", nr,
+	       nr / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+
+	free(fds);
+
+	return res;
+}
+
+struct rt_mt_read_arg {
+	struct nvfuse_handle *nvh;
+	s8 *name;
+	s64 file_size;
+	s32 nr_reads;
+	s32 seed;
+	s32 res;
+};
+
+static void *rt_mt_read_thread(void *arg)
+{
+	struct rt_mt_read_arg *rarg = (struct rt_mt_read_arg *)arg;
+	u32 seed = rarg->seed;
+	s64 nr_blocks = rarg->file_size / CLUSTER_SIZE;
+	s8 *buf;
+	s32 fid;
+	s32 i;
+
+	buf = nvfuse_alloc_aligned_buffer(CLUSTER_SIZE);
+	if (buf == NULL) {
+		rarg->res = -1;
+		return NULL;
+	}
+
+	/* each thread holds its own descriptor on the shared file */
+	fid = nvfuse_openfile_path(rarg->nvh, rarg->name, O_RDWR, 0);
+	if (fid < 0) {
+		printf(" Error: file open = %s\n", rarg->name);
+		nvfuse_free_aligned_buffer(buf);
+		rarg->res = -1;
+		return NULL;
+	}
+
+	for (i = 0; i < rarg->nr_reads; i++) {
+		s64 offset = (s64)(rand_r(&seed) % nr_blocks) * CLUSTER_SIZE;
+
+		if (nvfuse_readfile(rarg->nvh, fid, buf, CLUSTER_SIZE, offset) != CLUSTER_SIZE) {
+			printf(" Error: read offset = %ld\n", (long)offset);
+			rarg->res = -1;
+			break;
+		}
+	}
+
+	nvfuse_closefile(rarg->nvh, fid);
+	nvfuse_free_aligned_buffer(buf);
+
+	return NULL;
+}
+
+/* random 4KB reads on one file from a growing number of threads sharing the handle */
+int rt_mt_read_scaling(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct rt_mt_read_arg *rargs;
+	pthread_t *tids;
+	struct timeval tv;
+	char str[FNAME_SIZE];
+	s64 file_size;
+	s64 offset;
+	s32 nr_reads;
+	s32 nr_threads;
+	s32 res = 0;
+	s32 fid;
+	s8 *buf;
+	int i;
+
+	switch (test_type) {
+	case MAX_TEST:
+	case MILL_TEST:
+		file_size = 1 * GB;
+		nr_reads = 256 * 1024;
+		break;
+	case QUICK_TEST:
+		file_size = 64 * MB;
+		nr_reads = 16 * 1024;
+		break;
+	default:
+		printf(" Invalid test type = %d\n", test_type);
+		return -1;
+	}
+
+	sprintf(str, "mt_read_test");
+
+	buf = nvfuse_alloc_aligned_buffer(CLUSTER_SIZE);
+	if (buf == NULL) {
+		printf(" malloc error \n");
+		return -1;
+	}
+
+	fid = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0);
+	if (fid < 0) {
+		printf(" Error: file open or create \n");
+		nvfuse_free_aligned_buffer(buf);
+		return -1;
+	}
+
+	printf(" Start: writing file %s size %ldMB.\n", str, (long)file_size / MB);
+	for (offset = 0; offset < file_size; offset += CLUSTER_SIZE) {
+		memset(buf, (s8)(offset / CLUSTER_SIZE), CLUSTER_SIZE);
+		if (nvfuse_writefile(nvh, fid, buf, CLUSTER_SIZE, offset) != CLUSTER_SIZE) {
+			printf(" Error: write offset = %ld\n", (long)offset);
+			res = -1;
+			break;
+		}
+	}
+	nvfuse_closefile(nvh, fid);
+	nvfuse_free_aligned_buffer(buf);
+
+	tids = malloc(sizeof(pthread_t) * num_threads);
+	rargs = malloc(sizeof(struct rt_mt_read_arg) * num_threads);
+	if (tids == NULL || rargs == NULL) {
+		printf(" malloc error \n");
+		free(tids);
+		free(rargs);
+		nvfuse_rmfile_path(nvh, str);
+		return -1;
+	}
+
+	for (nr_threads = 1; nr_threads <= num_threads && !res; nr_threads *= 2) {
+		double elapsed;
+		s32 nr_created;
+
+		gettimeofday(&tv, NULL);
+		for (i = 0; i < nr_threads; i++) {
+			rargs[i].nvh = nvh;
+			rargs[i].name = str;
+			rargs[i].file_size = file_size;
+			rargs[i].nr_reads = nr_reads;
+			rargs[i].seed = i + 1;
+			rargs[i].res = 0;
+			if (pthread_create(&tids[i], NULL, rt_mt_read_thread, &rargs[i])) {
+				printf(" Error: pthread_create \n");
+				res = -1;
+				break;
+			}
+		}
+		nr_created = i;
+
+		for (i = 0; i < nr_created; i++) {
+			pthread_join(tids[i], NULL);
+			if (rargs[i].res)
+				res = -1;
+		}
+		elapsed = nvfuse_time_since_now(&tv);
+
+		if (res)
+			break;
+
+		printf(" threads = %d: %.3f MB/s %.0f IOPS (%0.3fs).\n", nr_threads,
+		       (double)nr_threads * nr_reads * CLUSTER_SIZE / MB / elapsed,
+		       (double)nr_threads * nr_reads / elapsed, elapsed);
+	}
+
+	free(tids);
+	free(rargs);
+
+	if (nvfuse_rmfile_path(nvh, str) < 0) {
+		printf(" Error: rmfile = %s\n", str);
+		res = -1;
+	}
+
+	return res;
+}
+
+/* scattered records written with pwritev and read back with a different split */
+int rt_vectored_rw(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct iovec iov[3];
+	char str[FNAME_SIZE];
+	s64 file_size;
+	s64 offset;
+	s32 rec_size;
+	s8 *wbuf, *rbuf;
+	s32 res = 0;
+	s32 fid;
+
+	switch (test_type) {
+	case MAX_TEST:
+	case MILL_TEST:
+		file_size = 256 * MB;
+		break;
+	case QUICK_TEST:
+		file_size = 16 * MB;
+		break;
+	default:
+		printf(" Invalid test type = %d\n", test_type);
+		return -1;
+	}
+
+	/* odd sized records cross block boundaries */
+	rec_size = 3 * 1000 + 7;
+
+	wbuf = malloc(rec_size);
+	rbuf = malloc(rec_size);
+	if (wbuf == NULL || rbuf == NULL) {
+		printf(" malloc error \n");
+		free(wbuf);
+		free(rbuf);
+		return -1;
+	}
+
+	sprintf(str, "vectored_test");
+	fid = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0);
+	if (fid < 0) {
+		printf(" Error: file open or create \n");
+		free(wbuf);
+		free(rbuf);
+		return -1;
+	}
+
+	printf(" Start: pwritev and preadv file %s size %ldMB.\n", str, (long)file_size / MB);
+	for (offset = 0; offset + rec_size <= file_size && !res; offset += rec_size) {
+		memset(wbuf, (s8)(offset / rec_size), rec_size);
+
+		iov[0].iov_base = wbuf;
+		iov[0].iov_len = 1000;
+		iov[1].iov_base = wbuf + 1000;
+		iov[1].iov_len = 7;
+		iov[2].iov_base = wbuf + 1007;
+		iov[2].iov_len = rec_size - 1007;
+		if (nvfuse_pwritev(nvh, fid, iov, 3, offset) != rec_size) {
+			printf(" Error: pwritev offset = %ld\n", (long)offset);
+			res = -1;
+		}
+	}
+
+	for (offset = 0; offset + rec_size <= file_size && !res; offset += rec_size) {
+		memset(wbuf, (s8)(offset / rec_size), rec_size);
+
+		iov[0].iov_base = rbuf;
+		iov[0].iov_len = 13;
+		iov[1].iov_base = rbuf + 13;
+		iov[1].iov_len = rec_size - 13;
+		if (nvfuse_preadv(nvh, fid, iov, 2, offset) != rec_size ||
+		    memcmp(wbuf, rbuf, rec_size)) {
+			printf(" Error: preadv offset = %ld\n", (long)offset);
+			res = -1;
+		}
+	}
+	printf(" Finish: pwritev and preadv.\n");
+
+	nvfuse_closefile(nvh, fid);
+	free(wbuf);
+	free(rbuf);
+
+	if (nvfuse_rmfile_path(nvh, str) < 0) {
+		printf(" Error: rmfile = %s\n", str);
+		res = -1;
+	}
+
+	return res;
+}
+
+/* synchronous O_DIRECT i/o must agree with buffered i/o of the same file */
+#define RT_DIRECT_TAIL	(3 * CLUSTER_SIZE + 100)
+
+/*
+ * direct i/o around the end of a file whose size is not block aligned: a
+ * read across eof returns the bytes up to eof and one at eof returns 0; a
+ * write from inside the file past eof extends it.
+ */
+static s32 rt_direct_tail(struct nvfuse_handle *nvh, s8 *wbuf, s8 *rbuf, s32 io_size)
+{
+	char str[FNAME_SIZE];
+	struct stat stat_buf;
+	s32 buffered_fid, direct_fid;
+	s32 tail_end = (RT_DIRECT_TAIL + CLUSTER_SIZE - 1) & ~(CLUSTER_SIZE - 1);
+	s32 res = 0;
+
+	sprintf(str, "direct_tail_test");
+	buffered_fid = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0);
+	direct_fid = nvfuse_openfile_path(nvh, str, O_RDWR | O_DIRECT, 0);
+	if (buffered_fid < 0 || direct_fid < 0) {
+		printf(" Error: file open or create \n");
+		res = -1;
+		goto CLOSE;
+	}
+
+	printf(" Start: direct i/o across eof of a %d byte file.\n", RT_DIRECT_TAIL);
+	memset(wbuf, 0x5a, io_size);
+	memset(rbuf, 0x00, io_size);
+	if (nvfuse_writefile(nvh, buffered_fid, wbuf, RT_DIRECT_TAIL, 0) != RT_DIRECT_TAIL ||
+	    nvfuse_readfile(nvh, direct_fid, rbuf, io_size, 0) != RT_DIRECT_TAIL ||
+	    memcmp(wbuf, rbuf, RT_DIRECT_TAIL)) {
+		printf(" Error: direct read across eof\n");
+		res = -1;
+		goto CLOSE;
+	}
+
+	if (nvfuse_readfile(nvh, direct_fid, rbuf, CLUSTER_SIZE, tail_end) != 0) {
+		printf(" Error: direct read at eof\n");
+		res = -1;
+		goto CLOSE;
+	}
+
+	memset(wbuf, 0xa5, io_size);
+	if (nvfuse_writefile(nvh, direct_fid, wbuf, io_size, 0) != io_size ||
+	    nvfuse_getattr(nvh, str, &stat_buf) || stat_buf.st_size != io_size ||
+	    nvfuse_readfile(nvh, buffered_fid, rbuf, io_size, 0) != io_size ||
+	    memcmp(wbuf, rbuf, io_size)) {
+		printf(" Error: direct write across eof\n");
+		res = -1;
+	}
+
+CLOSE:
+	if (buffered_fid >= 0)
+		nvfuse_closefile(nvh, buffered_fid);
+	if (direct_fid >= 0)
+		nvfuse_closefile(nvh, direct_fid);
+
+	if (nvfuse_rmfile_path(nvh, str) < 0) {
+		printf(" Error: rmfile = %s\n", str);
+		res = -1;
+	}
+
+	return res;
+}
+
+int rt_direct_rw(struct nvfuse_handle *nvh, u32 arg)
+{
+	char str[FNAME_SIZE];
+	s64 file_size;
+	s64 offset;
+	s32 io_size = 128 * 1024;
+	s8 *wbuf, *rbuf;
+	s32 buffered_fid, direct_fid;
+	s32 res = 0;
+
+	switch (test_type) {
+	case MAX_TEST:
+	case MILL_TEST:
+		file_size = 1 * GB;
+		break;
+	case QUICK_TEST:
+		file_size = 32 * MB;
+		break;
+	default:
+		printf(" Invalid test type = %d\n", test_type);
+		return -1;
+	}
+
+	/* direct i/o transfers from and to dma-able memory */
+	wbuf = nvfuse_alloc_aligned_buffer(io_size);
+	rbuf = nvfuse_alloc_aligned_buffer(io_size);
+	if (wbuf == NULL || rbuf == NULL) {
+		printf(" malloc error \n");
+		if (wbuf)
+			nvfuse_free_aligned_buffer(wbuf);
+		if (rbuf)
+			nvfuse_free_aligned_buffer(rbuf);
+		return -1;
+	}
+
+	sprintf(str, "direct_test");
+	buffered_fid = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0);
+	direct_fid = nvfuse_openfile_path(nvh, str, O_RDWR | O_DIRECT, 0);
+	if (buffered_fid < 0 || direct_fid < 0) {
+		printf(" Error: file open or create \n");
+		res = -1;
+		goto FREE;
+	}
+
+	printf(" Start: direct write, buffered read (file %s size %ldMB).\n", str, (long)file_size / MB);
+	for (offset = 0; offset < file_size && !res; offset += io_size) {
+		memset(wbuf, (s8)(offset / io_size), io_size);
+		if (nvfuse_writefile(nvh, direct_fid, wbuf, io_size, offset) != io_size ||
+		    nvfuse_readfile(nvh, buffered_fid, rbuf, io_size, offset) != io_size ||
+		    memcmp(wbuf, rbuf, io_size)) {
+			printf(" Error: direct write offset = %ld\n", (long)offset);
+			res = -1;
+		}
+	}
+
+	printf(" Start: buffered write, direct read.\n");
+	for (offset = 0; offset < file_size && !res; offset += io_size) {
+		memset(wbuf, (s8)~(offset / io_size), io_size);
+		if (nvfuse_writefile(nvh, buffered_fid, wbuf, io_size, offset) != io_size ||
+		    nvfuse_readfile(nvh, direct_fid, rbuf, io_size, offset) != io_size ||
+		    memcmp(wbuf, rbuf, io_size)) {
+			printf(" Error: direct read offset = %ld\n", (long)offset);
+			res = -1;
+		}
+	}
+
+	if (!res)
+		res = rt_direct_tail(nvh, wbuf, rbuf, io_size);
+	printf(" Finish: direct and buffered i/o.\n");
+
+FREE:
+	if (buffered_fid >= 0)
+		nvfuse_closefile(nvh, buffered_fid);
+	if (direct_fid >= 0)
+		nvfuse_closefile(nvh, direct_fid);
+	nvfuse_free_aligned_buffer(wbuf);
+	nvfuse_free_aligned_buffer(rbuf);
+
+	if (nvfuse_rmfile_path(nvh, str) < 0) {
+		printf(" Error: rmfile = %s\n", str);
+		res = -1;
+	}
+
+	return res;
+}
+
+#define RT_LEND_PAGES	32
+
+/* pages lent from the buffer cache must match the data read by copy */
+int rt_lend_read(struct nvfuse_handle *nvh, u32 arg)
+{
+	struct nvfuse_buffer_cache *pages[RT_LEND_PAGES];
+	struct iovec iov[RT_LEND_PAGES];
+	struct timeval tv;
+	char str[FNAME_SIZE];
+	s64 file_size;
+	s64 offset;
+	s64 lent_bytes = 0;
+	s32 io_size = RT_LEND_PAGES * CLUSTER_SIZE;
+	s8 *buf;
+	s32 res = 0;
+	s32 fid;
+	s32 nr, i;
+
+	switch (test_type) {
+	case MAX_TEST:
+	case MILL_TEST:
+		file_size = 256 * MB;
+		break;
+	case QUICK_TEST:
+		file_size = 16 * MB;
+		break;
+	default:
+		printf(" Invalid test type = %d\n", test_type);
+		return -1;
+	}
+
+	buf = malloc(io_size);
+	if (buf == NULL) {
+		printf(" malloc error \n");
+		return -1;
+	}
+
+	sprintf(str, "lend_test");
+	fid = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0);
+	if (fid < 0) {
+		printf(" Error: file open or create \n");
+		free(buf);
+		return -1;
+	}
+
+	for (offset = 0; offset < file_size && !res; offset += io_size) {
+		memset(buf, (s8)(offset / io_size), io_size);
+		if (nvfuse_writefile(nvh, fid, buf, io_size, offset) != io_size) {
+			printf(" Error: write offset = %ld\n", (long)offset);
+			res = -1;
+		}
+	}
+
+	/* start at an odd offset so that the first and last pages are partial */
+	gettimeofday(&tv, NULL);
+	printf(" Start: lending pages of file %s size %ldMB.\n", str, (long)file_size / MB);
+	for (offset = 100; offset < file_size && !res; offset += lent_bytes) {
+		nr = nvfuse_readfile_lend(nvh, fid, offset, io_size, iov, pages, RT_LEND_PAGES);
+		if (nr <= 0) {
+			printf(" Error: lend offset = %ld\n", (long)offset);
+			res = -1;
+			break;
+		}
+
+		lent_bytes = 0;
+		for (i = 0; i < nr; i++)
+			lent_bytes += iov[i].iov_len;
+
+		if (nvfuse_readfile(nvh, fid, buf, lent_bytes, offset) != lent_bytes) {
+			printf(" Error: read offset = %ld\n", (long)offset);
+			res = -1;
+		}
+
+		lent_bytes = 0;
+		for (i = 0; i < nr && !res; i++) {
+			if (memcmp(iov[i].iov_base, buf + lent_bytes, iov[i].iov_len)) {
+				printf(" Error: lent data mismatch offset = %ld\n", (long)(offset + lent_bytes));
+				res = -1;
+			}
+			lent_bytes += iov[i].iov_len;
+		}
+
+		nvfuse_readfile_lend_release(nvh, pages, nr);
+	}
+	printf(" Finish: lending pages %.3f MB/s (%0.3fs).\n",
+	       (double)file_size / MB / nvfuse_time_since_now(&tv), nvfuse_time_since_now(&tv));
+
+	nvfuse_closefile(nvh, fid);
+	free(buf);
+
+	if (nvfuse_rmfile_path(nvh, str) < 0) {
+		printf(" Error: rmfile = %s\n", str);
+		res = -1;
+	}
+
+	return res;
+}
+
+#define RT_APPEND_FILES		2
+#define RT_APPEND_BLOCKS	1024
+
+/*
+ * files appended in turn, a block at a time, must not end up interleaved
+ * block by block: apart from their first block, they are laid out in runs
+ * of at least a reservation window.
+ */
+int rt_interleaved_append(struct nvfuse_handle *nvh, u32 arg)
+{
+	char str[RT_APPEND_FILES][FNAME_SIZE];
+	s32 fid[RT_APPEND_FILES];
+	s8 *buf;
+	s32 lblk, pblk;
+	u32 num_alloc;
+	s32 nr_extents;
+	s32 res = 0;
+	s32 i;
+
+	buf = nvfuse_alloc_aligned_buffer(CLUSTER_SIZE);
+	if (buf == NULL) {
+		printf(" malloc error \n");
+		return -1;
+	}
+
+	for (i = 0; i < RT_APPEND_FILES; i++) {
+		sprintf(str[i], "append_test%d", i);
+		fid[i] = nvfuse_openfile_path(nvh, str[i], O_RDWR | O_CREAT, 0);
+		if (fid[i] < 0) {
+			printf(" Error: file open or create \n");
+			res = -1;
+		}
+	}
+
+	printf(" Start: appending %d files in turn (%d blocks each).\n", RT_APPEND_FILES,
+	       RT_APPEND_BLOCKS);
+	for (lblk = 0; lblk < RT_APPEND_BLOCKS && !res; lblk++) {
+		for (i = 0; i < RT_APPEND_FILES; i++) {
+			memset(buf, (s8)(lblk + i), CLUSTER_SIZE);
+			if (nvfuse_writefile(nvh, fid[i], buf, CLUSTER_SIZE, (s64)lblk * CLUSTER_SIZE) !=
+			    CLUSTER_SIZE) {
+				printf(" Error: file (%s) write() \n", str[i]);
+				res = -1;
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < RT_APPEND_FILES && !res; i++) {
+		nr_extents = 0;
+		for (lblk = 0; lblk < RT_APPEND_BLOCKS; lblk += num_alloc) {
+			pblk = nvfuse_fgetblk(&nvh->nvh_sb, fid[i], lblk, RT_APPEND_BLOCKS - lblk, &num_alloc);
+			if (pblk <= 0 || num_alloc == 0) {
+				printf(" Error: file (%s) has no block %d\n", str[i], lblk);
+				res = -1;
+				break;
+			}
+			nr_extents++;
+		}
+
+		printf(" %s: %d blocks in %d extents\n", str[i], RT_APPEND_BLOCKS, nr_extents);
+		if (!res && nr_extents > RT_APPEND_BLOCKS / NVFUSE_RSV_WINDOW_MIN + 1) {
+			printf(" Error: file (%s) is interleaved with others\n", str[i]);
+			res = -1;
+		}
+	}
+	printf(" Finish: appending files in turn.\n");
+
+	for (i = 0; i < RT_APPEND_FILES; i++) {
+		if (fid[i] < 0)
+			continue;
+		nvfuse_closefile(nvh, fid[i]);
+		if (nvfuse_rmfile_path(nvh, str[i]) < 0) {
+			printf(" Error: rmfile = %s\n", str[i]);
+			res = -1;
+		}
+	}
+	nvfuse_free_aligned_buffer(buf);
+
+	return res;
+}
+
 #define RANDOM		1
 #define SEQUENTIAL	0
 
@@ -811,13 +1686,22 @@ rt_ctx[] = {
 	{ rt_create_max_sized_file_aio_4KB, "Creating Maximum Sized Single File with 4KB Random AIO Read and Write.", RANDOM, 0, 0},
 	{ rt_create_max_sized_file_aio_128KB, "Creating Maximum Sized Single File with 128KB Sequential AIO Read and Write.", SEQUENTIAL, 0, 0 },
 	{ rt_create_max_sized_file_aio_128KB, "Creating Maximum Sized Single File with 128KB Random AIO Read and Write.", RANDOM, 0, 0 },
-	{ rt_create_4KB_files, "Creating 4KB files with fsync.", 0, 0, 0}
+	{ rt_buffered_aio_4KB, "4KB Random Buffered AIO Read and Write.", RANDOM, 0, 0 },
+	{ rt_merged_aio_4KB, "4KB Sequential Direct AIO with Request Merging.", SEQUENTIAL, 0, 0 },
+	{ rt_create_4KB_files, "Creating 4KB files with fsync.", 0, 0, 0},
+	{ rt_open_many_files, "Opening Many Files at Once.", 0, 0, 0},
+	{ rt_mt_read_scaling, "Random 4KB Reads from Multiple Threads Sharing One Handle.", 0, 0, 0},
+	{ rt_vectored_rw, "Vectored Read and Write of Odd Sized Records.", 0, 0, 0},
+	{ rt_direct_rw, "Synchronous Direct I/O Mixed with Buffered I/O.", 0, 0, 0},
+	{ rt_lend_read, "Zero-Copy Reads of Lent Cache Pages.", 0, 0, 0},
+	{ rt_interleaved_append, "Appending Files in Turn Keeps Each Contiguous.", 0, 0, 0}
 };
 
 void rt_usage(char *cmd)
 {
 	printf("\nOptions for NVFUSE application: \n");
 	printf("\t-T: test type (e.g., 1: max_test, 2: quick_test, 3: million test \n");
+	printf("\t-t: max number of threads for the multi-threaded read test (e.g., 4) \n");
 }
 
 static int rt_main(void *arg)
@@ -1156,7 +2040,7 @@ int main(int argc, char *argv[])
 
 	/* optind must be reset before using getopt() */
 	optind = 0;
-	while ((op = getopt(app_argc, app_argv, "T:")) != -1) {
+	while ((op = getopt(app_argc, app_argv, "T:t:")) != -1) {
 		switch (op) {
 		case 'T':
 			test_type = atoi(optarg);
@@ -1165,6 +2049,13 @@ int main(int argc, char *argv[])
 				goto INVALID_ARGS;
 			}
 			break;
+		case 't':
+			num_threads = atoi(optarg);
+			if (num_threads < 1) {
+				fprintf(stderr, " Invalid number of threads = %d", num_threads);
+				goto INVALID_ARGS;
+			}
+			break;
 		default:
 			goto INVALID_ARGS;
 		}
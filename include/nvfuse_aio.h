@@ -23,6 +23,7 @@
 
 #define NVFUSE_MAX_AIO_DEPTH		1024
 #define NVFUSE_MAX_AIO_COMPLETION	1
+#define NVFUSE_AIO_MERGE_MAX_BYTES	(128 * 1024)
 #define NVFUSE_SUBMISSION_QUEUE		1
 #define NVFUSE_COMPLETION_QUEUE		2
 
@@ -36,10 +37,11 @@ struct nvfuse_aio_req {
 	void *buf; /* actual data buffer */
 	s64 offset; /* start address in bytes */
 	s64 bytes; /* number of bytes */
+	s64 result; /* bytes transferred, short at the end of file */
 	s32 error; /* return error code */
 	s32 status; /* status (e.g., ready, submitted, and completed) */
 
-	struct list_head list; /* linked list */
+	struct list_head list; /* on abuf_head while a buffered read is in flight */
 	struct list_head bh_head; /* buffer head list */
 	s32 bio_job_count;
 	void(*actx_cb_func)(void *arg); /* callback function to process completion for each context */
@@ -53,16 +55,42 @@ struct nvfuse_aio_req {
 	void *tag3; /* keep track of temp pointer */
 };
 
+/* submission and completion queues are rings of asq/acq_max_depth entries */
 struct nvfuse_aio_queue {
-	struct list_head asq_head; /* submission queue head */
+	struct nvfuse_aio_req *asq[NVFUSE_MAX_AIO_DEPTH]; /* submission ring */
+	s32 asq_head; /* oldest submission */
 	s32 asq_max_depth; /* maximum submission queue depth */
 	s32 asq_cur_depth; /* current submission queue depth */
 
-	struct list_head acq_head; /* completion queue head */
+	struct nvfuse_aio_req *acq[NVFUSE_MAX_AIO_DEPTH]; /* completion ring */
+	s32 acq_head; /* oldest completion */
 	s32 acq_max_depth; /* maximum completion queue depth */
 	s32 acq_cur_depth; /* current completion queue depth */
+	/*
+	 * requests accepted and not yet reaped. kept within acq_max_depth so
+	 * that every completion finds room in the completion ring.
+	 */
+	s32 inflight;
+
+	/*
+	 * with cpl_callback set, nvfuse_aio_poll() calls actx_cb_func of each
+	 * request as its device jobs complete instead of queueing it.
+	 */
+	s32 cpl_callback;
+	/*
+	 * with merge set, direct requests wait in the submission ring until
+	 * nvfuse_aio_queue_commit(), which joins requests adjacent on the
+	 * device into shared jobs.
+	 */
+	s32 merge;
+	s32 polling; /* inside nvfuse_aio_poll() */
+	s32 cb_count; /* callbacks made by the current poll */
+	s32 cb_max; /* callbacks the current poll may make */
 
 	s32 total_bio_job_count;
+	s64 bio_job_issued; /* device jobs sent over the life of the queue */
+
+	struct list_head abuf_head; /* buffered reads waiting for the device */
 
 	struct reactor_task *task;
 
@@ -78,9 +106,9 @@ struct nvfuse_aio_queue {
 s32 nvfuse_aio_queue_init(struct io_target *target, struct nvfuse_aio_queue *aioq, s32 max_depth);
 void nvfuse_aio_queue_deinit(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq);
 s32 nvfuse_aio_queue_enqueue(struct nvfuse_aio_queue *aioq, struct nvfuse_aio_req *areq, s32 qtype);
-s32 nvfuse_aio_queue_dequeue(struct nvfuse_aio_queue *aioq, struct nvfuse_aio_req *areq, s32 qtype);
-s32 nvfuse_aio_queue_move(struct nvfuse_aio_queue *aioq, struct nvfuse_aio_req *areq, s32 qtype);
+struct nvfuse_aio_req *nvfuse_aio_queue_dequeue(struct nvfuse_aio_queue *aioq, s32 qtype);
 s32 nvfuse_aio_queue_submission(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq, struct nvfuse_aio_req *areq);
+s32 nvfuse_aio_queue_commit(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq);
 s32 nvfuse_aio_queue_completion(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq);
 
 void nvfuse_aio_gen_dev_cpls(void *arg);
@@ -92,5 +120,7 @@ s32 nvfuse_aio_get_queue_depth_type(struct nvfuse_aio_queue *aioq, s32 qtype);
 
 s32 nvfuse_io_submit(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq, s32 nr, struct nvfuse_aio_req **list);
 s32 nvfuse_io_getevents(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq, s32 min_nr, s32 nr, struct nvfuse_aio_req **list);
+s32 nvfuse_aio_poll(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq, s32 min_nr,
+		    s32 max_nr);
 
 #endif
@@ -15,6 +15,7 @@
 
 #if NVFUSE_OS == NVFUSE_OS_LINUX
 #include <sys/statvfs.h>
+#include <sys/uio.h>
 #endif
 
 #include "nvfuse_types.h"
@@ -27,8 +28,8 @@ extern "C" {
 #endif
 //#define VERIFY_BEFORE_RM_FILE
 
-s32 nvfuse_gather_bh(struct nvfuse_superblock *sb, s32 fid, const s8 *user_buf, u32 count,
-		     nvfuse_off_t woffset, struct list_head *aio_bh_head, s32 *aio_bh_count);
+s32 nvfuse_gather_bh(struct nvfuse_superblock *sb, s32 fid, s8 *user_buf, u32 count,
+		     nvfuse_off_t roffset, struct list_head *aio_bh_head, s32 *aio_bh_count);
 
 struct nvfuse_handle *nvfuse_create_handle(struct nvfuse_ipc_context *ipc_ctx, struct nvfuse_params *params);
 void nvfuse_destroy_handle(struct nvfuse_handle *nvh, s32 deinit_iom, s32 need_umount);
@@ -64,8 +65,31 @@ s32 nvfuse_readfile_aio(struct nvfuse_handle *nvh, u32 fid, s8 *buffer, s32 coun
 s32 nvfuse_writefile(struct nvfuse_handle *nvh, u32 fid, const s8 *user_buf, u32 count,
 		     nvfuse_off_t woffset);
 
+/* vectored i/o, one pass through the inode and buffer cache per call */
+s32 nvfuse_readv(struct nvfuse_handle *nvh, u32 fid, const struct iovec *iov, s32 iovcnt);
+s32 nvfuse_writev(struct nvfuse_handle *nvh, u32 fid, const struct iovec *iov, s32 iovcnt);
+s32 nvfuse_preadv(struct nvfuse_handle *nvh, u32 fid, const struct iovec *iov, s32 iovcnt,
+		  nvfuse_off_t roffset);
+s32 nvfuse_pwritev(struct nvfuse_handle *nvh, u32 fid, const struct iovec *iov, s32 iovcnt,
+		   nvfuse_off_t woffset);
+
+/*
+ * zero-copy read: fills iov with read-only views of cached pages covering
+ * up to count bytes from roffset and returns the number of entries used,
+ * at most max_pages. the pages stay pinned in the buffer cache until they
+ * are given back with nvfuse_readfile_lend_release(). a concurrent write to
+ * the file may change the lent data. files with inline data are not lent.
+ */
+struct nvfuse_buffer_cache;
+s32 nvfuse_readfile_lend(struct nvfuse_handle *nvh, u32 fid, nvfuse_off_t roffset, s32 count,
+			 struct iovec *iov, struct nvfuse_buffer_cache **pages, s32 max_pages);
+void nvfuse_readfile_lend_release(struct nvfuse_handle *nvh, struct nvfuse_buffer_cache **pages,
+				  s32 nr_pages);
+
 s32 nvfuse_createfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *str, inode_t *new_ino,
 		      mode_t mode, dev_t dev);
+s32 nvfuse_createfiles(struct nvfuse_superblock *sb, inode_t par_ino, s8 **filenames, s32 count,
+		       inode_t *new_inos, mode_t mode);
 
 s32 nvfuse_rmfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filename);
 s32 nvfuse_rmfile_path(struct nvfuse_handle *nvh, const char *path);
@@ -138,6 +162,12 @@ s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_
 			  nvfuse_off_t woffset);
 s32 nvfuse_readfile_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32 count,
 			 nvfuse_off_t roffset, s32 sync_read);
+s32 nvfuse_readv_core(struct nvfuse_superblock *sb, u32 fid, const struct iovec *iov, s32 iovcnt,
+		      nvfuse_off_t roffset, s32 sync_read);
+s32 nvfuse_writev_core(struct nvfuse_superblock *sb, s32 fid, const struct iovec *iov, s32 iovcnt,
+		       nvfuse_off_t woffset);
+s32 nvfuse_rwv_directio_core(struct nvfuse_superblock *sb, s32 fid, const struct iovec *iov,
+			     s32 iovcnt, nvfuse_off_t offset, s32 opcode);
 s32 nvfuse_path_resolve(struct nvfuse_handle *nvh, const char *path, char *filename,
 			struct nvfuse_dir_entry *direntry);
 s32 nvfuse_fgetblk(struct nvfuse_superblock *sb, s32 fid, s32 lblk, s32 max_blocks, u32 *num_alloc);
@@ -96,7 +96,8 @@ typedef struct {
 
 typedef struct master_node master_node_t;
 
-typedef struct index_node {
+/* node header at the beginning of each node block */
+typedef struct index_node_head {
 	int i_root; //4
 	int i_flag; //8
 	int i_num;	//12
@@ -105,8 +106,16 @@ typedef struct index_node {
 	int i_prev_node; //24
 	int i_status;	 //28
 	char pad[8 + 8]; //40
+} index_node_head_t;
 
-	key_pair_t *i_pair;	//4086B
+/*
+ * in-memory handle of a node. header, keys and items are typed views into the
+ * buffer cache page pinned by i_bh, so nothing is copied on read or write.
+ */
+typedef struct index_node {
+	index_node_head_t *i_head;
+	key_pair_t i_pair[1];
+	int i_offset;	/* node number the handle is bound to */
 	char *i_buf;
 	struct nvfuse_buffer_head *i_bh;
 	master_node_t *i_master;
@@ -157,6 +166,8 @@ typedef struct _master_ondisk_node {
 } master_ondisk_node_t;
 
 #define MAX_STACK 128
+/* node handles held at once by a tree operation */
+#define BP_MAX_NODE_HANDLES 64
 typedef struct master_node {
 	/* ondisk pointer */
 	master_ondisk_node_t *m_ondisk;
@@ -178,6 +189,10 @@ typedef struct master_node {
 	char *m_buf;
 	unsigned int m_key_count;
 
+	/* node handles, bit set in m_node_used while a handle is allocated */
+	index_node_t m_node[BP_MAX_NODE_HANDLES];
+	u64 m_node_used;
+
 	index_node_t *(*alloc)(struct master_node *master, int flag, int offset, int is_new);
 	int	(*dealloc)(struct master_node *master, index_node_t *p);
 	int	(*insert)(struct master_node *master, bkey_t *key, bitem_t *value, bitem_t *cur_value,
@@ -200,7 +215,7 @@ typedef struct master_node {
 * Master Node Context Structure
 */
 typedef struct {
-	master_node_t *master;
+	master_ondisk_node_t *m_ondisk;
 	struct nvfuse_buffer_head *bh;
 	s32 master_id;
 } master_ctx_t;
@@ -251,9 +266,6 @@ typedef struct {
 
 #define B_FLUSH_STACK(m) while(m->m_sp)B_POP(m);
 
-void *bp_malloc(struct nvfuse_superblock *sb, int mempool_type, int num);
-void bp_free(struct nvfuse_superblock *sb, int mempool_type, int num, void *ptr);
-
 #ifdef KEY_IS_INTEGER
 #define B_KEY_MAKE(b, n) (*b = n)
 
@@ -277,15 +289,11 @@ void bp_free(struct nvfuse_superblock *sb, int mempool_type, int num, void *ptr)
 //#define B_KEY_CMP(x, y)	(bkey_t)(*x - *y)
 #define B_KEY_CMP(x, y) key_compare(x, y, 0, 0, 0)
 #define B_KEY_INIT(x)	(*x =  0x00)
-#define B_KEY_ALLOC(sb, type, num) (bkey_t *)bp_malloc(sb, type, num);
-#define B_KEY_FREE(p) bp_free((void *)(p))
 
 
 #define B_ITEM_COPY(x,y)	(*x = *y)
 #define B_ITEM_CMP(x,y)	(int)(*x - *y)
 #define B_ITEM_INIT(x)	(*x =  0x00)
-#define B_ITEM_ALLOC(sb, type, num) (bitem_t *)bp_malloc(sb, type, num);
-#define B_ITEM_FREE(p) bp_free(p)
 
 #define B_KEY_ISNULL(p) (*p == 0)
 #define B_ITEM_ISNULL(p) (*p == 0)
@@ -338,10 +346,62 @@ void bp_free(struct nvfuse_superblock *sb, int mempool_type, int num, void *ptr)
 #endif
 
 #define B_PARENT(p) ((index_node_t *)p)->i_parent
-#define B_NEXT(p) p->i_next_node
-#define B_PREV(p) p->i_prev_node
-#define B_ISLEAF(p) (p->i_flag == DATA_FLAG)
-#define B_ISROOT(p) (p->i_root)
+#define B_NEXT(p) p->i_head->i_next_node
+#define B_PREV(p) p->i_head->i_prev_node
+#define B_ISLEAF(p) (p->i_head->i_flag == DATA_FLAG)
+#define B_ISROOT(p) (p->i_head->i_root)
+
+#ifdef KEY_IS_INTEGER
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/* keys left to the linear scan at the end of an in-node search */
+#define BP_SEARCH_LINEAR	16
+
+/* number of keys smaller than key in keys[0..num) sorted in ascending order */
+static inline int bp_lower_bound(const bkey_t *keys, int num, bkey_t key)
+{
+	const bkey_t *base = keys;
+	int count = 0;
+	int half;
+	int i = 0;
+
+	/* branch-free binary search (cmov) narrows the range to the final stretch */
+	while (num > BP_SEARCH_LINEAR) {
+		half = num >> 1;
+		base = (base[half] < key) ? base + half : base;
+		num -= half;
+	}
+
+#ifdef __AVX2__
+	{
+		/* flip sign bits so that signed 64bit compare orders unsigned keys */
+		const __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+		const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x((long long)key), sign);
+		__m256i v, lt;
+
+		for (; i + 4 <= num; i += 4) {
+			v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(base + i)), sign);
+			lt = _mm256_cmpgt_epi64(k, v);
+			count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(lt)));
+		}
+	}
+#endif
+	for (; i < num; i++)
+		count += (base[i] < key);
+
+	return (int)(base - keys) + count;
+}
+
+/* index of key in keys[0..num), -1 if not found */
+static inline int bp_search_key(const bkey_t *keys, int num, bkey_t key)
+{
+	int index = bp_lower_bound(keys, num, key);
+
+	return (index < num && keys[index] == key) ? index : -1;
+}
+#endif
 
 int bp_remove_key(master_node_t *master, bkey_t *key);
 int search_data_node(master_node_t *master, bkey_t *str, index_node_t **d);
@@ -408,12 +468,11 @@ index_node_t *bp_next_node(master_node_t *master, index_node_t *ip, bkey_t *key)
 
 int bp_read_master(master_node_t *master);
 int bp_find_key(master_node_t *master, bkey_t *key, bitem_t *value);
-void bp_copy_node_to_raw(index_node_t *node, char *raw);
-void bp_copy_raw_to_node(index_node_t *node, char *raw);
 
 void bp_print_node(index_node_t *node);
-void bubble_sort(master_node_t *master, key_pair_t *pair, int num, int(*compare)(void *src1,
-		 void *src2));
+void bp_sort_pair(master_node_t *master, key_pair_t *pair, int num, int(*compare)(void *src1,
+		  void *src2));
+int bp_bulk_load(master_node_t *master, key_pair_t *pair, int num);
 int bp_alloc_inode_and_master(struct nvfuse_superblock *sb, master_node_t *master);
 void bp_deinit_master(master_node_t *master);
 offset_t bp_alloc_bitmap(master_node_t *master, struct nvfuse_inode_ctx *ictx);
@@ -103,12 +103,17 @@ struct nvfuse_buffer_cache {
 	rte_spinlock_t bc_lock;		/* spin lock */
 	u32 bc_dirty: 1;			/* dirty status */
 	u32 bc_load	: 1;			/* data loaded from storage */
-	u32 bc_locked: 1;
 	u32	bc_flush: 1;
-	u32	bc_temp: 28;			/* FIXED: to be removed */
+	u32	bc_temp: 29;			/* FIXED: to be removed */
+	/* buffered aio read in flight; cleared by the device completion without bc_lock */
+	volatile u32 bc_locked;
 
 	rte_atomic32_t bc_ref;		/* reference count*/
 
+	/* bytes written to a block not loaded yet, see nvfuse_prepare_write_bc() */
+	u16 bc_valid_start;
+	u16 bc_valid_end;
+
 	struct list_head bc_bh_head; /* buffer list to retrieve */
 	rte_atomic32_t bc_bh_count;
 	pbno_t bc_pno;				/* physical block no*/
@@ -138,6 +143,54 @@ struct nvfuse_buffer_manager {
 	u64 bm_cache_ref;
 	u64 bm_cache_hit;
 	s32 bm_state;
+
+	/* buffer refill from the control plane, see nvfuse_refill_buffer_cache() */
+	s32 bm_alloc_batch; /* pages asked for per message */
+	s32 bm_alloc_low_wm; /* refill when fewer unused buffers are left */
+	u64 bm_alloc_tsc; /* last refill */
+	u64 bm_alloc_retry_tsc; /* no refill before, after a denied one */
+	s32 bm_alloc_inflight; /* a refill request is out to the control plane */
+	rte_atomic32_t bm_alloc_granted; /* its pages, < 0 if denied, set by the ipc callback */
+
+	/* usage reports to the control plane, see nvfuse_balloon_buffer_cache() */
+	u64 bm_report_tsc;
+	u64 bm_report_miss; /* bm_cache_ref - bm_cache_hit at the last report */
+	rte_atomic32_t bm_balloon_shrink; /* pages to give back, -1 while a report is out */
+
+	struct nvfuse_shared_cache *bm_shared; /* clean blocks shared by data planes, or NULL */
+};
+
+/*
+ * Shared Cache: clean blocks read by any data plane, kept in hugepage memory
+ * and indexed by physical block number. a copy is valid as long as no block
+ * of its container has been written since it was read from the device.
+ */
+#define NVFUSE_SHARED_CACHE_NAME	"nvfuse_shared_cache"
+#define NVFUSE_SHARED_CACHE_POOL_NAME	"nvfuse_shared_pages"
+
+struct nvfuse_shared_buffer {
+	pbno_t sh_pno;		/* physical block no, 0 if empty */
+	u32 sh_gen;		/* generation of its container when it was read */
+	u32 sh_stamp;		/* last use in its set, for replacement */
+	s32 sh_ref;		/* readers copying it out or the one filling it */
+	s32 sh_valid;		/* data filled in */
+	s8 *sh_buf;
+};
+
+struct nvfuse_shared_set {
+	rte_spinlock_t ss_lock;
+	u32 ss_clock;
+	struct nvfuse_shared_buffer ss_buf[NVFUSE_SHARED_CACHE_WAYS];
+};
+
+struct nvfuse_shared_cache {
+	u32 sc_nr_sets;
+	u32 sc_nr_containers;
+	u32 sc_blocks_per_container;
+	rte_atomic64_t sc_hit;
+	rte_atomic64_t sc_miss;
+	struct nvfuse_shared_set *sc_set;
+	rte_atomic32_t *sc_gen; /* per container, bumped when one of its blocks is written */
 };
 
 /*
@@ -148,6 +201,10 @@ struct nvfuse_buffer_manager {
 int nvfuse_init_buffer_cache(struct nvfuse_superblock *sb, s32 buffer_size);
 /* destroy buffer cache structure */
 void nvfuse_deinit_buffer_cache(struct nvfuse_superblock *sb);
+/* create (primary, size in MB) or attach to the cache shared by data planes */
+s32 nvfuse_init_shared_cache(struct nvfuse_superblock *sb, s32 size);
+/* fill bc from the shared cache, 0 on a hit */
+s32 nvfuse_shared_cache_read(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc);
 /* init buffer cache (bc) */
 void nvfuse_init_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc);
 /* alloc buffer head (bh) using memppol */
@@ -184,6 +241,9 @@ void nvfuse_move_buffer_list(struct nvfuse_superblock *sb, struct nvfuse_buffer_
 void nvfuse_move_buffer_list_nolock(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc,
 							 s32 buffer_type, s32 tail);
 void nvfuse_move_bc_to_unused_list(struct nvfuse_superblock *sb, u64 key);
+/* write back and optionally drop cached data blocks of a range before direct i/o */
+void nvfuse_sync_cached_range(struct nvfuse_superblock *sb, inode_t ino, lbno_t lblock,
+			      u32 nr_blocks, s32 invalidate);
 /* return the number of dirty buffer caches (e.g., 4K dirty buffers) */
 s32 nvfuse_get_dirty_count(struct nvfuse_superblock *sb);
 /* mark the buffer head as dirty */
@@ -223,6 +283,15 @@ s32 nvfuse_remove_buffer_cache(struct nvfuse_superblock *sb, s32 nr_buffers);
 void nvfuse_inc_bc_ref(struct nvfuse_buffer_cache *bc);
 /* dec bc->bc_ref */
 void nvfuse_dec_bc_ref(struct nvfuse_buffer_cache *bc);
+/* prepare a partial write to bc, reading the block only when it cannot be deferred */
+s32 nvfuse_prepare_write_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc,
+			    u32 offset, u32 len, u32 eof);
+/* complete a bc holding only part of its block by reading the rest */
+s32 nvfuse_fill_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc);
+/* keep a referenced bc cached without its bc lock, e.g. for pages lent to users */
+void nvfuse_pin_bc(struct nvfuse_buffer_cache *bc);
+/* drop a reference taken by nvfuse_pin_bc() */
+void nvfuse_unpin_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc);
 /* deubg bh info */
 void nvfuse_print_bh(struct nvfuse_buffer_head *bh);
 
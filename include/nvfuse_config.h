@@ -69,6 +69,10 @@ static inline int nvfuse_process_model_is_dataplane(void)
 /* attempting to allocate buffers and containers as much as desired at mount time*/
 #define NVFUSE_CONTAINER_PERALLOCATION_SIZE	1024 /* in 128MB unit */
 
+/* containers a data plane keeps allocated ahead of need, see nvfuse_get_reserved_container() */
+#define NVFUSE_CONTAINER_RESERVE_MIN	2
+#define NVFUSE_CONTAINER_RESERVE_MAX	64
+
 /* Default Buffer Cache Size */
 #define NVFUSE_INITIAL_BUFFER_SIZE_DATA (16) //16MB
 #define NVFUSE_INITIAL_BUFFER_SIZE_CONTROL (16) //16MB
@@ -78,12 +82,49 @@ static inline int nvfuse_process_model_is_dataplane(void)
 
 /* Default Inode Context Size */
 #define NVFUSE_ICTXC_SIZE (32*1024)
+/* Inode Context Cache Shards (power of two) and Hash Size per Shard */
+#define NVFUSE_ICTXC_SHARD_NUM	(16)
+#define NVFUSE_ICTXC_HASH_NUM	(3331)
+
+/* Block group ranges handed to the allocating threads of a standalone handle */
+#define NVFUSE_ALLOC_HOME_NUM	(16)
+
+/* Per-file reservation windows in blocks, doubling from MIN as a file keeps appending */
+#define NVFUSE_RSV_WINDOW_MIN	(16)
+#define NVFUSE_RSV_WINDOW_MAX	(256)
+
+/* Inode Reader/Writer Locks shared by hashing inode numbers (power of two) */
+#define NVFUSE_INODE_RWLOCK_NUM	(1024)
 
 /* RATIO BG TO BUFFER Cache */
 //#define NVFUSE_BUFFER_RATIO_TO_DATA (0.001) /* data optimized */
 //#define NVFUSE_BUFFER_RATIO_TO_DATA (0.005) /* meta optimized*/
 //#define NVFUSE_BUFFER_RATIO_TO_DATA (0.01) /* meta optimized*/
 #define NVFUSE_BUFFER_DEFAULT_ALLOC_SIZE_PER_MSG 1
+/*
+ * Data planes refill their buffer cache from the control plane in batches
+ * (4K pages) that double while a batch lasts less than the refill interval
+ * and halve when one lasts ten times longer.
+ */
+#define NVFUSE_BUFFER_MIN_ALLOC_SIZE_PER_MSG	64	/* 256KB */
+#define NVFUSE_BUFFER_MAX_ALLOC_SIZE_PER_MSG	16384	/* 64MB */
+#define NVFUSE_BUFFER_ALLOC_INTERVAL_MS		100
+
+/*
+ * data planes report their buffer usage to the control plane this often,
+ * which may ask an idle one to give pages back to a busy one.
+ */
+#define NVFUSE_BUFFER_REPORT_INTERVAL_MS	1000
+
+/* a data plane shutting down waits this long for its buffer requests */
+#define NVFUSE_BUFFER_DEINIT_TIMEOUT_MS		1000
+
+/*
+ * clean blocks can also be kept in a cache shared by all data planes (-r in
+ * MB for the primary), so blocks read by several of them are read from the
+ * device once.
+ */
+#define NVFUSE_SHARED_CACHE_WAYS	8
 
 /* Buffer Head Mempool Settings */
 #define NVFUSE_BH_MEMPOOL_TOTAL_SIZE	(0x10000) /* 256MB */
@@ -93,28 +134,6 @@ static inline int nvfuse_process_model_is_dataplane(void)
 #define NVFUSE_BC_MEMPOOL_TOTAL_SIZE	(0x400000) /* 16GB */
 #define NVFUSE_BC_MEMPOOL_CACHE_SIZE	2048
 
-/* Buffer Cache Mempool Settings */
-#define NVFUSE_BPTREE_MEMPOOL_TOTAL_SIZE	(0x800)
-#define NVFUSE_BPTREE_MEMPOOL_CACHE_SIZE	(0x10)
-
-#define NVFUSE_BPTREE_MEMPOOL_MASTER_TOTAL_SIZE	(0x10)
-#define NVFUSE_BPTREE_MEMPOOL_MASTER_CACHE_SIZE	(0x2)
-
-#define NVFUSE_BPTREE_MEMPOOL_INDEX_TOTAL_SIZE	(0x100)
-#define NVFUSE_BPTREE_MEMPOOL_INDEX_CACHE_SIZE	(0x10)
-
-#define NVFUSE_BPTREE_MEMPOOL_PAIR_TOTAL_SIZE	(0x100)
-#define NVFUSE_BPTREE_MEMPOOL_PAIR_CACHE_SIZE	(0x10)
-
-enum bp_mempool_type {
-	BP_MEMPOOL_INDEX	= 0,
-	BP_MEMPOOL_MASTER	= 1,
-	BP_MEMPOOL_KEY		= 2,
-	BP_MEMPOOL_VALUE	= 3,
-	BP_MEMPOOL_PAIR		= 4,
-	BP_MEMPOOL_NUM		= 5
-};
-
 #define NVFUSE_SYNC_DIRTY_COUNT (2048) /* blocks */
 
 /* Use AIO Library for Dirty Sync */
@@ -152,6 +171,9 @@ enum bp_mempool_type {
 #define NVFUSE_MIN_RA_SIZE (4*CLUSTER_SIZE)
 #define NVFUSE_MAX_RA_SIZE (32*CLUSTER_SIZE)
 
+/* tiny files keep their data in the spare space of the inode */
+#define NVFUSE_USE_INLINE_DATA
+
 /* MKFS uses zeroing to initialize inode table */
 //#define NVFUSE_USE_MKFS_INODE_ZEROING
 
@@ -28,6 +28,13 @@ struct app_manage_node {
 	s32 root_bg_id; /* identify to container */
 };
 
+/* buffer usage of a data plane, see nvfuse_control_plane_buffer_stat() */
+struct buffer_balloon {
+	s32 size; /* pages granted to it */
+	s32 miss_rate; /* misses per second at the last report */
+	s32 shrink; /* pages it is asked to give back at its next report */
+};
+
 struct control_plane_context {
 	/*
 	* registered application table
@@ -48,19 +55,41 @@ struct control_plane_context {
 	s32 free_containers;
 	s32 last_alloc_container_id;
 
+	/* allocation index over reservation_table, see nvfuse_container_index_build() */
+	u64 *container_free_map; /* a set bit is a free container */
+	u64 *container_free_summary; /* a set bit is a non-empty word of the free map */
+	s32 container_map_words;
+	s32 *container_next_dormant; /* next container in the same dormant list */
+	s32 container_dormant_head[SPDK_NUM_CORES]; /* owned, UNLOCKED containers per core */
+	s32 container_cursor[SPDK_NUM_CORES]; /* where a core's next new container is looked for */
+
 	s64 container_generation;
 	s32 container_cur_log_file;
 	s32 container_max_log_file;
 
+	/* updates since the last snapshot, see nvfuse_log_container_delta() */
+	s32 container_delta_fd;
+	s32 container_delta_offset;
+
 	/* total buffer size and status */
 	s32 total_buffer_size; // in pages
 	s32 curr_buffer_size; // in pages
+	struct buffer_balloon buffer_balloon[SPDK_NUM_CORES];
 
 	s8 container_name[128];
 	s8 container_log_name[128];
 	s8 app_log_name[128];
 };
 
+/* post-image of one reservation table entry, appended to the delta log */
+struct container_delta {
+	s64 generation; /* snapshot this update applies to */
+	s32 container_id;
+	s32 owner_core_id;
+	s32 status;
+	s32 ref_count;
+};
+
 struct nvfuse_handle;
 struct nvfuse_superblock_common;
 
@@ -84,8 +113,10 @@ s32 nvfuse_superblock_copy(struct nvfuse_handle *nvh, s8 *appname,
 
 /* Buffer Allocation Functions */
 s32 nvfuse_control_plane_buffer_init(struct nvfuse_handle *nvh, s32 size);
-s32 nvfuse_control_plane_buffer_alloc(struct nvfuse_handle *nvh, s32 size);
-s32 nvfuse_control_plane_buffer_free(struct nvfuse_handle *nvh, s32 size);
+s32 nvfuse_control_plane_buffer_alloc(struct nvfuse_handle *nvh, s32 core_id, s32 size);
+s32 nvfuse_control_plane_buffer_free(struct nvfuse_handle *nvh, s32 core_id, s32 size);
+s32 nvfuse_control_plane_buffer_stat(struct nvfuse_handle *nvh, s32 core_id, s32 size, s32 misses,
+				     s32 interval_ms);
 void nvfuse_control_plane_buffer_deinit(struct nvfuse_handle *nvh);
 
 /* Container Management Functions */
@@ -100,6 +131,7 @@ s32 nvfuse_control_plane_container_release_by_coreid(struct nvfuse_handle *nvh,
 
 s32 nvfuse_store_container_table(struct nvfuse_handle *nvh);
 s32 nvfuse_load_container_table(struct nvfuse_handle *nvh);
+s32 nvfuse_log_container_delta(struct nvfuse_handle *nvh, s32 container_id);
 
 /* Container Reservation Functions */
 s32 nvfuse_control_plane_reservation_acquire(struct nvfuse_handle *nvh, s32 container_id,
@@ -18,6 +18,8 @@
 #include "nvfuse_bp_tree.h"
 #include "nvfuse_stat.h"
 #include "rte_spinlock.h"
+#include "rte_rwlock.h"
+#include "rte_atomic.h"
 #include "list.h"
 #include "rbtree.h"
 
@@ -29,6 +31,7 @@
 #include <sys/stat.h>
 #include <pthread.h>
 #include <string.h>
+#include <stddef.h>
 
 #ifndef __NVFUSE_HEADER_H__
 #define __NVFUSE_HEADER_H__
@@ -75,7 +78,12 @@
 
 /* INODE RELATED */
 #define INODE_ENTRY_SIZE CLUSTER_SIZE
-#define INODE_ENTRY_NUM	(CLUSTER_SIZE/INODE_ENTRY_SIZE)
+#define INODE_ENTRY_SIZE_SMALL (256) /* compact inode, 16 per block, out-of-line xattr */
+#define NVFUSE_INODE_SIZE(sb) ((sb)->sb_inode_size)
+#define NVFUSE_INODE_IS_COMPACT(sb) (NVFUSE_INODE_SIZE(sb) != INODE_ENTRY_SIZE)
+#define INODE_ENTRY_NUM(sb)	(CLUSTER_SIZE / NVFUSE_INODE_SIZE(sb))
+#define INODE_ENTRY(sb, buf, idx) \
+	((struct nvfuse_inode *)((s8 *)(buf) + (idx) * NVFUSE_INODE_SIZE(sb)))
 
 /* ERROR STATUS */
 #define	NVFUSE_ERROR		-1
@@ -135,7 +143,10 @@
 
 /* # OF MAX OPEN FILE */
 #define START_OPEN_FILE	3 /* STDIN, STDOUT, STDERR*/
-#define MAX_OPEN_FILE	16
+#define MAX_OPEN_FILE	(64 * 1024) /* default, overridden by nvfuse_params.max_open_files */
+/* the fd table grows in chunks so that entries never move */
+#define NVFUSE_FILE_TABLE_CHUNK_BITS	8
+#define NVFUSE_FILE_TABLE_CHUNK	(1 << NVFUSE_FILE_TABLE_CHUNK_BITS)
 
 #define NVFUSE_BP_TYPE_DATA 0
 #define NVFUSE_BP_TYPE_DIR 1
@@ -169,6 +180,7 @@ struct nvfuse_app_superblock {
 
 struct nvfuse_superblock_common {
 	u32 sb_signature; //RDONLY
+	u32 sb_inode_size; /* RDONLY, on-disk inode size in bytes */
 	s64 sb_no_of_sectors;//RDONLY
 	s64 sb_no_of_blocks;//RDONLY
 	s64 sb_no_of_used_blocks; /* FS view*/
@@ -195,6 +207,7 @@ struct nvfuse_superblock_common {
 struct nvfuse_superblock {
 	struct { /* Must be identical to nvfuse_super_common */
 		u32 sb_signature; //RDONLY
+		u32 sb_inode_size; /* RDONLY, on-disk inode size in bytes */
 		s64	sb_no_of_sectors;//RDONLY
 		s64	sb_no_of_blocks;//RDONLY
 		s64	sb_no_of_used_blocks; /* FS view*/
@@ -222,9 +235,16 @@ struct nvfuse_superblock {
 		struct control_plane_context *sb_control_plane_ctx;
 		s32 sb_control_plane_buffer_size;
 
+		/* seeds of the per-thread allocation hints, see nvfuse_get_alloc_hint() */
 		s32 sb_last_allocated_ino;
 		s32 sb_last_allocated_bgid;
 		s32 sb_last_allocated_bgid_by_ino;
+		rte_atomic32_t sb_alloc_hint_seq; /* threads that took a hint */
+		s32 sb_alloc_hint_gen; /* mount generation of the hints */
+
+		rte_rwlock_t sb_ns_lock; /* namespace lock, see nvfuse_lock() */
+		rte_rwlock_t sb_inode_rwlock[NVFUSE_INODE_RWLOCK_NUM]; /* see nvfuse_inode_read_lock() */
+		rte_spinlock_t sb_flush_lock; /* one flusher of dirty buffers at a time */
 
 		struct io_target *target;
 
@@ -237,8 +257,11 @@ struct nvfuse_superblock {
 		/* inode context cache */
 		struct nvfuse_ictx_manager *sb_ictxc;
 
-		struct nvfuse_file_table *sb_file_table; /* INCLUDING FINE GRAINED LOCK */
-		//pthread_mutex_t sb_file_table_lock; /* COARSE LOCK */
+		struct nvfuse_file_table **sb_file_table; /* chunks, INCLUDING FINE GRAINED LOCK */
+		rte_spinlock_t sb_file_table_lock; /* free list and table growth */
+		s32 sb_file_table_free; /* head of free fd list, -1 if empty */
+		s32 sb_file_table_size; /* fds backed by allocated chunks */
+		s32 sb_file_table_max; /* max open files */
 
 		struct timeval sb_last_update;	/* SUPER BLOCK in memory UPDATE TIME */
 		struct timeval sb_sync_time; /* LAST SYNC TIME */
@@ -255,6 +278,19 @@ struct nvfuse_superblock {
 		struct list_head *sb_bg_search_ptr_for_inode;
 		struct list_head *sb_bg_search_ptr_for_data;
 
+		/* containers allocated ahead of need, not yet on sb_bg_list */
+		rte_spinlock_t sb_container_reserve_lock;
+		s32 sb_container_reserve[NVFUSE_CONTAINER_RESERVE_MAX];
+		s32 sb_container_reserve_count;
+		s32 sb_container_reserve_inflight; /* async requests out to the primary */
+		s32 sb_container_reserve_target; /* grows when a burst drains the reserve */
+		s32 sb_container_reserve_exhausted; /* the primary has no more containers */
+
+		/* inode contexts holding a block reservation window */
+		rte_spinlock_t sb_rsv_lock;
+		struct list_head sb_rsv_list;
+		s64 sb_rsv_blocks; /* blocks reserved but not yet handed to a file */
+
 		s32 sb_is_primary_process;
 
 		struct timeval sb_time_start;
@@ -273,8 +309,6 @@ struct nvfuse_superblock {
 		struct spdk_mempool *bh_mempool;
 		/* buffer cache mempool */
 		struct spdk_mempool *bc_mempool; /* allocated for primary core */
-		/* bptree mempool */
-		struct spdk_mempool *bp_mempool[BP_MEMPOOL_NUM];
 		/* bg node mempool*/
 		struct spdk_mempool *bg_mempool; /* allocated for primary core */
 		/* io job mempool */
@@ -282,6 +316,27 @@ struct nvfuse_superblock {
 	};
 };
 
+/*
+ * allocation hints of a thread. threads sharing a handle get different home
+ * ranges of block groups to take inodes and blocks from, so that concurrent
+ * writers rarely meet on the same bitmaps and keep their files contiguous.
+ * a thread spills over into the following groups once its home is full.
+ */
+struct nvfuse_alloc_hint {
+	struct nvfuse_superblock *sb; /* superblock the hint was taken from */
+	s32 gen; /* sb_alloc_hint_gen at that time */
+	s32 last_allocated_ino;
+	s32 last_allocated_bgid;
+	s32 last_allocated_bgid_by_ino;
+	u32 home_start; /* home block groups [home_start, home_end) */
+	u32 home_end;
+};
+
+static inline s32 nvfuse_bg_in_alloc_home(struct nvfuse_alloc_hint *hint, u32 bg_id)
+{
+	return bg_id >= hint->home_start && bg_id < hint->home_end;
+}
+
 /* bg node used by bg management for multiple data plane module */
 struct bg_node {
 	struct list_head list;
@@ -295,6 +350,7 @@ struct nvfuse_file_table {
 	s32	used;
 	nvfuse_off_t rwoffset;
 	s32 flags;
+	s32 next_free; /* next fd in the free list */
 };
 
 #define MAX_FILES_PER_DIR (0x7FFFFFFF)
@@ -314,13 +370,8 @@ struct nvfuse_dir_entry {
 #define NVFUSE_DBITMAP_OFFSET     (NVFUSE_IBITMAP_OFFSET+NVFUSE_IBITMAP_SIZE)
 #define NVFUSE_DBITMAP_SIZE       1
 
-#if (INODE_ENTRY_SIZE == 4096)
+/* same for both inode sizes; compact inodes only shrink the inode table */
 #define NVFUSE_INODE_PER_BG			(NVFUSE_IBITMAP_SIZE * CLUSTER_SIZE * 8 / 8)
-#elif (INODE_ENTRY_SIZE == 128)
-#define NVFUSE_INODE_PER_BG			(NVFUSE_IBITMAP_SIZE * CLUSTER_SIZE * 8 / 2)
-#else
-
-#endif
 
 #define NVFUSE_DATA_PER_BG			(NVFUSE_IBITMAP_SIZE * CLUSTER_SIZE * 8)
 
@@ -399,13 +450,21 @@ struct nvfuse_inode {
 	u16	i_gid;		/* Low 16 bits of Group Id */ //54
 	u16	i_uid;		/* Low 16 bits of Owner Uid */	//56
 	u16	i_mode;		/* File mode */ //58
-	u16	resv0;	//60
+	u16	i_flags;	/* NVFUSE_INODE_FL_* */ //60
 	u32 resv1[1]; //64
 	u32 i_blocks[TINDIRECT_BLOCKS + 1]; //120
-	u32 resv2[1]; // 124
-	u8	xattr[3972]; //4096
+	u32 i_xattr_blk; /* xattr block of compact inodes */ // 124
+	u8	xattr[3972]; //4096, absent in compact inodes
 };
 
+/* inode flags */
+#define NVFUSE_INODE_FL_INLINE_DATA	(1 << 0) /* file data is kept in xattr[] */
+
+/* inline data shares the inline xattr area, which compact inodes leave unused */
+#define NVFUSE_INLINE_DATA(inode) ((inode)->xattr)
+#define NVFUSE_INLINE_DATA_MAX(sb) (NVFUSE_INODE_SIZE(sb) - offsetof(struct nvfuse_inode, xattr))
+#define NVFUSE_INODE_HAS_INLINE_DATA(inode) ((inode)->i_flags & NVFUSE_INODE_FL_INLINE_DATA)
+
 /* state bit position*/
 #define INODE_STATE_NEW		(0) /* newly allocated. inode has zeroed data */
 #define INODE_STATE_CLEAN	(1) /* clean inode loaded in memory */
@@ -421,6 +480,8 @@ struct nvfuse_inode_ctx {
 
 	struct nvfuse_inode *ictx_inode;
 	struct nvfuse_buffer_head *ictx_bh; /* point out ot its buffer head */
+	/* private copy of a compact inode, whose itable block is shared with neighbours */
+	u64 ictx_icopy[INODE_ENTRY_SIZE_SMALL / sizeof(u64)];
 
 	struct list_head ictx_meta_bh_head;
 	struct list_head ictx_data_bh_head;
@@ -436,6 +497,15 @@ struct nvfuse_inode_ctx {
 	s32 ictx_type;
 	s32 ictx_status;
 	s32 ictx_ref;
+	s32 ictx_shard; /* shard whose lists hold this ictx */
+	s32 ictx_referenced; /* hit since the last replacement scan */
+
+	/* contiguous blocks set aside for the next appends of a regular file */
+	struct list_head ictx_rsv_list; /* on sb_rsv_list while a window is held */
+	pbno_t ictx_rsv_start;
+	u32 ictx_rsv_len; /* blocks left in the window */
+	u32 ictx_rsv_size; /* size of the next window */
+	pbno_t ictx_rsv_goal; /* block following the last allocation */
 };
 
 #if NVFUSE_OS == NVFUSE_OS_WINDOWS
@@ -462,6 +532,9 @@ struct nvfuse_params {
 	s32 need_format;
 	s32 need_mount;
 	s32 preallocation;
+	s32 inode_size; /* on-disk inode size for format (4096 or 256) */
+	s32 max_open_files; /* fd table limit, 0 for MAX_OPEN_FILE */
+	s32 shared_cache_size; /* in MB units, 0 for no shared cache */
 };
 
 /* IPC Ring Queue Name */
@@ -470,6 +543,21 @@ struct nvfuse_params {
 /* Mempool Name */
 #define NVFUSE_MSG_POOL_NAME "MSG_POOL"
 
+/* requests in flight on one channel, see nvfuse_ipc_send_async() */
+#define NVFUSE_IPC_MAX_OUTSTANDING 32
+
+union nvfuse_ipc_msg;
+typedef void (*nvfuse_ipc_cb_t)(union nvfuse_ipc_msg *ipc_msg, void *arg);
+
+struct nvfuse_ipc_req {
+	union nvfuse_ipc_msg *msg; /* NULL if the slot is free */
+	nvfuse_ipc_cb_t cb; /* NULL if someone waits on it */
+	void *arg;
+	u64 start_tsc;
+	s32 opcode;
+	s32 done;
+};
+
 struct nvfuse_ipc_context {
 	/* IPC Ring Queue Name */
 	char _SEC_2_PRI[SPDK_NUM_CORES][64];
@@ -494,6 +582,11 @@ struct nvfuse_ipc_context {
 	struct rte_mempool *stat_pool[MAX_NUM_STAT];
 
 	int my_channel_id;
+
+	/* outstanding requests to the primary, the slot index is the request id */
+	rte_spinlock_t req_lock;
+	rte_atomic32_t req_count;
+	struct nvfuse_ipc_req req[NVFUSE_IPC_MAX_OUTSTANDING];
 };
 
 struct nvfuse_handle {
@@ -512,14 +605,20 @@ struct nvfuse_handle {
 
 /* inode management functions */
 inode_t nvfuse_alloc_new_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx);
+u32 nvfuse_alloc_new_inodes(struct nvfuse_superblock *sb, inode_t *inos, u32 count);
 struct nvfuse_inode_ctx *nvfuse_read_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, inode_t ino);
 void nvfuse_release_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s32 dirty);
 s32 nvfuse_relocate_delete_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx);
 void nvfuse_mark_inode_dirty(struct nvfuse_inode_ctx *ictx);
 void nvfuse_free_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s64 size);
+#ifdef NVFUSE_USE_INLINE_DATA
+s32 nvfuse_inline_data_fits(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s64 end);
+s32 nvfuse_spill_inline_data(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx);
+#endif
 u32 nvfuse_find_free_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 last_ino);
 void nvfuse_print_inode(struct nvfuse_inode *inode, s8 *str);
 u32 nvfuse_scan_free_ibitmap(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 bg_id, u32 hint_free_inode);
+u32 nvfuse_scan_free_ibitmap_bulk(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 bg_id, u32 hint_free_inode, inode_t *inos, u32 count);
 void nvfuse_inc_free_inodes(struct nvfuse_superblock *sb, inode_t ino);
 void nvfuse_dec_free_inodes(struct nvfuse_superblock *sb, inode_t ino);
 void nvfuse_release_ibitmap(struct nvfuse_superblock *sb, u32 bg_id, u32 ino);
@@ -527,6 +626,7 @@ s32 nvfuse_inode_has_dirty(struct nvfuse_inode_ctx *ictx);
 
 /* Directory Indexing Functions */
 s32 nvfuse_set_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename, u32 offset);
+s32 nvfuse_set_dir_indexing_bulk(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 **filenames, u32 *offsets, s32 count);
 s32 nvfuse_get_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename, bitem_t *offset);
 s32 nvfuse_get_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename, bitem_t *offset);
 s32 nvfuse_del_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename);
@@ -562,7 +662,19 @@ u64 get_no_of_sectors(s32 fd);
 s32 nvfuse_dir(struct nvfuse_handle *nvh);
 s32 nvfuse_allocate_open_file_table(struct nvfuse_superblock *sb);
 s32 nvfuse_init_file_table(struct nvfuse_superblock *sb);
-struct nvfuse_file_table *nvfuse_get_file_table(struct nvfuse_superblock *sb, s32 fid);
+
+/* NULL for an fd outside the table, which was never handed out */
+static inline struct nvfuse_file_table *nvfuse_get_file_table(struct nvfuse_superblock *sb, s32 fid)
+{
+	if (fid < 0 || fid >= sb->sb_file_table_size)
+		return NULL;
+
+	/* pairs with the barrier before sb_file_table_size grows */
+	rte_smp_rmb();
+	return sb->sb_file_table[fid >> NVFUSE_FILE_TABLE_CHUNK_BITS] +
+	       (fid & (NVFUSE_FILE_TABLE_CHUNK - 1));
+}
+
 void nvfuse_close_file_table(struct nvfuse_superblock *sb, s32 fid);
 s32 nvfuse_chmod(struct nvfuse_handle *nvh, inode_t par_ino, s8 *filename, mode_t mode);
 s32 nvfuse_path_open(struct nvfuse_handle *nvh, s8 *path, s8 *filename, struct nvfuse_dir_entry *get);
@@ -587,15 +699,35 @@ s32 nvfuse_format(struct nvfuse_handle *nvh);
 void nvfuse_check_flush_dirty(struct nvfuse_superblock *sb, s32 force);
 
 /* Lock Management Functions */
-#define nvfuse_lock()
-#define nvfuse_unlock()
-
-void nvfuse_lock_init(void);
-void nvfuse_lock_exit(void);
+/*
+ * a handle may be shared by threads. namespace updates (create, remove, rename)
+ * hold the namespace lock exclusively and lookups hold it shared. file data
+ * is guarded by the inode rwlock, which is always taken before the inode
+ * context and never while holding one.
+ */
+#define nvfuse_lock(sb)			rte_rwlock_write_lock(&(sb)->sb_ns_lock)
+#define nvfuse_unlock(sb)		rte_rwlock_write_unlock(&(sb)->sb_ns_lock)
+#define nvfuse_lock_shared(sb)		rte_rwlock_read_lock(&(sb)->sb_ns_lock)
+#define nvfuse_unlock_shared(sb)	rte_rwlock_read_unlock(&(sb)->sb_ns_lock)
+
+static inline rte_rwlock_t *nvfuse_inode_rwlock(struct nvfuse_superblock *sb, inode_t ino)
+{
+	return &sb->sb_inode_rwlock[ino & (NVFUSE_INODE_RWLOCK_NUM - 1)];
+}
+
+#define nvfuse_inode_read_lock(sb, ino)		rte_rwlock_read_lock(nvfuse_inode_rwlock(sb, ino))
+#define nvfuse_inode_read_unlock(sb, ino)	rte_rwlock_read_unlock(nvfuse_inode_rwlock(sb, ino))
+#define nvfuse_inode_write_lock(sb, ino)	rte_rwlock_write_lock(nvfuse_inode_rwlock(sb, ino))
+#define nvfuse_inode_write_unlock(sb, ino)	rte_rwlock_write_unlock(nvfuse_inode_rwlock(sb, ino))
+
+void nvfuse_init_locks(struct nvfuse_superblock *sb);
+struct nvfuse_alloc_hint *nvfuse_get_alloc_hint(struct nvfuse_superblock *sb);
 
 /* container management function */
 s32 nvfuse_alloc_container_from_primary_process(struct nvfuse_handle *nvh, s32 type);
 s32 nvfuse_dealloc_container_from_primary_process(struct nvfuse_superblock *sb, u32 bg_id);
+s32 nvfuse_get_reserved_container(struct nvfuse_superblock *sb);
+void nvfuse_release_container_reserve(struct nvfuse_superblock *sb);
 u32 nvfuse_get_curr_bg_id(struct nvfuse_superblock *sb, s32 is_inode);
 u32 nvfuse_get_next_bg_id(struct nvfuse_superblock *sb, s32 is_inode);
 void nvfuse_move_curr_bg_id(struct nvfuse_superblock *sb, s32 bg_id, s32 is_inode);
@@ -603,6 +735,7 @@ void nvfuse_send_health_check_msg_to_primary_process(struct nvfuse_handle *nvh);
 
 void nvfuse_add_bg(struct nvfuse_superblock *sb, u32 bg_id);
 s32 nvfuse_remove_bg(struct nvfuse_superblock *sb, u32 bg_id);
+s32 nvfuse_has_bg(struct nvfuse_superblock *sb, u32 bg_id);
 void nvfuse_update_sb_with_bd_info(struct nvfuse_superblock *sb, s32 bg_id, s32 is_root_container, s32 increament);
 
 s32 nvfuse_check_free_inode(struct nvfuse_superblock *sb);
@@ -610,6 +743,12 @@ s32 nvfuse_check_free_block(struct nvfuse_superblock *sb, u32 num_blocks);
 
 /* block management functions */
 u32 nvfuse_alloc_dbitmap(struct nvfuse_superblock *sb, u32 bg_id, u32 *alloc_blks, u32 num_blocks);
+u32 nvfuse_alloc_dbitmap_run(struct nvfuse_superblock *sb, u32 bg_id, u32 goal, u32 *start,
+			     u32 num_blocks);
+u32 nvfuse_alloc_rsv_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			    u32 *alloc_blks, u32 num_blocks);
+void nvfuse_release_rsv_window(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx);
+void nvfuse_release_rsv_windows(struct nvfuse_superblock *sb);
 u32 nvfuse_free_dbitmap(struct nvfuse_superblock *sb, u32 bg_id, nvfuse_loff_t offset, u32 count);
 void nvfuse_dec_free_blocks(struct nvfuse_superblock *sb, u32 blockno, u32 cnt);
 void nvfuse_inc_free_blocks(struct nvfuse_superblock *sb, u32 blockno, u32 cnt);
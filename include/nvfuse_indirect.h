@@ -24,7 +24,7 @@ void nvfuse_truncate_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ct
 
 u32 nvfuse_alloc_free_block(struct nvfuse_superblock *sb, struct nvfuse_inode *inode,
 			    u32 *alloc_blks, u32 num_blocks);
-u32 nvfuse_alloc_free_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, u32 *blocks,
+u32 nvfuse_alloc_free_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 *blocks,
 			     u32 num_indirect_blocks, u32 num_blocks, u32 *direct_map, s32 *error);
 void nvfuse_return_free_blocks(struct nvfuse_superblock *sb, u32 *blks, u32 num);
 s32 nvfuse_get_block(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s32 lblock,
@@ -15,6 +15,7 @@
 
 #include "rte_spinlock.h"
 #include "rte_atomic.h"
+#include "rte_memory.h"
 #include "nvfuse_config.h"
 #include "nvfuse_core.h"
 #include "nvfuse_buffer_cache.h"
@@ -23,20 +24,41 @@
 #ifndef __NVFUSE_INODE_CACHE_H__
 #define __NVFUSE_INODE_CACHE_H__
 
-/* inode context cache manager */
-struct nvfuse_ictx_manager {
-	rte_spinlock_t ictxc_lock; /* spin lock */
+/*
+ * inode context cache shard. an ictx hashed with inode number (ino) lives in
+ * shard ino % NVFUSE_ICTXC_SHARD_NUM, so lookups of different inodes mostly
+ * touch different locks and cache lines.
+ */
+struct nvfuse_ictx_shard {
+	rte_spinlock_t ictxc_lock; /* protects lists, hash and counters */
 	struct list_head ictxc_list[BUFFER_TYPE_NUM];
-	struct hlist_head ictxc_hash[HASH_NUM + 1]; /* regular hash list and unused hash list (1) */
+	/* regular hash list and unused hash list (1) */
+	struct hlist_head ictxc_hash[NVFUSE_ICTXC_HASH_NUM + 1];
 
-	void *ictx_buf; /* allocated by spdk_zmalloc() */
 	s32 ictxc_list_count[BUFFER_TYPE_NUM];
-	s32 ictxc_hash_count[HASH_NUM + 1];
+	s32 ictxc_hash_count[NVFUSE_ICTXC_HASH_NUM + 1];
 	s32 ictxc_cache_size;
-	u64 ictxc_cache_ref;
-	u64 ictxc_cache_hit;
+	u64 ictxc_cache_miss; /* lookups not served by the lockless path */
+} __rte_cache_aligned;
+
+/* inode context cache manager */
+struct nvfuse_ictx_manager {
+	struct nvfuse_ictx_shard ictxc_shard[NVFUSE_ICTXC_SHARD_NUM];
+
+	void *ictx_buf; /* allocated by spdk_zmalloc() */
+	rte_atomic32_t ictxc_next_shard; /* shard tried first by nvfuse_alloc_ictx() */
 };
 
+static inline s32 nvfuse_ictx_shard_id(inode_t ino)
+{
+	return ino & (NVFUSE_ICTXC_SHARD_NUM - 1);
+}
+
+static inline s32 nvfuse_ictx_hash_id(inode_t ino)
+{
+	return (ino / NVFUSE_ICTXC_SHARD_NUM) % NVFUSE_ICTXC_HASH_NUM;
+}
+
 /*
  * Inode Context (ictx) Prototype Declration
  */
@@ -65,12 +87,13 @@ void nvfuse_move_ictx_list(struct nvfuse_superblock *sb,
 void nvfuse_init_ictx(struct nvfuse_inode_ctx *ictx, inode_t ino);
 /* lookup ictx structure with inode number (ino) */
 struct nvfuse_inode_ctx *nvfuse_ictx_hash_lookup(struct nvfuse_ictx_manager *ictxc, inode_t ino);
-/* replace ictx buffer in list */
-struct nvfuse_inode_ctx *nvfuse_replace_ictx(struct nvfuse_superblock *sb);
+/* replace ictx buffer in list, starting from the given shard */
+struct nvfuse_inode_ctx *nvfuse_replace_ictx(struct nvfuse_superblock *sb, s32 shard_id);
 
 /* debug ictx list */
 void nvfuse_print_ictx_list(struct nvfuse_superblock *sb, s32 type);
 void nvfuse_print_ictx_list_count(struct nvfuse_superblock *sb, s32 type);
+s32 nvfuse_get_ictx_list_count(struct nvfuse_superblock *sb, s32 type);
 void nvfuse_print_ictx(struct nvfuse_inode_ctx *ictx);
 s8 *nvfuse_decode_ictx_status(struct nvfuse_inode_ctx *ictx);
 
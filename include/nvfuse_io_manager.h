@@ -84,6 +84,7 @@ struct io_job {
 	int complete;
 	void *tag1;
 	void *tag2;
+	void *iov_tag[REACTOR_BUFFER_IOVS]; /* owner of each iov when tag1 is NULL */
 };
 
 #define SPDK_QUEUE_SYNC 0
@@ -41,6 +41,8 @@ enum ipc_opcode {
 	CONTAINER_RESERVATION_RELEASE_CPL,
 	HEALTH_CHECK_REQ,
 	HEALTH_CHECK_CPL,
+	BUFFER_STAT_REQ,
+	BUFFER_STAT_CPL,
 	UNKOWN_CPL,
 	NUM_IPC_MSGS,
 };
@@ -133,6 +135,25 @@ struct buffer_free_cpl {
 	s32 tag2;
 };
 
+/* periodic buffer usage report of a data plane */
+struct buffer_stat_req {
+	s32 opcode;
+	s32 chan_id;
+	s32 buffer_size; // pages held by the data plane
+	s32 misses; // since the last report
+	s32 interval_ms; // since the last report
+	s32 tag1;
+	s32 tag2;
+};
+
+struct buffer_stat_cpl {
+	s32 opcode;
+	s32 chan_id;
+	s32 ret; // pages the data plane is asked to give back
+	s32 tag1;
+	s32 tag2;
+};
+
 /* type of container allocation */
 
 enum container_alloc_type {
@@ -245,6 +266,8 @@ union nvfuse_ipc_msg {
 	struct buffer_alloc_cpl buffer_alloc_cpl;
 	struct buffer_free_req buffer_free_req;
 	struct buffer_free_cpl buffer_free_cpl;
+	struct buffer_stat_req buffer_stat_req;
+	struct buffer_stat_cpl buffer_stat_cpl;
 	struct container_alloc_req container_alloc_req;
 	struct container_alloc_cpl container_alloc_cpl;
 	struct container_release_req container_release_req;
@@ -302,6 +325,8 @@ void nvfuse_make_buffer_alloc_req(struct buffer_alloc_req *req);
 void nvfuse_make_buffer_alloc_cpl(struct buffer_alloc_cpl *req, s32 ret);
 void nvfuse_make_buffer_free_req(struct buffer_free_req *req);
 void nvfuse_make_buffer_free_cpl(struct buffer_free_cpl *req, s32 ret);
+void nvfuse_make_buffer_stat_req(struct buffer_stat_req *req);
+void nvfuse_make_buffer_stat_cpl(struct buffer_stat_cpl *req, s32 ret);
 void nvfuse_make_container_alloc_req(struct container_alloc_req *req);
 void nvfuse_make_container_alloc_cpl(struct container_alloc_cpl *req, s32 ret);
 void nvfuse_make_container_release_req(struct container_release_req *req);
@@ -317,12 +342,23 @@ void nvfuse_make_health_check_cpl(struct health_check_cpl *req, s32 ret);
 
 void nvfuse_try_ring_dequeue(struct rte_ring *recv_ring, union nvfuse_ipc_msg **msg, int timeout);
 
-int nvfuse_send_msg_to_primary_core(struct rte_ring *send_ring, struct rte_ring *recv_ring,
-				    union nvfuse_ipc_msg *ipc_msg, s32 opcode);
+int nvfuse_send_msg_to_primary_core(struct nvfuse_handle *nvh, union nvfuse_ipc_msg *ipc_msg,
+				    s32 opcode);
+s32 nvfuse_ipc_send_async(struct nvfuse_handle *nvh, union nvfuse_ipc_msg *ipc_msg, s32 opcode,
+			  nvfuse_ipc_cb_t cb, void *arg);
+s32 nvfuse_ipc_poll(struct nvfuse_handle *nvh);
+s32 nvfuse_ipc_wait(struct nvfuse_handle *nvh, s32 req_id);
+void nvfuse_ipc_forget(struct nvfuse_handle *nvh, void *arg);
 
 s32 nvfuse_send_app_unregister_req(struct nvfuse_handle *nvh, s32 destroy_containers);
 s32 nvfuse_send_alloc_buffer_req(struct nvfuse_handle *nvh, s32 buffer_size);
+s32 nvfuse_send_alloc_buffer_req_async(struct nvfuse_handle *nvh, s32 buffer_size,
+				       nvfuse_ipc_cb_t cb, void *arg);
 s32 nvfuse_send_dealloc_buffer_req(struct nvfuse_handle *nvh, s32 buffer_size);
+s32 nvfuse_send_dealloc_buffer_req_async(struct nvfuse_handle *nvh, s32 buffer_size,
+		nvfuse_ipc_cb_t cb, void *arg);
+s32 nvfuse_send_buffer_stat_req_async(struct nvfuse_handle *nvh, s32 misses, s32 interval_ms,
+				      nvfuse_ipc_cb_t cb, void *arg);
 
 int nvfuse_get_channel_id(struct nvfuse_ipc_context *ipc_ctx);
 int nvfuse_put_channel_id(struct nvfuse_ipc_context *ipc_ctx, int channel);
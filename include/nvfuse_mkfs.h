@@ -15,7 +15,8 @@
 #ifndef __NVFUSE_MKFS__
 #define __NVFUSE_MKFS__
 
-void nvfuse_make_bg_descriptor(struct nvfuse_bg_descriptor *bd, u32 bg_id, u32 bg_start, u32 bg_size);
+void nvfuse_make_bg_descriptor(struct nvfuse_bg_descriptor *bd, u32 bg_id, u32 bg_start, u32 bg_size,
+			       u32 inode_size);
 s32 nvfuse_alloc_root_inode_direct(struct io_target *target,
 		struct nvfuse_superblock *sb_disk, u32 bg_id, u32 bg_size);
 
@@ -36,6 +36,10 @@ struct io_target {
 	struct spdk_poller	*reset_timer;
 	struct rte_mempool *task_pool;
 	struct rte_mempool *req_pool;
+
+	/* called for each completed write, e.g., to invalidate cached copies */
+	void (*write_notify)(void *arg, uint64_t offset, uint32_t bytes);
+	void *write_notify_arg;
 };
 
 struct reactor_task {
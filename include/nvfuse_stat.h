@@ -76,8 +76,8 @@ struct perf_stat_ipc {
 	u32 lcore_id;
 	u32 sequence;
 
-	u64 total_tsc[22];
-	u64 total_count[22];
+	u64 total_tsc[24]; /* by ipc opcode */
+	u64 total_count[24];
 };
 
 struct perf_stat_rusage {
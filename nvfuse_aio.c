@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <assert.h>
 
 #include "nvfuse_io_manager.h"
@@ -39,17 +40,20 @@ s32 nvfuse_aio_queue_init(struct io_target *target, struct nvfuse_aio_queue *aio
 	memset(aioq, 0x00, sizeof(struct nvfuse_aio_queue));
 
 	/* Submission Queue */
-	INIT_LIST_HEAD(&aioq->asq_head);
+	aioq->asq_head = 0;
 	aioq->asq_cur_depth = 0;
 	aioq->asq_max_depth = max_depth > NVFUSE_MAX_AIO_DEPTH ? NVFUSE_MAX_AIO_DEPTH : max_depth;
 
 	/* Completion Queue */
-	INIT_LIST_HEAD(&aioq->acq_head);
+	aioq->acq_head = 0;
 	aioq->acq_cur_depth = 0;
 	aioq->acq_max_depth = max_depth > NVFUSE_MAX_AIO_DEPTH ? NVFUSE_MAX_AIO_DEPTH : max_depth;
+	aioq->inflight = 0;
 
 	aioq->max_completions = NVFUSE_MAX_AIO_COMPLETION;
 	aioq->total_bio_job_count = 0;
+	aioq->bio_job_issued = 0;
+	INIT_LIST_HEAD(&aioq->abuf_head);
 
 	/* FIXME: how to consider the fact that a large logical request is split into several small requests. */
 	aioq->task = reactor_alloc_task(target, aioq->asq_max_depth * 2);
@@ -123,7 +127,7 @@ s32 nvfuse_aio_queue_enqueue(struct nvfuse_aio_queue *aioq, struct nvfuse_aio_re
 			//dprintf_info(AIO, " aio submission queue is full %d\n", aioq->asq_cur_depth);
 			return -1;
 		}
-		list_add_tail(&areq->list, &aioq->asq_head);
+		aioq->asq[(aioq->asq_head + aioq->asq_cur_depth) % aioq->asq_max_depth] = areq;
 		aioq->asq_cur_depth++;
 		break;
 	case NVFUSE_COMPLETION_QUEUE:
@@ -131,7 +135,7 @@ s32 nvfuse_aio_queue_enqueue(struct nvfuse_aio_queue *aioq, struct nvfuse_aio_re
 			//dprintf_info(AIO, " aio completion queue is full %d\n", aioq->acq_cur_depth);
 			return -1;
 		}
-		list_add_tail(&areq->list, &aioq->acq_head);
+		aioq->acq[(aioq->acq_head + aioq->acq_cur_depth) % aioq->acq_max_depth] = areq;
 		aioq->acq_cur_depth++;
 		break;
 	default:
@@ -142,40 +146,66 @@ s32 nvfuse_aio_queue_enqueue(struct nvfuse_aio_queue *aioq, struct nvfuse_aio_re
 	return 0;
 }
 
-s32 nvfuse_aio_queue_dequeue(struct nvfuse_aio_queue *aioq, struct nvfuse_aio_req *areq, s32 qtype)
+/* removes and returns the oldest request of the queue, NULL if it is empty */
+struct nvfuse_aio_req *nvfuse_aio_queue_dequeue(struct nvfuse_aio_queue *aioq, s32 qtype)
 {
+	struct nvfuse_aio_req *areq;
+
 	switch (qtype) {
 	case NVFUSE_SUBMISSION_QUEUE:
-		list_del(&areq->list);
+		if (aioq->asq_cur_depth == 0)
+			return NULL;
+		areq = aioq->asq[aioq->asq_head];
+		aioq->asq_head = (aioq->asq_head + 1) % aioq->asq_max_depth;
 		aioq->asq_cur_depth--;
-		assert(aioq->asq_cur_depth >= 0);
 		break;
 	case NVFUSE_COMPLETION_QUEUE:
-		list_del(&areq->list);
+		if (aioq->acq_cur_depth == 0)
+			return NULL;
+		areq = aioq->acq[aioq->acq_head];
+		aioq->acq_head = (aioq->acq_head + 1) % aioq->acq_max_depth;
 		aioq->acq_cur_depth--;
-		assert(aioq->acq_cur_depth >= 0);
+		/* reaped */
+		aioq->inflight--;
 		break;
 	default:
 		dprintf_error(AIO, " invalid aio qtype = %d", qtype);
-		return -1;
+		return NULL;
 	}
 
-	return 0;
+	return areq;
 }
 
-s32 nvfuse_aio_queue_move(struct nvfuse_aio_queue *aioq, struct nvfuse_aio_req *areq, s32 qtype)
+/*
+ * every request ends here. its latency is recorded, then it is handed to
+ * its callback when the poller runs in callback mode or queued for
+ * nvfuse_io_getevents() otherwise.
+ */
+static void nvfuse_aio_finish(struct nvfuse_aio_queue *aioq, struct nvfuse_aio_req *areq)
 {
-	int res;
-
-	res = nvfuse_aio_queue_dequeue(aioq, areq, areq->status);
-	if (res)
-		return res;
+#ifdef SPDK_ENABLED
+	struct perf_stat_aio *stat = aioq->aio_stat;
+	u64 latency_tsc;
+
+	areq->complete_tsc = spdk_get_ticks();
+	latency_tsc = areq->complete_tsc - areq->submit_tsc;
+	stat->aio_lat_total_tsc += latency_tsc;
+	stat->aio_lat_total_count++;
+	stat->aio_lat_min_tsc = MIN(latency_tsc, stat->aio_lat_min_tsc);
+	stat->aio_lat_max_tsc = MAX(latency_tsc, stat->aio_lat_max_tsc);
+	stat->aio_total_size += areq->bytes;
+#endif
 
-	res = nvfuse_aio_queue_enqueue(aioq, areq, qtype);
-	if (res)
-		return res;
+	/* past the budget of the poll it waits for the next one */
+	if (aioq->cpl_callback && aioq->polling && aioq->cb_count < aioq->cb_max) {
+		aioq->cb_count++;
+		aioq->inflight--;
+		areq->actx_cb_func(areq);
+		return;
+	}
 
-	return 0;
+	/* cannot fail, submission keeps inflight within the ring */
+	nvfuse_aio_queue_enqueue(aioq, areq, NVFUSE_COMPLETION_QUEUE);
 }
 
 void nvfuse_aio_gen_dev_cpls(void *arg)
@@ -185,8 +215,7 @@ void nvfuse_aio_gen_dev_cpls(void *arg)
 	/* casting */
 	areq = (struct nvfuse_aio_req *)arg;
 
-	/* move areq to comletion queue*/
-	nvfuse_aio_queue_enqueue(areq->queue, areq, NVFUSE_COMPLETION_QUEUE);
+	nvfuse_aio_finish(areq->queue, areq);
 }
 
 s32 nvfuse_aio_gen_dev_reqs(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq, struct nvfuse_aio_req *areq)
@@ -223,8 +252,9 @@ s32 nvfuse_aio_gen_dev_reqs(struct nvfuse_superblock *sb, struct nvfuse_aio_queu
 #endif
 
 		pblk = nvfuse_fgetblk(sb, areq->fid, lblk, max_blocks, &num_alloc);
-		if (pblk < 0) {
+		if (pblk <= 0) {
 			dprintf_error(AIO, " Error: nvfuse_fgetblk() lblk = %x\n", lblk);
+			nvfuse_release_jobs(sb, jobs, areq->bio_job_count);
 			return -1;
 		}
 
@@ -265,18 +295,378 @@ s32 nvfuse_aio_gen_dev_reqs(struct nvfuse_superblock *sb, struct nvfuse_aio_queu
 	res = reactor_submit_reqs(sb->target, aioq->task, jobs, job_count);
 	if (res < 0) {
 		dprintf_error(AIO, " Error: aio submit error = %d\n", res);
+		nvfuse_release_jobs(sb, jobs, job_count);
 		return -1;
 	}
 
 	aioq->total_bio_job_count += job_count;
+	aioq->bio_job_issued += job_count;
 	areq->bio_job_count = job_count;
 
 	return 0;
 }
 
-s32 nvfuse_aio_queue_submission(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq, struct nvfuse_aio_req *areq)
+/*
+ * device completion of a buffered read job, on the reactor core. the blocks
+ * are released to other users as soon as the data is in the cache pages.
+ */
+#ifndef NVFUSE_USE_CEPH_SPDK
+static void nvfuse_aio_buffered_bio_cb(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+#else
+static void nvfuse_aio_buffered_bio_cb(struct spdk_bdev_io *bdev_io, enum spdk_bdev_io_status success,
+				       void *cb_arg)
+#endif
+{
+	struct io_job *job = (struct io_job *)cb_arg;
+	s32 i;
+
+	/* the data goes before the flag */
+	rte_smp_wmb();
+	for (i = 0; i < job->iovcnt; i++)
+		((struct nvfuse_buffer_cache *)job->iov_tag[i])->bc_locked = 0;
+
+	reactor_bio_cb(bdev_io, success, cb_arg);
+}
+
+/* copies out the blocks a buffered read brought into the cache and unpins them */
+static void nvfuse_aio_buffered_complete(struct nvfuse_superblock *sb, struct nvfuse_aio_req *areq)
+{
+	struct nvfuse_buffer_head *bh, *temp;
+	struct nvfuse_buffer_cache *bc;
+	s64 start, end;
+
+	list_for_each_entry_safe(bh, temp, &areq->bh_head, bh_aio_list) {
+		list_del(&bh->bh_aio_list);
+		bc = bh->bh_bc;
+
+		SPINLOCK_LOCK(&bc->bc_lock);
+		bc->bc_locked = 0;
+		/* a block invalidated meanwhile (bc_pno cleared) is not cached */
+		if (!areq->error && bc->bc_pno) {
+			/* bytes written since the read landed are already in the page */
+			bc->bc_valid_start = 0;
+			bc->bc_valid_end = 0;
+			bc->bc_load = 1;
+
+			start = MAX(areq->offset, (s64)bc->bc_lbno * CLUSTER_SIZE);
+			end = MIN(areq->offset + areq->result, (s64)(bc->bc_lbno + 1) * CLUSTER_SIZE);
+			memcpy((s8 *)areq->buf + (start - areq->offset),
+			       bh->bh_buf + (start & (CLUSTER_SIZE - 1)), end - start);
+		}
+		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+	}
+
+	nvfuse_aio_gen_dev_cpls(areq);
+}
+
+/* true if a buffered read of this queue is still filling a block of areq */
+static s32 nvfuse_aio_buffered_overlaps(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq,
+					struct nvfuse_aio_req *areq)
+{
+	struct nvfuse_aio_req *inflight;
+	inode_t ino = nvfuse_get_file_table(sb, areq->fid)->ino;
+	s64 first = areq->offset / CLUSTER_SIZE;
+	s64 last = (areq->offset + areq->bytes - 1) / CLUSTER_SIZE;
+
+	list_for_each_entry(inflight, &aioq->abuf_head, list) {
+		if (nvfuse_get_file_table(sb, inflight->fid)->ino != ino)
+			continue;
+		if (inflight->offset / CLUSTER_SIZE <= last &&
+		    (inflight->offset + inflight->bytes - 1) / CLUSTER_SIZE >= first)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * buffered aio goes through the buffer cache. a write completes once the
+ * data is copied in, like write(2). a read copies what is cached and sends
+ * device jobs for the rest straight into the cache pages, so the caller can
+ * keep submitting while they are in flight. misses on physically adjacent
+ * blocks share a job.
+ */
+static s32 nvfuse_aio_buffered_submission(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq,
+		struct nvfuse_aio_req *areq)
+{
+	struct nvfuse_superblock *sb = &nvh->nvh_sb;
+	struct nvfuse_buffer_head *bh;
+	struct io_job *jobs[AIO_MAX_QDEPTH];
+	struct io_job *job = NULL;
+	s32 nr_bh = 0;
+	s32 job_count = 0;
+	s32 res;
+
+	areq->queue = aioq;
+	areq->bio_job_count = 0;
+	INIT_LIST_HEAD(&areq->bh_head);
+
+	if (NVFUSE_SIZE_TO_BLK(areq->bytes) >= AIO_MAX_QDEPTH) {
+		dprintf_error(AIO, " buffered aio request is too large (%ld bytes)\n", (long)areq->bytes);
+		return -1;
+	}
+
+	/* our own blocks in flight are only completed by this thread */
+	while (nvfuse_aio_buffered_overlaps(sb, aioq, areq))
+		nvfuse_aio_wait_dev_cpls(sb, aioq, 1, MIN(aioq->total_bio_job_count, AIO_MAX_QDEPTH));
+
+	if (areq->opcode == WRITE) {
+		res = nvfuse_writefile(nvh, areq->fid, areq->buf, areq->bytes, areq->offset);
+		if (res != areq->bytes)
+			areq->error = -1;
+		areq->result = res < 0 ? 0 : res;
+		nvfuse_aio_gen_dev_cpls(areq);
+		return 0;
+	}
+
+	res = nvfuse_gather_bh(sb, areq->fid, areq->buf, areq->bytes, areq->offset,
+			       &areq->bh_head, &nr_bh);
+	if (res < 0) {
+		areq->error = -1;
+		areq->result = 0;
+		nvfuse_aio_buffered_complete(sb, areq);
+		return 0;
+	}
+	areq->result = res;
+
+	if (nr_bh == 0) {
+		nvfuse_aio_buffered_complete(sb, areq);
+		return 0;
+	}
+
+	res = nvfuse_make_jobs(sb, jobs, nr_bh);
+	if (res < 0) {
+		/* the missed blocks are pinned and locked, let them go */
+		areq->error = -1;
+		areq->result = 0;
+		nvfuse_aio_buffered_complete(sb, areq);
+		return 0;
+	}
+
+	list_for_each_entry(bh, &areq->bh_head, bh_aio_list) {
+		long pos = (long)bh->bh_bc->bc_pno * CLUSTER_SIZE;
+
+		if (job && job->iovcnt < REACTOR_BUFFER_IOVS && job->offset + job->bytes == pos) {
+			job->iov[job->iovcnt].iov_base = bh->bh_buf;
+			job->iov[job->iovcnt].iov_len = CLUSTER_SIZE;
+			job->iov_tag[job->iovcnt] = bh->bh_bc;
+			job->iovcnt++;
+			job->bytes += CLUSTER_SIZE;
+			continue;
+		}
+
+		job = jobs[job_count++];
+		job->offset = pos;
+		job->bytes = CLUSTER_SIZE;
+		job->ret = 0;
+		job->req_type = SPDK_BDEV_IO_TYPE_READ;
+		job->buf = bh->bh_buf;
+
+		job->iov[0].iov_base = bh->bh_buf;
+		job->iov[0].iov_len = CLUSTER_SIZE;
+		job->iov_tag[0] = bh->bh_bc;
+		job->iovcnt = 1;
+		job->cb = nvfuse_aio_buffered_bio_cb;
+
+		job->complete = 0;
+		job->tag1 = (void *)areq;
+	}
+
+	if (job_count < nr_bh)
+		nvfuse_release_jobs(sb, jobs + job_count, nr_bh - job_count);
+
+	res = reactor_submit_reqs(sb->target, aioq->task, jobs, job_count);
+	if (res < 0) {
+		dprintf_error(AIO, " Error: aio submit error = %d\n", res);
+		nvfuse_release_jobs(sb, jobs, job_count);
+		areq->error = -1;
+		areq->result = 0;
+		nvfuse_aio_buffered_complete(sb, areq);
+		return 0;
+	}
+
+	aioq->total_bio_job_count += job_count;
+	aioq->bio_job_issued += job_count;
+	areq->bio_job_count = job_count;
+	list_add_tail(&areq->list, &aioq->abuf_head);
+
+	return 0;
+}
+
+static s32 nvfuse_aio_submit_jobs(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq,
+				  struct io_job **jobs, s32 job_count)
+{
+	s32 res;
+
+	res = reactor_submit_reqs(sb->target, aioq->task, jobs, job_count);
+	if (res < 0) {
+		dprintf_error(AIO, " Error: aio submit error = %d\n", res);
+		return -1;
+	}
+
+	aioq->total_bio_job_count += job_count;
+	aioq->bio_job_issued += job_count;
+
+	return 0;
+}
+
+/* completes a direct request that got no device job with an error */
+static void nvfuse_aio_fail_req(struct nvfuse_aio_req *areq)
+{
+	areq->error = -1;
+	areq->result = 0;
+	areq->bio_job_count = 0;
+	nvfuse_aio_gen_dev_cpls(areq);
+}
+
+/*
+ * fails every request with a part in jobs that could not be submitted.
+ * requests never span two batches and the iovs of one request are
+ * adjacent, so each request is met as one run of iov_tag.
+ */
+static void nvfuse_aio_fail_merged_jobs(struct nvfuse_superblock *sb, struct io_job **jobs,
+					s32 job_count)
+{
+	void *prev = NULL;
+	s32 i, j;
+
+	for (i = 0; i < job_count; i++) {
+		for (j = 0; j < jobs[i]->iovcnt; j++) {
+			if (jobs[i]->iov_tag[j] == prev)
+				continue;
+			prev = jobs[i]->iov_tag[j];
+			nvfuse_aio_fail_req((struct nvfuse_aio_req *)prev);
+		}
+	}
+
+	nvfuse_release_jobs(sb, jobs, job_count);
+}
+
+static void nvfuse_aio_submit_merged_jobs(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq,
+		struct io_job **jobs, s32 job_count)
+{
+	if (nvfuse_aio_submit_jobs(sb, aioq, jobs, job_count))
+		nvfuse_aio_fail_merged_jobs(sb, jobs, job_count);
+}
+
+/*
+ * builds the jobs of all direct requests in the submission ring at once.
+ * an extent that starts on the device where the last job ends is added to
+ * that job as one more iov, so that small sequential requests, e.g., from a
+ * log writer, go out as a single command. such jobs leave tag1 NULL and
+ * record the request of each iov in iov_tag; a request counts each job it
+ * has a part in.
+ *
+ * a request is mapped in full before it joins the batch, and a batch is
+ * only sent between requests. a request that cannot be mapped or given
+ * jobs thus completes with an error without touching the others.
+ */
+static s32 nvfuse_aio_gen_merged_reqs(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq)
+{
+	struct nvfuse_aio_req *areq;
+	struct io_job *jobs[AIO_MAX_QDEPTH];
+	struct io_job *spare[AIO_MAX_QDEPTH];
+	s32 ext_pblk[AIO_MAX_QDEPTH];
+	u32 ext_num[AIO_MAX_QDEPTH];
+	struct io_job *job = NULL;
+	s32 job_count = 0;
+	s32 nr_ext, nr_spare;
+	s32 req_type;
+	s32 i;
+
+	while ((areq = nvfuse_aio_queue_dequeue(aioq, NVFUSE_SUBMISSION_QUEUE)) != NULL) {
+		s64 start = areq->offset;
+		s64 length = areq->bytes;
+		s8 *buf = areq->buf;
+
+		INIT_LIST_HEAD(&areq->bh_head);
+		areq->bio_job_count = 0;
+		req_type = (areq->opcode == READ) ? SPDK_BDEV_IO_TYPE_READ : SPDK_BDEV_IO_TYPE_WRITE;
+
+		/* block 0 is never a data block, it stands for a hole */
+		for (nr_ext = 0; length && nr_ext < AIO_MAX_QDEPTH; nr_ext++) {
+			ext_pblk[nr_ext] = nvfuse_fgetblk(sb, areq->fid, start / CLUSTER_SIZE,
+							  length / CLUSTER_SIZE, &ext_num[nr_ext]);
+			if (ext_pblk[nr_ext] <= 0) {
+				dprintf_error(AIO, " Error: nvfuse_fgetblk() lblk = %lx\n", (long)(start / CLUSTER_SIZE));
+				break;
+			}
+			start += (s64)ext_num[nr_ext] * CLUSTER_SIZE;
+			length -= (s64)ext_num[nr_ext] * CLUSTER_SIZE;
+		}
+		if (length) {
+			nvfuse_aio_fail_req(areq);
+			continue;
+		}
+
+		/* room for a new job per extent, so the batch is sent before, not within */
+		if (job_count + nr_ext > AIO_MAX_QDEPTH) {
+			nvfuse_aio_submit_merged_jobs(sb, aioq, jobs, job_count);
+			job_count = 0;
+			job = NULL;
+		}
+
+		if (nvfuse_make_jobs(sb, spare, nr_ext) < 0) {
+			nvfuse_aio_fail_req(areq);
+			continue;
+		}
+		nr_spare = nr_ext;
+
+		for (i = 0; i < nr_ext; i++) {
+			long bytes = (long)ext_num[i] * CLUSTER_SIZE;
+
+			if (job && job->req_type == req_type && job->iovcnt < REACTOR_BUFFER_IOVS &&
+			    job->offset + job->bytes == (long)ext_pblk[i] * CLUSTER_SIZE &&
+			    job->bytes + bytes <= NVFUSE_AIO_MERGE_MAX_BYTES) {
+				if (job->iov_tag[job->iovcnt - 1] != areq)
+					areq->bio_job_count++;
+			} else {
+				job = spare[--nr_spare];
+				job->offset = (long)ext_pblk[i] * CLUSTER_SIZE;
+				job->bytes = 0;
+				job->ret = 0;
+				job->req_type = req_type;
+				job->buf = buf;
+				job->iovcnt = 0;
+				job->cb = reactor_bio_cb;
+				job->complete = 0;
+				job->tag1 = NULL;
+
+				jobs[job_count++] = job;
+				areq->bio_job_count++;
+			}
+
+			job->iov[job->iovcnt].iov_base = buf;
+			job->iov[job->iovcnt].iov_len = bytes;
+			job->iov_tag[job->iovcnt] = areq;
+			job->iovcnt++;
+			job->bytes += bytes;
+
+			buf += bytes;
+		}
+
+		if (nr_spare)
+			nvfuse_release_jobs(sb, spare, nr_spare);
+	}
+
+	if (job_count)
+		nvfuse_aio_submit_merged_jobs(sb, aioq, jobs, job_count);
+
+	return 0;
+}
+
+/* sends the requests held back in the submission ring of a merging queue */
+s32 nvfuse_aio_queue_commit(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq)
+{
+	if (aioq->asq_cur_depth == 0)
+		return 0;
+
+	return nvfuse_aio_gen_merged_reqs(&nvh->nvh_sb, aioq);
+}
+
+static s32 __nvfuse_aio_queue_submission(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq,
+		struct nvfuse_aio_req *areq)
 {
-	struct list_head *head, *ptr, *temp;
 	u32 bytes;
 	s32 res;
 
@@ -287,7 +677,14 @@ s32 nvfuse_aio_queue_submission(struct nvfuse_handle *nvh, struct nvfuse_aio_que
 
 	//dprintf_info(AIO, " aio ready queue : fd = %d offset = %ld, bytes = %ld, op = %d\n", areq->fid, (long)areq->offset,
 	//	(long)areq->bytes, areq->opcode);
-	assert(nvfuse_is_directio(&nvh->nvh_sb, areq->fid));
+	if (nvfuse_get_file_table(&nvh->nvh_sb, areq->fid) == NULL) {
+		dprintf_error(AIO, " invalid fd = %d\n", areq->fid);
+		return -1;
+	}
+
+	if (!nvfuse_is_directio(&nvh->nvh_sb, areq->fid))
+		return nvfuse_aio_buffered_submission(nvh, aioq, areq);
+
 	if (areq->opcode == READ) {
 		bytes = nvfuse_readfile_aio_directio(nvh, areq->fid, areq->buf, areq->bytes,
 							 areq->offset);
@@ -296,43 +693,85 @@ s32 nvfuse_aio_queue_submission(struct nvfuse_handle *nvh, struct nvfuse_aio_que
 				areq->offset);
 	}
 
-	if (bytes == areq->bytes) {
-		/* move to submission queue */
-		nvfuse_aio_queue_enqueue(aioq, areq, NVFUSE_SUBMISSION_QUEUE);
-	} else {
+	if (bytes != areq->bytes) {
 		dprintf_error(AIO, " submission error\n ");
 		return -1;
 	}
+	areq->result = bytes;
 
-	/* collect buffer */
-	head = &aioq->asq_head;
-	list_for_each_safe(ptr, temp, head) {
-		areq = (struct nvfuse_aio_req *)list_entry(ptr, struct nvfuse_aio_req, list);
+	/* a full ring is committed to make room */
+	if (aioq->asq_cur_depth == aioq->asq_max_depth && nvfuse_aio_queue_commit(nvh, aioq))
+		return -1;
+
+	/* move to submission queue */
+	nvfuse_aio_queue_enqueue(aioq, areq, NVFUSE_SUBMISSION_QUEUE);
+
+	if (aioq->merge)
+		return 0;
 
+	/* collect buffer */
+	while ((areq = nvfuse_aio_queue_dequeue(aioq, NVFUSE_SUBMISSION_QUEUE)) != NULL) {
 		INIT_LIST_HEAD(&areq->bh_head);
 		//dprintf_info(AIO, " aio submission queue : fd = %d offset = %ld, bytes = %ld, op = %d\n", areq->fid, (long)areq->offset,
 		//	(long)areq->bytes, areq->opcode);
 
-		assert(nvfuse_is_directio(&nvh->nvh_sb, areq->fid));
 		/* direct i/o without buffer head */
 		areq->bio_job_count = NVFUSE_SIZE_TO_BLK(areq->bytes);
 		res = nvfuse_aio_gen_dev_reqs(&nvh->nvh_sb, aioq, areq);
 		if (res < 0)
-			return -1;
-
-		nvfuse_aio_queue_dequeue(aioq, areq, NVFUSE_SUBMISSION_QUEUE);
+			nvfuse_aio_fail_req(areq);
 	}
 
 	return 0;
 }
 
+/*
+ * accepts areq unless acq_max_depth requests are already submitted and not
+ * yet reaped, in which case it returns -EAGAIN; the caller reaps some and
+ * tries again. a request that is accepted, even one that fails later on,
+ * completes through the completion ring or its callback.
+ */
+s32 nvfuse_aio_queue_submission(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq, struct nvfuse_aio_req *areq)
+{
+	s32 res;
+
+	if (aioq->inflight >= aioq->acq_max_depth)
+		return -EAGAIN;
+
+	aioq->inflight++;
+	res = __nvfuse_aio_queue_submission(nvh, aioq, areq);
+	if (res)
+		aioq->inflight--;
+
+	return res;
+}
+
+static void nvfuse_aio_job_done(struct nvfuse_superblock *sb, struct nvfuse_aio_req *areq, size_t ret)
+{
+	areq->bio_job_count--;
+
+	if (ret != 0) {
+		dprintf_error(AIO, " IO error \n");
+		areq->error = -1;
+	}
+
+	if (areq->bio_job_count == 0) {
+		if (list_empty(&areq->bh_head)) {
+			nvfuse_aio_gen_dev_cpls(areq);
+		} else {
+			/* buffered read */
+			list_del(&areq->list);
+			nvfuse_aio_buffered_complete(sb, areq);
+		}
+	}
+}
+
 s32 nvfuse_aio_wait_dev_cpls(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq, s32 min_nr, s32 nr)
 {
-	struct nvfuse_aio_req *areq;
 	struct io_job *job;
 	struct io_job *jobs[AIO_MAX_QDEPTH];
 	int cc = 0; // completion count
-	int i;
+	int i, j;
 
 	cc = reactor_cq_get_reqs(aioq->task, jobs, min_nr, nr);
 
@@ -343,19 +782,17 @@ s32 nvfuse_aio_wait_dev_cpls(struct nvfuse_superblock *sb, struct nvfuse_aio_que
 
 		job->complete = 1;
 
-		areq = (struct nvfuse_aio_req *)job->tag1;
-		areq->bio_job_count--;
-
-		if (job->ret != 0) {
-			dprintf_error(AIO, " IO error \n");
-			areq->error = -1;
+		if (job->tag1) {
+			nvfuse_aio_job_done(sb, (struct nvfuse_aio_req *)job->tag1, job->ret);
+			continue;
 		}
 
-		if (areq->bio_job_count == 0) {
-			assert(nvfuse_is_directio(sb, areq->fid));
-			nvfuse_aio_gen_dev_cpls(areq);
+		/* merged job: each request once, its iovs are adjacent */
+		for (j = 0; j < job->iovcnt; j++) {
+			if (j && job->iov_tag[j] == job->iov_tag[j - 1])
+				continue;
+			nvfuse_aio_job_done(sb, (struct nvfuse_aio_req *)job->iov_tag[j], job->ret);
 		}
-
 	}
 
 	nvfuse_release_jobs(sb, jobs, cc);
@@ -365,10 +802,9 @@ s32 nvfuse_aio_wait_dev_cpls(struct nvfuse_superblock *sb, struct nvfuse_aio_que
 
 s32 nvfuse_aio_queue_completion(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq)
 {
-	struct list_head *head, *ptr, *temp;
 	struct nvfuse_aio_req *areq;
 
-	while (aioq->acq_cur_depth < aioq->max_completions) {
+	while (aioq->acq_cur_depth < aioq->max_completions && aioq->total_bio_job_count) {
 		/* busy wating here*/
 #if (NVFUSE_OS==NVFUSE_OS_LINUX)
 		nvfuse_aio_wait_dev_cpls(sb, aioq, aioq->total_bio_job_count, aioq->total_bio_job_count);
@@ -377,23 +813,12 @@ s32 nvfuse_aio_queue_completion(struct nvfuse_superblock *sb, struct nvfuse_aio_
 
 	//dprintf_info(AIO, " completion queue depth = %d", aioq->acq_cur_depth);
 
-	head = &aioq->acq_head;
-	/* copy user data to buffer cache */
-	list_for_each_safe(ptr, temp, head) {
-		areq = (struct nvfuse_aio_req *)list_entry(ptr, struct nvfuse_aio_req, list);
-
+	while ((areq = nvfuse_aio_queue_dequeue(aioq, NVFUSE_COMPLETION_QUEUE)) != NULL) {
 		assert(areq->bio_job_count == 0);
-		nvfuse_aio_queue_dequeue(aioq, areq, areq->status);
 
 		if (areq->error) {
 			dprintf_error(AIO, " aio I/O error happened with fid = %d offset = %ld\n", areq->fid,
 			       (long)areq->offset);
-
-		} else {
-			//dprintf_info(AIO, " aio was done successfully with fid = %d offset = %ld\n", areq->fid, (long)areq->offset);
-#ifdef SPDK_ENABLED
-			areq->complete_tsc = spdk_get_ticks();
-#endif
 		}
 
 		areq->actx_cb_func(areq);
@@ -409,50 +834,83 @@ s32 nvfuse_io_submit(struct nvfuse_handle *nvh, struct nvfuse_aio_queue *aioq, s
 
 	for (idx = 0; idx < nr; idx++) {
 		ret = nvfuse_aio_queue_submission(nvh, aioq, list[idx]);
+		if (ret == -EAGAIN) {
+			dprintf_error(AIO, " Error: more than %d requests in flight\n", aioq->acq_max_depth);
+			break;
+		}
 		if (ret) {
 			dprintf_error(AIO, " Error: queue submission\n");
 		}
 	}
 
+	if (nvfuse_aio_queue_commit(nvh, aioq)) {
+		dprintf_error(AIO, " Error: queue commit\n");
+		ret = -1;
+	}
+
 	return ret;
 }
 
 s32 nvfuse_io_getevents(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq, s32 min_nr, s32 nr, struct nvfuse_aio_req **list)
 {
-	struct list_head *head, *ptr, *temp;
 	struct nvfuse_aio_req *areq;
 	s32 idx = 0;
 
 #if (NVFUSE_OS==NVFUSE_OS_LINUX)
-	nvfuse_aio_wait_dev_cpls(sb, aioq, min_nr, nr);
+	/* buffered requests served by the cache are completed already */
+	while (aioq->acq_cur_depth < min_nr && aioq->total_bio_job_count)
+		nvfuse_aio_wait_dev_cpls(sb, aioq, 1, MIN(aioq->total_bio_job_count, AIO_MAX_QDEPTH));
 #endif
 
 	//dprintf_info(AIO, " completion queue depth = %d\n", aioq->acq_cur_depth);
 
-	head = &aioq->acq_head;
-	/* copy user data to buffer cache */
-	list_for_each_safe(ptr, temp, head) {
-		areq = (struct nvfuse_aio_req *)list_entry(ptr, struct nvfuse_aio_req, list);
-
+	while (idx < nr && (areq = nvfuse_aio_queue_dequeue(aioq, NVFUSE_COMPLETION_QUEUE)) != NULL) {
 		assert(areq->bio_job_count == 0);
-		nvfuse_aio_queue_dequeue(aioq, areq, areq->status);
 
 		if (areq->error) {
 			dprintf_error(AIO, " aio I/O error happened with fid = %d offset = %ld\n", areq->fid,
 			       (long)areq->offset);
-
-		} else {
-			//dprintf_info(AIO, " aio was done successfully with fid = %d offset = %ld\n", areq->fid, (long)areq->offset);
-#ifdef SPDK_ENABLED
-			areq->complete_tsc = spdk_get_ticks();
-#endif
 		}
 
 		list[idx++] = areq;
-		if (idx == nr)
-			break;
 	}
 
 	return idx;
 }
 
+/*
+ * completion poller for queues in callback mode. calls actx_cb_func for
+ * requests completed at submission (e.g., buffered cache hits) and for
+ * each request whose device jobs complete, waiting until min_nr requests
+ * are done. with min_nr 0 it only reaps what is ready. at most max_nr
+ * callbacks are made; requests completed beyond that are queued for the
+ * next poll. returns the number of requests completed.
+ */
+s32 nvfuse_aio_poll(struct nvfuse_superblock *sb, struct nvfuse_aio_queue *aioq, s32 min_nr,
+		    s32 max_nr)
+{
+	struct nvfuse_aio_req *areq;
+
+	aioq->polling = 1;
+	aioq->cb_count = 0;
+	aioq->cb_max = max_nr;
+
+	for (;;) {
+		while (aioq->cb_count < max_nr &&
+		       (areq = nvfuse_aio_queue_dequeue(aioq, NVFUSE_COMPLETION_QUEUE)) != NULL) {
+			aioq->cb_count++;
+			areq->actx_cb_func(areq);
+		}
+
+		if (aioq->cb_count >= max_nr || !aioq->total_bio_job_count)
+			break;
+		if (aioq->cb_count >= min_nr && !reactor_cq_size(aioq->task))
+			break;
+
+		nvfuse_aio_wait_dev_cpls(sb, aioq, 1, MIN(aioq->total_bio_job_count, AIO_MAX_QDEPTH));
+	}
+
+	aioq->polling = 0;
+
+	return aioq->cb_count;
+}
@@ -66,6 +66,9 @@ void nvfuse_core_usage(char *cmd)
 	printf("\t-a: application name (e.g., rocksdb, fiebenc, redis)\n");
 	printf("\t-p: pre-allocation of buffers and containers\n");
 	printf("\t-o: configuration file (e.g., TransportID PCIe 01:00.0) \n");
+	printf("\t-i: inode size in bytes for format (4096 (default) or 256)\n");
+	printf("\t-n: max open files (default %d)\n", MAX_OPEN_FILE);
+	printf("\t-r: shared read cache size (in MB) for primary process\n");
 }
 
 void nvfuse_core_usage_example(char *cmd)
@@ -76,7 +79,7 @@ void nvfuse_core_usage_example(char *cmd)
 
 s8 *nvfuse_get_core_options()
 {
-	return "a:c:fmq:s:b:p:o:";
+	return "a:c:fmq:s:b:p:o:i:n:r:";
 }
 
 s32 nvfuse_is_core_option(s8 option)
@@ -205,6 +208,9 @@ s32 nvfuse_parse_args(int argc, char **argv, struct nvfuse_params *params)
 	s32 dev_size = 0; /* in MB units */
 	s32 buffer_size = 0; /* in MB units */
 	s32 preallocation = 0;
+	s32 inode_size = INODE_ENTRY_SIZE;
+	s32 max_open_files = MAX_OPEN_FILE;
+	s32 shared_cache_size = 0; /* in MB units */
 	s8 op;
 	s8 *cmd;
 
@@ -259,6 +265,28 @@ s32 nvfuse_parse_args(int argc, char **argv, struct nvfuse_params *params)
 		case 'p':
 			preallocation = 1;
 			break;
+		case 'i':
+			inode_size = atoi(optarg);
+			if (inode_size != INODE_ENTRY_SIZE && inode_size != INODE_ENTRY_SIZE_SMALL) {
+				dprintf_error(API, "Invalid inode size = %d (%d or %d)\n", inode_size,
+					      INODE_ENTRY_SIZE, INODE_ENTRY_SIZE_SMALL);
+				goto PRINT_USAGE;
+			}
+			break;
+		case 'n':
+			max_open_files = atoi(optarg);
+			if (max_open_files <= START_OPEN_FILE) {
+				dprintf_error(API, "Invalid max open files = %d\n", max_open_files);
+				goto PRINT_USAGE;
+			}
+			break;
+		case 'r':
+			shared_cache_size = atoi(optarg);
+			if (shared_cache_size <= 0) {
+				dprintf_error(API, "Invalid shared cache size = %d MB\n", shared_cache_size);
+				goto PRINT_USAGE;
+			}
+			break;
 		default:
 			dprintf_error(API, " Invalid op code %c in getopt()\n", op);
 			goto PRINT_USAGE;
@@ -288,6 +316,9 @@ s32 nvfuse_parse_args(int argc, char **argv, struct nvfuse_params *params)
 	params->need_format		= need_format; /* no allowed for secondary processes */
 	params->need_mount		= need_mount;
 	params->preallocation	= preallocation;
+	params->inode_size		= inode_size;
+	params->max_open_files	= max_open_files;
+	params->shared_cache_size	= shared_cache_size;
 #if 1
 	dprintf_info(API, " appname = %s\n", params->appname);
 	dprintf_info(API, " cpu core mask = %x\n", params->cpu_core_mask);
@@ -296,6 +327,9 @@ s32 nvfuse_parse_args(int argc, char **argv, struct nvfuse_params *params)
 	dprintf_info(API, " need format = %d \n", params->need_format);
 	dprintf_info(API, " need mount = %d \n", params->need_mount);
 	dprintf_info(API, " preallocation = %d \n", params->preallocation);
+	dprintf_info(API, " inode size = %d \n", params->inode_size);
+	dprintf_info(API, " max open files = %d \n", params->max_open_files);
+	dprintf_info(API, " shared cache size = %d MB\n", params->shared_cache_size);
 	dprintf_info(API, " config file = %s \n", params->config_file);
 #endif
 
@@ -794,22 +828,22 @@ s32 nvfuse_openfile_path(struct nvfuse_handle *nvh, const char *path, int flags,
 
 	memset(&dir_entry, 0x00, sizeof(struct nvfuse_dir_entry));
 
-	nvfuse_lock();
+	sb = nvfuse_read_super(nvh);
 
-	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
-	if (res < 0)
-		return res;
+	nvfuse_lock(sb);
 
-	if (dir_entry.d_ino == 0) {
+	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
+	if (res < 0) {
+		fd = res;
+	} else if (dir_entry.d_ino == 0) {
 		printf(" %s: invalid path\n", __FUNCTION__);
 		fd = -1;
 	} else {
-		sb = nvfuse_read_super(nvh);
 		fd = nvfuse_openfile(sb, dir_entry.d_ino, filename, flags, mode);
-		nvfuse_release_super(sb);
 	}
 
-	nvfuse_unlock();
+	nvfuse_unlock(sb);
+	nvfuse_release_super(sb);
 
 	return fd;
 }
@@ -852,69 +886,204 @@ s32 nvfuse_openfile_ino(struct nvfuse_superblock *sb, inode_t ino, s32 flags)
 s32 nvfuse_closefile(struct nvfuse_handle *nvh, s32 fid)
 {
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	struct nvfuse_file_table *ft;
+	struct nvfuse_inode_ctx *ictx;
 
 	/* FIXME: flush bhs and bcs related to inode that fd points out */
 
+	ft = nvfuse_get_file_table(sb, fid);
+	if (ft == NULL) {
+		nvfuse_release_super(sb);
+		return NVFUSE_ERROR;
+	}
+
+	if (ft->used && ft->ino && (ft->flags & (O_WRONLY | O_RDWR | O_CREAT))) {
+		/* the appender is done, hand the rest of its window back */
+		nvfuse_inode_write_lock(sb, ft->ino);
+		ictx = nvfuse_read_inode(sb, NULL, ft->ino);
+		nvfuse_release_rsv_window(sb, ictx);
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		nvfuse_inode_write_unlock(sb, ft->ino);
+	}
+
 	nvfuse_close_file_table(sb, fid);
 	nvfuse_release_super(sb);
 
 	return NVFUSE_SUCCESS;
 }
 
-s32 nvfuse_readfile_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32 count,
-			 nvfuse_off_t roffset, s32 sync_read)
+/* position in a user iovec array */
+struct nvfuse_iov_iter {
+	const struct iovec *iov;
+	s32 iovcnt;
+	s32 idx;
+	size_t off;
+};
+
+static void nvfuse_iov_iter_init(struct nvfuse_iov_iter *it, const struct iovec *iov, s32 iovcnt)
+{
+	it->iov = iov;
+	it->iovcnt = iovcnt;
+	it->idx = 0;
+	it->off = 0;
+}
+
+/*
+ * copies len bytes between buf and the iovec array and advances the
+ * iterator. to_iov selects the direction; a NULL buf only advances.
+ */
+static void nvfuse_iov_iter_copy(struct nvfuse_iov_iter *it, void *data, u32 len, s32 to_iov)
+{
+	s8 *buf = (s8 *)data;
+
+	while (len && it->idx < it->iovcnt) {
+		const struct iovec *v = &it->iov[it->idx];
+		u32 chunk = MIN(len, v->iov_len - it->off);
+
+		if (buf) {
+			if (to_iov)
+				rte_memcpy((s8 *)v->iov_base + it->off, buf, chunk);
+			else
+				rte_memcpy(buf, (s8 *)v->iov_base + it->off, chunk);
+			buf += chunk;
+		}
+
+		len -= chunk;
+		it->off += chunk;
+		if (it->off == v->iov_len) {
+			it->idx++;
+			it->off = 0;
+		}
+	}
+}
+
+/* returns total bytes of the iovec array or -1 if it exceeds an s32 */
+static s32 nvfuse_iov_length(const struct iovec *iov, s32 iovcnt)
+{
+	s64 total = 0;
+	s32 i;
+
+	for (i = 0; i < iovcnt; i++) {
+		total += iov[i].iov_len;
+		if (total > INT32_MAX)
+			return -1;
+	}
+
+	return (s32)total;
+}
+
+s32 nvfuse_readv_core(struct nvfuse_superblock *sb, u32 fid, const struct iovec *iov, s32 iovcnt,
+		      nvfuse_off_t roffset, s32 sync_read)
 {
 	struct nvfuse_inode_ctx *ictx;
 	struct nvfuse_inode *inode;
 	struct nvfuse_buffer_head *bh;
 	struct nvfuse_file_table *of;
+	struct nvfuse_iov_iter it;
+	nvfuse_off_t pos;
+	inode_t ino;
+	s64 size;
 
-	s32 offset, remain, rcount = 0;
+	s32 offset, remain, count, rcount = 0;
 
-	of = nvfuse_get_file_table(sb, fid);
+	count = nvfuse_iov_length(iov, iovcnt);
+	if (count < 0)
+		return NVFUSE_ERROR;
 
-	ictx = nvfuse_read_inode(sb, NULL, of->ino);
-	inode = ictx->ictx_inode;
+	nvfuse_iov_iter_init(&it, iov, iovcnt);
+
+	of = nvfuse_get_file_table(sb, fid);
+	if (of == NULL)
+		return NVFUSE_ERROR;
+	ino = of->ino;
 
+	/* threads sharing an fd each read from their own position */
 #if NVFUSE_OS == NVFUSE_OS_WINDOWS
-	if (roffset) {
-		of->rwoffset = roffset;
-	}
+	pos = roffset ? roffset : of->rwoffset;
 #else
-	of->rwoffset = roffset;
+	pos = roffset;
 #endif
 
-	while (count > 0 && of->rwoffset < inode->i_size) {
+	/* readers of an inode run in parallel, writers wait */
+	nvfuse_inode_read_lock(sb, ino);
+
+	ictx = nvfuse_read_inode(sb, NULL, ino);
+	inode = ictx->ictx_inode;
+	size = inode->i_size;
+
+#ifdef NVFUSE_USE_INLINE_DATA
+	/* served from the cached inode block without data I/O */
+	if (NVFUSE_INODE_HAS_INLINE_DATA(inode)) {
+		if (count > 0 && pos < size) {
+			rcount = MIN(count, size - pos);
+			nvfuse_iov_iter_copy(&it, NVFUSE_INLINE_DATA(inode) + pos, rcount, 1);
+			pos += rcount;
+		}
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		goto RES;
+	}
+#endif
+
+	while (count > 0 && pos < size) {
+		if (ictx == NULL)
+			ictx = nvfuse_read_inode(sb, NULL, ino);
+
+		bh = nvfuse_get_bh(sb, ictx, ino, NVFUSE_SIZE_TO_BLK(pos), sync_read, NVFUSE_TYPE_DATA);
+
+		/* the context is held for the block lookup only, not for the copy */
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		ictx = NULL;
 
-		bh = nvfuse_get_bh(sb, ictx, inode->i_ino, NVFUSE_SIZE_TO_BLK(of->rwoffset), sync_read,
-				   NVFUSE_TYPE_DATA);
 		if (bh == NULL) {
 			dprintf_error(BUFFER, " read error \n");
 			goto RES;
 		}
 
-		offset = of->rwoffset & (CLUSTER_SIZE - 1);
+		offset = pos & (CLUSTER_SIZE - 1);
 		remain = CLUSTER_SIZE - offset;
 
 		if (remain > count)
 			remain = count;
 
-		if (sync_read)
-			rte_memcpy(buffer + rcount, &bh->bh_buf[offset], remain);
+		/* without sync read the block is only brought into the cache */
+		nvfuse_iov_iter_copy(&it, sync_read ? &bh->bh_buf[offset] : NULL, remain, 1);
 
 		rcount += remain;
-		of->rwoffset += remain;
+		pos += remain;
 		count -= remain;
 		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
 	}
 
+	if (ictx)
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+
 RES:
 	;
-	nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+	nvfuse_inode_read_unlock(sb, ino);
+
+	of->rwoffset = pos;
 
 	return rcount;
 }
 
+s32 nvfuse_readfile_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32 count,
+			 nvfuse_off_t roffset, s32 sync_read)
+{
+	struct iovec iov;
+
+	iov.iov_base = buffer;
+	iov.iov_len = count;
+
+	return nvfuse_readv_core(sb, fid, &iov, 1, roffset, sync_read);
+}
+
+/*
+ * prepares a direct read: checks the range against the file size and moves
+ * the file position. the data itself is transferred by the caller, either
+ * nvfuse_rwv_directio_core() or an aio request. a read across eof is cut
+ * short there, so it returns the bytes up to eof, and 0 at or past eof;
+ * the caller still transfers whole blocks.
+ */
 s32 nvfuse_readfile_directio_core(struct nvfuse_superblock *sb, u32 fid, s8 *buffer, s32 count,
 				  nvfuse_off_t roffset, s32 sync_read)
 {
@@ -924,6 +1093,8 @@ s32 nvfuse_readfile_directio_core(struct nvfuse_superblock *sb, u32 fid, s8 *buf
 	s32 rcount = 0;
 
 	of = nvfuse_get_file_table(sb, fid);
+	if (of == NULL)
+		return NVFUSE_ERROR;
 
 #if NVFUSE_OS == NVFUSE_OS_WINDOWS
 	if (roffset) {
@@ -941,15 +1112,13 @@ s32 nvfuse_readfile_directio_core(struct nvfuse_superblock *sb, u32 fid, s8 *buf
 
 	ictx = nvfuse_read_inode(sb, NULL, of->ino);
 	inode = ictx->ictx_inode;
-	if (inode->i_size < roffset + count) {
+	if (inode->i_size <= of->rwoffset) {
 		rcount = 0;
 		goto RET;
-	} else {
-		rcount = count;
 	}
 
-	of->rwoffset += count;
-	rcount = count;
+	rcount = MIN((s64)count, inode->i_size - of->rwoffset);
+	of->rwoffset += rcount;
 
 	if (of->rwoffset > of->size)
 		of->size = of->rwoffset;
@@ -966,12 +1135,111 @@ s32 nvfuse_readfile(struct nvfuse_handle *nvh, u32 fid, s8 *buffer, s32 count, n
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
 	s32 rcount;
 
-	rcount = nvfuse_readfile_core(sb, fid, buffer, count, roffset, READ);
+	if (nvfuse_is_directio(sb, fid)) {
+		struct iovec iov;
+
+		iov.iov_base = buffer;
+		iov.iov_len = count;
+		rcount = nvfuse_rwv_directio_core(sb, fid, &iov, 1, roffset, READ);
+	} else {
+		rcount = nvfuse_readfile_core(sb, fid, buffer, count, roffset, READ);
+	}
 
 	nvfuse_release_super(sb);
 	return rcount;
 }
 
+s32 nvfuse_readfile_lend(struct nvfuse_handle *nvh, u32 fid, nvfuse_off_t roffset, s32 count,
+			 struct iovec *iov, struct nvfuse_buffer_cache **pages, s32 max_pages)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	struct nvfuse_inode_ctx *ictx;
+	struct nvfuse_buffer_head *bh;
+	struct nvfuse_file_table *of;
+	nvfuse_off_t pos = roffset;
+	inode_t ino;
+	s64 size;
+	s32 offset, remain;
+	s32 nr_pages = 0;
+
+	of = nvfuse_get_file_table(sb, fid);
+	if (of == NULL) {
+		nvfuse_release_super(sb);
+		return NVFUSE_ERROR;
+	}
+	ino = of->ino;
+
+	nvfuse_inode_read_lock(sb, ino);
+
+	ictx = nvfuse_read_inode(sb, NULL, ino);
+	size = ictx->ictx_inode->i_size;
+
+#ifdef NVFUSE_USE_INLINE_DATA
+	if (NVFUSE_INODE_HAS_INLINE_DATA(ictx->ictx_inode)) {
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		nr_pages = NVFUSE_ERROR;
+		goto RES;
+	}
+#endif
+
+	while (count > 0 && pos < size && nr_pages < max_pages) {
+		if (ictx == NULL)
+			ictx = nvfuse_read_inode(sb, NULL, ino);
+
+		bh = nvfuse_get_bh(sb, ictx, ino, NVFUSE_SIZE_TO_BLK(pos), READ, NVFUSE_TYPE_DATA);
+
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		ictx = NULL;
+
+		if (bh == NULL) {
+			dprintf_error(BUFFER, " read error \n");
+			break;
+		}
+
+		offset = pos & (CLUSTER_SIZE - 1);
+		remain = CLUSTER_SIZE - offset;
+		if (remain > count)
+			remain = count;
+		if (remain > size - pos)
+			remain = size - pos;
+
+		/* the page outlives the buffer head until the caller gives it back */
+		nvfuse_pin_bc(bh->bh_bc);
+		pages[nr_pages] = bh->bh_bc;
+		iov[nr_pages].iov_base = &bh->bh_buf[offset];
+		iov[nr_pages].iov_len = remain;
+		nr_pages++;
+
+		pos += remain;
+		count -= remain;
+		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+	}
+
+	if (ictx)
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+
+	of->rwoffset = pos;
+
+RES:
+	;
+	nvfuse_inode_read_unlock(sb, ino);
+
+	nvfuse_release_super(sb);
+	return nr_pages;
+}
+
+void nvfuse_readfile_lend_release(struct nvfuse_handle *nvh, struct nvfuse_buffer_cache **pages,
+				  s32 nr_pages)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 i;
+
+	for (i = 0; i < nr_pages; i++)
+		nvfuse_unpin_bc(sb, pages[i]);
+
+	nvfuse_release_super(sb);
+}
+
 s32 nvfuse_readfile_aio(struct nvfuse_handle *nvh, u32 fid, s8 *buffer, s32 count,
 			nvfuse_off_t roffset)
 {
@@ -997,18 +1265,31 @@ s32 nvfuse_readfile_aio_directio(struct nvfuse_handle *nvh, u32 fid, s8 *buffer,
 }
 
 
-s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_buf, u32 count,
-			  nvfuse_off_t woffset)
+s32 nvfuse_writev_core(struct nvfuse_superblock *sb, s32 fid, const struct iovec *iov, s32 iovcnt,
+		       nvfuse_off_t woffset)
 {
 	struct nvfuse_inode_ctx *ictx;
 	struct nvfuse_inode *inode;
 	struct nvfuse_file_table *of;
 	struct nvfuse_buffer_head *bh = NULL;
+	struct nvfuse_iov_iter it;
 	u32 offset = 0, remain = 0, wcount = 0;
 	lbno_t lblock = 0;
+	s32 count;
 	int ret;
 
+	count = nvfuse_iov_length(iov, iovcnt);
+	if (count < 0)
+		return NVFUSE_ERROR;
+
+	nvfuse_iov_iter_init(&it, iov, iovcnt);
+
 	of = nvfuse_get_file_table(sb, fid);
+	if (of == NULL)
+		return NVFUSE_ERROR;
+
+	/* writers of an inode are serialized and exclude its readers */
+	nvfuse_inode_write_lock(sb, of->ino);
 
 #if NVFUSE_OS == NVFUSE_OS_WINDOWS
 	if (woffset) {
@@ -1023,6 +1304,32 @@ s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_
 		ictx = nvfuse_read_inode(sb, NULL, of->ino);
 		inode = ictx->ictx_inode;
 
+#ifdef NVFUSE_USE_INLINE_DATA
+		if (nvfuse_inline_data_fits(sb, inode, of->rwoffset + count)) {
+			inode->i_flags |= NVFUSE_INODE_FL_INLINE_DATA;
+			nvfuse_iov_iter_copy(&it, NVFUSE_INLINE_DATA(inode) + of->rwoffset, count, 0);
+
+			wcount += count;
+			of->rwoffset += count;
+			count = 0;
+
+			if (of->rwoffset > of->size)
+				of->size = of->rwoffset;
+
+			inode->i_type = NVFUSE_TYPE_FILE;
+			inode->i_size = of->size;
+
+			nvfuse_release_inode(sb, ictx, DIRTY);
+			break;
+		}
+
+		if (nvfuse_spill_inline_data(sb, ictx)) {
+			nvfuse_release_inode(sb, ictx, DIRTY);
+			wcount = NVFUSE_ERROR;
+			goto UNLOCK_INODE;
+		}
+#endif
+
 		lblock = NVFUSE_SIZE_TO_BLK(of->rwoffset);
 		offset = of->rwoffset & (CLUSTER_SIZE - 1);
 		remain = CLUSTER_SIZE - offset;
@@ -1034,17 +1341,31 @@ s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_
 					       1);
 			if (ret) {
 				dprintf_error(INODE, "data block allocation fails.");
-				return NVFUSE_ERROR;
+				nvfuse_release_inode(sb, ictx, DIRTY);
+				wcount = NVFUSE_ERROR;
+				goto UNLOCK_INODE;
 			}
 		}
 
-		/*read modify write or partial write */
-		if (remain != CLUSTER_SIZE)
-			bh = nvfuse_get_bh(sb, ictx, inode->i_ino, lblock, READ, NVFUSE_TYPE_DATA);
-		else
-			bh = nvfuse_get_bh(sb, ictx, inode->i_ino, lblock, WRITE, NVFUSE_TYPE_DATA);
+		bh = nvfuse_get_bh(sb, ictx, inode->i_ino, lblock, WRITE, NVFUSE_TYPE_DATA);
 
-		rte_memcpy(&bh->bh_buf[offset], user_buf + wcount, remain);
+		/* a partial write reads the block only if it cannot be deferred */
+		if (remain != CLUSTER_SIZE) {
+			s64 eof = inode->i_size - ((s64)lblock << CLUSTER_SIZE_BITS);
+
+			eof = MAX(0, MIN(eof, CLUSTER_SIZE));
+			if (nvfuse_prepare_write_bc(sb, bh->bh_bc, offset, remain, (u32)eof)) {
+				dprintf_error(BUFFER, " read error \n");
+				nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+				nvfuse_release_inode(sb, ictx, DIRTY);
+				wcount = NVFUSE_ERROR;
+				goto UNLOCK_INODE;
+			}
+		} else {
+			nvfuse_prepare_write_bc(sb, bh->bh_bc, 0, CLUSTER_SIZE, 0);
+		}
+
+		nvfuse_iov_iter_copy(&it, &bh->bh_buf[offset], remain, 0);
 
 		wcount += remain;
 		of->rwoffset += remain;
@@ -1075,134 +1396,513 @@ s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_
 		reactor_sync_flush(sb->target);
 	}
 
+UNLOCK_INODE:
+	nvfuse_inode_write_unlock(sb, of->ino);
+
 	return wcount;
 }
 
-s32 nvfuse_writefile_directio_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_buf,
-				   u32 count, nvfuse_off_t woffset)
+s32 nvfuse_writefile_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_buf, u32 count,
+			  nvfuse_off_t woffset)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)user_buf;
+	iov.iov_len = count;
+
+	return nvfuse_writev_core(sb, fid, &iov, 1, woffset);
+}
+
+/*
+ * allocates the blocks of a direct write that are not mapped yet and
+ * updates the file size and position. on failure, blocks allocated past
+ * eof are freed and neither the size nor the position moves. the caller
+ * holds the inode write lock.
+ */
+static s32 nvfuse_writefile_directio_locked(struct nvfuse_superblock *sb,
+		struct nvfuse_file_table *of, u32 count, nvfuse_off_t woffset)
 {
 	struct nvfuse_inode_ctx *ictx;
 	struct nvfuse_inode *inode;
-	struct nvfuse_file_table *of;
-	u32 wcount = 0;
+	nvfuse_off_t end;
+	s32 dirty = NVF_CLEAN;
 	int ret;
 
+#if NVFUSE_OS == NVFUSE_OS_WINDOWS
+	if (!woffset) {
+		woffset = of->rwoffset;
+	}
+#endif
+	end = woffset + count;
+
+	if (count % CLUSTER_SIZE) {
+		dprintf_error(API, "count (%d) is not aligned to 4KB.", count);
+		return 0;
+	}
+
+	ictx = nvfuse_read_inode(sb, NULL, of->ino);
+	inode = ictx->ictx_inode;
+
+#ifdef NVFUSE_USE_INLINE_DATA
+	/* direct I/O needs the data in blocks */
+	if (NVFUSE_INODE_HAS_INLINE_DATA(inode)) {
+		if (nvfuse_spill_inline_data(sb, ictx)) {
+			nvfuse_release_inode(sb, ictx, DIRTY);
+			return NVFUSE_ERROR;
+		}
+		dirty = DIRTY;
+	}
+#endif
+
+	if (count && inode->i_size < end) {
+		lbno_t lblk = NVFUSE_SIZE_TO_BLK(woffset);
+		lbno_t last = NVFUSE_SIZE_TO_BLK(end - 1) + 1;
+		u32 num_alloc;
+
+		/* mapped blocks are skipped, holes and blocks past eof are allocated */
+		while (lblk < last) {
+			ret = nvfuse_get_block(sb, ictx, lblk, last - lblk, &num_alloc, NULL, 1);
+			if (ret || !num_alloc) {
+				dprintf_error(INODE, "data block allocation fails.");
+				nvfuse_truncate_blocks(sb, ictx, inode->i_size);
+				nvfuse_release_inode(sb, ictx, DIRTY);
+				return NVFUSE_ERROR;
+			}
+			lblk += num_alloc;
+		}
+
+		inode->i_size = end;
+		assert(inode->i_size < MAX_FILE_SIZE);
+		nvfuse_release_inode(sb, ictx, DIRTY);
+	} else {
+		nvfuse_release_inode(sb, ictx, dirty);
+	}
+
+	of->rwoffset = end;
+
+	if (of->rwoffset > of->size)
+		of->size = of->rwoffset;
+
+	return count;
+}
+
+s32 nvfuse_writefile_directio_core(struct nvfuse_superblock *sb, s32 fid, const s8 *user_buf,
+				   u32 count, nvfuse_off_t woffset)
+{
+	struct nvfuse_file_table *of;
+	s32 wcount;
+
 	of = nvfuse_get_file_table(sb, fid);
+	if (of == NULL)
+		return NVFUSE_ERROR;
 
-#if NVFUSE_OS == NVFUSE_OS_WINDOWS
-	if (woffset) {
-		of->rwoffset = woffset;
+	nvfuse_inode_write_lock(sb, of->ino);
+	wcount = nvfuse_writefile_directio_locked(sb, of, count, woffset);
+	nvfuse_inode_write_unlock(sb, of->ino);
+
+	return wcount;
+}
+
+s32 nvfuse_writefile(struct nvfuse_handle *nvh, u32 fid, const s8 *user_buf, u32 count,
+		     nvfuse_off_t woffset)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 wcount;
+
+	if (nvfuse_is_directio(sb, fid)) {
+		struct iovec iov;
+
+		iov.iov_base = (void *)user_buf;
+		iov.iov_len = count;
+		wcount = nvfuse_rwv_directio_core(sb, fid, &iov, 1, woffset, WRITE);
+		nvfuse_release_super(sb);
+		return wcount;
+	}
+
+	wcount = nvfuse_writefile_core(sb, fid, user_buf, count, woffset);
+
+	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
+
+	nvfuse_release_super(sb);
+
+	return wcount;
+}
+
+s32 nvfuse_writefile_directio_prepare(struct nvfuse_handle *nvh, u32 fid, const s8 *user_buf,
+				      u32 count, nvfuse_off_t woffset)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 wcount;
+
+	wcount = nvfuse_writefile_directio_core(sb, fid, user_buf, count, woffset);
+
+	nvfuse_release_super(sb);
+
+	return wcount;
+}
+
+static s32 nvfuse_directio_submit(struct nvfuse_superblock *sb, struct io_job **jobs, s32 job_count)
+{
+	struct reactor_task *task;
+	s32 res = 0;
+	s32 i;
+
+	task = reactor_alloc_task(sb->target, job_count);
+	assert(task);
+
+	reactor_submit_reqs(sb->target, task, jobs, job_count);
+	nvfuse_wait_aio_completion(sb, task, jobs, job_count);
+
+	for (i = 0; i < job_count; i++) {
+		if (jobs[i]->ret)
+			res = NVFUSE_ERROR;
+	}
+
+	nvfuse_release_jobs(sb, jobs, job_count);
+	reactor_free_task(sb->target, task);
+
+	return res;
+}
+
+/* true if the device can transfer straight from or into the segments */
+static s32 nvfuse_directio_capable(const struct iovec *iov, s32 iovcnt, nvfuse_off_t offset)
+{
+	s32 i;
+
+	if (offset & (CLUSTER_SIZE - 1))
+		return 0;
+
+	for (i = 0; i < iovcnt; i++) {
+		if ((iov[i].iov_len | (uintptr_t)iov[i].iov_base) & (CLUSTER_SIZE - 1))
+			return 0;
+		/* ordinary heap memory is not registered for dma */
+		if (iov[i].iov_len && spdk_vtophys(iov[i].iov_base) == SPDK_VTOPHYS_ERROR)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * O_DIRECT on segments the device cannot use: buffered i/o, with the
+ * written range put on the device before returning.
+ */
+static s32 nvfuse_rwv_directio_fallback(struct nvfuse_superblock *sb, s32 fid,
+					const struct iovec *iov, s32 iovcnt,
+					nvfuse_off_t offset, s32 opcode)
+{
+	struct nvfuse_file_table *of;
+	lbno_t first, last;
+	s32 res;
+
+	if (opcode == READ)
+		return nvfuse_readv_core(sb, fid, iov, iovcnt, offset, READ);
+
+	res = nvfuse_writev_core(sb, fid, iov, iovcnt, offset);
+	if (res <= 0)
+		return res;
+
+	of = nvfuse_get_file_table(sb, fid);
+	first = NVFUSE_SIZE_TO_BLK(offset);
+	last = NVFUSE_SIZE_TO_BLK(offset + res - 1);
+
+	nvfuse_inode_write_lock(sb, of->ino);
+	nvfuse_sync_cached_range(sb, of->ino, first, last - first + 1, 0);
+	nvfuse_inode_write_unlock(sb, of->ino);
+
+	return res;
+}
+
+/*
+ * direct I/O of an iovec array. each physically contiguous extent becomes
+ * one io job whose iov[] entries point straight into the user segments,
+ * so the device gets a scatter-gather list and no data is copied. this
+ * needs a block aligned offset and block aligned dma-able segments, e.g.
+ * from nvfuse_alloc_aligned_buffer(); other requests fall back to the
+ * buffer cache.
+ */
+s32 nvfuse_rwv_directio_core(struct nvfuse_superblock *sb, s32 fid, const struct iovec *iov,
+			     s32 iovcnt, nvfuse_off_t offset, s32 opcode)
+{
+	struct io_job *jobs[AIO_MAX_QDEPTH];
+	struct nvfuse_file_table *of;
+	s32 job_count = 0;
+	s32 count, done = 0;
+	s32 nbytes;
+	s32 seg = 0;
+	size_t seg_off = 0;
+	lbno_t lblk;
+	s32 res = 0;
+
+	count = nvfuse_iov_length(iov, iovcnt);
+	if (count < 0) {
+		dprintf_error(API, "direct i/o length is invalid.");
+		return NVFUSE_ERROR;
+	}
+
+	of = nvfuse_get_file_table(sb, fid);
+	if (of == NULL)
+		return NVFUSE_ERROR;
+
+	if (!nvfuse_directio_capable(iov, iovcnt, offset))
+		return nvfuse_rwv_directio_fallback(sb, fid, iov, iovcnt, offset, opcode);
+
+#ifdef NVFUSE_USE_INLINE_DATA
+	/* inline data has no blocks to read from */
+	if (opcode == READ) {
+		struct nvfuse_inode_ctx *ictx;
+		s32 inline_data;
+
+		ictx = nvfuse_read_inode(sb, NULL, of->ino);
+		inline_data = NVFUSE_INODE_HAS_INLINE_DATA(ictx->ictx_inode);
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+
+		if (inline_data)
+			return nvfuse_readv_core(sb, fid, iov, iovcnt, offset, READ);
+	}
+#endif
+
+	/*
+	 * the lock keeps blocks of the range from being freed from the size
+	 * check or allocation on until the device is done with them. a direct
+	 * write also keeps buffered readers off the range until its cached
+	 * copies are dropped and the new data is on the device.
+	 */
+	if (opcode == READ)
+		nvfuse_inode_read_lock(sb, of->ino);
+	else
+		nvfuse_inode_write_lock(sb, of->ino);
+
+	/* allocates missing blocks for writes, cuts reads short at eof */
+	if (opcode == READ)
+		res = nvfuse_readfile_directio_core(sb, fid, NULL, count, offset, 0);
+	else
+		res = nvfuse_writefile_directio_locked(sb, of, count, offset);
+	if (res <= 0 || (opcode == WRITE && res != count))
+		goto UNLOCK_INODE;
+
+	/* the tail block of a short read is transferred in full */
+	nbytes = res;
+	count = (nbytes + CLUSTER_SIZE - 1) & ~(CLUSTER_SIZE - 1);
+
+	lblk = NVFUSE_SIZE_TO_BLK(offset);
+	nvfuse_sync_cached_range(sb, of->ino, lblk, count >> CLUSTER_SIZE_BITS, opcode == WRITE);
+
+	res = 0;
+	while (done < count) {
+		struct io_job *job;
+		u32 extent;
+		u32 bytes = 0;
+		u32 num_alloc;
+		s32 pblk;
+
+		pblk = nvfuse_fgetblk(sb, fid, lblk, (count - done) >> CLUSTER_SIZE_BITS, &num_alloc);
+		if (pblk <= 0) {
+			dprintf_error(API, "unmapped block lblk = %d.", lblk);
+			res = NVFUSE_ERROR;
+			break;
+		}
+		extent = num_alloc << CLUSTER_SIZE_BITS;
+
+		nvfuse_make_jobs(sb, &job, 1);
+		job->iovcnt = 0;
+		while (bytes < extent && job->iovcnt < REACTOR_BUFFER_IOVS) {
+			size_t len = MIN(iov[seg].iov_len - seg_off, extent - bytes);
+
+			job->iov[job->iovcnt].iov_base = (s8 *)iov[seg].iov_base + seg_off;
+			job->iov[job->iovcnt].iov_len = len;
+			job->iovcnt++;
+
+			bytes += len;
+			seg_off += len;
+			if (seg_off == iov[seg].iov_len) {
+				seg++;
+				seg_off = 0;
+			}
+		}
+
+		job->offset = (long)pblk * CLUSTER_SIZE;
+		job->bytes = bytes;
+		job->buf = job->iov[0].iov_base;
+		job->ret = 0;
+		job->req_type = (opcode == READ) ? SPDK_BDEV_IO_TYPE_READ : SPDK_BDEV_IO_TYPE_WRITE;
+		job->cb = reactor_bio_cb;
+		job->complete = 0;
+		jobs[job_count++] = job;
+
+		lblk += bytes >> CLUSTER_SIZE_BITS;
+		done += bytes;
+
+		if (job_count == AIO_MAX_QDEPTH) {
+			res = nvfuse_directio_submit(sb, jobs, job_count);
+			job_count = 0;
+			if (res)
+				break;
+		}
 	}
-#else
-	of->rwoffset = woffset;
-#endif
 
-	if (count % CLUSTER_SIZE) {
-		dprintf_error(API, "count (%d) is not aligned to 4KB.", count);
-		wcount = 0;
-		goto RET;
+	if (job_count) {
+		if (nvfuse_directio_submit(sb, jobs, job_count))
+			res = NVFUSE_ERROR;
 	}
 
-	ictx = nvfuse_read_inode(sb, NULL, of->ino);
-	inode = ictx->ictx_inode;
-	if (count && inode->i_size <= of->rwoffset) {
-		u32 num_alloc = count >> CLUSTER_SIZE_BITS;
-		ret = nvfuse_get_block(sb, ictx, NVFUSE_SIZE_TO_BLK(inode->i_size), num_alloc/* num block */, NULL,
-				       NULL, 1);
-		if (ret) {
-			dprintf_error(INODE, "data block allocation fails.");
-			return NVFUSE_ERROR;
-		}
+	if (!res)
+		res = nbytes;
 
-		assert(inode->i_size < MAX_FILE_SIZE);
-		inode->i_size += count;
-		nvfuse_release_inode(sb, ictx, DIRTY);
-	} else {
-		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
-	}
+UNLOCK_INODE:
+	if (opcode == READ)
+		nvfuse_inode_read_unlock(sb, of->ino);
+	else
+		nvfuse_inode_write_unlock(sb, of->ino);
 
-	of->rwoffset += count;
-	wcount = count;
+	return res;
+}
 
-	if (of->rwoffset > of->size)
-		of->size = of->rwoffset;
+s32 nvfuse_preadv(struct nvfuse_handle *nvh, u32 fid, const struct iovec *iov, s32 iovcnt,
+		  nvfuse_off_t roffset)
+{
+	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	s32 rcount;
 
-RET:
-	;
+	if (nvfuse_is_directio(sb, fid))
+		rcount = nvfuse_rwv_directio_core(sb, fid, iov, iovcnt, roffset, READ);
+	else
+		rcount = nvfuse_readv_core(sb, fid, iov, iovcnt, roffset, READ);
 
-	return wcount;
+	nvfuse_release_super(sb);
+	return rcount;
 }
 
-s32 nvfuse_writefile(struct nvfuse_handle *nvh, u32 fid, const s8 *user_buf, u32 count,
-		     nvfuse_off_t woffset)
+s32 nvfuse_pwritev(struct nvfuse_handle *nvh, u32 fid, const struct iovec *iov, s32 iovcnt,
+		   nvfuse_off_t woffset)
 {
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
 	s32 wcount;
 
-	wcount = nvfuse_writefile_core(sb, fid, user_buf, count, woffset);
+	if (nvfuse_is_directio(sb, fid)) {
+		wcount = nvfuse_rwv_directio_core(sb, fid, iov, iovcnt, woffset, WRITE);
+	} else {
+		wcount = nvfuse_writev_core(sb, fid, iov, iovcnt, woffset);
 
-	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
+		/* one flush check for the whole vector */
+		nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
+	}
 
 	nvfuse_release_super(sb);
-
 	return wcount;
 }
 
-s32 nvfuse_writefile_directio_prepare(struct nvfuse_handle *nvh, u32 fid, const s8 *user_buf,
-				      u32 count, nvfuse_off_t woffset)
+s32 nvfuse_readv(struct nvfuse_handle *nvh, u32 fid, const struct iovec *iov, s32 iovcnt)
 {
-	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
-	s32 wcount;
+	struct nvfuse_file_table *of = nvfuse_get_file_table(&nvh->nvh_sb, fid);
 
-	wcount = nvfuse_writefile_directio_core(sb, fid, user_buf, count, woffset);
+	if (of == NULL)
+		return NVFUSE_ERROR;
 
-	nvfuse_release_super(sb);
+	return nvfuse_preadv(nvh, fid, iov, iovcnt, of->rwoffset);
+}
 
-	return wcount;
+s32 nvfuse_writev(struct nvfuse_handle *nvh, u32 fid, const struct iovec *iov, s32 iovcnt)
+{
+	struct nvfuse_file_table *of = nvfuse_get_file_table(&nvh->nvh_sb, fid);
+
+	if (of == NULL)
+		return NVFUSE_ERROR;
+
+	return nvfuse_pwritev(nvh, fid, iov, iovcnt, of->rwoffset);
 }
 
 
-s32 nvfuse_gather_bh(struct nvfuse_superblock *sb, s32 fid, const s8 *user_buf, u32 count,
-		     nvfuse_off_t woffset, struct list_head *aio_bh_head, s32 *aio_bh_count)
+/*
+ * gathers the blocks of a buffered aio read. cached data is copied to
+ * user_buf at once. blocks that must come from the device are linked on
+ * aio_bh_head in file order, pinned and marked in flight (bc_locked) with
+ * the bc lock dropped; the aio engine reads them into the cache and copies
+ * them out on completion. returns the number of bytes the read covers.
+ */
+s32 nvfuse_gather_bh(struct nvfuse_superblock *sb, s32 fid, s8 *user_buf, u32 count,
+		     nvfuse_off_t roffset, struct list_head *aio_bh_head, s32 *aio_bh_count)
 {
 	struct nvfuse_inode_ctx *ictx;
 	struct nvfuse_inode *inode;
 	struct nvfuse_file_table *of;
-	struct nvfuse_buffer_head *bh = NULL;
-	u32 offset = 0, remain = 0;
-	nvfuse_off_t curoffset;
-	lbno_t lblock = 0;
+	struct nvfuse_buffer_head *bh;
+	struct nvfuse_buffer_cache *bc;
+	nvfuse_off_t pos = roffset;
+	u32 offset, remain;
+	s32 rcount = 0;
+	inode_t ino;
 
 	of = nvfuse_get_file_table(sb, fid);
+	if (of == NULL)
+		return NVFUSE_ERROR;
+	ino = of->ino;
 
-	curoffset = woffset;
+	nvfuse_inode_read_lock(sb, ino);
 
-	ictx = nvfuse_read_inode(sb, NULL, of->ino);
+	ictx = nvfuse_read_inode(sb, NULL, ino);
 	inode = ictx->ictx_inode;
 
+	if (pos >= inode->i_size)
+		count = 0;
+	else if (count > inode->i_size - pos)
+		count = inode->i_size - pos;
+
+#ifdef NVFUSE_USE_INLINE_DATA
+	if (NVFUSE_INODE_HAS_INLINE_DATA(inode)) {
+		memcpy(user_buf, NVFUSE_INLINE_DATA(inode) + pos, count);
+		rcount = count;
+		count = 0;
+	}
+#endif
+
 	while (count > 0) {
-		lblock = NVFUSE_SIZE_TO_BLK(curoffset);
-		offset = curoffset & (CLUSTER_SIZE - 1);
+		offset = pos & (CLUSTER_SIZE - 1);
 		remain = CLUSTER_SIZE - offset;
 
 		if (remain > count)
 			remain = count;
 
-		bh = nvfuse_get_bh(sb, ictx, inode->i_ino, lblock, WRITE, NVFUSE_TYPE_DATA);
+		bh = nvfuse_get_bh(sb, ictx, ino, NVFUSE_SIZE_TO_BLK(pos), 0, NVFUSE_TYPE_DATA);
 		if (bh == NULL) {
-			dprintf_error(BUFFER, "get_bh()\n");
-			return -1;
+			dprintf_error(BUFFER, " get_bh() for aio read\n");
+			rcount = -1;
+			break;
+		}
+		bc = bh->bh_bc;
+
+		/* a partially written block is completed synchronously */
+		if (!bc->bc_load && bc->bc_valid_start != bc->bc_valid_end &&
+		    nvfuse_fill_bc(sb, bc)) {
+			nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+			rcount = -1;
+			break;
+		}
+
+		/* another data plane may have read it already */
+		if (!bc->bc_load)
+			nvfuse_shared_cache_read(sb, bc);
+
+		if (bc->bc_load) {
+			memcpy(user_buf + rcount, &bh->bh_buf[offset], remain);
+			nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+		} else {
+			bc->bc_locked = 1;
+			SPINLOCK_UNLOCK(&bc->bc_lock);
+			list_add_tail(&bh->bh_aio_list, aio_bh_head);
+			(*aio_bh_count)++;
 		}
-		curoffset += remain;
-		count -= remain;
-		(*aio_bh_count)++;
 
-		list_add(&bh->bh_aio_list, aio_bh_head);
+		rcount += remain;
+		pos += remain;
+		count -= remain;
 	}
 
 	nvfuse_release_inode(sb, ictx, NVF_CLEAN);
 
-	return 0;
+	nvfuse_inode_read_unlock(sb, ino);
+
+	return rcount;
 }
 
 static inline u16 old_encode_dev(dev_t dev)
@@ -1354,6 +2054,228 @@ s32 nvfuse_createfile(struct nvfuse_superblock *sb, inode_t par_ino, s8 *filenam
 	return NVFUSE_SUCCESS;
 }
 
+/* return the dentry block holding lblock, growing the directory if lblock is new */
+static struct nvfuse_buffer_head *nvfuse_get_dentry_bh(struct nvfuse_superblock *sb,
+		struct nvfuse_inode_ctx *dir_ictx, struct nvfuse_inode *dir_inode, u32 lblock)
+{
+	struct nvfuse_buffer_head *dir_bh;
+	s32 ret;
+
+	if (lblock < NVFUSE_SIZE_TO_BLK(dir_inode->i_size))
+		return nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, lblock, READ, NVFUSE_TYPE_META);
+
+	ret = nvfuse_get_block(sb, dir_ictx, lblock, 1/* num block */, NULL, NULL, 1);
+	if (ret) {
+		dprintf_error(BLOCK, " data block allocation fails.");
+		return NULL;
+	}
+
+	dir_bh = nvfuse_get_new_bh(sb, dir_ictx, dir_inode->i_ino, lblock, NVFUSE_TYPE_META);
+	assert(dir_inode->i_size < MAX_FILE_SIZE);
+	dir_inode->i_size += CLUSTER_SIZE;
+
+	return dir_bh;
+}
+
+static int nvfuse_filename_cmp(const void *a, const void *b)
+{
+	return strcmp(*(s8 *const *)a, *(s8 *const *)b);
+}
+
+/*
+ * Create count regular files under par_ino at once. Inodes are allocated in
+ * contiguous runs, dentries are appended block by block, directory hashes are
+ * inserted into the b+tree in key order and dirty data is flushed only once.
+ * Filenames must not exist in the directory yet and must be distinct.
+ */
+s32 nvfuse_createfiles(struct nvfuse_superblock *sb, inode_t par_ino, s8 **filenames, s32 count,
+		       inode_t *new_inos, mode_t mode)
+{
+	struct nvfuse_dir_entry *dir = NULL;
+	struct nvfuse_inode_ctx *new_ictx, *dir_ictx;
+	struct nvfuse_inode *new_inode, *dir_inode;
+	struct nvfuse_buffer_head *dir_bh = NULL;
+	inode_t *alloc_inos;
+	u32 *dentry_offsets;
+	s8 **sorted_names;
+	u32 dir_lblock = 0;
+	u32 search_lblock, search_entry;
+	s32 alloc_count;
+	s32 created = 0;
+	s32 res = NVFUSE_ERROR;
+	s32 ret;
+	s32 i;
+
+	if (count <= 0)
+		return 0;
+
+	for (i = 0; i < count; i++) {
+		if (strlen(filenames[i]) < 1 || strlen(filenames[i]) >= FNAME_SIZE) {
+			dprintf_error(API, " invalid file name = %s, %d\n", filenames[i], (int)strlen(filenames[i]));
+			return -1;
+		}
+	}
+
+	alloc_inos = malloc(sizeof(inode_t) * count);
+	dentry_offsets = malloc(sizeof(u32) * count);
+	sorted_names = malloc(sizeof(s8 *) * count);
+	if (alloc_inos == NULL || dentry_offsets == NULL || sorted_names == NULL) {
+		dprintf_error(MEMALLOC, " malloc error \n");
+		goto FREE;
+	}
+
+	/* a name given twice would leave two dentries under one key */
+	memcpy(sorted_names, filenames, sizeof(s8 *) * count);
+	qsort(sorted_names, count, sizeof(s8 *), nvfuse_filename_cmp);
+	for (i = 1; i < count; i++) {
+		if (strcmp(sorted_names[i - 1], sorted_names[i]) == 0) {
+			dprintf_error(API, " duplicate file name = %s\n", sorted_names[i]);
+			goto FREE;
+		}
+	}
+
+	dir_ictx = nvfuse_read_inode(sb, NULL, par_ino);
+	dir_inode = dir_ictx->ictx_inode;
+
+	if ((s64)dir_inode->i_links_count + count > MAX_FILES_PER_DIR) {
+		dprintf_error(API, " The number of files exceeds %d\n", MAX_FILES_PER_DIR);
+		goto RELEASE_DIR;
+	}
+
+#ifdef NVFUSE_USE_DELAYED_DIRECTORY_ALLOC
+	if (dir_inode->i_links_count == 2 && dir_inode->i_bpino == 0) {
+		ret = nvfuse_make_first_directory(sb, dir_ictx, dir_inode);
+		if (ret) {
+			dprintf_error(DIRECTORY, "mkdir_first_directory()\n");
+			goto RELEASE_DIR;
+		}
+	}
+#endif
+
+#ifdef NVFUSE_USE_DELAYED_BPTREE_CREATION
+	if (dir_inode->i_bpino == 0 && dir_inode->i_links_count == 2) {
+		/* create bptree related nodes for new directory's dentries */
+		ret = nvfuse_create_bptree(sb, dir_inode);
+		if (ret) {
+			dprintf_error(BPTREE, " bptree allocation fails.");
+			goto RELEASE_DIR;
+		}
+	}
+#endif
+
+	alloc_count = nvfuse_alloc_new_inodes(sb, alloc_inos, count);
+	if (alloc_count == 0) {
+		dprintf_error(INODE, " It runs out of free inodes.");
+		goto RELEASE_DIR;
+	}
+
+	for (i = 0; i < alloc_count; i++) {
+		new_ictx = nvfuse_alloc_ictx(sb);
+		if (new_ictx == NULL)
+			break;
+
+		SPINLOCK_LOCK(&new_ictx->ictx_lock);
+		set_bit(&new_ictx->ictx_status, INODE_STATE_LOCK);
+		set_bit(&new_ictx->ictx_status, INODE_STATE_DIRTY);
+
+		new_ictx = nvfuse_read_inode(sb, new_ictx, alloc_inos[i]);
+		nvfuse_insert_ictx(sb, new_ictx);
+
+		new_inode = new_ictx->ictx_inode;
+		new_inode->i_type = NVFUSE_TYPE_FILE;
+		new_inode->i_size = 0;
+		new_inode->i_mode = mode;
+		new_inode->i_gid = 0;
+		new_inode->i_uid = 0;
+		new_inode->i_links_count = 1;
+		new_inode->i_atime = time(NULL);
+		new_inode->i_ctime = time(NULL);
+		new_inode->i_mtime = time(NULL);
+
+		/* dentries are kept dense, so the next free slot follows the last one */
+		dentry_offsets[i] = dir_inode->i_links_count;
+		search_lblock = dentry_offsets[i] / DIR_ENTRY_NUM;
+		search_entry = dentry_offsets[i] % DIR_ENTRY_NUM;
+
+		if (dir_bh == NULL || dir_lblock != search_lblock) {
+			nvfuse_release_bh(sb, dir_bh, 0/*tail*/, DIRTY);
+			dir_bh = nvfuse_get_dentry_bh(sb, dir_ictx, dir_inode, search_lblock);
+			if (dir_bh == NULL) {
+				nvfuse_relocate_delete_inode(sb, new_ictx);
+				i++;
+				break;
+			}
+			dir_lblock = search_lblock;
+			dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
+		}
+
+		assert(nvfuse_dir_is_invalid(dir + search_entry));
+		dir[search_entry].d_flag = DIR_USED;
+		dir[search_entry].d_ino = new_inode->i_ino;
+		dir[search_entry].d_version = new_inode->i_version;
+		strcpy(dir[search_entry].d_filename, filenames[i]);
+
+		dir_inode->i_links_count++;
+		dir_inode->i_ptr = dentry_offsets[i];
+		assert(dir_inode->i_links_count == dir_inode->i_ptr + 1);
+
+		if (new_inos)
+			new_inos[i] = new_inode->i_ino;
+
+		nvfuse_release_inode(sb, new_ictx, DIRTY);
+		created++;
+	}
+
+	nvfuse_release_bh(sb, dir_bh, 0/*tail*/, DIRTY);
+
+	/* give back inodes left unused due to a failure above */
+	for (; i < alloc_count; i++) {
+		nvfuse_inc_free_inodes(sb, alloc_inos[i]);
+		nvfuse_release_ibitmap(sb, alloc_inos[i] / sb->sb_no_of_inodes_per_bg, alloc_inos[i]);
+	}
+
+#if NVFUSE_USE_DIR_INDEXING == 1
+	/*
+	 * the bulk insert fails before touching the b+tree, so undoing the
+	 * batch only needs the dentries and inodes, newest first to keep the
+	 * dentries dense.
+	 */
+	if (created && nvfuse_set_dir_indexing_bulk(sb, dir_inode, filenames, dentry_offsets, created)) {
+		dprintf_error(DIRECTORY, " failed to index %d new files\n", created);
+		while (created) {
+			created--;
+			search_lblock = dentry_offsets[created] / DIR_ENTRY_NUM;
+			search_entry = dentry_offsets[created] % DIR_ENTRY_NUM;
+			dir_bh = nvfuse_get_bh(sb, dir_ictx, dir_inode->i_ino, search_lblock, READ,
+					       NVFUSE_TYPE_META);
+			dir = (struct nvfuse_dir_entry *)dir_bh->bh_buf;
+			dir[search_entry].d_flag = DIR_DELETED;
+			nvfuse_release_bh(sb, dir_bh, 0/*tail*/, DIRTY);
+
+			new_ictx = nvfuse_read_inode(sb, NULL, alloc_inos[created]);
+			nvfuse_relocate_delete_inode(sb, new_ictx);
+
+			dir_inode->i_links_count--;
+			dir_inode->i_ptr = dir_inode->i_links_count - 1;
+		}
+		goto RELEASE_DIR;
+	}
+#endif
+	res = created;
+
+RELEASE_DIR:
+	nvfuse_release_inode(sb, dir_ictx, DIRTY);
+
+	/* all creations are committed at once */
+	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
+FREE:
+	free(alloc_inos);
+	free(dentry_offsets);
+	free(sorted_names);
+
+	return res;
+}
+
 s32 nvfuse_shrink_dentry(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 to_entry,
 			 u32 from_entry)
 {
@@ -1502,22 +2424,29 @@ s32 nvfuse_rmfile_path(struct nvfuse_handle *nvh, const char *path)
 	int res;
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_superblock *sb = nvfuse_read_super(nvh);
+	struct nvfuse_dir_entry file_entry;
 	s8 filename[FNAME_SIZE];
 
-	nvfuse_lock();
+	nvfuse_lock(sb);
 
 	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
 	if (res < 0)
-		return res;
+		goto UNLOCK_NS;
 
 	if (dir_entry.d_ino == 0) {
 		printf(" %s: invalid path\n", __FUNCTION__);
 		res = -1;
+	} else if (nvfuse_lookup(sb, NULL, &file_entry, filename, dir_entry.d_ino) < 0) {
+		res = nvfuse_rmfile(sb, dir_entry.d_ino, filename);
 	} else {
+		/* readers and writers of the file through open fds are drained */
+		nvfuse_inode_write_lock(sb, file_entry.d_ino);
 		res = nvfuse_rmfile(sb, dir_entry.d_ino, filename);
+		nvfuse_inode_write_unlock(sb, file_entry.d_ino);
 	}
 
-	nvfuse_unlock();
+UNLOCK_NS:
+	nvfuse_unlock(sb);
 	return res;
 }
 
@@ -1625,22 +2554,24 @@ s32 nvfuse_rmdir_path(struct nvfuse_handle *nvh, const char *path)
 	struct nvfuse_superblock *sb;
 	s8 filename[FNAME_SIZE];
 
-	nvfuse_lock();
+	sb = nvfuse_read_super(nvh);
+
+	nvfuse_lock(sb);
 
 	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
 	if (res < 0)
-		return res;
+		goto UNLOCK_NS;
 
 	if (dir_entry.d_ino == 0) {
 		printf(" %s: invalid path\n", __FUNCTION__);
 		res = -1;
 	} else {
-		sb = nvfuse_read_super(nvh);
 		res = nvfuse_rmdir(sb, dir_entry.d_ino, filename);
-		nvfuse_release_super(sb);
 	}
 
-	nvfuse_unlock();
+UNLOCK_NS:
+	nvfuse_unlock(sb);
+	nvfuse_release_super(sb);
 	return res;
 }
 
@@ -1839,6 +2770,8 @@ s32 nvfuse_rename(struct nvfuse_handle *nvh, inode_t par_ino, s8 *name, inode_t
 
 	sb = nvfuse_read_super(nvh);
 
+	nvfuse_lock(sb);
+
 	nvfuse_rm_direntry(sb, par_ino, name, &ino);
 
 	if (!nvfuse_lookup(sb, &ictx, NULL, newname, new_par_ino)) {
@@ -1854,6 +2787,8 @@ s32 nvfuse_rename(struct nvfuse_handle *nvh, inode_t par_ino, s8 *name, inode_t
 
 	nvfuse_link(sb, new_par_ino, newname, ino);
 
+	nvfuse_unlock(sb);
+
 	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
 
 	nvfuse_release_super(sb);
@@ -1890,8 +2825,11 @@ s32 nvfuse_hardlink(struct nvfuse_superblock *sb, inode_t par_ino, s8 *name, ino
 
 	printf(" src name = %s dst name = %s \n", name, newname);
 
+	nvfuse_lock(sb);
+
 	if (nvfuse_lookup(sb, NULL, &direntry, name, par_ino) < 0) {
 		printf(" link: source inode doesn't exist\n");
+		nvfuse_unlock(sb);
 		return -1;
 	}
 
@@ -1899,6 +2837,7 @@ s32 nvfuse_hardlink(struct nvfuse_superblock *sb, inode_t par_ino, s8 *name, ino
 
 	if (!nvfuse_lookup(sb, NULL, NULL, newname, new_par_ino)) {
 		printf(" link: link exists %s \n", newname);
+		nvfuse_unlock(sb);
 		return -1;
 	}
 
@@ -1907,6 +2846,8 @@ s32 nvfuse_hardlink(struct nvfuse_superblock *sb, inode_t par_ino, s8 *name, ino
 		dprintf_error(API, "link() \n");
 	}
 
+	nvfuse_unlock(sb);
+
 	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
 
 	return 0;
@@ -1949,35 +2890,37 @@ s32 nvfuse_mknod(struct nvfuse_handle *nvh, const char *path, mode_t mode, dev_t
 	s8 filename[FNAME_SIZE];
 	struct nvfuse_superblock *sb;
 
-	nvfuse_lock();
+	sb = nvfuse_read_super(nvh);
+
+	nvfuse_lock(sb);
 
 	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
 	if (res < 0)
-		return res;
+		goto UNLOCK_NS;
 
 	if (dir_entry.d_ino == 0) {
 		printf(" %s: invalid path\n", __FUNCTION__);
 		res = -1;
 	} else {
-		sb = nvfuse_read_super(nvh);
-
 		if (!nvfuse_lookup(sb, NULL, NULL, filename, dir_entry.d_ino)) {
 			dprintf_error(API, "exist file or directory\n");
-			return NVFUSE_ERROR;
+			res = NVFUSE_ERROR;
+			goto UNLOCK_NS;
 		}
 
 		res = nvfuse_createfile(sb, dir_entry.d_ino, filename, 0, mode, dev);
 		if (res < 0)
-			return res;
+			goto UNLOCK_NS;
 
 		nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
-
-		nvfuse_release_super(sb);
+		res = 0;
 	}
 
-	nvfuse_unlock();
+UNLOCK_NS:
+	nvfuse_unlock(sb);
+	nvfuse_release_super(sb);
 
-	return 0;
+	return res;
 }
 
 s32 nvfuse_mkdir_path(struct nvfuse_handle *nvh, const char *path, mode_t mode)
@@ -1987,13 +2930,13 @@ s32 nvfuse_mkdir_path(struct nvfuse_handle *nvh, const char *path, mode_t mode)
 	struct nvfuse_superblock *sb;
 	s8 filename[FNAME_SIZE];
 
-	nvfuse_lock();
-
 	sb = nvfuse_read_super(nvh);
 
+	nvfuse_lock(sb);
+
 	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
 	if (res < 0)
-		return res;
+		goto UNLOCK_NS;
 
 	if (dir_entry.d_ino == 0) {
 		printf(" %s: invalid path\n", __FUNCTION__);
@@ -2002,8 +2945,9 @@ s32 nvfuse_mkdir_path(struct nvfuse_handle *nvh, const char *path, mode_t mode)
 		res = nvfuse_mkdir(sb, dir_entry.d_ino, filename, 0, mode);
 	}
 
+UNLOCK_NS:
+	nvfuse_unlock(sb);
 	nvfuse_release_super(sb);
-	nvfuse_unlock();
 
 	return res;
 }
@@ -2012,22 +2956,32 @@ s32 nvfuse_truncate_path(struct nvfuse_handle *nvh, const char *path, nvfuse_off
 {
 	int res;
 	struct nvfuse_dir_entry dir_entry;
+	struct nvfuse_dir_entry file_entry;
 	struct nvfuse_superblock *sb;
 	s8 filename[FNAME_SIZE];
 
 	sb = nvfuse_read_super(nvh);
 
+	nvfuse_lock_shared(sb);
+
 	res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
 	if (res < 0)
-		return res;
+		goto UNLOCK_NS;
 
 	if (dir_entry.d_ino == 0) {
 		printf(" %s: invalid path\n", __FUNCTION__);
 		res = -1;
+	} else if (nvfuse_lookup(sb, NULL, &file_entry, filename, dir_entry.d_ino) < 0) {
+		res = nvfuse_truncate(sb, dir_entry.d_ino, filename, size);
 	} else {
+		nvfuse_inode_write_lock(sb, file_entry.d_ino);
 		res = nvfuse_truncate(sb, dir_entry.d_ino, filename, size);
+		nvfuse_inode_write_unlock(sb, file_entry.d_ino);
 	}
 
+UNLOCK_NS:
+	nvfuse_unlock_shared(sb);
+
 	return res;
 }
 
@@ -2042,6 +2996,12 @@ s32 nvfuse_ftruncate(struct nvfuse_handle *nvh, s32 fid, nvfuse_off_t size)
 	sb = nvfuse_read_super(nvh);
 
 	ft = nvfuse_get_file_table(sb, fid);
+	if (ft == NULL) {
+		nvfuse_release_super(sb);
+		return NVFUSE_ERROR;
+	}
+
+	nvfuse_inode_write_lock(sb, ft->ino);
 
 	ictx = nvfuse_read_inode(sb, NULL, ft->ino);
 	inode = ictx->ictx_inode;
@@ -2052,6 +3012,8 @@ s32 nvfuse_ftruncate(struct nvfuse_handle *nvh, s32 fid, nvfuse_off_t size)
 	inode->i_size = size;
 	nvfuse_release_inode(sb, ictx, DIRTY);
 
+	nvfuse_inode_write_unlock(sb, ft->ino);
+
 	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
 
 	return res;
@@ -2070,37 +3032,40 @@ s32 nvfuse_symlink(struct nvfuse_handle *nvh, const char *link, inode_t parent,
 	printf(" symlink : \"%s\", parent #%d, name \"%s\" \n",
 	       link, (int)parent, name);
 
-	nvfuse_lock();
+	nvfuse_lock(sb);
 
 	if (!nvfuse_lookup(sb, NULL, NULL, name, parent)) {
 		dprintf_error(API, " exist file or directory\n");
-		return NVFUSE_ERROR;
+		res = NVFUSE_ERROR;
+		goto UNLOCK_NS;
 	}
 
 	res = nvfuse_createfile(sb, parent, (char *)name, (inode_t *)&ino, 0777 | S_IFLNK, 0);
 	if (res != NVFUSE_SUCCESS) {
 		dprintf_error(API, "create file error \n");
-		return res;
+		goto UNLOCK_NS;
 	}
 
 	fid = nvfuse_openfile_ino(sb, ino, O_WRONLY);
 
 	bytes = nvfuse_writefile(nvh, fid, link, strlen(link) + 1, 0);
 
+	nvfuse_closefile(nvh, fid);
+
 	if (bytes != strlen(link) + 1) {
 		dprintf_error(API, " symlink error \n");
-		return -1;
+		res = -1;
+		goto UNLOCK_NS;
 	}
 
 	nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
 
-	nvfuse_closefile(nvh, fid);
+UNLOCK_NS:
+	nvfuse_unlock(sb);
 
 	nvfuse_release_super(sb);
 
-	nvfuse_unlock();
-
-	return 0;
+	return res;
 }
 
 s32 nvfuse_symlink_path(struct nvfuse_handle *nvh, const char *target_name, const char *link_name)
@@ -2121,6 +3086,7 @@ s32 nvfuse_readlink_ino(struct nvfuse_handle *nvh, inode_t ino, char *buf, size_
 	unsigned int bytes;
 	int fid;
 	struct nvfuse_superblock *sb;
+	struct nvfuse_inode_ctx *ictx;
 
 	sb = nvfuse_read_super(nvh);
 
@@ -2129,23 +3095,33 @@ s32 nvfuse_readlink_ino(struct nvfuse_handle *nvh, inode_t ino, char *buf, size_
 	if (ino == 0)
 		ino = ROOT_INO;
 
-	nvfuse_lock();
+	nvfuse_lock_shared(sb);
+
+	/* short link targets are copied straight from the inode */
+	ictx = nvfuse_read_inode(sb, NULL, ino);
+	if (NVFUSE_INODE_HAS_INLINE_DATA(ictx->ictx_inode)) {
+		bytes = MIN(size, ictx->ictx_inode->i_size);
+		rte_memcpy(buf, NVFUSE_INLINE_DATA(ictx->ictx_inode), bytes);
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+	} else {
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+
+		fid = nvfuse_openfile_ino(sb, ino, O_RDONLY);
+		bytes = nvfuse_readfile(nvh, fid, buf, size, 0);
+		nvfuse_closefile(nvh, fid);
+	}
 
-	fid = nvfuse_openfile_ino(sb, ino, O_RDONLY);
+	nvfuse_unlock_shared(sb);
 
-	bytes = nvfuse_readfile(nvh, fid, buf, size, 0);
 	if (bytes != size) {
 		dprintf_error(API, "read bytes = %d \n", bytes);
 		return -1;
 	}
 
 	printf(" read link = %s \n", buf);
-	nvfuse_closefile(nvh, fid);
 
 	nvfuse_release_super(sb);
 
-	nvfuse_unlock();
-
 	return bytes;
 }
 
@@ -2164,20 +3140,22 @@ s32 nvfuse_getattr(struct nvfuse_handle *nvh, const char *path, struct stat *stb
 		stbuf->st_mode = S_IFDIR | 0755;
 		stbuf->st_nlink = 2;
 	} else {
+		sb = nvfuse_read_super(nvh);
+
+		nvfuse_lock_shared(sb);
 
 		res = nvfuse_path_resolve(nvh, path, filename, &dir_entry);
 		if (res < 0)
-			return res;
+			goto UNLOCK_NS;
 
 		if (dir_entry.d_ino == 0) {
 			printf(" %s: invalid path\n", __FUNCTION__);
 			res = -ENOENT;
-			goto RET;
+			goto UNLOCK_NS;
 		} else {
-			sb = nvfuse_read_super(nvh);
 			if (nvfuse_lookup(sb, &ictx, &dir_entry, filename, dir_entry.d_ino) < 0) {
 				res = -ENOENT;
-				goto RET;
+				goto UNLOCK_NS;
 			}
 
 			inode = ictx->ictx_inode;
@@ -2198,13 +3176,14 @@ s32 nvfuse_getattr(struct nvfuse_handle *nvh, const char *path, struct stat *stb
 			}
 
 			nvfuse_release_inode(sb, ictx, NVF_CLEAN);
-			nvfuse_release_super(sb);
 
 			res = 0;
 		}
+UNLOCK_NS:
+		nvfuse_unlock_shared(sb);
+		nvfuse_release_super(sb);
 	}
 
-RET:
 	return res;
 }
 
@@ -2224,7 +3203,11 @@ s32 nvfuse_fgetattr(struct nvfuse_handle *nvh, const char *path, struct stat *st
 	} else {
 		sb = nvfuse_read_super(nvh);
 
-		ft = sb->sb_file_table + fd;
+		ft = nvfuse_get_file_table(sb, fd);
+		if (ft == NULL) {
+			nvfuse_release_super(sb);
+			return NVFUSE_ERROR;
+		}
 
 		ictx = nvfuse_read_inode(sb, NULL, ft->ino);
 		inode = ictx->ictx_inode;
@@ -2499,7 +3482,11 @@ s32 nvfuse_fdatasync(struct nvfuse_handle *nvh, int fd)
 	struct nvfuse_inode_ctx *ictx;
 
 	sb = nvfuse_read_super(nvh);
-	ft = sb->sb_file_table + fd;
+	ft = nvfuse_get_file_table(sb, fd);
+	if (ft == NULL) {
+		nvfuse_release_super(sb);
+		return NVFUSE_ERROR;
+	}
 	ictx = nvfuse_read_inode(sb, NULL, ft->ino);
 	/* flush dirty pages associated with inode context including only data pages */
 	nvfuse_fdsync_ictx(sb, ictx);
@@ -2516,7 +3503,11 @@ s32 nvfuse_fsync(struct nvfuse_handle *nvh, int fd)
 	struct nvfuse_inode_ctx *ictx;
 
 	sb = nvfuse_read_super(nvh);
-	ft = sb->sb_file_table + fd;
+	ft = nvfuse_get_file_table(sb, fd);
+	if (ft == NULL) {
+		nvfuse_release_super(sb);
+		return NVFUSE_ERROR;
+	}
 	ictx = nvfuse_read_inode(sb, NULL, ft->ino);
 
 	/* flush dirty pages associated with inode context including meta and data pages */
@@ -2718,14 +3709,31 @@ s32 nvfuse_fallocate(struct nvfuse_handle *nvh, const char *path, s64 start, s64
 		/* test */
 		//nvfuse_check_flush_dirty(sb, 1);
 
-		if (nvfuse_lookup(sb, &ictx, &dir_entry, filename, dir_entry.d_ino) < 0) {
+		nvfuse_lock_shared(sb);
+
+		if (nvfuse_lookup(sb, NULL, &dir_entry, filename, dir_entry.d_ino) < 0) {
+			nvfuse_unlock_shared(sb);
 			res = -1;
 			goto RET;
 		}
 
 		dprintf_info(API, " file name = %s, ino = %d \n", filename, dir_entry.d_ino);
 
+		/* the inode lock comes before its context */
+		nvfuse_inode_write_lock(sb, dir_entry.d_ino);
+		ictx = nvfuse_read_inode(sb, NULL, dir_entry.d_ino);
+
 		if (ictx->ictx_inode->i_size < (start + length)) {
+#ifdef NVFUSE_USE_INLINE_DATA
+			if (nvfuse_spill_inline_data(sb, ictx)) {
+				nvfuse_release_inode(sb, ictx, DIRTY);
+				nvfuse_inode_write_unlock(sb, dir_entry.d_ino);
+				nvfuse_unlock_shared(sb);
+				nvfuse_release_super(sb);
+				res = NVFUSE_ERROR;
+				goto RET;
+			}
+#endif
 			curr_block = start / CLUSTER_SIZE;
 			max_block = CEIL(length, CLUSTER_SIZE);
 			remain_block = max_block;
@@ -2766,6 +3774,9 @@ s32 nvfuse_fallocate(struct nvfuse_handle *nvh, const char *path, s64 start, s64
 			nvfuse_check_flush_dirty(sb, sb->sb_dirty_sync_policy);
 		}
 
+		nvfuse_inode_write_unlock(sb, dir_entry.d_ino);
+		nvfuse_unlock_shared(sb);
+
 		nvfuse_release_super(sb);
 	}
 RET:
@@ -2781,6 +3792,8 @@ s32 nvfuse_fgetblk(struct nvfuse_superblock *sb, s32 fid, s32 lblk, s32 max_bloc
 	s32 ret;
 
 	of = nvfuse_get_file_table(sb, fid);
+	if (of == NULL)
+		return -1;
 
 	ictx = nvfuse_read_inode(sb, NULL, of->ino);
 	if (ictx == NULL) {
@@ -34,45 +34,15 @@
 #include "nvfuse_indirect.h"
 #include "nvfuse_debug.h"
 
-void *bp_malloc(struct nvfuse_superblock *sb, int mempool_type, int num)
-{
-	struct rte_mempool *mp;
-	void *ptr;
-	s32 ret;
-
-	assert(mempool_type >= 0 && mempool_type < BP_MEMPOOL_NUM);
-
-	mp = (struct rte_mempool *)sb->bp_mempool[mempool_type];
-
-	ret = rte_mempool_get(mp, &ptr);
-	if (ret < 0) {
-		dprintf_error(BPTREE, "ERROR: rte_mempool_get_bulk()\n");
-		return NULL;
-	}
-	//dprintf_info(BPTREE, " bpmalloc: type = %d ptr = %p, num = %d\n", mempool_type, ptr, num);
-	return ptr;
-}
-
-void bp_free(struct nvfuse_superblock *sb, int mempool_type, int num, void *ptr)
-{
-	struct rte_mempool *mp;
-
-	assert(mempool_type >= 0 && mempool_type < BP_MEMPOOL_NUM);
-
-	mp = (struct rte_mempool *)sb->bp_mempool[mempool_type];
-	rte_mempool_put(mp, ptr);
-
-	//dprintf_info(BPTREE, " bpfree: type = %d ptr = %p, num = %d \n", mempool_type, ptr, num);
-}
-
 master_node_t *bp_init_master(struct nvfuse_superblock *sb)
 {
 	master_node_t *master;
 
 	// init master node
-	master = (master_node_t *)bp_malloc(sb, BP_MEMPOOL_MASTER, 1);
+	master = (master_node_t *)malloc(sizeof(master_node_t));
 	if (master == NULL) {
 		dprintf_error(BPTREE, " Error: malloc()\n");
+		return NULL;
 	}
 
 	memset(master, 0x00, sizeof(master_node_t));
@@ -101,13 +71,16 @@ void bp_deinit_master(master_node_t *master)
 	nvfuse_release_inode(master->m_sb, master->m_ictx,
 			     test_bit(&master->m_ictx->ictx_status, INODE_STATE_DIRTY) ? 1 : 0);
 
-	bp_free(master->m_sb, BP_MEMPOOL_MASTER, 1, master);
+	/* every node handle must have been released */
+	assert(master->m_node_used == 0);
+
+	free(master);
 }
 
 s32 bp_read_master_ctx(master_node_t *master, master_ctx_t *master_ctx, s32 master_id)
 {
 	if (master_id == 0) {
-		master_ctx->master = master;
+		master_ctx->m_ondisk = master->m_ondisk;
 		master_ctx->bh = NULL;
 	} else {
 		struct nvfuse_buffer_head *bh;
@@ -120,7 +93,7 @@ s32 bp_read_master_ctx(master_node_t *master, master_ctx_t *master_ctx, s32 mast
 			dprintf_error(BPTREE, " read master block = %d", sub_master_offset);
 			return -1;
 		}
-		master_ctx->master = (master_node_t *)bh->bh_buf;
+		master_ctx->m_ondisk = (master_ondisk_node_t *)bh->bh_buf;
 		master_ctx->bh = bh;
 	}
 
@@ -139,7 +112,7 @@ void bp_release_master_ctx(master_node_t *master, master_ctx_t *master_ctx, s32
 s32 bp_set_bitmap(master_node_t *master, u32 offset)
 {
 	master_ctx_t master_ctx;
-	master_node_t *sub_master;
+	master_ondisk_node_t *sub_master;
 	s32 res;
 
 	res = bp_read_master_ctx(master, &master_ctx, offset / BP_NODES_PER_MASTER);
@@ -147,11 +120,11 @@ s32 bp_set_bitmap(master_node_t *master, u32 offset)
 		dprintf_error(BPTREE, " Error: read master ctx\n");
 		return -1;
 	}
-	sub_master = master_ctx.master;
+	sub_master = master_ctx.m_ondisk;
 
-	set_bit(sub_master->m_ondisk->bitmap, offset % BP_NODES_PER_MASTER);
-	sub_master->m_ondisk->m_bitmap_free--;
-	assert(sub_master->m_ondisk->m_bitmap_free >= 0);
+	set_bit(sub_master->bitmap, offset % BP_NODES_PER_MASTER);
+	sub_master->m_bitmap_free--;
+	assert(sub_master->m_bitmap_free >= 0);
 
 	bp_release_master_ctx(master, &master_ctx, DIRTY);
 
@@ -161,7 +134,7 @@ s32 bp_set_bitmap(master_node_t *master, u32 offset)
 s32 bp_clear_bitmap(master_node_t *master, u32 offset)
 {
 	master_ctx_t master_ctx;
-	master_node_t *sub_master;
+	master_ondisk_node_t *sub_master;
 	s32 res;
 
 	res = bp_read_master_ctx(master, &master_ctx, offset / BP_NODES_PER_MASTER);
@@ -169,12 +142,12 @@ s32 bp_clear_bitmap(master_node_t *master, u32 offset)
 		dprintf_error(BPTREE, " Error: read master ctx\n");
 		return -1;
 	}
-	sub_master = master_ctx.master;
+	sub_master = master_ctx.m_ondisk;
 
-	assert(test_bit(sub_master->m_ondisk->bitmap, offset % BP_NODES_PER_MASTER));
-	clear_bit(sub_master->m_ondisk->bitmap, offset % BP_NODES_PER_MASTER);
-	sub_master->m_ondisk->m_bitmap_free++;
-	assert(sub_master->m_ondisk->m_bitmap_free <= BP_NODES_PER_MASTER);
+	assert(test_bit(sub_master->bitmap, offset % BP_NODES_PER_MASTER));
+	clear_bit(sub_master->bitmap, offset % BP_NODES_PER_MASTER);
+	sub_master->m_bitmap_free++;
+	assert(sub_master->m_bitmap_free <= BP_NODES_PER_MASTER);
 
 	bp_release_master_ctx(master, &master_ctx, DIRTY);
 
@@ -184,7 +157,7 @@ s32 bp_clear_bitmap(master_node_t *master, u32 offset)
 s32 bp_test_bitmap(master_node_t *master, u32 offset)
 {
 	master_ctx_t master_ctx;
-	master_node_t *sub_master;
+	master_ondisk_node_t *sub_master;
 	s32 res;
 
 	res = bp_read_master_ctx(master, &master_ctx, offset / BP_NODES_PER_MASTER);
@@ -192,9 +165,9 @@ s32 bp_test_bitmap(master_node_t *master, u32 offset)
 		dprintf_error(BPTREE, " Error: read master ctx\n");
 		return -1;
 	}
-	sub_master = master_ctx.master;
+	sub_master = master_ctx.m_ondisk;
 
-	res = test_bit(sub_master->m_ondisk->bitmap, offset % BP_NODES_PER_MASTER);
+	res = test_bit(sub_master->bitmap, offset % BP_NODES_PER_MASTER);
 
 	bp_release_master_ctx(master, &master_ctx, DIRTY);
 
@@ -204,7 +177,7 @@ s32 bp_test_bitmap(master_node_t *master, u32 offset)
 s32 bp_inc_free_bitmap(master_node_t *master, u32 offset)
 {
 	master_ctx_t master_ctx;
-	master_node_t *sub_master;
+	master_ondisk_node_t *sub_master;
 	s32 res;
 
 	res = bp_read_master_ctx(master, &master_ctx, offset / BP_NODES_PER_MASTER);
@@ -212,10 +185,10 @@ s32 bp_inc_free_bitmap(master_node_t *master, u32 offset)
 		dprintf_error(BPTREE, " Error: read master ctx\n");
 		return -1;
 	}
-	sub_master = master_ctx.master;
+	sub_master = master_ctx.m_ondisk;
 
-	sub_master->m_ondisk->m_bitmap_free++;
-	assert(sub_master->m_ondisk->m_bitmap_free <= BP_NODES_PER_MASTER);
+	sub_master->m_bitmap_free++;
+	assert(sub_master->m_bitmap_free <= BP_NODES_PER_MASTER);
 
 	bp_release_master_ctx(master, &master_ctx, NVF_CLEAN);
 
@@ -261,7 +234,7 @@ s32 bp_scan_bitmap(master_node_t *master)
 
 	for (i = 0; i < max_master; i++) {
 		master_ctx_t master_ctx;
-		master_node_t *sub_master;
+		master_ondisk_node_t *sub_master;
 		s32 res;
 
 		res = bp_read_master_ctx(master, &master_ctx, last_touched_master);
@@ -269,13 +242,13 @@ s32 bp_scan_bitmap(master_node_t *master)
 			dprintf_error(BPTREE, " Error: read master ctx \n");
 			return -1;
 		}
-		sub_master = master_ctx.master;
+		sub_master = master_ctx.m_ondisk;
 
-		if (sub_master->m_ondisk->m_bitmap_free) {
+		if (sub_master->m_bitmap_free) {
 			s32 bitmap_length;
 			bitmap_length = (last_touched_master + 1 == max_master) ? (max_offset % BP_NODES_PER_MASTER) :
 					BP_NODES_PER_MASTER;
-			free_blk = _bp_scan_bitmap(sub_master->m_ondisk->bitmap, last_touched_offset, bitmap_length);
+			free_blk = _bp_scan_bitmap(sub_master->bitmap, last_touched_offset, bitmap_length);
 		} else {
 			free_blk = 0;
 		}
@@ -370,25 +343,11 @@ int bp_alloc_inode_and_master(struct nvfuse_superblock *sb, master_node_t *maste
 
 void bp_init_root(master_node_t *master)
 {
-	struct nvfuse_inode_ctx *ictx;
 	index_node_t *root;
-	struct nvfuse_buffer_head *bh;
-	offset_t new_bno;
 
 	/* allocation of root node block */
-	//ictx = nvfuse_read_inode(master->m_sb, NULL, master->m_ino);
-	ictx = master->m_ictx;
-
-	new_bno = bp_alloc_bitmap(master, ictx);
-	bh = nvfuse_get_bh(master->m_sb, ictx, master->m_ino, new_bno, READ, NVFUSE_TYPE_META);
-
-	root = (index_node_t *)B_dALLOC(master, master->m_ondisk->m_root, ALLOC_READ);
-	root->i_root = 1;
-	root->i_offset = 1;
-	root->i_flag = DATA_FLAG;
-	root->i_status = INDEX_NODE_USED;
-	root->i_bh = bh;
-	root->i_buf = bh->bh_buf;
+	root = (index_node_t *)B_dALLOC(master, 0, ALLOC_CREATE);
+	root->i_head->i_root = 1;
 	master->m_ondisk->m_root = root->i_offset;
 
 	B_WRITE(master, root, root->i_offset);
@@ -424,7 +383,9 @@ int bp_bin_search(bkey_t *key, key_pair_t *pair, int max,
 		  int (*compare)(void *, void *, void *start, int num, int mid))
 {
 	int min = 0, mid = 0;
-#if 0
+#if 1
+	int ret;
+#else
 	u64 key1, key2;
 	key1 = *key;
 #endif
@@ -432,14 +393,13 @@ int bp_bin_search(bkey_t *key, key_pair_t *pair, int max,
 	while (max >= min) {
 		mid = (min + max) >> 1;
 #if 1
-		if (compare((void *)key, (void *)B_KEY_PAIR(pair, mid), (void *)pair, max, mid) == 0)
+		ret = compare((void *)key, (void *)B_KEY_PAIR(pair, mid), (void *)pair, max, mid);
+		if (ret == 0)
 			return mid;
-		else {
-			if (compare((void *)key, (void *)B_KEY_PAIR(pair, mid), (void *)pair, max, mid) < 0)
-				max = mid - 1;
-			else
-				min = mid + 1;
-		}
+		else if (ret < 0)
+			max = mid - 1;
+		else
+			min = mid + 1;
 #else
 		key2 = *B_KEY_PAIR(pair, mid);
 
@@ -478,36 +438,36 @@ index_node_t *bp_add_root_node(master_node_t *master, index_node_t *dp, bkey_t *
 	}
 
 	src = dp->i_pair;
-	B_PAIR_COPY_N(pair, src, 0, 0, dp->i_num);
+	B_PAIR_COPY_N(pair, src, 0, 0, dp->i_head->i_num);
 
-	bp_merge_key2(pair, key, value, dp->i_num + 1);
+	bp_merge_key2(pair, key, value, dp->i_head->i_num + 1);
 
-	offset = (dp->i_num) / 2;
-	dp->i_num -= offset;
-	dp_left->i_num = dp->i_num;
-	dp_right->i_num += offset;
-	dp_right->i_num++;
+	offset = (dp->i_head->i_num) / 2;
+	dp->i_head->i_num -= offset;
+	dp_left->i_head->i_num = dp->i_head->i_num;
+	dp_right->i_head->i_num += offset;
+	dp_right->i_head->i_num++;
 
 	bp_init_pair(dp_left->i_pair, FANOUT);
 	bp_init_pair(dp_right->i_pair, FANOUT);
 
 	//distribution left
 	dst = dp_left->i_pair;
-	B_PAIR_COPY_N(dst, pair, 0, 0, dp_left->i_num);
+	B_PAIR_COPY_N(dst, pair, 0, 0, dp_left->i_head->i_num);
 	dst = dp_right->i_pair;
 	//distribution right
-	B_PAIR_COPY_N(dst, pair, 0, dp_left->i_num, dp_right->i_num);
+	B_PAIR_COPY_N(dst, pair, 0, dp_left->i_head->i_num, dp_right->i_head->i_num);
 
 	parent_ip = dp;
-	parent_ip->i_flag = 0;
-	parent_ip->i_num = 1;
+	parent_ip->i_head->i_flag = 0;
+	parent_ip->i_head->i_num = 1;
 
 	bp_init_pair(parent_ip->i_pair, FANOUT);
 
 	B_ITEM_COPY(B_ITEM_GET(parent_ip, 0), &dp_left->i_offset);
-	B_KEY_COPY(B_KEY_GET(parent_ip, 0), B_KEY_GET(dp_left, dp_left->i_num - 1));
+	B_KEY_COPY(B_KEY_GET(parent_ip, 0), B_KEY_GET(dp_left, dp_left->i_head->i_num - 1));
 	B_ITEM_COPY(B_ITEM_GET(parent_ip, 1), &dp_right->i_offset);
-	B_KEY_COPY(B_KEY_GET(parent_ip, 1), B_KEY_GET(dp_right, dp_right->i_num - 1));
+	B_KEY_COPY(B_KEY_GET(parent_ip, 1), B_KEY_GET(dp_right, dp_right->i_head->i_num - 1));
 
 	/* insert list */
 	B_NEXT(dp_right) = B_NEXT(dp_left);
@@ -515,6 +475,7 @@ index_node_t *bp_add_root_node(master_node_t *master, index_node_t *dp, bkey_t *
 
 	if (B_NEXT(dp_left)) {
 		node = B_dALLOC(master, B_NEXT(dp_left), ALLOC_READ);
+		B_READ(master, node, node->i_offset, 1, 0);
 	}
 
 	if (node) {
@@ -540,7 +501,7 @@ index_node_t *bp_add_root_node(master_node_t *master, index_node_t *dp, bkey_t *
 
 int bp_distribute_node(index_node_t *p_ip, key_pair_t *pair)
 {
-	B_PAIR_COPY_N(p_ip->i_pair, pair, 0, 0, p_ip->i_num + 1);
+	B_PAIR_COPY_N(p_ip->i_pair, pair, 0, 0, p_ip->i_head->i_num + 1);
 	return 0;
 }
 
@@ -556,17 +517,17 @@ int bp_split_data(master_node_t *master, index_node_t *p_ip, key_pair_t *child,
 
 	bp_init_pair(p_ip->i_pair, FANOUT);
 
-	p_ip->i_num = 0;
-	p_ip->i_root = 0;
+	p_ip->i_head->i_num = 0;
+	p_ip->i_head->i_root = 0;
 
 	//distribute half
 	for (i = 0; i < count / 2; i++) {
 		B_KEY_COPY(B_KEY_GET(p_ip, i), &child->i_key[child_count]);
 		B_ITEM_COPY(B_ITEM_GET(p_ip, i), &child->i_item[child_count]);
-		p_ip->i_num++;
+		p_ip->i_head->i_num++;
 		child_count++;
 	}
-	p_ip->i_num--;
+	p_ip->i_head->i_num--;
 	B_KEY_COPY(median->i_key, &child->i_key[i - 1]);
 	B_ITEM_COPY(median->i_item, &p_ip->i_offset);
 
@@ -574,10 +535,10 @@ int bp_split_data(master_node_t *master, index_node_t *p_ip, key_pair_t *child,
 	for (i = 0; i < count / 2; i++) {
 		B_KEY_COPY(B_KEY_GET(sibling_ip, i), &child->i_key[child_count]);
 		B_ITEM_COPY(B_ITEM_GET(sibling_ip, i), &child->i_item[child_count]);
-		sibling_ip->i_num++;
+		sibling_ip->i_head->i_num++;
 		child_count++;
 	}
-	sibling_ip->i_num--;
+	sibling_ip->i_head->i_num--;
 
 	return 0;
 }
@@ -615,7 +576,7 @@ int bp_split_data_node(master_node_t *master,
 	index_node_t *node = NULL;
 	key_pair_t *pair_array;
 	int i, offset = 0, count = 0;
-	int alloc_num = dp->i_num + 1;
+	int alloc_num = dp->i_head->i_num + 1;
 #if 0
 	int seq_detection = 1;
 #endif
@@ -627,7 +588,7 @@ int bp_split_data_node(master_node_t *master,
 	dp_right = B_dALLOC(master, 0, ALLOC_CREATE);
 	B_READ(master, dp_right, dp_right->i_offset, 0, 0);
 
-	for (i = 0; i < ip->i_num + 1; i++) {
+	for (i = 0; i < ip->i_head->i_num + 1; i++) {
 		if (!B_ITEM_CMP(B_ITEM_GET(ip, i), &dp->i_offset)) {
 			B_KEY_INIT(B_KEY_GET(ip, i));
 			B_ITEM_INIT(B_ITEM_GET(ip, i));
@@ -636,7 +597,7 @@ int bp_split_data_node(master_node_t *master,
 	}
 
 #if 0
-	for (i = 0; i < dp->i_num - 1; i++) {
+	for (i = 0; i < dp->i_head->i_num - 1; i++) {
 		u64 key1 = *B_KEY_GET(dp, i);
 		u64 key2 = *B_KEY_GET(dp, (i + 1));
 
@@ -652,21 +613,21 @@ int bp_split_data_node(master_node_t *master,
 	}
 #endif
 
-	B_PAIR_COPY_N(pair_array, dp->i_pair, 0, 0, dp->i_num);
-	bp_merge_key2(pair_array, key, value, dp->i_num + 1);
+	B_PAIR_COPY_N(pair_array, dp->i_pair, 0, 0, dp->i_head->i_num);
+	bp_merge_key2(pair_array, key, value, dp->i_head->i_num + 1);
 
-	offset = (dp->i_num) / 2;
-	dp->i_num -= offset;
-	dp_right->i_num += offset;
-	dp_right->i_num++;
+	offset = (dp->i_head->i_num) / 2;
+	dp->i_head->i_num -= offset;
+	dp_right->i_head->i_num += offset;
+	dp_right->i_head->i_num++;
 
 	//init
 	bp_init_pair(dp_left->i_pair, FANOUT);
 	bp_init_pair(dp_right->i_pair, FANOUT);
 
 	//distribute
-	B_PAIR_COPY_N(dp_left->i_pair, pair_array, 0, 0, dp->i_num);
-	B_PAIR_COPY_N(dp_right->i_pair, pair_array, 0, dp->i_num, dp_right->i_num);
+	B_PAIR_COPY_N(dp_left->i_pair, pair_array, 0, 0, dp->i_head->i_num);
+	B_PAIR_COPY_N(dp_right->i_pair, pair_array, 0, dp->i_head->i_num, dp_right->i_head->i_num);
 
 	/* insert list */
 	B_NEXT(dp_right) = B_NEXT(dp_left);
@@ -693,7 +654,7 @@ int bp_split_data_node(master_node_t *master,
 		dp_right = dp_right;
 
 	count = 0;
-	for (i = 0; i < ip->i_num + 1; i++) {
+	for (i = 0; i < ip->i_head->i_num + 1; i++) {
 		if (!B_KEY_ISNULL(B_KEY_GET(ip, i))) {
 			B_KEY_COPY(&pair->i_key[count], B_KEY_GET(ip, i));
 			B_ITEM_COPY(&pair->i_item[count], B_ITEM_GET(ip, i));
@@ -701,8 +662,8 @@ int bp_split_data_node(master_node_t *master,
 		}
 	}
 
-	bp_merge_key2(pair, B_KEY_GET(dp_left, dp_left->i_num - 1), (u32 *)&(dp_left->i_offset), ++count);
-	bp_merge_key2(pair, B_KEY_GET(dp_right, dp_right->i_num - 1), (u32 *)&(dp_right->i_offset), ++count);
+	bp_merge_key2(pair, B_KEY_GET(dp_left, dp_left->i_head->i_num - 1), (u32 *)&(dp_left->i_offset), ++count);
+	bp_merge_key2(pair, B_KEY_GET(dp_right, dp_right->i_head->i_num - 1), (u32 *)&(dp_right->i_offset), ++count);
 
 	B_WRITE(master, dp_left, dp_left->i_offset);
 	B_WRITE(master, dp_right, dp_right->i_offset);
@@ -745,17 +706,17 @@ int bp_split_tree(master_node_t *master, index_node_t *dp, bkey_t *key, bitem_t
 		if (dp) {
 			bp_split_data_node(master, ip, dp, key, value, pair_arr);
 			dp = NULL;
-			ip->i_num++;
-			count = ip->i_num + 1;
+			ip->i_head->i_num++;
+			count = ip->i_head->i_num + 1;
 			new_child = bp_split_index_node(master, ip, pair_arr, count, median, 1);
 		} else if (new_child) {
 			bkey_t key = 0;
 			int ptr = 0;
 
-			ip->i_num++;
-			count = ip->i_num + 1;
+			ip->i_head->i_num++;
+			count = ip->i_head->i_num + 1;
 
-			for (i = 0; i < ip->i_num; i++) {
+			for (i = 0; i < ip->i_head->i_num; i++) {
 				if (!B_ITEM_CMP(B_ITEM_GET(ip, i), median->i_item)) {
 					B_KEY_COPY(&key, B_KEY_GET(ip, i));
 				} else {
@@ -764,17 +725,17 @@ int bp_split_tree(master_node_t *master, index_node_t *dp, bkey_t *key, bitem_t
 				}
 			}
 
-			bp_merge_key2(pair_arr, median->i_key, median->i_item, ip->i_num);
+			bp_merge_key2(pair_arr, median->i_key, median->i_item, ip->i_head->i_num);
 			B_PAIR_INIT(median, 0);
 
-			if (B_KEY_CMP(&key, B_KEY_GET(new_child, new_child->i_num)) > 0) {
-				bp_merge_key2(pair_arr, &key, (u32 *)(&new_child->i_offset), ip->i_num + 1);
+			if (B_KEY_CMP(&key, B_KEY_GET(new_child, new_child->i_head->i_num)) > 0) {
+				bp_merge_key2(pair_arr, &key, (u32 *)(&new_child->i_offset), ip->i_head->i_num + 1);
 			} else {
-				bp_merge_key2(pair_arr, B_KEY_GET(new_child, new_child->i_num), (u32 *)(&new_child->i_offset),
-					      ip->i_num + 1);
+				bp_merge_key2(pair_arr, B_KEY_GET(new_child, new_child->i_head->i_num), (u32 *)(&new_child->i_offset),
+					      ip->i_head->i_num + 1);
 			}
 
-			bubble_sort(master, pair_arr, count, compare_str);
+			bp_sort_pair(master, pair_arr, count, compare_str);
 
 			B_WRITE(master, new_child, new_child->i_offset);
 			B_RELEASE_BH(master, new_child->i_bh);
@@ -788,7 +749,7 @@ int bp_split_tree(master_node_t *master, index_node_t *dp, bkey_t *key, bitem_t
 		B_WRITE(master, ip, ip->i_offset);
 		if (new_child == NULL)
 			break;
-		if (ip->i_root)
+		if (ip->i_head->i_root)
 			break;
 		if (!master->m_sp)
 			break;
@@ -804,23 +765,23 @@ int bp_split_tree(master_node_t *master, index_node_t *dp, bkey_t *key, bitem_t
 		root = B_iALLOC(master, 0, ALLOC_CREATE);
 		B_READ(master, root, root->i_offset, 0, 0);
 
-		if (B_KEY_CMP(B_KEY_GET(ip, ip->i_num - 1), B_KEY_GET(new_child, new_child->i_num - 1)) < 0) {
+		if (B_KEY_CMP(B_KEY_GET(ip, ip->i_head->i_num - 1), B_KEY_GET(new_child, new_child->i_head->i_num - 1)) < 0) {
 			B_ITEM_COPY(B_ITEM_GET(root, 0), &ip->i_offset);
 			B_ITEM_COPY(B_ITEM_GET(root, 1), &new_child->i_offset);
 
 			B_KEY_COPY(B_KEY_GET(root, 0), median->i_key);
-			B_KEY_COPY(B_KEY_GET(root, 1), B_KEY_GET(new_child, new_child->i_num - 1));
+			B_KEY_COPY(B_KEY_GET(root, 1), B_KEY_GET(new_child, new_child->i_head->i_num - 1));
 		} else {
 			B_ITEM_COPY(B_ITEM_GET(root, 0), &new_child->i_offset);
 			B_ITEM_COPY(B_ITEM_GET(root, 1), &ip->i_offset);
 
 			B_KEY_COPY(B_KEY_GET(root, 0), median->i_key);
-			B_KEY_COPY(B_KEY_GET(root, 1), B_KEY_GET(ip, ip->i_num - 1));
+			B_KEY_COPY(B_KEY_GET(root, 1), B_KEY_GET(ip, ip->i_head->i_num - 1));
 		}
 
-		temp->i_root = 0;
-		new_child->i_root = 0;
-		root->i_root = 1;
+		temp->i_head->i_root = 0;
+		new_child->i_head->i_root = 0;
+		root->i_head->i_root = 1;
 
 		master->m_ondisk->m_root = root->i_offset;
 
@@ -830,7 +791,7 @@ int bp_split_tree(master_node_t *master, index_node_t *dp, bkey_t *key, bitem_t
 		nvfuse_mark_dirty_bh(master->m_sb, master->m_bh);
 #endif
 
-		root->i_num = 1;
+		root->i_head->i_num = 1;
 
 		B_WRITE(master, root, root->i_offset);
 		B_WRITE(master, ip, ip->i_offset);
@@ -920,7 +881,7 @@ int bp_merge_key(master_node_t *master, index_node_t *dp, bkey_t *key, bitem_t *
 	int max = FANOUT;
 	key_pair_t *pair = dp->i_pair;
 
-	max = dp->i_num + 1;
+	max = dp->i_head->i_num + 1;
 	for (i = max - 2; i >= 0; i--) {
 		if (!B_KEY_ISNULL(B_KEY_PAIR(pair, i)) && B_KEY_CMP(B_KEY_PAIR(pair, i), key) < 0) {
 			break;
@@ -936,7 +897,7 @@ int bp_merge_key(master_node_t *master, index_node_t *dp, bkey_t *key, bitem_t *
 	if (B_KEY_ISNULL(B_KEY_PAIR(pair, i))) {
 		B_KEY_COPY(B_KEY_PAIR(pair, i), key);
 		B_ITEM_COPY(B_ITEM_PAIR(pair, i), value);
-		dp->i_num++;
+		dp->i_head->i_num++;
 	}
 
 	return 0;
@@ -983,13 +944,13 @@ int bp_insert_key_tree(master_node_t *master,
 	}
 
 	//check overflow in case of root node
-	if (dp->i_root && dp->i_num == FANOUT) {
+	if (dp->i_head->i_root && dp->i_head->i_num == FANOUT) {
 		root = bp_add_root_node(master, dp, key, value);
-		root->i_root = 1;
+		root->i_head->i_root = 1;
 		B_WRITE(master, root, root->i_offset);
 		B_RELEASE_BH(master, root->i_bh);
 		B_RELEASE(master, root);
-	} else if (dp->i_num == FANOUT) {
+	} else if (dp->i_head->i_num == FANOUT) {
 		bp_split_tree(master, dp, key, value);
 	} else {
 		bp_merge_key(master, dp, key, value);
@@ -1009,6 +970,152 @@ RES:
 }
 
 
+/* fill nodes of one tree level from sorted entries and collect (max key, offset) of each node */
+static int bp_bulk_load_level(master_node_t *master, key_pair_t *src, int num, key_pair_t *dst,
+			      int is_leaf)
+{
+	index_node_t *node, *prev = NULL;
+	int done = 0, remain, count;
+	int n = 0;
+
+	while (done < num) {
+		remain = num - done;
+		/* pack nodes full, but split a short tail so that no node underflows */
+		if (remain <= FANOUT)
+			count = remain;
+		else if (remain < FANOUT + (FANOUT / 2 + 1))
+			count = (remain + 1) / 2;
+		else
+			count = FANOUT;
+
+		if (is_leaf)
+			node = B_dALLOC(master, 0, ALLOC_CREATE);
+		else
+			node = B_iALLOC(master, 0, ALLOC_CREATE);
+		B_READ(master, node, node->i_offset, 0, 0);
+
+		bp_init_pair(node->i_pair, FANOUT);
+		B_PAIR_COPY_N(node->i_pair, src, 0, done, count);
+		/* index nodes keep i_num + 1 children */
+		node->i_head->i_num = is_leaf ? count : count - 1;
+
+		B_KEY_COPY(B_KEY_PAIR(dst, n), B_KEY_GET(node, count - 1));
+		B_ITEM_COPY(B_ITEM_PAIR(dst, n), (bitem_t *)&node->i_offset);
+		n++;
+		done += count;
+
+		if (prev) {
+			if (is_leaf) {
+				B_PREV(node) = prev->i_offset;
+				B_NEXT(prev) = node->i_offset;
+			}
+			B_WRITE(master, prev, prev->i_offset);
+			B_RELEASE_BH(master, prev->i_bh);
+			B_RELEASE(master, prev);
+		}
+		prev = node;
+	}
+
+	if (prev) {
+		B_WRITE(master, prev, prev->i_offset);
+		B_RELEASE_BH(master, prev->i_bh);
+		B_RELEASE(master, prev);
+	}
+
+	return n;
+}
+
+/*
+ * build the tree bottom-up from keys sorted in ascending order without duplicates.
+ * leaves are fully packed and linked, then each index level is packed over the
+ * level below until the remaining entries fit into the existing root node.
+ * only an empty tree can be bulk-loaded; -1 is returned otherwise and the
+ * caller falls back to B_INSERT.
+ */
+int bp_bulk_load(master_node_t *master, key_pair_t *pair, int num)
+{
+	index_node_t *root;
+	key_pair_t level[2];
+	key_pair_t *src;
+	bkey_t *keys;
+	bitem_t *items;
+	int max_nodes;
+	int src_num;
+	int is_leaf;
+	int i, cur;
+
+	if (num <= 0)
+		return 0;
+
+	for (i = 1; i < num; i++) {
+		if (B_KEY_CMP(B_KEY_PAIR(pair, i - 1), B_KEY_PAIR(pair, i)) >= 0) {
+			dprintf_error(BPTREE, " bulk load requires sorted unique keys \n");
+			return -1;
+		}
+	}
+
+	root = B_dALLOC(master, master->m_ondisk->m_root, ALLOC_READ);
+	B_READ(master, root, root->i_offset, HEAD_SYNC, NOLOCK);
+	if (!B_ISLEAF(root) || root->i_head->i_num) {
+		B_RELEASE_BH(master, root->i_bh);
+		B_RELEASE(master, root);
+		return -1;
+	}
+
+	/* the leaf level needs the most nodes, upper levels reuse the same arrays */
+	max_nodes = CEIL(num, FANOUT);
+	keys = (bkey_t *)malloc(BP_KEY_SIZE * max_nodes * 2);
+	items = (bitem_t *)malloc(BP_ITEM_SIZE * max_nodes * 2);
+	if (keys == NULL || items == NULL) {
+		dprintf_error(BPTREE, " malloc error \n");
+		free(keys);
+		free(items);
+		B_RELEASE_BH(master, root->i_bh);
+		B_RELEASE(master, root);
+		return -1;
+	}
+
+	level[0].i_key = keys;
+	level[0].i_item = items;
+	level[1].i_key = (bkey_t *)((char *)keys + BP_KEY_SIZE * max_nodes);
+	level[1].i_item = items + max_nodes;
+
+	src = pair;
+	src_num = num;
+	is_leaf = 1;
+	cur = 0;
+
+	while (src_num > FANOUT) {
+		src_num = bp_bulk_load_level(master, src, src_num, &level[cur], is_leaf);
+		src = &level[cur];
+		cur ^= 1;
+		is_leaf = 0;
+	}
+
+	/* the remaining entries become the root */
+	bp_init_pair(root->i_pair, FANOUT);
+	B_PAIR_COPY_N(root->i_pair, src, 0, 0, src_num);
+	if (is_leaf) {
+		root->i_head->i_num = src_num;
+	} else {
+		root->i_head->i_flag = INDEX_FLAG;
+		root->i_head->i_num = src_num - 1;
+	}
+	root->i_head->i_root = 1;
+
+	B_WRITE(master, root, root->i_offset);
+	B_RELEASE_BH(master, root->i_bh);
+	B_RELEASE(master, root);
+
+	free(keys);
+	free(items);
+
+	master->m_key_count += num;
+
+	return 0;
+}
+
+
 int bp_redist_data_child(master_node_t *master, index_node_t *ip, index_node_t *child, int data_node)
 {
 	index_node_t *child2;
@@ -1020,7 +1127,7 @@ int bp_redist_data_child(master_node_t *master, index_node_t *ip, index_node_t *
 	int target1 = 0, target2 = 0;
 	int max_count;
 
-	for (i = 0; i < ip->i_num + 1; i++) {
+	for (i = 0; i < ip->i_head->i_num + 1; i++) {
 		if (!B_ITEM_CMP(B_ITEM_GET(ip, i), &child->i_offset)) {
 			target1 = i;
 			break;
@@ -1029,8 +1136,8 @@ int bp_redist_data_child(master_node_t *master, index_node_t *ip, index_node_t *
 
 	if (target1 == 0)
 		target2 = 1;
-	else if (target1 >= ip->i_num)
-		target2 = ip->i_num - 1;
+	else if (target1 >= ip->i_head->i_num)
+		target2 = ip->i_head->i_num - 1;
 	else
 		target2 = target1 + 1;
 
@@ -1044,26 +1151,26 @@ int bp_redist_data_child(master_node_t *master, index_node_t *ip, index_node_t *
 
 	if (data_node) {
 		//collect keys and items
-		B_PAIR_COPY_N(pair, child->i_pair, 0, 0, child->i_num);
+		B_PAIR_COPY_N(pair, child->i_pair, 0, 0, child->i_head->i_num);
 
 		child2 = B_dALLOC(master, *B_ITEM_GET(ip, target2), ALLOC_READ);
 		B_READ(master, child2, child2->i_offset, 1, 0);
 
-		B_PAIR_COPY_N(pair, child2->i_pair, child->i_num, 0, child2->i_num);
-		count = child->i_num + child2->i_num;
+		B_PAIR_COPY_N(pair, child2->i_pair, child->i_head->i_num, 0, child2->i_head->i_num);
+		count = child->i_head->i_num + child2->i_head->i_num;
 
 	} else {
 		//collect keys and items
-		B_PAIR_COPY_N(pair, child->i_pair, 0, 0, child->i_num + 1);
+		B_PAIR_COPY_N(pair, child->i_pair, 0, 0, child->i_head->i_num + 1);
 
 		child2 = B_dALLOC(master, *B_ITEM_GET(ip, target2), ALLOC_READ);
 		B_READ(master, child2, child2->i_offset, 1, 0);
 
-		B_PAIR_COPY_N(pair, child2->i_pair, child->i_num + 1, 0, child2->i_num + 1);
-		count = child->i_num + 1 + child2->i_num + 1;
+		B_PAIR_COPY_N(pair, child2->i_pair, child->i_head->i_num + 1, 0, child2->i_head->i_num + 1);
+		count = child->i_head->i_num + 1 + child2->i_head->i_num + 1;
 	}
 
-	bubble_sort(master, pair, count, compare_str);
+	bp_sort_pair(master, pair, count, compare_str);
 
 	max_count = data_node ? FANOUT : (FANOUT + 1);
 
@@ -1078,17 +1185,17 @@ int bp_redist_data_child(master_node_t *master, index_node_t *ip, index_node_t *
 			de_alloc = child2;
 		}
 
-		for (; i < ip->i_num; i++) {
+		for (; i < ip->i_head->i_num; i++) {
 			B_PAIR_COPY(ip->i_pair, ip->i_pair, i, i + 1);
 		}
 		B_PAIR_INIT(ip->i_pair, i);
 
-		ip->i_num--;
+		ip->i_head->i_num--;
 
-		node->i_num = count;
+		node->i_head->i_num = count;
 		count = 0;
 		for (i = 0; i < FANOUT; i++) {
-			if (i < node->i_num) {
+			if (i < node->i_head->i_num) {
 				B_PAIR_COPY(node->i_pair, pair, i, count);
 				count++;
 			}
@@ -1133,7 +1240,7 @@ int bp_redist_data_child(master_node_t *master, index_node_t *ip, index_node_t *
 		}
 
 		if (!data_node)
-			node->i_num--;
+			node->i_head->i_num--;
 
 		B_DEALLOC(master, de_alloc);
 	} else {
@@ -1144,42 +1251,42 @@ int bp_redist_data_child(master_node_t *master, index_node_t *ip, index_node_t *
 			child = t;
 		}
 
-		child->i_num = count / 2;
-		child2->i_num = count / 2;
+		child->i_head->i_num = count / 2;
+		child2->i_head->i_num = count / 2;
 		if (count % 2) {
-			child2->i_num++;
+			child2->i_head->i_num++;
 		}
 
 		//distribute
 		count = 0;
-		B_PAIR_COPY_N(child->i_pair, pair, 0, 0, child->i_num);
-		B_PAIR_INIT_N(child->i_pair, child->i_num, (FANOUT - child->i_num));
+		B_PAIR_COPY_N(child->i_pair, pair, 0, 0, child->i_head->i_num);
+		B_PAIR_INIT_N(child->i_pair, child->i_head->i_num, (FANOUT - child->i_head->i_num));
 
-		B_PAIR_COPY_N(child2->i_pair, pair, 0, child->i_num, child2->i_num);
-		B_PAIR_INIT_N(child2->i_pair, child2->i_num, (FANOUT - child2->i_num));
+		B_PAIR_COPY_N(child2->i_pair, pair, 0, child->i_head->i_num, child2->i_head->i_num);
+		B_PAIR_INIT_N(child2->i_pair, child2->i_head->i_num, (FANOUT - child2->i_head->i_num));
 
 		//change key
-		for (i = 0; i < ip->i_num + 1; i++) {
+		for (i = 0; i < ip->i_head->i_num + 1; i++) {
 			if (!B_ITEM_CMP(B_ITEM_GET(ip, i), &child->i_offset)) {
-				B_KEY_COPY(B_KEY_GET(ip, i), B_KEY_GET(child, child->i_num - 1));
+				B_KEY_COPY(B_KEY_GET(ip, i), B_KEY_GET(child, child->i_head->i_num - 1));
 			}
 			if (!B_ITEM_CMP(B_ITEM_GET(ip, i), &child2->i_offset)) {
-				if (B_KEY_CMP(B_KEY_GET(child2, child2->i_num - 1), B_KEY_GET(ip, i)) > 0) {
-					B_KEY_COPY(B_KEY_GET(ip, i), B_KEY_GET(child2, child2->i_num - 1));
+				if (B_KEY_CMP(B_KEY_GET(child2, child2->i_head->i_num - 1), B_KEY_GET(ip, i)) > 0) {
+					B_KEY_COPY(B_KEY_GET(ip, i), B_KEY_GET(child2, child2->i_head->i_num - 1));
 				}
 			}
 		}
 
 		if (!data_node) {
-			child->i_num--;
-			child2->i_num--;
+			child->i_head->i_num--;
+			child2->i_head->i_num--;
 		}
 	}
 
 	bp_release_pair(master, pair, alloc_num);
 
 	if (de_alloc) {
-		de_alloc->i_status = INDEX_NODE_FREE;
+		de_alloc->i_head->i_status = INDEX_NODE_FREE;
 		memset(de_alloc->i_bh->bh_buf, 0x00, CLUSTER_SIZE);
 		B_WRITE(master, de_alloc, de_alloc->i_offset);
 	}
@@ -1196,7 +1303,7 @@ int bp_redist_data_child(master_node_t *master, index_node_t *ip, index_node_t *
 	B_RELEASE(master, child2);
 	B_RELEASE(master, child);
 
-	if (ip->i_num + 1 >= (FANOUT / 2 + 1))//INDEX_MIN_WAY
+	if (ip->i_head->i_num + 1 >= (FANOUT / 2 + 1))//INDEX_MIN_WAY
 		return 0;
 	else
 		return 1; //under flow
@@ -1243,7 +1350,7 @@ int bp_merge_key_tree(master_node_t *master, bkey_t *key, index_node_t *dp, int
 			break;
 	}
 
-	if (ip->i_root && ip->i_num == 0) {
+	if (ip->i_head->i_root && ip->i_head->i_num == 0) {
 		B_DEALLOC(master, ip);
 
 		master->m_ondisk->m_root = *B_ITEM_GET(ip, 0);
@@ -1255,7 +1362,7 @@ int bp_merge_key_tree(master_node_t *master, bkey_t *key, index_node_t *dp, int
 
 		root = B_iALLOC(master, master->m_ondisk->m_root, ALLOC_READ);
 		B_READ(master, root, root->i_offset, 1, ALLOC_READ);
-		root->i_root = 1;
+		root->i_head->i_root = 1;
 		B_WRITE(master, root, root->i_offset);
 
 		/* necessary to mark as a free node*/
@@ -1277,6 +1384,7 @@ int bp_merge_key_tree(master_node_t *master, bkey_t *key, index_node_t *dp, int
 	return ret;
 }
 
+#ifndef KEY_IS_INTEGER
 static int bp_compare_index_node(void *k1, void *k2, void *start, int num, int mid)
 {
 	bkey_t  *key1 = (bkey_t *) k1;
@@ -1304,16 +1412,21 @@ static int bp_compare_index_node(void *k1, void *k2, void *start, int num, int m
 
 	return ret2;
 }
+#endif
 
 index_node_t *bp_next_node(master_node_t *master, index_node_t *ip, bkey_t *key)
 {
 	int offset = 0;
 	int key_num = 0;
 
-	if (B_KEY_CMP(key, B_KEY_GET(ip, ip->i_num - 1)) > 0) {
-		offset = *B_ITEM_GET(ip, ip->i_num);
+	if (B_KEY_CMP(key, B_KEY_GET(ip, ip->i_head->i_num - 1)) > 0) {
+		offset = *B_ITEM_GET(ip, ip->i_head->i_num);
 	} else {
-		key_num = bp_bin_search(key, ip->i_pair, ip->i_num, bp_compare_index_node);
+#ifdef KEY_IS_INTEGER
+		key_num = bp_lower_bound(ip->i_pair->i_key, ip->i_head->i_num, *key);
+#else
+		key_num = bp_bin_search(key, ip->i_pair, ip->i_head->i_num, bp_compare_index_node);
+#endif
 		offset = ip->i_pair->i_item[key_num];
 	}
 
@@ -1368,7 +1481,7 @@ int rsearch_data_node(master_node_t *master, bkey_t *s_key, bkey_t *e_key)
 	while (1) {
 		//dprintf_info(BPTREE, " key item : %d,%d\n", *B_KEY_GET(ip, index), *B_ITEM_GET(ip, index));
 		index++;
-		if (index == ip->i_num) {
+		if (index == ip->i_head->i_num) {
 			B_READ(master, ip, B_NEXT(ip), 1, 1);
 			index = 0;
 		}
@@ -1408,13 +1521,17 @@ int search_data_node(master_node_t *master, bkey_t *key, index_node_t **d)
 
 int get_pair_tree(index_node_t *dp, bkey_t *key)
 {
+#ifdef KEY_IS_INTEGER
+	return bp_search_key(dp->i_pair->i_key, dp->i_head->i_num, *key);
+#else
 	int key_num;
-	key_num = bp_bin_search(key, dp->i_pair, dp->i_num - 1, key_compare);
+	key_num = bp_bin_search(key, dp->i_pair, dp->i_head->i_num - 1, key_compare);
 
 	if (key_num < 0)
 		return key_num;
 	else
 		return key_num;
+#endif
 }
 
 int bp_remove_key(master_node_t *master, bkey_t *key)
@@ -1436,16 +1553,16 @@ int bp_remove_key(master_node_t *master, bkey_t *key)
 		goto RES;
 	}
 
-	for (; i < dp->i_num - 1; i++) {
+	for (; i < dp->i_head->i_num - 1; i++) {
 		B_PAIR_COPY(dp->i_pair, dp->i_pair, i, i + 1);
 	}
 	B_PAIR_INIT(dp->i_pair, i);
-	dp->i_num--;
+	dp->i_head->i_num--;
 
 #ifdef NVFUSE_USE_DELAYED_REDISTRIBUTION_BPTREE
-	if (dp->i_num >= 1)
+	if (dp->i_head->i_num >= 1)
 #else
-	if (dp->i_num >= (FANOUT / 2 + 1))
+	if (dp->i_head->i_num >= (FANOUT / 2 + 1))
 #endif
 	{
 		//INDEX_MIN_WAY
@@ -1456,7 +1573,7 @@ int bp_remove_key(master_node_t *master, bkey_t *key)
 		B_RELEASE(master, master->m_cur);
 		master->m_cur = 0;
 	} else {
-		//dprintf_info(BPTREE, " key merge num = %d\n ", dp->i_num);
+		//dprintf_info(BPTREE, " key merge num = %d\n ", dp->i_head->i_num);
 		bp_merge_key_tree(master, key, dp, i);
 	}
 
@@ -1470,20 +1587,10 @@ RES:
 }
 
 
-void bp_copy_node_to_raw(index_node_t *node, char *raw)
-{
-	if (node->i_flag != 0 && node->i_flag != 1) {
-		dprintf_error(BPTREE, " error copy node to raw \n");
-		assert(0);
-	}
-
-	rte_memcpy(raw, node, BP_NODE_HEAD_SIZE);
-	raw += BP_NODE_HEAD_SIZE;
-}
-
 void bp_print_node(index_node_t *node)
 {
 	dprintf_info(BPTREE, " node lbno = %d \n", node->i_offset);
+	dprintf_info(BPTREE, " node flag = %d num = %d \n", node->i_head->i_flag, node->i_head->i_num);
 	dprintf_info(BPTREE, " bh load = %d \n", node->i_bh->bh_bc->bc_load);
 	dprintf_info(BPTREE, " bh pno = %d\n", node->i_bh->bh_bc->bc_pno);
 	dprintf_info(BPTREE, " bh ino = %d\n", node->i_bh->bh_bc->bc_ino);
@@ -1491,20 +1598,6 @@ void bp_print_node(index_node_t *node)
 }
 
 
-void bp_copy_raw_to_node(index_node_t *node, char *raw)
-{
-	rte_memcpy(node, raw, BP_NODE_HEAD_SIZE);
-
-	if (node->i_flag != 0 && node->i_flag != 1) {
-		bp_print_node(node);
-		assert(0);
-	}
-
-	if (node->i_offset == 0) {
-		assert(0);
-	}
-}
-
 inline struct nvfuse_buffer_head *bp_read_block(master_node_t *master, int offset, int rwlock)
 {
 	lbno_t p_offset;
@@ -1519,18 +1612,27 @@ inline void bp_write_block(struct nvfuse_superblock *sb, struct nvfuse_buffer_he
 	nvfuse_release_bh(sb, bh, 0, DIRTY);
 }
 
-int bp_read_node(master_node_t *master, index_node_t *node, int offset, int sync, int rwlock)
+/* bind the handle to the node image in its buffer cache page */
+static void bp_map_node(master_node_t *master, index_node_t *node)
 {
-	node->i_bh = bp_read_block(master, offset, rwlock);
-	node->i_buf = node->i_bh->bh_buf + BP_NODE_SIZE * (offset % BP_CLUSTER_PER_NODE);
+	node->i_buf = node->i_bh->bh_buf + BP_NODE_SIZE * (node->i_offset % BP_CLUSTER_PER_NODE);
+	node->i_head = (index_node_head_t *)node->i_buf;
 
 	node->i_pair->i_key = (bkey_t *)(node->i_buf + BP_KEY_START);
 	node->i_pair->i_item = (bitem_t *)(node->i_buf + BP_ITEM_START(master));
+}
+
+int bp_read_node(master_node_t *master, index_node_t *node, int offset, int sync, int rwlock)
+{
+	/* a newly created node is already mapped by bp_alloc_node() */
+	if (!sync && node->i_bh && node->i_offset == offset)
+		return 0;
 
-	if (sync)
-		bp_copy_raw_to_node(node, node->i_buf);
+	node->i_bh = bp_read_block(master, offset, rwlock);
+	node->i_offset = offset;
+	bp_map_node(master, node);
 
-	if (node->i_flag != 0 && node->i_flag != 1) {
+	if (node->i_head->i_flag != 0 && node->i_head->i_flag != 1) {
 		dprintf_error(BPTREE, " Error: Invalid or Corrupted node data \n");
 		bp_print_node(node);
 		assert(0);
@@ -1567,7 +1669,7 @@ inline int bp_write_node(master_node_t *master, index_node_t *node, int offset)
 {
 	assert(node->i_bh);
 
-	bp_copy_node_to_raw(node, node->i_buf);
+	/* keys, items and header are modified in place */
 	nvfuse_mark_dirty_bh(master->m_sb, node->i_bh);
 	return 0;
 }
@@ -1578,7 +1680,7 @@ offset_t bp_alloc_bitmap(master_node_t *master, struct nvfuse_inode_ctx *ictx)
 {
 	struct nvfuse_buffer_head *bh;
 	struct nvfuse_inode *inode;
-	index_node_t *node;
+	index_node_head_t *head;
 	u32 new_bno = 0;
 
 	if (master->m_ondisk->m_dealloc_block) {
@@ -1643,8 +1745,8 @@ FREE_BLK_FOUND:
 		}
 		bh = nvfuse_get_new_bh(master->m_sb, ictx, inode->i_ino, new_bno, NVFUSE_TYPE_META);
 
-		node = (index_node_t *)bh->bh_buf;
-		node->i_status = INDEX_NODE_USED;
+		head = (index_node_head_t *)bh->bh_buf;
+		head->i_status = INDEX_NODE_USED;
 
 		nvfuse_release_bh(master->m_sb, bh, INSERT_HEAD, DIRTY);
 
@@ -1674,7 +1776,7 @@ FREE_BLK_FOUND:
 /* deallocation disk space */
 int bp_dealloc_bitmap(master_node_t *master, index_node_t *p)
 {
-	p->i_status = INDEX_NODE_FREE;
+	p->i_head->i_status = INDEX_NODE_FREE;
 	master->m_bitmap_ptr = p->i_offset;
 	master->m_ondisk->m_alloc_block--;
 	master->m_ondisk->m_dealloc_block++;
@@ -1695,16 +1797,20 @@ int bp_dealloc_bitmap(master_node_t *master, index_node_t *p)
 index_node_t *bp_alloc_node(master_node_t *master, int flag, int offset, int is_new)
 {
 	index_node_t *node = NULL;
+	int slot;
 
-	node = (index_node_t *)bp_malloc(master->m_sb, BP_MEMPOOL_INDEX, 1);
-	if (node == NULL) {
-		dprintf_error(BPTREE, " cannot allocate memory \n");
+	if (master->m_node_used == ~0ULL) {
+		dprintf_error(BPTREE, " no free node handle \n");
+		assert(0);
 		return NULL;
 	}
-	master->m_size += sizeof(index_node_t);
+
+	slot = __builtin_ctzll(~master->m_node_used);
+	master->m_node_used |= (1ULL << slot);
+
+	node = &master->m_node[slot];
 	memset(node, 0x00, sizeof(index_node_t));
-	node->i_flag = flag;
-	node->i_status = INDEX_NODE_USED;
+	node->i_master = master;
 
 	if (offset) {
 		node->i_offset = offset;
@@ -1713,15 +1819,14 @@ index_node_t *bp_alloc_node(master_node_t *master, int flag, int offset, int is_
 	if (is_new) {
 		node->i_offset = bp_alloc_bitmap(master, master->m_ictx);
 		master->m_fsize += CLUSTER_SIZE;
-	}
 
-	node->i_pair = (key_pair_t *)bp_malloc(master->m_sb, BP_MEMPOOL_PAIR, 1);
-	if (node->i_pair == NULL) {
-		dprintf_error(BPTREE, " malloc error \n");
-		return NULL;
+		node->i_bh = bp_read_block(master, node->i_offset, 0);
+		bp_map_node(master, node);
+		memset(node->i_buf, 0x00, BP_NODE_SIZE);
+		node->i_head->i_flag = flag;
+		node->i_head->i_status = INDEX_NODE_USED;
+		node->i_head->i_offset = node->i_offset;
 	}
-	master->m_size += sizeof(key_pair_t);
-	node->i_master = master;
 
 	return node;
 }
@@ -1743,18 +1848,8 @@ int bp_release_node(master_node_t *master, index_node_t *p)
 	if (!p)
 		return 0;
 
-	p->i_pair->i_item = NULL;
-	p->i_pair->i_key = NULL;
-
-	bp_free(master->m_sb, BP_MEMPOOL_PAIR, 1, (void *)(p->i_pair));
-
-	p->i_pair = NULL;
-
-	master->m_size -= sizeof(key_pair_t);
-	bp_free(master->m_sb, BP_MEMPOOL_INDEX, 1, p);
-	p = NULL;
-
-	master->m_size -= sizeof(index_node_t);
+	assert(p >= master->m_node && p < master->m_node + BP_MAX_NODE_HANDLES);
+	master->m_node_used &= ~(1ULL << (p - master->m_node));
 
 	return 0;
 }
@@ -1876,65 +1971,72 @@ u32 nvfuse_get_ino(bkey_t key)
 }
 #endif
 
+/* scratch pair for split and merge; keys and items share one allocation */
 key_pair_t *bp_alloc_pair(master_node_t *master, int num)
 {
 	key_pair_t *pair;
 
-	pair = (key_pair_t *)bp_malloc(master->m_sb, BP_MEMPOOL_PAIR, 1);
+	pair = (key_pair_t *)malloc(sizeof(key_pair_t) + (BP_KEY_SIZE + BP_ITEM_SIZE) * num);
 	if (pair == NULL) {
 		dprintf_error(BPTREE, " malloc error \n");
 		return NULL;
 	}
 
-	pair->i_key = (bkey_t *)bp_malloc(master->m_sb, BP_MEMPOOL_KEY, num);
-	if (pair->i_key == NULL) {
-		dprintf_error(BPTREE, " malloc error \n");
-		return NULL;
-	}
-	memset(pair->i_key, 0x00, BP_KEY_SIZE * num);
-
-	pair->i_item = (bitem_t *)bp_malloc(master->m_sb, BP_MEMPOOL_VALUE, num);
-	if (pair->i_item == NULL) {
-		dprintf_error(BPTREE, " malloc error \n");
-		return NULL;
-	}
-	memset(pair->i_item, 0x00, BP_ITEM_SIZE * num);
+	pair->i_key = (bkey_t *)(pair + 1);
+	pair->i_item = (bitem_t *)((char *)pair->i_key + BP_KEY_SIZE * num);
+	memset(pair->i_key, 0x00, (BP_KEY_SIZE + BP_ITEM_SIZE) * num);
 
 	return pair;
 }
 
 void bp_release_pair(master_node_t *master, key_pair_t *pair, int num)
 {
-	bp_free(master->m_sb, BP_MEMPOOL_VALUE, num, (void *)pair->i_item);
-	bp_free(master->m_sb, BP_MEMPOOL_KEY, num, (void *)pair->i_key);
-	bp_free(master->m_sb, BP_MEMPOOL_PAIR, 1, (void *)pair);
+	free(pair);
 }
 
-void bubble_sort(master_node_t *master, key_pair_t *pair, int num, int(*compare)(void *src1,
-		 void *src2))
+static void bp_swap_pair(key_pair_t *pair, int i, int j)
 {
-	int i, j;
-	int swap = 0;
 	bkey_t temp;
 	bitem_t r;
-	//sorting
-	for (i = 0; i < num; i++) {
-		swap = 0;
-		for (j = 1; j < num - i; j++) {
-			if (compare(&pair->i_key[j - 1], &pair->i_key[j]) > 0) {
 
-				B_KEY_COPY(&temp, &pair->i_key[j]);
-				B_KEY_COPY(&pair->i_key[j], &pair->i_key[j - 1]);
-				B_KEY_COPY(&pair->i_key[j - 1], &temp);
+	B_KEY_COPY(&temp, B_KEY_PAIR(pair, i));
+	B_KEY_COPY(B_KEY_PAIR(pair, i), B_KEY_PAIR(pair, j));
+	B_KEY_COPY(B_KEY_PAIR(pair, j), &temp);
 
-				B_ITEM_COPY(&r, &pair->i_item[j]);
-				B_ITEM_COPY(&pair->i_item[j], &pair->i_item[j - 1]);
-				B_ITEM_COPY(&pair->i_item[j - 1], &r);
+	B_ITEM_COPY(&r, B_ITEM_PAIR(pair, i));
+	B_ITEM_COPY(B_ITEM_PAIR(pair, i), B_ITEM_PAIR(pair, j));
+	B_ITEM_COPY(B_ITEM_PAIR(pair, j), &r);
+}
 
-				swap = 1;
-			}
-		}
-		if (swap == 0)
+static void bp_sift_down_pair(key_pair_t *pair, int root, int num, int(*compare)(void *src1,
+			      void *src2))
+{
+	int child;
+
+	while ((child = 2 * root + 1) < num) {
+		if (child + 1 < num &&
+		    compare(B_KEY_PAIR(pair, child), B_KEY_PAIR(pair, child + 1)) < 0)
+			child++;
+
+		if (compare(B_KEY_PAIR(pair, root), B_KEY_PAIR(pair, child)) >= 0)
 			break;
+
+		bp_swap_pair(pair, root, child);
+		root = child;
+	}
+}
+
+/* in-place heap sort over the parallel key and item arrays, O(n log n) */
+void bp_sort_pair(master_node_t *master, key_pair_t *pair, int num, int(*compare)(void *src1,
+		  void *src2))
+{
+	int i;
+
+	for (i = num / 2 - 1; i >= 0; i--)
+		bp_sift_down_pair(pair, i, num, compare);
+
+	for (i = num - 1; i > 0; i--) {
+		bp_swap_pair(pair, 0, i);
+		bp_sift_down_pair(pair, 0, i, compare);
 	}
 }
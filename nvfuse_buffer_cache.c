@@ -17,10 +17,12 @@
 #include <rte_lcore.h>
 #include <rte_mempool.h>
 #include <rte_malloc.h>
+#include <rte_memzone.h>
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 //#define NDEBUG
 #include <assert.h>
 
@@ -87,7 +89,10 @@ void nvfuse_init_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc
 	bc->bc_ino = 0;
 	bc->bc_lbno = 0;
 	bc->bc_load = 0;
+	bc->bc_locked = 0;
 	bc->bc_pno = 0;
+	bc->bc_valid_start = 0;
+	bc->bc_valid_end = 0;
 
 	/* init spinlock */
 	SPINLOCK_INIT(&bc->bc_lock);
@@ -99,27 +104,203 @@ void nvfuse_init_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc
 	memset(bc->bc_buf, 0x00, CLUSTER_SIZE);
 }
 
-struct nvfuse_buffer_cache *nvfuse_replace_buffer_cache(struct nvfuse_superblock *sb, u64 key)
+/* arg carries the number of pages returned, not a pointer */
+static void nvfuse_balloon_free_cpl(union nvfuse_ipc_msg *ipc_msg, void *arg)
+{
+	if (ipc_msg->ret < 0)
+		dprintf_error(BUFFER, " control plane refused %d returned pages\n",
+			      (s32)(intptr_t)arg);
+}
+
+/* runs from nvfuse_ipc_poll(), maybe without bm_lock, so it only posts the result */
+static void nvfuse_refill_buffer_cache_cpl(union nvfuse_ipc_msg *ipc_msg, void *arg)
 {
+	struct nvfuse_buffer_manager *bm = (struct nvfuse_buffer_manager *)arg;
 
+	rte_atomic32_set(&bm->bm_alloc_granted, ipc_msg->ret > 0 ? ipc_msg->ret : -1);
+}
+
+/*
+ * asks the control plane for more buffers without waiting for it; the pages
+ * are added on a later call once the completion has been reaped. the batch
+ * size follows the miss rate: it doubles when the last batch was used up
+ * within the refill interval and halves when it lasted ten intervals. a
+ * denied request is not repeated for a second. requests never go past
+ * NVFUSE_MAX_BUFFER_SIZE_DATA, and granted pages that cannot be added are
+ * handed back. called with bm_lock held.
+ */
+static void nvfuse_refill_buffer_cache(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_buffer_manager *bm = sb->sb_bm;
+	u64 interval = spdk_get_ticks_hz() * NVFUSE_BUFFER_ALLOC_INTERVAL_MS / 1000;
+	u64 now = spdk_get_ticks();
+	s32 nr_buffers, nr_added;
+	s32 headroom;
+
+	if (bm->bm_alloc_inflight) {
+		nvfuse_ipc_poll(sb->sb_nvh);
+		nr_buffers = rte_atomic32_read(&bm->bm_alloc_granted);
+		if (nr_buffers == 0)
+			return;
+
+		bm->bm_alloc_inflight = 0;
+		rte_atomic32_set(&bm->bm_alloc_granted, 0);
+		if (nr_buffers < 0) {
+			bm->bm_alloc_retry_tsc = now + interval * 10;
+			return;
+		}
+
+		nr_added = bm->bm_cache_size;
+		nvfuse_add_buffer_cache(sb, nr_buffers);
+		nr_added = bm->bm_cache_size - nr_added;
+		if (nr_added < nr_buffers) {
+			dprintf_warn(BUFFER, " %d granted pages are handed back\n", nr_buffers - nr_added);
+			nvfuse_send_dealloc_buffer_req_async(sb->sb_nvh, nr_buffers - nr_added,
+							     nvfuse_balloon_free_cpl,
+							     (void *)(intptr_t)(nr_buffers - nr_added));
+		}
+		bm->bm_alloc_tsc = now;
+		/* the next batch is asked for before this one is gone */
+		bm->bm_alloc_low_wm = bm->bm_alloc_batch / 4;
+		return;
+	}
+
+	if (now < bm->bm_alloc_retry_tsc)
+		return;
+
+	headroom = NVFUSE_MAX_BUFFER_SIZE_DATA * (NVFUSE_MEGA_BYTES / CLUSTER_SIZE) - bm->bm_cache_size;
+	if (headroom <= 0)
+		return;
+
+	if (bm->bm_alloc_tsc) {
+		if (now - bm->bm_alloc_tsc < interval)
+			bm->bm_alloc_batch = MIN(bm->bm_alloc_batch * 2, NVFUSE_BUFFER_MAX_ALLOC_SIZE_PER_MSG);
+		else if (now - bm->bm_alloc_tsc > interval * 10)
+			bm->bm_alloc_batch = MAX(bm->bm_alloc_batch / 2, NVFUSE_BUFFER_MIN_ALLOC_SIZE_PER_MSG);
+	}
+
+	if (nvfuse_send_alloc_buffer_req_async(sb->sb_nvh, MIN(bm->bm_alloc_batch, headroom),
+					       nvfuse_refill_buffer_cache_cpl, bm) < 0) {
+		bm->bm_alloc_retry_tsc = now + interval * 10;
+		return;
+	}
+	bm->bm_alloc_inflight = 1;
+}
+
+/*
+ * frees up to nr_buffers unused and least recently used clean buffers, but
+ * never below the initial buffer size. called with bm_lock held; returns
+ * the number of pages freed.
+ */
+static s32 nvfuse_shrink_buffer_cache(struct nvfuse_superblock *sb, s32 nr_buffers)
+{
 	struct nvfuse_buffer_manager *bm = sb->sb_bm;
 	struct nvfuse_buffer_cache *bc;
-	struct list_head *remove_ptr;
-	s32 type = 0;
+	struct list_head *head, *ptr, *temp;
+	s32 types[2] = {BUFFER_TYPE_UNUSED, BUFFER_TYPE_CLEAN};
+	s32 nr_freed = 0;
+	s32 i;
 
-	/* if buffers are insufficient, it sens buffer allocation mesg to control plane */
-	if (rte_atomic32_read(&bm->bm_list_count[BUFFER_TYPE_UNUSED]) == 0 && nvfuse_process_model_is_dataplane()) {
-		s32 nr_buffers;
+	nr_buffers = MIN(nr_buffers, bm->bm_cache_size -
+			 NVFUSE_INITIAL_BUFFER_SIZE_DATA * (NVFUSE_MEGA_BYTES / CLUSTER_SIZE));
 
-		/* try to allocate buffers from primary process */
-		nr_buffers = NVFUSE_BUFFER_DEFAULT_ALLOC_SIZE_PER_MSG;
-		nr_buffers = nvfuse_send_alloc_buffer_req(sb->sb_nvh, nr_buffers);
-		if (nr_buffers > 0) {
-			nvfuse_add_buffer_cache(sb, nr_buffers);
-			assert(rte_atomic32_read(&bm->bm_list_count[BUFFER_TYPE_UNUSED]));
+	for (i = 0; i < 2 && nr_freed < nr_buffers; i++) {
+		head = &bm->bm_list[types[i]];
+		/* from the tail, the least recently used end */
+		for (ptr = head->prev, temp = ptr->prev; ptr != head; ptr = temp, temp = ptr->prev) {
+			bc = list_entry(ptr, struct nvfuse_buffer_cache, bc_list);
+			if (rte_atomic32_read(&bc->bc_ref) || rte_atomic32_read(&bc->bc_bh_count) ||
+			    bc->bc_dirty)
+				continue;
+
+			list_del(&bc->bc_list);
+			hlist_del(&bc->bc_hash);
+			rte_atomic32_dec(&bm->bm_list_count[types[i]]);
+			if (types[i] == BUFFER_TYPE_UNUSED)
+				rte_atomic32_dec(&bm->bm_hash_count[HASH_NUM]);
+			else
+				rte_atomic32_dec(&bm->bm_hash_count[bc->bc_bno % HASH_NUM]);
+
+			nvfuse_free_aligned_buffer(bc->bc_buf);
+			nvfuse_free_bc(sb, bc);
+			bm->bm_cache_size--;
+
+			if (++nr_freed == nr_buffers)
+				break;
+		}
+	}
+
+	return nr_freed;
+}
+
+static void nvfuse_balloon_report_cpl(union nvfuse_ipc_msg *ipc_msg, void *arg)
+{
+	struct nvfuse_buffer_manager *bm = (struct nvfuse_buffer_manager *)arg;
+
+	rte_atomic32_set(&bm->bm_balloon_shrink, ipc_msg->ret > 0 ? ipc_msg->ret : 0);
+}
+
+/*
+ * reports the miss rate to the control plane once per report interval.
+ * when a busier data plane runs short, the answer carries the pages this
+ * one should give back, which are freed here from the clean LRU tail on
+ * a later call. called with bm_lock held.
+ */
+static void nvfuse_balloon_buffer_cache(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_buffer_manager *bm = sb->sb_bm;
+	u64 interval = spdk_get_ticks_hz() * NVFUSE_BUFFER_REPORT_INTERVAL_MS / 1000;
+	u64 now = spdk_get_ticks();
+	u64 miss = bm->bm_cache_ref - bm->bm_cache_hit;
+	s32 nr_freed;
+	s32 shrink;
+
+	shrink = rte_atomic32_read(&bm->bm_balloon_shrink);
+	if (shrink < 0) {
+		nvfuse_ipc_poll(sb->sb_nvh);
+		return;
+	}
+
+	if (shrink > 0) {
+		rte_atomic32_set(&bm->bm_balloon_shrink, 0);
+		nr_freed = nvfuse_shrink_buffer_cache(sb, shrink);
+		if (nr_freed) {
+			nvfuse_send_dealloc_buffer_req_async(sb->sb_nvh, nr_freed,
+							     nvfuse_balloon_free_cpl, (void *)(intptr_t)nr_freed);
+			/* do not grow back for a report interval */
+			bm->bm_alloc_retry_tsc = now + interval;
+			bm->bm_alloc_low_wm = 0;
 		}
 	}
 
+	if (now - bm->bm_report_tsc < interval)
+		return;
+
+	rte_atomic32_set(&bm->bm_balloon_shrink, -1);
+	if (nvfuse_send_buffer_stat_req_async(sb->sb_nvh, miss - bm->bm_report_miss,
+					      (now - bm->bm_report_tsc) * 1000 / spdk_get_ticks_hz(),
+					      nvfuse_balloon_report_cpl, bm) < 0) {
+		rte_atomic32_set(&bm->bm_balloon_shrink, 0);
+		return;
+	}
+	bm->bm_report_tsc = now;
+	bm->bm_report_miss = miss;
+}
+
+struct nvfuse_buffer_cache *nvfuse_replace_buffer_cache(struct nvfuse_superblock *sb, u64 key)
+{
+
+	struct nvfuse_buffer_manager *bm = sb->sb_bm;
+	struct nvfuse_buffer_cache *bc;
+	struct list_head *remove_ptr;
+	s32 type = 0;
+
+	/* if buffers run low, it sends a buffer allocation mesg to control plane */
+	if (nvfuse_process_model_is_dataplane() &&
+	    (bm->bm_alloc_inflight ||
+	     rte_atomic32_read(&bm->bm_list_count[BUFFER_TYPE_UNUSED]) <= bm->bm_alloc_low_wm))
+		nvfuse_refill_buffer_cache(sb);
+
 	if (rte_atomic32_read(&bm->bm_list_count[BUFFER_TYPE_UNUSED])) {
 		type = BUFFER_TYPE_UNUSED;
 	} else if (rte_atomic32_read(&bm->bm_list_count[BUFFER_TYPE_CLEAN])) {
@@ -185,6 +366,10 @@ struct nvfuse_buffer_cache *nvfuse_find_bc(struct nvfuse_superblock *sb, u64 key
 	SPINLOCK_LOCK(&bm->bm_lock);
 
 	bm->bm_cache_ref++;
+	if (!(bm->bm_cache_ref & 0xfff) && nvfuse_process_model_is_dataplane() &&
+	    !spdk_process_is_primary())
+		nvfuse_balloon_buffer_cache(sb);
+
 	bc = nvfuse_hash_lookup(sb->sb_bm, key);
 	if (bc) {
 		/* in case of cache hit */
@@ -226,8 +411,12 @@ struct nvfuse_buffer_cache *nvfuse_find_bc(struct nvfuse_superblock *sb, u64 key
 		}
 	}
 
-	/* this counter will be decremented when release_bc() is called */
-	SPINLOCK_LOCK(&bc->bc_lock);
+	/*
+	 * this counter will be decremented when release_bc() is called. it pins
+	 * bc in the ref list, where it is never replaced, so that the bc lock
+	 * can be waited for after dropping the manager lock. a thread holding
+	 * another bc may be waiting for the manager lock in the meantime.
+	 */
 	nvfuse_inc_bc_ref(bc);
 
 	/* FIXME: needed to be in ref list? */
@@ -237,6 +426,8 @@ struct nvfuse_buffer_cache *nvfuse_find_bc(struct nvfuse_superblock *sb, u64 key
 
 	SPINLOCK_UNLOCK(&bm->bm_lock);
 
+	SPINLOCK_LOCK(&bc->bc_lock);
+
 	return bc;
 }
 
@@ -289,7 +480,7 @@ void nvfuse_inc_bc_ref(struct nvfuse_buffer_cache *bc)
 
 	dprintf_debug(BUFFER, " ino = %d lbno = %d inc refcnt = %d %d\n", bc->bc_ino, bc->bc_lbno, rte_atomic32_read(&bc->bc_ref), bc->bc_temp);
 
-	assert(rte_atomic32_read(&bc->bc_ref) == 1);
+	assert(rte_atomic32_read(&bc->bc_ref) >= 1);
 }
 
 void nvfuse_dec_bc_ref(struct nvfuse_buffer_cache *bc)
@@ -313,6 +504,18 @@ struct nvfuse_buffer_cache *nvfuse_get_bc(struct nvfuse_superblock *sb, struct n
 		return NULL;
 	}
 
+	/*
+	 * a buffered aio read is filling the block. the flag is cleared when
+	 * the device completes the read, not when the owner of the aio queue
+	 * reaps it, so this wait ends even if the owner is the current thread
+	 * or is blocked on an inode lock held here.
+	 */
+	while (bc->bc_locked) {
+		SPINLOCK_UNLOCK(&bc->bc_lock);
+		SPINLOCK_LOCK(&bc->bc_lock);
+	}
+	rte_smp_rmb();
+
 	if (!bc->bc_pno) {
 		pbno_t new_pno;
 		/* logical to physical address translation */
@@ -323,13 +526,11 @@ struct nvfuse_buffer_cache *nvfuse_get_bc(struct nvfuse_superblock *sb, struct n
 
 	if (bc->bc_pno) {
 		if (sync_read && !bc->bc_load) {
-			if (nvfuse_read_block(bc->bc_buf, bc->bc_pno, sb->target)) {
+			if (nvfuse_fill_bc(sb, bc)) {
 				/* FIXME: how can we handle this case? */
 				dprintf_error(BUFFER, " Error: block read in %s\n", __FUNCTION__);
 				/* necesary to release bc and bh here */
 				assert(0);
-			} else {
-				bc->bc_load = 1;
 			}
 		}
 	} else if (!bc->bc_pno && sync_read && !bc->bc_load) {
@@ -466,15 +667,71 @@ void nvfuse_move_bc_to_unused_list(struct nvfuse_superblock *sb, u64 key) {
 		bc->bc_load = 0;
 		bc->bc_pno = 0;
 		bc->bc_dirty = 0;
-		rte_atomic32_init(&bc->bc_ref);
+		bc->bc_valid_start = 0;
+		bc->bc_valid_end = 0;
 
 		SPINLOCK_UNLOCK(&bc->bc_lock);
 
-		nvfuse_move_buffer_list_nolock(sb, bc, BUFFER_TYPE_UNUSED, INSERT_HEAD);
+		/* a pinned bc goes to the clean list when its last pin is dropped */
+		if (rte_atomic32_read(&bc->bc_ref) == 0)
+			nvfuse_move_buffer_list_nolock(sb, bc, BUFFER_TYPE_UNUSED, INSERT_HEAD);
 	}
 	SPINLOCK_UNLOCK(&sb->sb_bm->bm_lock);
 }
 
+/*
+ * direct i/o bypasses the cache, so the device copy of the range must be
+ * current first. dirty blocks are written back, and with invalidate the
+ * cached copies are dropped so that later buffered reads see the new data.
+ * the caller holds the inode lock, which keeps other users off the range.
+ */
+void nvfuse_sync_cached_range(struct nvfuse_superblock *sb, inode_t ino, lbno_t lblock,
+			      u32 nr_blocks, s32 invalidate)
+{
+	struct nvfuse_buffer_manager *bm = sb->sb_bm;
+	struct nvfuse_buffer_cache *bc;
+	u64 key;
+	u32 i;
+
+	/* no buffer of the range can be in the flushing list meanwhile */
+	rte_spinlock_lock(&sb->sb_flush_lock);
+
+	for (i = 0; i < nr_blocks; i++) {
+		nvfuse_make_pbno_key(ino, lblock + i, &key, NVFUSE_BP_TYPE_DATA);
+
+		SPINLOCK_LOCK(&bm->bm_lock);
+		bc = nvfuse_hash_lookup(bm, key);
+		if (bc == NULL) {
+			SPINLOCK_UNLOCK(&bm->bm_lock);
+			continue;
+		}
+
+		/* pages lent to users may be dirty too; they hold no bc lock */
+		if (bc->bc_dirty) {
+			nvfuse_inc_bc_ref(bc);
+			nvfuse_move_buffer_list_nolock(sb, bc, BUFFER_TYPE_REF, 0);
+			SPINLOCK_UNLOCK(&bm->bm_lock);
+
+			SPINLOCK_LOCK(&bc->bc_lock);
+			if (nvfuse_fill_bc(sb, bc) ||
+			    nvfuse_write_cluster(bc->bc_buf, bc->bc_pno, sb->target)) {
+				dprintf_error(BUFFER, " Error: block write in %s\n", __FUNCTION__);
+				nvfuse_release_bc(sb, bc, 0, DIRTY);
+				continue;
+			}
+			bc->bc_dirty = 0;
+			nvfuse_release_bc(sb, bc, 0, NVF_CLEAN);
+		} else {
+			SPINLOCK_UNLOCK(&bm->bm_lock);
+		}
+
+		if (invalidate)
+			nvfuse_move_bc_to_unused_list(sb, key);
+	}
+
+	rte_spinlock_unlock(&sb->sb_flush_lock);
+}
+
 s32 nvfuse_remove_buffer_cache(struct nvfuse_superblock *sb, s32 nr_buffers)
 {
 	struct nvfuse_buffer_manager *bm = sb->sb_bm;
@@ -541,10 +798,13 @@ int nvfuse_add_buffer_cache(struct nvfuse_superblock *sb, int nr)
 
 	assert(nr > 0);
 
-	if (nvfuse_process_model_is_dataplane() &&
-	    bm->bm_cache_size / 256 >= NVFUSE_MAX_BUFFER_SIZE_DATA) {
-		dprintf_warn(BUFFER, " Current buffer size = %.3f \n", (double)bm->bm_cache_size / 256);
-		return -1;
+	if (nvfuse_process_model_is_dataplane()) {
+		if (bm->bm_cache_size / 256 >= NVFUSE_MAX_BUFFER_SIZE_DATA) {
+			dprintf_warn(BUFFER, " Current buffer size = %.3f \n", (double)bm->bm_cache_size / 256);
+			return -1;
+		}
+		/* a data plane never grows past the cap */
+		nr = MIN(nr, NVFUSE_MAX_BUFFER_SIZE_DATA * 256 - bm->bm_cache_size);
 	}
 
 	//printf(" Add buffer cache (%d 4K pages) to process\n", nr);
@@ -562,6 +822,7 @@ int nvfuse_add_buffer_cache(struct nvfuse_superblock *sb, int nr)
 #ifdef SPDK_ENABLED
 			dprintf_warn(BUFFER, " Please, increase # of huge pages in scripts/setup.sh\n");
 #endif
+			nvfuse_free_bc(sb, bc);
 			return -1;
 		}
 
@@ -587,6 +848,221 @@ int nvfuse_add_buffer_cache(struct nvfuse_superblock *sb, int nr)
 	return 0;
 }
 
+static inline rte_atomic32_t *nvfuse_shared_cache_gen(struct nvfuse_shared_cache *sc, pbno_t pno)
+{
+	return &sc->sc_gen[pno / sc->sc_blocks_per_container];
+}
+
+/* write_notify hook of the io target, called on the reactor core */
+static void nvfuse_shared_cache_written(void *arg, uint64_t offset, uint32_t bytes)
+{
+	struct nvfuse_shared_cache *sc = (struct nvfuse_shared_cache *)arg;
+	u32 first = offset / CLUSTER_SIZE / sc->sc_blocks_per_container;
+	u32 last = (offset + bytes - 1) / CLUSTER_SIZE / sc->sc_blocks_per_container;
+	u32 i;
+
+	for (i = first; i <= last && i < sc->sc_nr_containers; i++)
+		rte_atomic32_inc(&sc->sc_gen[i]);
+}
+
+static s32 nvfuse_create_shared_cache(struct nvfuse_shared_cache *sc, u32 nr_sets,
+				      u32 nr_containers, u32 blocks_per_container)
+{
+	struct rte_mempool *pool;
+	struct nvfuse_shared_set *set;
+	u32 i, j;
+
+	sc->sc_nr_sets = nr_sets;
+	sc->sc_nr_containers = nr_containers;
+	sc->sc_blocks_per_container = blocks_per_container;
+	rte_atomic64_init(&sc->sc_hit);
+	rte_atomic64_init(&sc->sc_miss);
+	sc->sc_set = (struct nvfuse_shared_set *)(sc + 1);
+	sc->sc_gen = (rte_atomic32_t *)(sc->sc_set + nr_sets);
+
+	for (i = 0; i < nr_containers; i++)
+		rte_atomic32_init(&sc->sc_gen[i]);
+
+	pool = rte_mempool_create(NVFUSE_SHARED_CACHE_POOL_NAME, nr_sets * NVFUSE_SHARED_CACHE_WAYS,
+				  CLUSTER_SIZE, 0, 0, NULL, NULL, NULL, NULL, SOCKET_ID_ANY, 0);
+	if (pool == NULL) {
+		dprintf_error(BUFFER, " Error: allocation of shared cache pages\n");
+		return -1;
+	}
+
+	for (i = 0; i < nr_sets; i++) {
+		set = &sc->sc_set[i];
+		SPINLOCK_INIT(&set->ss_lock);
+		set->ss_clock = 0;
+		for (j = 0; j < NVFUSE_SHARED_CACHE_WAYS; j++) {
+			memset(&set->ss_buf[j], 0x00, sizeof(struct nvfuse_shared_buffer));
+			if (rte_mempool_get(pool, (void **)&set->ss_buf[j].sh_buf) < 0) {
+				dprintf_error(BUFFER, " Error: shared cache pages run out\n");
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * the primary process creates the shared cache with -r, and data planes
+ * mounting later attach to it by name. all of them, the primary included,
+ * invalidate the copies of the containers they write to.
+ */
+s32 nvfuse_init_shared_cache(struct nvfuse_superblock *sb, s32 size)
+{
+	const struct rte_memzone *mz;
+	struct nvfuse_shared_cache *sc;
+	u32 nr_sets;
+	size_t len;
+
+	if (spdk_process_is_primary()) {
+		if (size == 0)
+			return 0;
+
+		nr_sets = MAX(size * (NVFUSE_MEGA_BYTES / CLUSTER_SIZE) / NVFUSE_SHARED_CACHE_WAYS, 1);
+		len = sizeof(struct nvfuse_shared_cache) + nr_sets * sizeof(struct nvfuse_shared_set) +
+		      sb->sb_bg_num * sizeof(rte_atomic32_t);
+		mz = rte_memzone_reserve(NVFUSE_SHARED_CACHE_NAME, len, SOCKET_ID_ANY, 0);
+		if (mz == NULL) {
+			dprintf_error(BUFFER, " Error: allocation of shared cache (%dMB)\n", size);
+			return -1;
+		}
+
+		sc = (struct nvfuse_shared_cache *)mz->addr;
+		memset(sc, 0x00, len);
+		if (nvfuse_create_shared_cache(sc, nr_sets, sb->sb_bg_num, sb->sb_no_of_blocks_per_bg) < 0)
+			return -1;
+		dprintf_info(BUFFER, " Shared cache = %dMB\n", size);
+	} else {
+		mz = rte_memzone_lookup(NVFUSE_SHARED_CACHE_NAME);
+		if (mz == NULL)
+			return 0;
+		sc = (struct nvfuse_shared_cache *)mz->addr;
+	}
+
+	sb->sb_bm->bm_shared = sc;
+	sb->target->write_notify_arg = sc;
+	sb->target->write_notify = nvfuse_shared_cache_written;
+
+	return 0;
+}
+
+static void nvfuse_deinit_shared_cache(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_shared_cache *sc = sb->sb_bm->bm_shared;
+	u64 hit, miss;
+
+	if (sc == NULL)
+		return;
+
+	/* the cache stays for the other data planes */
+	sb->target->write_notify = NULL;
+	sb->sb_bm->bm_shared = NULL;
+
+	hit = rte_atomic64_read(&sc->sc_hit);
+	miss = rte_atomic64_read(&sc->sc_miss);
+	dprintf_info(BUFFER, " > shared cache hit rate = %f \n",
+		     hit + miss ? (double)hit / (hit + miss) : 0.0);
+}
+
+s32 nvfuse_shared_cache_read(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc)
+{
+	struct nvfuse_shared_cache *sc = sb->sb_bm->bm_shared;
+	struct nvfuse_shared_buffer *sh = NULL;
+	struct nvfuse_shared_set *set;
+	u32 gen;
+	s32 i;
+
+	if (sc == NULL)
+		return -1;
+
+	set = &sc->sc_set[bc->bc_pno % sc->sc_nr_sets];
+	gen = rte_atomic32_read(nvfuse_shared_cache_gen(sc, bc->bc_pno));
+
+	SPINLOCK_LOCK(&set->ss_lock);
+	for (i = 0; i < NVFUSE_SHARED_CACHE_WAYS; i++) {
+		if (set->ss_buf[i].sh_valid && set->ss_buf[i].sh_pno == bc->bc_pno &&
+		    set->ss_buf[i].sh_gen == gen) {
+			sh = &set->ss_buf[i];
+			sh->sh_ref++;
+			sh->sh_stamp = ++set->ss_clock;
+			break;
+		}
+	}
+	SPINLOCK_UNLOCK(&set->ss_lock);
+
+	if (sh == NULL) {
+		rte_atomic64_inc(&sc->sc_miss);
+		return -1;
+	}
+
+	/* a referenced copy is not replaced */
+	rte_memcpy(bc->bc_buf, sh->sh_buf, CLUSTER_SIZE);
+
+	SPINLOCK_LOCK(&set->ss_lock);
+	sh->sh_ref--;
+	SPINLOCK_UNLOCK(&set->ss_lock);
+
+	rte_atomic64_inc(&sc->sc_hit);
+	bc->bc_load = 1;
+
+	return 0;
+}
+
+/*
+ * keeps a copy of a block just read from the device. gen is the generation
+ * of its container sampled before the read, so that a block written in the
+ * meantime is not kept. an empty or invalidated way is taken first, then the
+ * least recently used one not being copied.
+ */
+static void nvfuse_shared_cache_insert(struct nvfuse_shared_cache *sc, pbno_t pno, u32 gen, s8 *buf)
+{
+	struct nvfuse_shared_set *set = &sc->sc_set[pno % sc->sc_nr_sets];
+	struct nvfuse_shared_buffer *sh, *victim = NULL;
+	s32 i;
+
+	SPINLOCK_LOCK(&set->ss_lock);
+	if (rte_atomic32_read(nvfuse_shared_cache_gen(sc, pno)) != gen)
+		goto UNLOCK_SET;
+
+	for (i = 0; i < NVFUSE_SHARED_CACHE_WAYS; i++) {
+		sh = &set->ss_buf[i];
+		if (sh->sh_pno == pno && (sh->sh_ref || sh->sh_gen == gen))
+			goto UNLOCK_SET;
+		if (sh->sh_ref)
+			continue;
+		if (!sh->sh_valid ||
+		    sh->sh_gen != rte_atomic32_read(nvfuse_shared_cache_gen(sc, sh->sh_pno))) {
+			victim = sh;
+			break;
+		}
+		if (victim == NULL || sh->sh_stamp < victim->sh_stamp)
+			victim = sh;
+	}
+
+	if (victim == NULL)
+		goto UNLOCK_SET;
+
+	victim->sh_pno = pno;
+	victim->sh_valid = 0;
+	victim->sh_ref = 1;
+	SPINLOCK_UNLOCK(&set->ss_lock);
+
+	rte_memcpy(victim->sh_buf, buf, CLUSTER_SIZE);
+
+	SPINLOCK_LOCK(&set->ss_lock);
+	victim->sh_gen = gen;
+	victim->sh_valid = 1;
+	victim->sh_stamp = ++set->ss_clock;
+	victim->sh_ref = 0;
+
+UNLOCK_SET:
+	SPINLOCK_UNLOCK(&set->ss_lock);
+}
+
 /* buffe_size in MB units */
 int nvfuse_init_buffer_cache(struct nvfuse_superblock *sb, s32 buffer_size)
 {
@@ -699,6 +1175,14 @@ int nvfuse_init_buffer_cache(struct nvfuse_superblock *sb, s32 buffer_size)
 		}
 	}
 
+	bm->bm_alloc_batch = NVFUSE_BUFFER_MIN_ALLOC_SIZE_PER_MSG;
+	bm->bm_alloc_low_wm = 0;
+	bm->bm_alloc_inflight = 0;
+	rte_atomic32_init(&bm->bm_alloc_granted);
+	bm->bm_report_tsc = spdk_get_ticks();
+	bm->bm_report_miss = 0;
+	rte_atomic32_init(&bm->bm_balloon_shrink);
+
 	SPINLOCK_INIT(&bm->bm_lock);
 	bm->bm_state = BM_STATE_RUNNING;
 
@@ -710,12 +1194,32 @@ int nvfuse_init_buffer_cache(struct nvfuse_superblock *sb, s32 buffer_size)
 
 void nvfuse_deinit_buffer_cache(struct nvfuse_superblock *sb)
 {
+	struct nvfuse_buffer_manager *bm = sb->sb_bm;
 	struct list_head *head;
 	struct list_head *ptr, *temp;
 	struct nvfuse_buffer_cache *bc;
+	u64 timeout;
 	s32 type;
 	s32 removed_count = 0;
 
+	/* pages granted to an outstanding refill are ours to give back too */
+	timeout = spdk_get_ticks() + spdk_get_ticks_hz() * NVFUSE_BUFFER_DEINIT_TIMEOUT_MS / 1000;
+	SPINLOCK_LOCK(&bm->bm_lock);
+	while (bm->bm_alloc_inflight && spdk_get_ticks() < timeout)
+		nvfuse_refill_buffer_cache(sb);
+	while (rte_atomic32_read(&bm->bm_balloon_shrink) < 0 && spdk_get_ticks() < timeout)
+		nvfuse_ipc_poll(sb->sb_nvh);
+	SPINLOCK_UNLOCK(&bm->bm_lock);
+
+	if (bm->bm_alloc_inflight || rte_atomic32_read(&bm->bm_balloon_shrink) < 0) {
+		dprintf_warn(BUFFER, " control plane did not answer buffer requests in %d ms\n",
+			     NVFUSE_BUFFER_DEINIT_TIMEOUT_MS);
+		/* bm is freed below, late answers must not reach it */
+		nvfuse_ipc_forget(sb->sb_nvh, bm);
+	}
+
+	nvfuse_deinit_shared_cache(sb);
+
 	/* dealloc buffer cache */
 	for (type = BUFFER_TYPE_UNUSED; type < BUFFER_TYPE_NUM; type++) {
 		head = &sb->sb_bm->bm_list[type];
@@ -909,28 +1413,127 @@ s32 nvfuse_forget_bh(struct nvfuse_superblock *sb, struct nvfuse_buffer_head *bh
 
 void nvfuse_release_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc, s32 tail, s32 dirty)
 {
-	nvfuse_dec_bc_ref(bc);
+	struct nvfuse_buffer_manager *bm = sb->sb_bm;
 
 	dirty = dirty + bc->bc_dirty;
 
 	if (dirty) {
 		bc->bc_dirty = 1;
-		bc->bc_load = 1;
-		SPINLOCK_UNLOCK(&bc->bc_lock);
-
-		nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_DIRTY, tail);
+		/* a partially written block stays unloaded until it is filled */
+		if (bc->bc_valid_start == bc->bc_valid_end)
+			bc->bc_load = 1;
 	} else {
-
 		bc->bc_dirty = 0;
-		SPINLOCK_UNLOCK(&bc->bc_lock);
+	}
+	SPINLOCK_UNLOCK(&bc->bc_lock);
 
-		if (rte_atomic32_read(&bc->bc_ref) == 0)
-			nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_CLEAN, tail);
-		else {
-			assert(0);
-			nvfuse_move_buffer_list(sb, bc, BUFFER_TYPE_REF, tail);
+	/* bc pinned by another thread meanwhile stays in the ref list */
+	SPINLOCK_LOCK(&bm->bm_lock);
+	nvfuse_dec_bc_ref(bc);
+	if (rte_atomic32_read(&bc->bc_ref) == 0) {
+		nvfuse_move_buffer_list_nolock(sb, bc, dirty ? BUFFER_TYPE_DIRTY : BUFFER_TYPE_CLEAN,
+					       tail);
+	}
+	SPINLOCK_UNLOCK(&bm->bm_lock);
+}
+
+s32 nvfuse_fill_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc)
+{
+	s8 valid[CLUSTER_SIZE];
+	u32 start = bc->bc_valid_start;
+	u32 end = bc->bc_valid_end;
+
+	if (bc->bc_load)
+		return 0;
+
+	/* newer bytes already in the buffer are put back over the device copy */
+	if (end > start)
+		memcpy(valid, bc->bc_buf + start, end - start);
+
+	if (nvfuse_shared_cache_read(sb, bc)) {
+		struct nvfuse_shared_cache *sc = sb->sb_bm->bm_shared;
+		u32 gen = sc ? rte_atomic32_read(nvfuse_shared_cache_gen(sc, bc->bc_pno)) : 0;
+
+		if (nvfuse_read_block(bc->bc_buf, bc->bc_pno, sb->target))
+			return -1;
+
+		if (sc)
+			nvfuse_shared_cache_insert(sc, bc->bc_pno, gen, bc->bc_buf);
+	}
+
+	if (end > start)
+		memcpy(bc->bc_buf + start, valid, end - start);
+
+	bc->bc_valid_start = 0;
+	bc->bc_valid_end = 0;
+	bc->bc_load = 1;
+
+	return 0;
+}
+
+/*
+ * a partial write to a block that is not loaded is tracked as one valid
+ * byte range instead of reading the block first. eof is the number of bytes
+ * of the block inside the file; nothing past it is on the device, so it is
+ * zeroed rather than read. the block is read only when the write leaves a
+ * gap to the range already tracked, or later when the rest is needed.
+ */
+s32 nvfuse_prepare_write_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc,
+			    u32 offset, u32 len, u32 eof)
+{
+	u32 start = offset;
+	u32 end = offset + len;
+
+	if (bc->bc_load)
+		return 0;
+
+	if (end >= eof) {
+		if (start > eof) {
+			memset(bc->bc_buf + eof, 0x00, start - eof);
+			start = eof;
 		}
+		memset(bc->bc_buf + end, 0x00, CLUSTER_SIZE - end);
+		end = CLUSTER_SIZE;
+	}
+
+	if (bc->bc_valid_start != bc->bc_valid_end) {
+		if (start > bc->bc_valid_end || end < bc->bc_valid_start)
+			return nvfuse_fill_bc(sb, bc);
+
+		start = MIN(start, bc->bc_valid_start);
+		end = MAX(end, bc->bc_valid_end);
+	}
+
+	if (start == 0 && end == CLUSTER_SIZE) {
+		bc->bc_valid_start = 0;
+		bc->bc_valid_end = 0;
+		bc->bc_load = 1;
+	} else {
+		bc->bc_valid_start = start;
+		bc->bc_valid_end = end;
+	}
+
+	return 0;
+}
+
+void nvfuse_pin_bc(struct nvfuse_buffer_cache *bc)
+{
+	/* the caller holds a reference, so bc cannot leave the ref list meanwhile */
+	assert(rte_atomic32_read(&bc->bc_ref) >= 1);
+	nvfuse_inc_bc_ref(bc);
+}
+
+void nvfuse_unpin_bc(struct nvfuse_superblock *sb, struct nvfuse_buffer_cache *bc)
+{
+	struct nvfuse_buffer_manager *bm = sb->sb_bm;
+
+	SPINLOCK_LOCK(&bm->bm_lock);
+	nvfuse_dec_bc_ref(bc);
+	if (rte_atomic32_read(&bc->bc_ref) == 0) {
+		nvfuse_move_buffer_list_nolock(sb, bc, bc->bc_dirty ? BUFFER_TYPE_DIRTY : BUFFER_TYPE_CLEAN,
+					       0);
 	}
+	SPINLOCK_UNLOCK(&bm->bm_lock);
 }
 
 void nvfuse_release_bh(struct nvfuse_superblock *sb, struct nvfuse_buffer_head *bh, s32 tail, s32 dirty)
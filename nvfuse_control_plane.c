@@ -49,6 +49,9 @@
 * global variable for control plane
 */
 #define LOG_CHUNK_SIZE 4096
+#define CONTAINER_DELTA_LOG_NAME "container_delta.file"
+/* the delta log is folded into a snapshot once it is as large as the table */
+#define CONTAINER_DELTA_MIN_LOG_SIZE (LOG_CHUNK_SIZE * 16)
 
 s8 *get_container_name(struct nvfuse_handle *nvh, s8 *name)
 {
@@ -301,11 +304,129 @@ void nvfuse_app_manage_table_deinit(struct nvfuse_handle *nvh)
 	nvfuse_free_aligned_buffer(nvh->nvh_sb.sb_control_plane_ctx->app_manage_table);
 }
 
+static inline void nvfuse_container_set_free(struct control_plane_context *cp, s32 container_id)
+{
+	s32 word = container_id / 64;
+
+	cp->container_free_map[word] |= 1ULL << (container_id % 64);
+	cp->container_free_summary[word / 64] |= 1ULL << (word % 64);
+}
+
+static inline void nvfuse_container_clear_free(struct control_plane_context *cp, s32 container_id)
+{
+	s32 word = container_id / 64;
+
+	cp->container_free_map[word] &= ~(1ULL << (container_id % 64));
+	if (cp->container_free_map[word] == 0)
+		cp->container_free_summary[word / 64] &= ~(1ULL << (word % 64));
+}
+
+/* first free container at or after container_id, wrapping around; 0 if none */
+static s32 nvfuse_container_find_free(struct control_plane_context *cp, s32 container_id)
+{
+	s32 nr_sums = DIV_UP(cp->container_map_words, 64) / 64;
+	s32 word = container_id / 64;
+	s32 start;
+	u64 bits;
+	s32 i;
+
+	bits = cp->container_free_map[word] & (~0ULL << (container_id % 64));
+	if (bits)
+		return word * 64 + __builtin_ctzll(bits);
+
+	/* the summary skips empty words, the last round wraps onto the first words */
+	start = (word + 1) % cp->container_map_words;
+	for (i = 0; i <= nr_sums; i++) {
+		s32 sum_id = (start / 64 + i) % nr_sums;
+		u64 sum = cp->container_free_summary[sum_id];
+
+		if (i == 0)
+			sum &= ~0ULL << (start % 64);
+		if (sum) {
+			word = sum_id * 64 + __builtin_ctzll(sum);
+			return word * 64 + __builtin_ctzll(cp->container_free_map[word]);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * pops an UNLOCKED container of core_id that was allocated in an earlier run.
+ * entries whose owner changed since they were listed are dropped on the way.
+ */
+static s32 nvfuse_container_pop_dormant(struct control_plane_context *cp, s32 core_id)
+{
+	struct container_reservation *reservation_table = cp->reservation_table;
+	s32 *prev = &cp->container_dormant_head[core_id];
+	s32 container_id;
+
+	while ((container_id = *prev) != 0) {
+		if (reservation_table[container_id].owner_core_id != core_id) {
+			*prev = cp->container_next_dormant[container_id];
+			continue;
+		}
+		if (reservation_table[container_id].status == UNLOCKED) {
+			*prev = cp->container_next_dormant[container_id];
+			return container_id;
+		}
+		prev = &cp->container_next_dormant[container_id];
+	}
+
+	return 0;
+}
+
+static void nvfuse_container_push_dormant(struct control_plane_context *cp, s32 core_id,
+		s32 container_id)
+{
+	cp->container_next_dormant[container_id] = cp->container_dormant_head[core_id];
+	cp->container_dormant_head[core_id] = container_id;
+}
+
+/*
+ * rebuilds the free bitmap and the dormant lists from reservation_table.
+ * each core starts looking for new containers in its own slice of the
+ * device, so that a data plane's containers end up next to each other.
+ */
+static void nvfuse_container_index_build(struct control_plane_context *cp)
+{
+	struct container_reservation *reservation_table = cp->reservation_table;
+	s32 nr_sums = DIV_UP(cp->container_map_words, 64) / 64;
+	s32 owner;
+	s32 i;
+
+	memset(cp->container_free_map, 0x00, sizeof(u64) * cp->container_map_words);
+	memset(cp->container_free_summary, 0x00, sizeof(u64) * nr_sums);
+	memset(cp->container_dormant_head, 0x00, sizeof(cp->container_dormant_head));
+
+	cp->free_containers = 0;
+	for (i = cp->nr_containers - 1; i > 0; i--) {
+		owner = reservation_table[i].owner_core_id;
+		if (owner == 0) {
+			nvfuse_container_set_free(cp, i);
+			cp->free_containers++;
+		} else if (owner > 0 && owner < SPDK_NUM_CORES &&
+			   reservation_table[i].status == UNLOCKED) {
+			nvfuse_container_push_dormant(cp, owner, i);
+		}
+	}
+
+	for (i = 0; i < SPDK_NUM_CORES; i++)
+		cp->container_cursor[i] = (s64)cp->nr_containers * i / SPDK_NUM_CORES;
+}
+
+/*
+ * writes a snapshot of the whole reservation table. the table is synced
+ * before the generation header is written, so that a torn snapshot is
+ * never taken as the latest one. the header is synced as well before the
+ * delta log starts over: until then, the records at its head still belong
+ * to the generation on disk.
+ */
 s32 nvfuse_store_container_table(struct nvfuse_handle *nvh)
 {
 	struct control_plane_context *cp;
 	s32 ct_size;
-	s32 offset = 0;
+	s32 offset = LOG_CHUNK_SIZE;
 	s32 fd;
 	s32 chunk_size = LOG_CHUNK_SIZE;
 	s8 *buf;
@@ -332,15 +453,24 @@ s32 nvfuse_store_container_table(struct nvfuse_handle *nvh)
 	if (fd < 0) {
 		fprintf(stderr, " Error: file open = %s \n", filename);
 		ret = -1;
-		goto RET;
+		goto FREE_BUF;
 	}
 
-	while (offset < ct_size + chunk_size) {
-
-		/* store generation number at the begining of file */
-		if (offset == 0) {
+	while (offset <= ct_size + chunk_size) {
+		/* store generation number at the begining of file, after the table */
+		if (offset == ct_size + chunk_size) {
 			s64 *p = (s64 *)buf;
+
+			/* the buffer cache writes back in any order */
+			if (nvfuse_fsync(nvh, fd)) {
+				printf(" Error: file (%s) fsync() \n", filename);
+				ret = -1;
+				goto CLOSE_FD;
+			}
+
+			memset(buf, 0x00, chunk_size);
 			*p = cp->container_generation++;
+			offset = 0;
 		} else {
 			s8 *p = (s8 *)cp->reservation_table;
 			rte_memcpy(buf, p + offset - chunk_size, chunk_size);
@@ -349,29 +479,141 @@ s32 nvfuse_store_container_table(struct nvfuse_handle *nvh)
 		ret = nvfuse_writefile(nvh, fd, buf, chunk_size, offset);
 		if (ret != chunk_size) {
 			printf(" Error: file (%s) write() \n", filename);
+			/* deltas keep going to the generation on disk */
+			if (offset == 0)
+				cp->container_generation--;
 			ret = -1;
-			goto RET;
+			goto CLOSE_FD;
 		}
 
+		if (offset == 0)
+			break;
 		offset += chunk_size;
 	}
 
-#if 0	/* sync dirty data to SSD */
-	nvfuse_fsync(fd);
-#else	/* sync asynchronously  */
-	nvfuse_check_flush_dirty(&nvh->nvh_sb, 0 /* delayed flush */);
-#endif
-
-	/* release memory */
-	nvfuse_free_aligned_buffer(buf);
+	/* new generation deltas may only overwrite the old ones after this */
+	if (nvfuse_fsync(nvh, fd)) {
+		printf(" Error: file (%s) fsync() \n", filename);
+		cp->container_generation--;
+		ret = -1;
+		goto CLOSE_FD;
+	}
+	ret = 0;
+	cp->container_delta_offset = 0;
 
+CLOSE_FD:
 	/* close file */
 	nvfuse_closefile(nvh, fd);
+
+FREE_BUF:
+	/* release memory */
+	nvfuse_free_aligned_buffer(buf);
 RET:
 
 	return ret;
 }
 
+/*
+ * appends the current state of container_id to the delta log instead of
+ * rewriting the whole reservation table on every update.
+ */
+s32 nvfuse_log_container_delta(struct nvfuse_handle *nvh, s32 container_id)
+{
+	struct control_plane_context *cp = nvh->nvh_sb.sb_control_plane_ctx;
+	struct container_reservation *entry = cp->reservation_table + container_id;
+	struct container_delta delta;
+	s32 ret;
+
+	if (cp->container_delta_offset >= MAX(cp->reservation_table_size, CONTAINER_DELTA_MIN_LOG_SIZE))
+		return nvfuse_store_container_table(nvh);
+
+	if (cp->container_delta_fd < 0) {
+		cp->container_delta_fd = nvfuse_openfile_path(nvh, CONTAINER_DELTA_LOG_NAME, O_RDWR | O_CREAT, 0);
+		if (cp->container_delta_fd < 0) {
+			fprintf(stderr, " Error: file open = %s \n", CONTAINER_DELTA_LOG_NAME);
+			return -1;
+		}
+	}
+
+	delta.generation = cp->container_generation - 1;
+	delta.container_id = container_id;
+	delta.owner_core_id = entry->owner_core_id;
+	delta.status = entry->status;
+	delta.ref_count = entry->ref_count;
+
+	ret = nvfuse_writefile(nvh, cp->container_delta_fd, (s8 *)&delta, sizeof(delta),
+			       cp->container_delta_offset);
+	if (ret != sizeof(delta)) {
+		printf(" Error: file (%s) write() \n", CONTAINER_DELTA_LOG_NAME);
+		return -1;
+	}
+	cp->container_delta_offset += sizeof(delta);
+
+	/* sync asynchronously  */
+	nvfuse_check_flush_dirty(&nvh->nvh_sb, 0 /* delayed flush */);
+
+	return 0;
+}
+
+/*
+ * applies the delta log on top of the loaded snapshot. the valid records
+ * carry the snapshot's generation and end at the first one that does not;
+ * anything after it was written against an older snapshot.
+ */
+static s32 nvfuse_replay_container_delta(struct nvfuse_handle *nvh)
+{
+	struct control_plane_context *cp = nvh->nvh_sb.sb_control_plane_ctx;
+	struct container_reservation *entry;
+	struct container_delta *delta;
+	s32 chunk_size = LOG_CHUNK_SIZE / sizeof(struct container_delta) * sizeof(struct container_delta);
+	s64 generation = cp->container_generation - 1;
+	s32 nr_deltas = 0;
+	s8 *buf;
+	s32 fd;
+	s32 ret;
+	s32 i;
+
+	cp->container_delta_offset = 0;
+
+	fd = nvfuse_openfile_path(nvh, CONTAINER_DELTA_LOG_NAME, O_RDWR, 0);
+	if (fd < 0)
+		return 0;
+
+	buf = nvfuse_alloc_aligned_buffer(LOG_CHUNK_SIZE);
+	if (buf == NULL) {
+		printf(" Error: malloc() \n");
+		nvfuse_closefile(nvh, fd);
+		return -1;
+	}
+
+	do {
+		ret = nvfuse_readfile(nvh, fd, buf, chunk_size, cp->container_delta_offset);
+		for (i = 0; i < ret / (s32)sizeof(struct container_delta); i++) {
+			delta = (struct container_delta *)buf + i;
+			if (delta->generation != generation ||
+			    delta->container_id <= 0 || delta->container_id >= cp->nr_containers)
+				goto DONE;
+
+			entry = cp->reservation_table + delta->container_id;
+			entry->owner_core_id = delta->owner_core_id;
+			entry->status = delta->status;
+			entry->ref_count = delta->ref_count;
+
+			cp->container_delta_offset += sizeof(struct container_delta);
+			nr_deltas++;
+		}
+	} while (ret == chunk_size);
+DONE:
+	nvfuse_free_aligned_buffer(buf);
+
+	/* later updates are appended right after the valid records */
+	cp->container_delta_fd = fd;
+
+	printf(" Replayed %d container table updates \n", nr_deltas);
+
+	return nr_deltas;
+}
+
 s32 nvfuse_load_container_table(struct nvfuse_handle *nvh)
 {
 	struct control_plane_context *cp;
@@ -408,7 +650,8 @@ s32 nvfuse_load_container_table(struct nvfuse_handle *nvh)
 		ret = nvfuse_readfile(nvh, fd, buf, chunk_size, 0);
 		if (ret != chunk_size) {
 			printf(" Error: file (%s) read().\n", filename);
-			goto RET;
+			nvfuse_closefile(nvh, fd);
+			continue;
 		}
 		curr_generation = (s64 *)buf;
 		if (*curr_generation > max_generation) {
@@ -419,13 +662,15 @@ s32 nvfuse_load_container_table(struct nvfuse_handle *nvh)
 		nvfuse_closefile(nvh, fd);
 	}
 
-	if (latest_log_file == 0) {
-		fprintf(stdout, " app table log is not found. \n");
-		return 0;
+	if (max_generation == 0) {
+		fprintf(stdout, " container table log is not found. \n");
+		goto REPLAY;
 	}
 
 	filename = get_container_log_name(nvh, latest_log_file);
 	printf(" Latest log file = %s, generation = %ld\n", filename, max_generation);
+	/* the next snapshot must not overwrite the latest one */
+	cp->container_cur_log_file = (latest_log_file + 1) % cp->container_max_log_file;
 
 	ct_size = cp->reservation_table_size;
 	printf(" Container Table Size = %d bytes \n", ct_size);
@@ -434,15 +679,15 @@ s32 nvfuse_load_container_table(struct nvfuse_handle *nvh)
 	fd = nvfuse_openfile_path(nvh, filename, O_RDWR, 0);
 	if (fd < 0) {
 		fprintf(stderr, "Error: file open = %s. \n", filename);
-		goto RET;
+		goto REPLAY;
 	}
 
 	while (offset < ct_size + chunk_size) {
 
 		ret = nvfuse_readfile(nvh, fd, buf, chunk_size, offset);
 		if (ret != chunk_size) {
-			printf(" Error: file write() \n");
-			goto RET;
+			printf(" Error: file read() \n");
+			break;
 		}
 
 		/* store generation number at the begining of file */
@@ -461,6 +706,10 @@ s32 nvfuse_load_container_table(struct nvfuse_handle *nvh)
 	/* close file */
 	nvfuse_closefile(nvh, fd);
 
+REPLAY:
+	nvfuse_replay_container_delta(nvh);
+	nvfuse_container_index_build(cp);
+
 	/* release memory */
 	nvfuse_free_aligned_buffer(buf);
 RET:
@@ -504,7 +753,8 @@ s32 nvfuse_app_manage_table_add(struct nvfuse_handle *nvh, s32 channel_id, s8 *n
 				    UNLOCKED);
 
 		/* work around: container directory and related objects to be located in allocated container */
-		nvh->nvh_sb.sb_last_allocated_ino = node->root_bg_id * nvh->nvh_sb.sb_no_of_inodes_per_bg;
+		nvfuse_get_alloc_hint(&nvh->nvh_sb)->last_allocated_ino = node->root_bg_id *
+				nvh->nvh_sb.sb_no_of_inodes_per_bg;
 		printf(" Create container direcotory %s in container %d\n", dir_name, node->root_bg_id);
 		res = nvfuse_mkdir_path(nvh, (const char *)dir_name, 0644);
 		if (res < 0) {
@@ -512,7 +762,7 @@ s32 nvfuse_app_manage_table_add(struct nvfuse_handle *nvh, s32 channel_id, s8 *n
 			return res;
 		}
 		/* reset */
-		nvh->nvh_sb.sb_last_allocated_ino = 0;
+		nvfuse_get_alloc_hint(&nvh->nvh_sb)->last_allocated_ino = 0;
 
 		printf(" Add app: created dir = %s\n", dir_name);
 	} else {
@@ -560,7 +810,8 @@ s32 nvfuse_destroy_containers_for_app_unregistration(struct nvfuse_handle *nvh,
 
 		/* format bg (container) summary with initial value */
 		nvfuse_make_bg_descriptor(bd, container_id,
-					    container_id * sb->sb_no_of_blocks_per_bg, sb->sb_no_of_blocks_per_bg);
+					    container_id * sb->sb_no_of_blocks_per_bg, sb->sb_no_of_blocks_per_bg,
+					    sb->sb_inode_size);
 		nvfuse_release_bh(sb, bd_bh, 0, DIRTY);
 
 		/* clear data bitmap tables */
@@ -618,9 +869,6 @@ s32 nvfuse_app_manage_table_remove(struct nvfuse_handle *nvh, s32 core_id, s32 d
 		printf(" Later, this information can be recovered through registration of app.\n");
 	}
 
-	/* logging container allocation table */
-	nvfuse_store_container_table(nvh);
-
 	/* logging app allocation table */
 	nvfuse_store_app_table(nvh);
 
@@ -674,6 +922,7 @@ s32 nvfuse_control_plane_buffer_init(struct nvfuse_handle *nvh, s32 size)
 	}
 
 	cp->curr_buffer_size = cp->total_buffer_size = size;
+	memset(cp->buffer_balloon, 0x00, sizeof(cp->buffer_balloon));
 
 	return 0;
 }
@@ -683,19 +932,57 @@ void nvfuse_control_plane_buffer_deinit(struct nvfuse_handle *nvh)
 
 }
 
-s32 nvfuse_control_plane_buffer_alloc(struct nvfuse_handle *nvh, s32 size)
+/*
+ * asks data planes that miss less than core_id to give back deficit pages
+ * in total, the idlest first. none is shrunk below its initial buffer size.
+ */
+static void nvfuse_control_plane_buffer_balloon(struct control_plane_context *cp, s32 core_id,
+		s32 deficit)
+{
+	struct buffer_balloon *busy = &cp->buffer_balloon[core_id];
+	struct buffer_balloon *victim;
+	s32 min_size = NVFUSE_INITIAL_BUFFER_SIZE_DATA * (NVFUSE_MEGA_BYTES / CLUSTER_SIZE);
+	s32 shrink;
+	s32 i;
+
+	while (deficit > 0) {
+		victim = NULL;
+		for (i = 1; i < SPDK_NUM_CORES; i++) {
+			struct buffer_balloon *balloon = &cp->buffer_balloon[i];
+
+			if (i == core_id || balloon->miss_rate >= busy->miss_rate ||
+			    balloon->size - balloon->shrink <= min_size)
+				continue;
+			if (victim == NULL || balloon->miss_rate < victim->miss_rate)
+				victim = balloon;
+		}
+		if (victim == NULL)
+			break;
+
+		shrink = MIN(deficit, victim->size - victim->shrink - min_size);
+		victim->shrink += shrink;
+		deficit -= shrink;
+	}
+}
+
+s32 nvfuse_control_plane_buffer_alloc(struct nvfuse_handle *nvh, s32 core_id, s32 size)
 {
 	struct control_plane_context *cp = nvh->nvh_sb.sb_control_plane_ctx;
 	s32 allocated_size;
 
-	if (cp->curr_buffer_size < size) {
+	/* batched requests are granted in part when buffers run short */
+	allocated_size = MIN(size, cp->curr_buffer_size);
+	if (allocated_size < size)
+		nvfuse_control_plane_buffer_balloon(cp, core_id, size - allocated_size);
+
+	if (cp->curr_buffer_size == 0) {
 		fprintf(stderr, " buffers are not sufficient. \n");
 		rte_malloc_dump_stats(stdout, NULL);
 		return 0;
 	}
 
-	cp->curr_buffer_size -= size;
-	allocated_size = size;
+	cp->curr_buffer_size -= allocated_size;
+	cp->buffer_balloon[core_id].size += allocated_size;
 #if 0
 	printf(" Remaining buffers = %.3f%% (%.3fGB)\n",
 	       (double)cp->curr_buffer_size * 100 / cp->total_buffer_size,
@@ -706,9 +993,10 @@ s32 nvfuse_control_plane_buffer_alloc(struct nvfuse_handle *nvh, s32 size)
 	return allocated_size;
 }
 
-s32 nvfuse_control_plane_buffer_free(struct nvfuse_handle *nvh, s32 size)
+s32 nvfuse_control_plane_buffer_free(struct nvfuse_handle *nvh, s32 core_id, s32 size)
 {
 	struct control_plane_context *cp = nvh->nvh_sb.sb_control_plane_ctx;
+	struct buffer_balloon *balloon = &cp->buffer_balloon[core_id];
 
 	if (size == 0 || cp->curr_buffer_size + size > cp->total_buffer_size) {
 		return -1;
@@ -717,6 +1005,9 @@ s32 nvfuse_control_plane_buffer_free(struct nvfuse_handle *nvh, s32 size)
 	cp->curr_buffer_size += size;
 	assert(cp->curr_buffer_size <= cp->total_buffer_size);
 
+	balloon->size = MAX(balloon->size - size, 0);
+	balloon->shrink = MIN(balloon->shrink, balloon->size);
+
 	//printf(" Remaining buffers = %.3f%% (%.3fGB)\n",
 	//	(double)cp->curr_buffer_size * 100 / cp->total_buffer_size,
 	//	(double)cp->curr_buffer_size / 256 / 1024);
@@ -724,6 +1015,27 @@ s32 nvfuse_control_plane_buffer_free(struct nvfuse_handle *nvh, s32 size)
 	return 0;
 }
 
+/*
+ * records the buffer usage reported by a data plane and returns the pages
+ * it is asked to give back. it answers with BUFFER_FREE_REQ for what it
+ * could actually free.
+ */
+s32 nvfuse_control_plane_buffer_stat(struct nvfuse_handle *nvh, s32 core_id, s32 size, s32 misses,
+				     s32 interval_ms)
+{
+	struct control_plane_context *cp = nvh->nvh_sb.sb_control_plane_ctx;
+	struct buffer_balloon *balloon = &cp->buffer_balloon[core_id];
+	s32 shrink;
+
+	balloon->size = size;
+	balloon->miss_rate = interval_ms ? (s64)misses * 1000 / interval_ms : misses;
+
+	shrink = MIN(balloon->shrink, size);
+	balloon->shrink = 0;
+
+	return shrink;
+}
+
 s32 nvfuse_control_plane_container_table_init(struct nvfuse_handle *nvh, s32 num_containers)
 {
 	struct control_plane_context *cp = nvh->nvh_sb.sb_control_plane_ctx;
@@ -741,6 +1053,8 @@ s32 nvfuse_control_plane_container_table_init(struct nvfuse_handle *nvh, s32 num
 	cp->container_generation = 1;
 	cp->container_cur_log_file = 0;
 	cp->container_max_log_file = 2;
+	cp->container_delta_fd = -1;
+	cp->container_delta_offset = 0;
 
 	cp->nr_containers = num_containers;
 	cp->free_containers = num_containers;
@@ -761,6 +1075,17 @@ s32 nvfuse_control_plane_container_table_init(struct nvfuse_handle *nvh, s32 num
 	cp->reservation_table[0].owner_core_id = ~0;
 	cp->free_containers --;
 
+	cp->container_map_words = DIV_UP(cp->nr_containers, 64) / 64;
+	cp->container_free_map = nvfuse_malloc(sizeof(u64) * cp->container_map_words);
+	cp->container_free_summary = nvfuse_malloc(sizeof(u64) * DIV_UP(cp->container_map_words, 64) / 64);
+	cp->container_next_dormant = nvfuse_malloc(sizeof(s32) * cp->nr_containers);
+	if (cp->container_free_map == NULL || cp->container_free_summary == NULL ||
+	    cp->container_next_dormant == NULL) {
+		fprintf(stderr, " Error: malloc() \n");
+		return -1;
+	}
+	nvfuse_container_index_build(cp);
+
 #if 1
 	{
 		int i;
@@ -812,14 +1137,17 @@ s32 nvfuse_control_plane_container_alloc(struct nvfuse_handle *nvh, s32 core_id,
 	assert(core_id != 0);
 
 	if (type == CONTAINER_NEW_ALLOC) {
+		s32 max_try_count = cp->free_containers;
+
 		if (cp->free_containers == 0)
 			return 0;
 
-		container_id = (cp->last_alloc_container_id + 1) % cp->nr_containers;
-
-		while (reservation_table[container_id].owner_core_id != 0 ||
-		       reservation_table[container_id].status != UNLOCKED) {
-			container_id = (container_id + 1) % cp->nr_containers;
+		/* free containers locked by readers are passed over */
+		container_id = nvfuse_container_find_free(cp, cp->container_cursor[core_id]);
+		while (reservation_table[container_id].status != UNLOCKED) {
+			if (--max_try_count == 0)
+				return 0;
+			container_id = nvfuse_container_find_free(cp, (container_id + 1) % cp->nr_containers);
 		}
 
 		assert(container_id != 0);
@@ -829,24 +1157,18 @@ s32 nvfuse_control_plane_container_alloc(struct nvfuse_handle *nvh, s32 core_id,
 		reservation_table[container_id].owner_core_id = core_id;
 		reservation_table[container_id].status = status;
 		reservation_table[container_id].ref_count = 0;
+		nvfuse_container_clear_free(cp, container_id);
 		cp->free_containers--;
 
+		cp->container_cursor[core_id] = (container_id + 1) % cp->nr_containers;
 		cp->last_alloc_container_id = container_id;
 	} else { // type == CONTAINER_ALLOCATED_ALLOC
-		s32 max_try_count = cp->nr_containers;
-
-		container_id = (cp->last_alloc_container_id + 1) % cp->nr_containers;
-		while (reservation_table[container_id].owner_core_id != core_id ||
-		       reservation_table[container_id].status != UNLOCKED) {
-			container_id = (container_id + 1) % cp->nr_containers;
-			if (--max_try_count == 0) {
-				container_id = 0;
-				printf(" No such containers for core %d\n\n", core_id);
-				goto RET;
-			}
+		container_id = nvfuse_container_pop_dormant(cp, core_id);
+		if (container_id == 0) {
+			printf(" No such containers for core %d\n\n", core_id);
+			goto RET;
 		}
 
-		assert(container_id != 0);
 		assert(reservation_table[container_id].owner_core_id == core_id);
 		assert(reservation_table[container_id].status == UNLOCKED);
 
@@ -859,7 +1181,7 @@ s32 nvfuse_control_plane_container_alloc(struct nvfuse_handle *nvh, s32 core_id,
 	//fprintf( stdout, " allocated container id = %d, remained containers = %d \n", container_id, free_containers);
 
 	/* logging container allocation table */
-	nvfuse_store_container_table(nvh);
+	nvfuse_log_container_delta(nvh, container_id);
 RET:
 
 	return container_id;
@@ -884,10 +1206,11 @@ s32 nvfuse_control_plane_container_release(struct nvfuse_handle *nvh, s32 core_i
 	reservation_table[container_id].owner_core_id = 0;
 	reservation_table[container_id].status = UNLOCKED;
 	reservation_table[container_id].ref_count = 0;
+	nvfuse_container_set_free(cp, container_id);
 	cp->free_containers++;
 
 	/* logging container allocation table */
-	nvfuse_store_container_table(nvh);
+	nvfuse_log_container_delta(nvh, container_id);
 
 	return 0;
 }
@@ -899,7 +1222,10 @@ s32 nvfuse_control_plane_container_release_by_coreid(struct nvfuse_handle *nvh,
 	struct container_reservation *reservation_table = cp->reservation_table;
 	s32 container_id;
 
-	for (container_id = 1; container_id < cp->nr_containers; container_id++) {
+	/* the dormant list is rebuilt below, in id order */
+	cp->container_dormant_head[core_id] = 0;
+
+	for (container_id = cp->nr_containers - 1; container_id > 0; container_id--) {
 		if (reservation_table[container_id].owner_core_id != core_id)
 			continue;
 
@@ -915,8 +1241,14 @@ s32 nvfuse_control_plane_container_release_by_coreid(struct nvfuse_handle *nvh,
 		reservation_table[container_id].status = UNLOCKED;
 		reservation_table[container_id].ref_count = 0;
 
-		if (clear_owner)
+		if (clear_owner) {
+			nvfuse_container_set_free(cp, container_id);
 			cp->free_containers++;
+		} else {
+			nvfuse_container_push_dormant(cp, core_id, container_id);
+		}
+
+		nvfuse_log_container_delta(nvh, container_id);
 	}
 
 	return 0;
@@ -995,7 +1327,12 @@ void nvfuse_control_plane_container_table_deinit(struct nvfuse_handle *nvh)
 	struct control_plane_context *cp = nvh->nvh_sb.sb_control_plane_ctx;
 
 	nvfuse_store_container_table(nvh);
+	if (cp->container_delta_fd >= 0)
+		nvfuse_closefile(nvh, cp->container_delta_fd);
 	nvfuse_free_aligned_buffer(cp->reservation_table);
+	nvfuse_free(cp->container_free_map);
+	nvfuse_free(cp->container_free_summary);
+	nvfuse_free(cp->container_next_dormant);
 }
 
 s32 nvfuse_control_plane_init(struct nvfuse_handle *nvh)
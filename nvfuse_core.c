@@ -85,8 +85,8 @@ struct nvfuse_inode_ctx *nvfuse_read_inode(struct nvfuse_superblock *sb,
 	assert(test_bit(&ictx->ictx_status, INODE_STATE_LOCK));
 	assert(ictx->ictx_ino == ino);
 
-	block = ino / INODE_ENTRY_NUM;
-	offset = ino % INODE_ENTRY_NUM;
+	block = ino / INODE_ENTRY_NUM(sb);
+	offset = ino % INODE_ENTRY_NUM(sb);
 
 	bh = nvfuse_get_bh(sb, ictx, ITABLE_INO, block, READ, NVFUSE_TYPE_META);
 	if (bh == NULL) {
@@ -94,10 +94,20 @@ struct nvfuse_inode_ctx *nvfuse_read_inode(struct nvfuse_superblock *sb,
 		/* FIXME: needed to release ictx here */
 		return NULL;
 	}
-	inode = (struct nvfuse_inode *)bh->bh_buf;
-	inode += offset;
+	inode = INODE_ENTRY(sb, bh->bh_buf, offset);
 	assert(ino == inode->i_ino);
 
+	/*
+	 * compact inodes share an itable block with their neighbours, which
+	 * may be held by other contexts, so work on a copy and drop the block.
+	 */
+	if (NVFUSE_INODE_IS_COMPACT(sb)) {
+		rte_memcpy(ictx->ictx_icopy, inode, NVFUSE_INODE_SIZE(sb));
+		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+		inode = (struct nvfuse_inode *)ictx->ictx_icopy;
+		bh = NULL;
+	}
+
 	/* TODO: needed to consider copying inode to ictx. */
 	ictx->ictx_inode = inode;
 	ictx->ictx_bh = bh;
@@ -127,6 +137,13 @@ void nvfuse_release_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx
 	if (bh) {
 		nvfuse_set_bh_status(bh, BUFFER_STATUS_META);
 		nvfuse_release_bh(sb, bh, 0/*head*/, dirty);
+	} else if (dirty && ictx->ictx_inode == (struct nvfuse_inode *)ictx->ictx_icopy) {
+		/* write the compact inode copy back to its itable block */
+		bh = nvfuse_get_bh(sb, ictx, ITABLE_INO, ictx->ictx_ino / INODE_ENTRY_NUM(sb),
+				   READ, NVFUSE_TYPE_META);
+		rte_memcpy(INODE_ENTRY(sb, bh->bh_buf, ictx->ictx_ino % INODE_ENTRY_NUM(sb)),
+			   ictx->ictx_icopy, NVFUSE_INODE_SIZE(sb));
+		nvfuse_release_bh(sb, bh, 0, DIRTY);
 	}
 
 	nvfuse_release_ictx(sb, ictx, dirty);
@@ -139,6 +156,10 @@ s32 nvfuse_relocate_delete_inode(struct nvfuse_superblock *sb, struct nvfuse_ino
 	u32 bg_id;
 	ino = ictx->ictx_ino;
 	inode = ictx->ictx_inode;
+	if (inode->i_xattr_blk) {
+		nvfuse_free_blocks(sb, inode->i_xattr_blk, 1);
+		inode->i_xattr_blk = 0;
+	}
 	inode->i_deleted = 1;
 	inode->i_ino = 0;
 	inode->i_size = 0;
@@ -218,6 +239,21 @@ void nvfuse_free_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ct
 
 	inode = ictx->ictx_inode;
 
+	/* blocks past the new size are freed below, the window goes with them */
+	nvfuse_release_rsv_window(sb, ictx);
+
+#ifdef NVFUSE_USE_INLINE_DATA
+	if (NVFUSE_INODE_HAS_INLINE_DATA(inode)) {
+		if (size <= NVFUSE_INLINE_DATA_MAX(sb)) {
+			/* keep the tail zeroed so that a later extension reads zeroes */
+			if (size < inode->i_size)
+				memset(NVFUSE_INLINE_DATA(inode) + size, 0x00, inode->i_size - size);
+			return;
+		}
+		nvfuse_spill_inline_data(sb, ictx);
+	}
+#endif
+
 	num_block = NVFUSE_SIZE_TO_BLK(inode->i_size);
 	trun_num_block = NVFUSE_SIZE_TO_BLK(size);
 	if (inode->i_size & (CLUSTER_SIZE - 1))
@@ -262,6 +298,53 @@ void nvfuse_free_inode_size(struct nvfuse_superblock *sb, struct nvfuse_inode_ct
 	nvfuse_truncate_blocks(sb, ictx, size);
 }
 
+#ifdef NVFUSE_USE_INLINE_DATA
+/* whether the file data ending at end can be kept in the inode */
+s32 nvfuse_inline_data_fits(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s64 end)
+{
+	if (end > NVFUSE_INLINE_DATA_MAX(sb))
+		return 0;
+
+	if (NVFUSE_INODE_HAS_INLINE_DATA(inode))
+		return 1;
+
+	/* only an empty file without data blocks or inline xattrs turns inline */
+	return inode->i_type == NVFUSE_TYPE_FILE && inode->i_size == 0 && inode->i_blocks[0] == 0 &&
+	       (NVFUSE_INODE_IS_COMPACT(sb) || *(u32 *)NVFUSE_INLINE_DATA(inode) == 0);
+}
+
+/* move inline data to the first data block before the file outgrows the inode */
+s32 nvfuse_spill_inline_data(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx)
+{
+	struct nvfuse_inode *inode = ictx->ictx_inode;
+	struct nvfuse_buffer_head *bh;
+	s32 ret;
+
+	if (!NVFUSE_INODE_HAS_INLINE_DATA(inode))
+		return 0;
+
+	ret = nvfuse_get_block(sb, ictx, 0, 1/* num block */, NULL, NULL, 1);
+	if (ret) {
+		dprintf_error(INODE, "data block allocation fails.");
+		return NVFUSE_ERROR;
+	}
+
+	bh = nvfuse_get_bh(sb, ictx, inode->i_ino, 0, WRITE, NVFUSE_TYPE_DATA);
+	if (bh == NULL)
+		return NVFUSE_ERROR;
+
+	memset(bh->bh_buf, 0x00, CLUSTER_SIZE);
+	rte_memcpy(bh->bh_buf, NVFUSE_INLINE_DATA(inode), inode->i_size);
+	nvfuse_release_bh(sb, bh, 0, DIRTY);
+
+	memset(NVFUSE_INLINE_DATA(inode), 0x00, NVFUSE_INLINE_DATA_MAX(sb));
+	inode->i_flags &= ~NVFUSE_INODE_FL_INLINE_DATA;
+	nvfuse_mark_inode_dirty(ictx);
+
+	return 0;
+}
+#endif
+
 inode_t nvfuse_alloc_new_inode(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx)
 {
 	struct nvfuse_buffer_head *bh;
@@ -271,10 +354,11 @@ inode_t nvfuse_alloc_new_inode(struct nvfuse_superblock *sb, struct nvfuse_inode
 	inode_t alloc_ino = 0;
 	inode_t hint_ino = 0;
 	inode_t last_allocated_ino = 0;
+	struct nvfuse_alloc_hint *hint;
 	s32 container_id;
 
 	if (nvfuse_process_model_is_dataplane() && !nvfuse_check_free_inode(sb)) {
-		container_id = nvfuse_alloc_container_from_primary_process(sb->sb_nvh, CONTAINER_NEW_ALLOC);
+		container_id = nvfuse_get_reserved_container(sb);
 		if (container_id > 0) {
 			/* insert allocated container to process */
 			nvfuse_add_bg(sb, container_id);
@@ -284,26 +368,26 @@ inode_t nvfuse_alloc_new_inode(struct nvfuse_superblock *sb, struct nvfuse_inode
 		}
 	}
 
-	last_allocated_ino = sb->sb_last_allocated_ino;
+	hint = nvfuse_get_alloc_hint(sb);
+	last_allocated_ino = hint->last_allocated_ino;
 	hint_ino = nvfuse_find_free_inode(sb, ictx, last_allocated_ino);
 	if (hint_ino) {
-		search_block = hint_ino / INODE_ENTRY_NUM;
-		search_entry = hint_ino % INODE_ENTRY_NUM;
+		search_block = hint_ino / INODE_ENTRY_NUM(sb);
+		search_entry = hint_ino % INODE_ENTRY_NUM(sb);
 	} else {
 		dprintf_error(INODE, " no more inodes in the file system.");
 		return 0;
 	}
 
 	bh = nvfuse_get_bh(sb, ictx, ITABLE_INO, search_block, READ, NVFUSE_TYPE_META);
-	ip = (struct nvfuse_inode *)bh->bh_buf;
 #ifdef NVFUSE_USE_MKFS_INODE_ZEROING
-	for (j = 0; j < INODE_ENTRY_NUM; j++) {
-		if (ip[search_entry].i_ino == 0 &&
-		    (search_entry + search_block * INODE_ENTRY_NUM) >= NUM_RESV_INO) {
-			alloc_ino = search_entry + search_block * INODE_ENTRY_NUM;
+	for (j = 0; j < INODE_ENTRY_NUM(sb); j++) {
+		if (INODE_ENTRY(sb, bh->bh_buf, search_entry)->i_ino == 0 &&
+		    (search_entry + search_block * INODE_ENTRY_NUM(sb)) >= NUM_RESV_INO) {
+			alloc_ino = search_entry + search_block * INODE_ENTRY_NUM(sb);
 			goto RES;
 		}
-		search_entry = (search_entry + 1) % INODE_ENTRY_NUM;
+		search_entry = (search_entry + 1) % INODE_ENTRY_NUM(sb);
 	}
 
 	/* FIXME: need to put error handling code  */
@@ -314,15 +398,15 @@ RES:
 	;
 
 #else
-	alloc_ino = search_entry + search_block * INODE_ENTRY_NUM;
+	alloc_ino = search_entry + search_block * INODE_ENTRY_NUM(sb);
 #endif
 
 	nvfuse_dec_free_inodes(sb, alloc_ino);
 
-	ip += search_entry;
+	ip = INODE_ENTRY(sb, bh->bh_buf, search_entry);
 
 	/* initialization of inode entry */
-	memset(ip, 0x00, INODE_ENTRY_SIZE);
+	memset(ip, 0x00, NVFUSE_INODE_SIZE(sb));
 
 	ip->i_ino = alloc_ino;
 	ip->i_deleted = 0;
@@ -332,7 +416,7 @@ RES:
 
 	/* keep hit information to rapidly find a free inode */
 	if (!spdk_process_is_primary() || nvfuse_process_model_is_standalone()) {
-		sb->sb_last_allocated_ino = alloc_ino + 1;
+		hint->last_allocated_ino = alloc_ino + 1;
 	}
 
 	if (spdk_process_is_primary() && nvfuse_process_model_is_dataplane()) {
@@ -342,6 +426,90 @@ RES:
 	return alloc_ino;
 }
 
+/* allocate inodes in contiguous runs starting from the last allocation hint */
+u32 nvfuse_alloc_new_inodes(struct nvfuse_superblock *sb, inode_t *inos, u32 count)
+{
+	struct nvfuse_buffer_head *bh;
+	struct nvfuse_inode *ip;
+	struct nvfuse_alloc_hint *hint;
+	inode_t last_ino;
+	u32 alloc_count = 0;
+	u32 retry = 0;
+	u32 bg_id;
+	u32 nr;
+	u32 i;
+	s32 container_id;
+
+	hint = nvfuse_get_alloc_hint(sb);
+	last_ino = hint->last_allocated_ino;
+
+	while (alloc_count < count) {
+		if (nvfuse_process_model_is_dataplane() && !nvfuse_check_free_inode(sb)) {
+			container_id = nvfuse_get_reserved_container(sb);
+			if (container_id <= 0) {
+				dprintf_error(INODE, " no more containers for new inodes.\n");
+				break;
+			}
+			/* insert allocated container to process */
+			nvfuse_add_bg(sb, container_id);
+		}
+
+		if (!spdk_process_is_primary())
+			bg_id = nvfuse_get_curr_bg_id(sb, 1 /*inode type*/);
+		else
+			bg_id = (last_ino / sb->sb_no_of_inodes_per_bg) % sb->sb_bg_num;
+
+		nr = nvfuse_scan_free_ibitmap_bulk(sb, NULL, bg_id, last_ino % sb->sb_no_of_inodes_per_bg,
+						   inos + alloc_count, count - alloc_count);
+		if (nr) {
+			alloc_count += nr;
+			last_ino = inos[alloc_count - 1] + 1;
+			retry = 0;
+			continue;
+		}
+
+		/* current bg has no free inode */
+		if (nvfuse_process_model_is_dataplane())
+			bg_id = nvfuse_get_next_bg_id(sb, 1 /*inode type*/);
+		else
+			bg_id = (bg_id + 1) % sb->sb_bg_num;
+		last_ino = bg_id * sb->sb_no_of_inodes_per_bg;
+
+		if (++retry >= sb->sb_bg_num)
+			break;
+	}
+
+	if (alloc_count < count) {
+		dprintf_error(INODE, " only %d of %d inodes are allocated.\n", alloc_count, count);
+	}
+
+	/* initialization of inode entries */
+	for (i = 0; i < alloc_count; i++) {
+		/* inode entry occupying a whole block needs no read */
+		if (INODE_ENTRY_NUM(sb) == 1)
+			bh = nvfuse_get_new_bh(sb, NULL, ITABLE_INO, inos[i], NVFUSE_TYPE_META);
+		else
+			bh = nvfuse_get_bh(sb, NULL, ITABLE_INO, inos[i] / INODE_ENTRY_NUM(sb), READ, NVFUSE_TYPE_META);
+
+		ip = INODE_ENTRY(sb, bh->bh_buf, inos[i] % INODE_ENTRY_NUM(sb));
+
+		memset(ip, 0x00, NVFUSE_INODE_SIZE(sb));
+
+		ip->i_ino = inos[i];
+		ip->i_deleted = 0;
+		ip->i_version++;
+
+		nvfuse_release_bh(sb, bh, 0, DIRTY);
+	}
+
+	/* keep hit information to rapidly find a free inode */
+	if (alloc_count && (!spdk_process_is_primary() || nvfuse_process_model_is_standalone())) {
+		hint->last_allocated_ino = last_ino;
+	}
+
+	return alloc_count;
+}
+
 void nvfuse_release_ibitmap(struct nvfuse_superblock *sb, u32 bg_id, u32 ino)
 {
 	struct nvfuse_bg_descriptor *bd = NULL;
@@ -378,10 +546,14 @@ void nvfuse_inc_free_inodes(struct nvfuse_superblock *sb, inode_t ino)
 	assert(bd->bd_id == bg_id);
 
 	bd->bd_free_inodes++;
+
+	SPINLOCK_LOCK(&sb->sb_lock);
 	sb->sb_free_inodes++;
 	if (!spdk_process_is_primary()) {
 		sb->asb.asb_free_inodes++;
 	}
+	SPINLOCK_UNLOCK(&sb->sb_lock);
+
 	assert(bd->bd_free_inodes <= bd->bd_max_inodes);
 	nvfuse_release_bh(sb, bd_bh, 0, DIRTY);
 
@@ -409,10 +581,14 @@ void nvfuse_dec_free_inodes(struct nvfuse_superblock *sb, inode_t ino)
 	assert(bd->bd_id == bg_id);
 
 	bd->bd_free_inodes--;
+
+	SPINLOCK_LOCK(&sb->sb_lock);
 	sb->sb_free_inodes--;
 	if (!spdk_process_is_primary()) {
 		sb->asb.asb_free_inodes--;
 	}
+	SPINLOCK_UNLOCK(&sb->sb_lock);
+
 	assert(bd->bd_free_inodes >= 0);
 	nvfuse_release_bh(sb, bd_bh, 0, DIRTY);
 }
@@ -516,6 +692,50 @@ u32 nvfuse_scan_free_ibitmap(struct nvfuse_superblock *sb, struct nvfuse_inode_c
 	return free_inode;
 }
 
+/* claim up to count free inodes of a bg with a single pass over its bitmap */
+u32 nvfuse_scan_free_ibitmap_bulk(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				  u32 bg_id, u32 hint_free_inode, inode_t *inos, u32 count)
+{
+	struct nvfuse_bg_descriptor *bd = NULL;
+	struct nvfuse_buffer_head *bd_bh;
+	struct nvfuse_buffer_head *bh;
+	void *buf;
+	u32 scanned = 0;
+	u32 free_inode = hint_free_inode;
+	u32 found = 0;
+
+	bd_bh = nvfuse_get_bh(sb, ictx, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+	bd = (struct nvfuse_bg_descriptor *)bd_bh->bh_buf;
+	assert(bd->bd_id == bg_id);
+
+	bh = nvfuse_get_bh(sb, ictx, IBITMAP_INO, bg_id, READ, NVFUSE_TYPE_META);
+	buf = bh->bh_buf;
+
+	while (found < count && bd->bd_free_inodes && scanned < sb->sb_no_of_inodes_per_bg) {
+		if (!ext2fs_test_bit(free_inode, buf)) {
+			ext2fs_set_bit(free_inode, buf);
+			inos[found++] = free_inode + (bg_id * bd->bd_max_inodes);
+			bd->bd_free_inodes--;
+		}
+		free_inode = (free_inode + 1) % sb->sb_no_of_inodes_per_bg;
+		scanned++;
+	}
+
+	/* free inode counters are updated here instead of nvfuse_dec_free_inodes() */
+	SPINLOCK_LOCK(&sb->sb_lock);
+	sb->sb_free_inodes -= found;
+	if (!spdk_process_is_primary()) {
+		sb->asb.asb_free_inodes -= found;
+	}
+	SPINLOCK_UNLOCK(&sb->sb_lock);
+	assert(bd->bd_free_inodes >= 0);
+
+	nvfuse_release_bh(sb, bd_bh, 0, found ? DIRTY : NVF_CLEAN);
+	nvfuse_release_bh(sb, bh, 0, found ? DIRTY : NVF_CLEAN);
+
+	return found;
+}
+
 u32 nvfuse_get_next_bg_id(struct nvfuse_superblock *sb, s32 is_inode)
 {
 	u32 next_bg_id;
@@ -771,6 +991,120 @@ s32 nvfuse_set_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *i
 	return 0;
 }
 
+struct nvfuse_dir_index_pair {
+	bkey_t key;
+	u32 offset;
+};
+
+static int nvfuse_dir_index_pair_cmp(const void *p1, const void *p2)
+{
+	const struct nvfuse_dir_index_pair *pair1 = p1;
+	const struct nvfuse_dir_index_pair *pair2 = p2;
+
+	if (pair1->key > pair2->key)
+		return 1;
+	else if (pair1->key < pair2->key)
+		return -1;
+
+	return 0;
+}
+
+/* insert hashes of many filenames in key order through a single master */
+s32 nvfuse_set_dir_indexing_bulk(struct nvfuse_superblock *sb, struct nvfuse_inode *inode,
+				 s8 **filenames, u32 *offsets, s32 count)
+{
+	struct nvfuse_dir_index_pair *pairs;
+	key_pair_t sorted;
+	u32 dir_hash[2];
+	u32 collision = ~0;
+	u32 cur_offset;
+	u64 start_tsc = spdk_get_ticks();
+	u64 end_tsc;
+	master_node_t *master;
+	s32 num;
+	s32 i;
+
+	assert(inode->i_bpino);
+
+	pairs = malloc(sizeof(struct nvfuse_dir_index_pair) * count);
+	if (pairs == NULL) {
+		dprintf_error(MEMALLOC, " malloc error \n");
+		return -1;
+	}
+
+	collision >>= NVFUSE_BP_COLLISION_BITS;
+
+	for (i = 0; i < count; i++) {
+		nvfuse_dir_hash(filenames[i], dir_hash, dir_hash + 1);
+		pairs[i].key = (u64)dir_hash[0] | ((u64)dir_hash[1]) << 32;
+		pairs[i].offset = offsets[i] & collision;
+	}
+
+	/* sorted keys make consecutive inserts land on the same leaf */
+	qsort(pairs, count, sizeof(struct nvfuse_dir_index_pair), nvfuse_dir_index_pair_cmp);
+
+	/* collapse duplicate hashes into collision entries for bulk loading */
+	sorted.i_key = malloc(sizeof(bkey_t) * count);
+	sorted.i_item = malloc(sizeof(bitem_t) * count);
+	if (sorted.i_key == NULL || sorted.i_item == NULL) {
+		dprintf_error(MEMALLOC, " malloc error \n");
+		free(sorted.i_key);
+		free(sorted.i_item);
+		free(pairs);
+		return -1;
+	}
+
+	num = 0;
+	for (i = 0; i < count; i++) {
+		if (num && sorted.i_key[num - 1] == pairs[i].key) {
+			u32 c = sorted.i_item[num - 1] >> (NVFUSE_BP_LOW_BITS - NVFUSE_BP_COLLISION_BITS);
+			c++;
+			sorted.i_item[num - 1] = c << (NVFUSE_BP_LOW_BITS - NVFUSE_BP_COLLISION_BITS);
+			continue;
+		}
+		sorted.i_key[num] = pairs[i].key;
+		sorted.i_item[num] = pairs[i].offset;
+		num++;
+	}
+
+	master = bp_init_master(sb);
+	master->m_ino = inode->i_bpino;
+	master->m_sb = sb;
+	bp_read_master(master);
+
+	/* an empty tree is built bottom-up, otherwise keys are inserted one by one */
+	if (bp_bulk_load(master, &sorted, num) == 0)
+		goto WRITE_MASTER;
+
+	for (i = 0; i < count; i++) {
+		if (B_INSERT(master, &pairs[i].key, &pairs[i].offset, &cur_offset, 0) < 0) {
+			u32 c = cur_offset >> (NVFUSE_BP_LOW_BITS - NVFUSE_BP_COLLISION_BITS);
+			c++;
+
+			dprintf_warn(DIRECTORY, " file name collision = %016lx, %d\n", (unsigned long)pairs[i].key, c);
+
+			c <<= (NVFUSE_BP_LOW_BITS - NVFUSE_BP_COLLISION_BITS);
+			/* if collision occurs, offset is set to 0 */
+			cur_offset = c;
+			B_UPDATE(master, &pairs[i].key, &cur_offset);
+		}
+	}
+
+WRITE_MASTER:
+	bp_write_master(master);
+	bp_deinit_master(master);
+
+	free(sorted.i_key);
+	free(sorted.i_item);
+	free(pairs);
+
+	end_tsc = spdk_get_ticks();
+	sb->bp_set_index_tsc += (end_tsc - start_tsc);
+	sb->bp_set_index_count += count;
+
+	return 0;
+}
+
 s32 nvfuse_get_dir_indexing(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, s8 *filename,
 			    bitem_t *offset)
 {
@@ -939,6 +1273,7 @@ s32 nvfuse_make_jobs(struct nvfuse_superblock *sb, struct io_job **jobs, int num
 		dprintf_error(SPDK, "mempool get error for io job \n");
 		/* FIXME: how can we handle this error? */
 		assert(0);
+		return -1;
 	}
 	return 0;
 }
@@ -995,6 +1330,14 @@ void nvfuse_sync_dirty_data(struct nvfuse_superblock *sb, s32 num_blocks)
 	}
 	SPINLOCK_UNLOCK(&bm->bm_lock);
 
+	/* buffers referenced by other threads in the meantime left the flushing list */
+	if (count < num_blocks) {
+		nvfuse_release_jobs(sb, jobs + count, num_blocks - count);
+		num_blocks = count;
+		if (num_blocks == 0)
+			return;
+	}
+
 	count = 0;
 	while (count < num_blocks) {
 		nvfuse_aio_prep(jobs[count], sb->target);
@@ -1128,10 +1471,28 @@ s32 nvfuse_remove_bg(struct nvfuse_superblock *sb, u32 bg_id)
 	if (ret < 0)
 		return ret;
 
+	/* the primary has a free container again */
+	SPINLOCK_LOCK(&sb->sb_container_reserve_lock);
+	sb->sb_container_reserve_exhausted = 0;
+	SPINLOCK_UNLOCK(&sb->sb_container_reserve_lock);
+
 	dprintf_info(BD, " core %d removes bg %d (total %d)\n", rte_lcore_id(), bg_id, sb->sb_bg_list_count);
 	return 0;
 }
 
+/* whether bg_id is one of the containers on the bg list of this process */
+s32 nvfuse_has_bg(struct nvfuse_superblock *sb, u32 bg_id)
+{
+	struct bg_node *node;
+
+	list_for_each_entry(node, &sb->sb_bg_list, list) {
+		if (node->bg_id == bg_id)
+			return 1;
+	}
+
+	return 0;
+}
+
 void nvfuse_print_bg_list(struct nvfuse_superblock *sb)
 {
 	struct list_head *head = &sb->sb_bg_list;
@@ -1155,15 +1516,10 @@ s32 nvfuse_alloc_container_from_primary_process(struct nvfuse_handle *nvh, s32 t
 {
 	struct nvfuse_superblock *sb = &nvh->nvh_sb;
 	union nvfuse_ipc_msg *ipc_msg;
-	struct rte_ring *send_ring, *recv_ring;
 	struct rte_mempool *mempool;
 	s32 ret;
 	s32 container_id;
 
-	/* INITIALIZATION OF TX/RX RING BUFFERS */
-	send_ring = nvfuse_ipc_get_sendq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-	recv_ring = nvfuse_ipc_get_recvq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-
 	/* INITIALIZATION OF MEMORY POOL */
 	mempool = nvfuse_ipc_mempool(&nvh->nvh_ipc_ctx);
 	/*
@@ -1180,7 +1536,7 @@ s32 nvfuse_alloc_container_from_primary_process(struct nvfuse_handle *nvh, s32 t
 		u64 start_tsc = spdk_get_ticks();
 
 		/* SEND CONTAINER_ALLOC_REQ TO PRIMARY CORE */
-		ret = nvfuse_send_msg_to_primary_core(send_ring, recv_ring, ipc_msg, CONTAINER_ALLOC_REQ);
+		ret = nvfuse_send_msg_to_primary_core(nvh, ipc_msg, CONTAINER_ALLOC_REQ);
 		if (ret == 0) {
 			dprintf_error(IPC, "Failed to get new container (lcore = %d)\n", rte_lcore_id());
 			return 0;
@@ -1196,18 +1552,114 @@ s32 nvfuse_alloc_container_from_primary_process(struct nvfuse_handle *nvh, s32 t
 	return container_id;
 }
 
+static void nvfuse_container_reserve_cpl(union nvfuse_ipc_msg *ipc_msg, void *arg)
+{
+	struct nvfuse_superblock *sb = (struct nvfuse_superblock *)arg;
+
+	SPINLOCK_LOCK(&sb->sb_container_reserve_lock);
+	if (ipc_msg->ret > 0) {
+		sb->sb_container_reserve[sb->sb_container_reserve_count++] = ipc_msg->ret;
+		sb->sb_container_reserve_exhausted = 0;
+	} else {
+		sb->sb_container_reserve_exhausted = 1;
+	}
+	sb->sb_container_reserve_inflight--;
+	SPINLOCK_UNLOCK(&sb->sb_container_reserve_lock);
+}
+
+/* asks the primary for containers in the background once half the reserve is used */
+static void nvfuse_refill_container_reserve(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_handle *nvh = sb->sb_nvh;
+	struct rte_mempool *mempool = nvfuse_ipc_mempool(&nvh->nvh_ipc_ctx);
+	union nvfuse_ipc_msg *ipc_msg;
+	s32 nr_reqs;
+
+	SPINLOCK_LOCK(&sb->sb_container_reserve_lock);
+	nr_reqs = sb->sb_container_reserve_count + sb->sb_container_reserve_inflight;
+	if (sb->sb_container_reserve_exhausted || nr_reqs > sb->sb_container_reserve_target / 2)
+		nr_reqs = 0;
+	else
+		nr_reqs = sb->sb_container_reserve_target - nr_reqs;
+	sb->sb_container_reserve_inflight += nr_reqs;
+	SPINLOCK_UNLOCK(&sb->sb_container_reserve_lock);
+
+	while (nr_reqs) {
+		if (rte_mempool_get(mempool, (void **)&ipc_msg) < 0)
+			break;
+
+		memset(ipc_msg->bytes, 0x00, NVFUSE_IPC_MSG_SIZE);
+		ipc_msg->chan_id = nvh->nvh_ipc_ctx.my_channel_id;
+		ipc_msg->container_alloc_req.type = CONTAINER_NEW_ALLOC;
+		if (nvfuse_ipc_send_async(nvh, ipc_msg, CONTAINER_ALLOC_REQ,
+					  nvfuse_container_reserve_cpl, sb) < 0) {
+			rte_mempool_put(mempool, ipc_msg);
+			break;
+		}
+		nr_reqs--;
+	}
+
+	/* requests the channel had no room for */
+	if (nr_reqs) {
+		SPINLOCK_LOCK(&sb->sb_container_reserve_lock);
+		sb->sb_container_reserve_inflight -= nr_reqs;
+		SPINLOCK_UNLOCK(&sb->sb_container_reserve_lock);
+	}
+}
+
+/*
+ * returns a new container for this data plane, 0 if there is none. it comes
+ * from the reserve when possible, so that creates do not wait on the primary.
+ * a drained reserve means the burst was larger than the reserve, which is
+ * then doubled.
+ */
+s32 nvfuse_get_reserved_container(struct nvfuse_superblock *sb)
+{
+	s32 container_id = 0;
+
+	nvfuse_ipc_poll(sb->sb_nvh);
+
+	SPINLOCK_LOCK(&sb->sb_container_reserve_lock);
+	if (sb->sb_container_reserve_count)
+		container_id = sb->sb_container_reserve[--sb->sb_container_reserve_count];
+	else
+		sb->sb_container_reserve_target = MIN(sb->sb_container_reserve_target * 2,
+						      NVFUSE_CONTAINER_RESERVE_MAX);
+	SPINLOCK_UNLOCK(&sb->sb_container_reserve_lock);
+
+	if (container_id == 0) {
+		container_id = nvfuse_alloc_container_from_primary_process(sb->sb_nvh, CONTAINER_NEW_ALLOC);
+		/* others have released containers since the reserve ran dry */
+		if (container_id > 0) {
+			SPINLOCK_LOCK(&sb->sb_container_reserve_lock);
+			sb->sb_container_reserve_exhausted = 0;
+			SPINLOCK_UNLOCK(&sb->sb_container_reserve_lock);
+		}
+	}
+
+	nvfuse_refill_container_reserve(sb);
+
+	return container_id;
+}
+
+/* gives the unused reserve back to the primary at umount */
+void nvfuse_release_container_reserve(struct nvfuse_superblock *sb)
+{
+	while (((volatile struct nvfuse_superblock *)sb)->sb_container_reserve_inflight)
+		nvfuse_ipc_poll(sb->sb_nvh);
+
+	while (sb->sb_container_reserve_count)
+		nvfuse_dealloc_container_from_primary_process(sb,
+				sb->sb_container_reserve[--sb->sb_container_reserve_count]);
+}
+
 s32 nvfuse_dealloc_container_from_primary_process(struct nvfuse_superblock *sb, u32 bg_id)
 {
 	struct nvfuse_handle *nvh = sb->sb_nvh;
-	struct rte_ring *send_ring, *recv_ring;
 	struct rte_mempool *mempool;
 	union nvfuse_ipc_msg *ipc_msg;
 	s32 ret;
 
-	/* INITIALIZATION OF TX/RX RING BUFFERS */
-	send_ring = nvfuse_ipc_get_sendq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-	recv_ring = nvfuse_ipc_get_recvq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-
 	/* initialization of memory pool */
 	mempool = nvfuse_ipc_mempool(&nvh->nvh_ipc_ctx);
 
@@ -1225,7 +1677,7 @@ s32 nvfuse_dealloc_container_from_primary_process(struct nvfuse_superblock *sb,
 		u64 start_tsc = spdk_get_ticks();
 
 		/* SEND CONTAINER_RELEASE_REQ TO PRIMARY CORE */
-		ret = nvfuse_send_msg_to_primary_core(send_ring, recv_ring, ipc_msg, CONTAINER_RELEASE_REQ);
+		ret = nvfuse_send_msg_to_primary_core(nvh, ipc_msg, CONTAINER_RELEASE_REQ);
 		if (ret < 0) {
 			rte_panic("Failed to get new container\n");
 			return -1;
@@ -1242,7 +1694,6 @@ s32 nvfuse_dealloc_container_from_primary_process(struct nvfuse_superblock *sb,
 
 void nvfuse_send_health_check_msg_to_primary_process(struct nvfuse_handle *nvh)
 {
-	struct rte_ring *send_ring, *recv_ring;
 	struct rte_mempool *mempool;
 	union nvfuse_ipc_msg *ipc_msg;
 	u64 tsc_rate = spdk_get_ticks_hz();
@@ -1251,10 +1702,6 @@ void nvfuse_send_health_check_msg_to_primary_process(struct nvfuse_handle *nvh)
 	s32 count;
 	s32 ret;
 
-	/* INITIALIZATION OF TX/RX RING BUFFERS */
-	send_ring = nvfuse_ipc_get_sendq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-	recv_ring = nvfuse_ipc_get_recvq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-
 	/* initialization of memory pool */
 	mempool = nvfuse_ipc_mempool(&nvh->nvh_ipc_ctx);
 	/*
@@ -1270,7 +1717,7 @@ void nvfuse_send_health_check_msg_to_primary_process(struct nvfuse_handle *nvh)
 	while (count--) {
 		start_tsc = spdk_get_ticks();
 		/* SEND APP_UNREGISTER_REQ TO PRIMARY CORE */
-		ret = nvfuse_send_msg_to_primary_core(send_ring, recv_ring, ipc_msg, HEALTH_CHECK_REQ);
+		ret = nvfuse_send_msg_to_primary_core(nvh, ipc_msg, HEALTH_CHECK_REQ);
 		end_tsc = spdk_get_ticks();
 		sum_tsc += (end_tsc - start_tsc);
 	}
@@ -1307,30 +1754,69 @@ s32 nvfuse_sync_superblock(struct nvfuse_superblock *sb)
 	return 0;
 }
 
-s32 nvfuse_allocate_open_file_table(struct nvfuse_superblock *sb)
+/* back the next chunk of fds with entries and push them to the free list */
+static s32 nvfuse_grow_file_table(struct nvfuse_superblock *sb)
 {
-	struct nvfuse_file_table *ft;
+	struct nvfuse_file_table *chunk;
+	s32 first, fd;
 
-	s32 i = 0, fid = -1;
+	if (sb->sb_file_table_size >= sb->sb_file_table_max)
+		return -1;
 
-	for (i = START_OPEN_FILE; i < MAX_OPEN_FILE; i++) {
-		ft = nvfuse_get_file_table(sb, i);
-		SPINLOCK_LOCK(&ft->lock);
-		if (ft->used == FALSE) {
-			ft->used = TRUE;
-			fid = i;
-			break;
-		}
-		SPINLOCK_UNLOCK(&ft->lock);
+	chunk = (struct nvfuse_file_table *)spdk_dma_malloc(sizeof(struct nvfuse_file_table) *
+			NVFUSE_FILE_TABLE_CHUNK, 0, NULL);
+	if (chunk == NULL) {
+		dprintf_error(API, " nvfuse_malloc error \n");
+		return -1;
 	}
-	SPINLOCK_UNLOCK(&ft->lock);
+	memset(chunk, 0x00, sizeof(struct nvfuse_file_table) * NVFUSE_FILE_TABLE_CHUNK);
 
-	return fid;
+	first = sb->sb_file_table_size;
+	for (fd = 0; fd < NVFUSE_FILE_TABLE_CHUNK; fd++)
+		SPINLOCK_INIT(&chunk[fd].lock);
+
+	/* readers index chunks without the table lock */
+	sb->sb_file_table[first >> NVFUSE_FILE_TABLE_CHUNK_BITS] = chunk;
+	rte_smp_wmb();
+	sb->sb_file_table_size += NVFUSE_FILE_TABLE_CHUNK;
+
+	/* stdin, stdout and stderr are never handed out */
+	if (first == 0)
+		first = START_OPEN_FILE;
+
+	for (fd = sb->sb_file_table_size - 1; fd >= first; fd--) {
+		if (fd >= sb->sb_file_table_max)
+			continue;
+		nvfuse_get_file_table(sb, fd)->next_free = sb->sb_file_table_free;
+		sb->sb_file_table_free = fd;
+	}
+
+	return 0;
 }
 
-struct nvfuse_file_table *nvfuse_get_file_table(struct nvfuse_superblock *sb, s32 fid)
+s32 nvfuse_allocate_open_file_table(struct nvfuse_superblock *sb)
 {
-	return sb->sb_file_table + fid;
+	struct nvfuse_file_table *ft;
+	s32 fid;
+
+	SPINLOCK_LOCK(&sb->sb_file_table_lock);
+	if (sb->sb_file_table_free < 0 && nvfuse_grow_file_table(sb) < 0) {
+		SPINLOCK_UNLOCK(&sb->sb_file_table_lock);
+		dprintf_error(API, " too many open files (max = %d)\n", sb->sb_file_table_max);
+		return -1;
+	}
+
+	fid = sb->sb_file_table_free;
+	ft = nvfuse_get_file_table(sb, fid);
+	sb->sb_file_table_free = ft->next_free;
+	SPINLOCK_UNLOCK(&sb->sb_file_table_lock);
+
+	SPINLOCK_LOCK(&ft->lock);
+	assert(ft->used == FALSE);
+	ft->used = TRUE;
+	SPINLOCK_UNLOCK(&ft->lock);
+
+	return fid;
 }
 
 void nvfuse_close_file_table(struct nvfuse_superblock *sb, s32 fid)
@@ -1338,9 +1824,17 @@ void nvfuse_close_file_table(struct nvfuse_superblock *sb, s32 fid)
 	struct nvfuse_file_table *ft;
 
 	ft = nvfuse_get_file_table(sb, fid);
+	if (ft == NULL)
+		return;
 
 	SPINLOCK_LOCK(&ft->lock);
 
+	/* a second close must not put the fd on the free list twice */
+	if (!ft->used) {
+		SPINLOCK_UNLOCK(&ft->lock);
+		return;
+	}
+
 	ft->ino = 0;
 	ft->size = 0;
 	ft->used = 0;
@@ -1348,30 +1842,48 @@ void nvfuse_close_file_table(struct nvfuse_superblock *sb, s32 fid)
 	ft->flags = 0;
 
 	SPINLOCK_UNLOCK(&ft->lock);
+
+	SPINLOCK_LOCK(&sb->sb_file_table_lock);
+	ft->next_free = sb->sb_file_table_free;
+	sb->sb_file_table_free = fid;
+	SPINLOCK_UNLOCK(&sb->sb_file_table_lock);
 }
 
 
 s32 nvfuse_init_file_table(struct nvfuse_superblock *sb)
 {
-	int fd;
+	s32 max_open_files = sb->sb_nvh->nvh_params.max_open_files;
+	s32 num_chunks;
+
+	if (max_open_files <= START_OPEN_FILE)
+		max_open_files = MAX_OPEN_FILE;
 
-	sb->sb_file_table = (struct nvfuse_file_table *)spdk_dma_malloc(sizeof(struct nvfuse_file_table) *
-			    MAX_OPEN_FILE, 0, NULL);
+	num_chunks = (max_open_files + NVFUSE_FILE_TABLE_CHUNK - 1) >> NVFUSE_FILE_TABLE_CHUNK_BITS;
+
+	/* only the chunk directory is sized for the limit, chunks come on demand */
+	sb->sb_file_table = (struct nvfuse_file_table **)spdk_dma_malloc(
+				    sizeof(struct nvfuse_file_table *) * num_chunks, 0, NULL);
 	if (sb->sb_file_table == NULL) {
 		dprintf_info(MOUNT, " nvfuse_malloc error \n");
 		return -1;
 	}
-	memset(sb->sb_file_table, 0x00, sizeof(struct nvfuse_file_table) * MAX_OPEN_FILE);
+	memset(sb->sb_file_table, 0x00, sizeof(struct nvfuse_file_table *) * num_chunks);
 
-	for (fd = 0;fd < MAX_OPEN_FILE; fd++) {
-		SPINLOCK_INIT(&sb->sb_file_table[fd].lock);
-	}
+	SPINLOCK_INIT(&sb->sb_file_table_lock);
+	sb->sb_file_table_free = -1;
+	sb->sb_file_table_size = 0;
+	sb->sb_file_table_max = max_open_files;
 
-	return 0;
+	return nvfuse_grow_file_table(sb);
 }
 
 void nvfuse_free_file_table(struct nvfuse_superblock *sb)
 {
+	s32 i;
+
+	for (i = 0; i < sb->sb_file_table_size >> NVFUSE_FILE_TABLE_CHUNK_BITS; i++)
+		spdk_dma_free(sb->sb_file_table[i]);
+
 	spdk_dma_free(sb->sb_file_table);
 }
 
@@ -1388,7 +1900,7 @@ s32 nvfuse_mount(struct nvfuse_handle *nvh)
 
 	sb = nvfuse_read_super(nvh);
 
-	SPINLOCK_INIT(&sb->sb_lock);
+	nvfuse_init_locks(sb);
 	sb->target = nvh->nvh_target;
 	sb->sb_nvh = nvh;
 
@@ -1397,57 +1909,6 @@ s32 nvfuse_mount(struct nvfuse_handle *nvh)
 		dprintf_info(IPC, " Obtained Channel ID = %d \n", nvh->nvh_ipc_ctx.my_channel_id);
 	}
 
-	{
-		s32 type;
-
-		for (type = 0; type < BP_MEMPOOL_NUM; type++) {
-			u32 fanout = (CLUSTER_SIZE - BP_NODE_HEAD_SIZE) / (BP_PAIR_SIZE) * 2 + 1;
-			sprintf(mempool_name, "nvfuse_bp_%d_%d", type, rte_lcore_id());
-
-			switch (type) {
-			case BP_MEMPOOL_MASTER:
-				dprintf_info(MOUNT, "mempool size for master: %d\n",
-				       (int)(NVFUSE_BPTREE_MEMPOOL_MASTER_TOTAL_SIZE * sizeof(master_node_t)));
-				sb->bp_mempool[type] = spdk_mempool_create(mempool_name, NVFUSE_BPTREE_MEMPOOL_MASTER_TOTAL_SIZE,
-						       sizeof(master_node_t), NVFUSE_BPTREE_MEMPOOL_MASTER_CACHE_SIZE, SPDK_ENV_SOCKET_ID_ANY);
-				break;
-			case BP_MEMPOOL_INDEX:
-				dprintf_info(MOUNT, "mempool size for index: %d\n",
-				       (int)(NVFUSE_BPTREE_MEMPOOL_INDEX_TOTAL_SIZE * sizeof(index_node_t)));
-				sb->bp_mempool[type] = spdk_mempool_create(mempool_name, NVFUSE_BPTREE_MEMPOOL_INDEX_TOTAL_SIZE,
-						       sizeof(index_node_t), NVFUSE_BPTREE_MEMPOOL_INDEX_CACHE_SIZE, SPDK_ENV_SOCKET_ID_ANY);
-				break;
-			case BP_MEMPOOL_PAIR:
-				dprintf_info(MOUNT, "mempool size for pair: %d\n",
-				       (int)(NVFUSE_BPTREE_MEMPOOL_PAIR_TOTAL_SIZE * sizeof(key_pair_t)));
-				sb->bp_mempool[type] = spdk_mempool_create(mempool_name, NVFUSE_BPTREE_MEMPOOL_PAIR_TOTAL_SIZE,
-						       sizeof(key_pair_t), NVFUSE_BPTREE_MEMPOOL_PAIR_CACHE_SIZE, SPDK_ENV_SOCKET_ID_ANY);
-				break;
-			case BP_MEMPOOL_KEY:
-				dprintf_info(MOUNT, "mempool size for key: %d\n",
-				       (int)(NVFUSE_BPTREE_MEMPOOL_TOTAL_SIZE * sizeof(bkey_t) * fanout));
-				sb->bp_mempool[type] = spdk_mempool_create(mempool_name, NVFUSE_BPTREE_MEMPOOL_TOTAL_SIZE,
-						       sizeof(bkey_t) * fanout, NVFUSE_BPTREE_MEMPOOL_CACHE_SIZE, SPDK_ENV_SOCKET_ID_ANY);
-				break;
-			case BP_MEMPOOL_VALUE:
-				dprintf_info(MOUNT, "mempool size for value: %d\n",
-				       (int)(NVFUSE_BPTREE_MEMPOOL_TOTAL_SIZE * sizeof(bitem_t) * fanout));
-				sb->bp_mempool[type] = spdk_mempool_create(mempool_name, NVFUSE_BPTREE_MEMPOOL_TOTAL_SIZE,
-						       sizeof(bitem_t) * fanout, NVFUSE_BPTREE_MEMPOOL_CACHE_SIZE, SPDK_ENV_SOCKET_ID_ANY);
-				break;
-			default:
-				dprintf_info(MOUNT, "Invalid mempool type = %d\n", type);
-				assert(0);
-			}
-
-			if (sb->bp_mempool[type] == NULL) {
-				dprintf_error(MOUNT, "allocation of mempool type = %d\n", type);
-				exit(0);
-			}
-			dprintf_info(MOUNT, "Allocation of BP_MEMPOOL type = %d %p \n", type, sb->bp_mempool[type]);
-		}
-	}
-
 	sprintf(mempool_name, "nvfuse_iojob_%d", rte_lcore_id());
 
 	dprintf_info(MOUNT, " mempool size for value: %d\n", (int)(sizeof(struct io_job) * AIO_MAX_QDEPTH * 2));
@@ -1517,15 +1978,10 @@ s32 nvfuse_mount(struct nvfuse_handle *nvh)
 
 	} else {
 		/* App Registration Process*/
-		struct rte_ring *send_ring, *recv_ring;
 		struct rte_mempool *mempool;
 		union nvfuse_ipc_msg *ipc_msg;
 		s32 ret;
 
-		/* INITIALIZATION OF TX/RX RING BUFFERS */
-		send_ring = nvfuse_ipc_get_sendq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-		recv_ring = nvfuse_ipc_get_recvq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-
 		/* initialization of memory pool */
 		mempool = nvfuse_ipc_mempool(&nvh->nvh_ipc_ctx);
 
@@ -1546,7 +2002,7 @@ s32 nvfuse_mount(struct nvfuse_handle *nvh)
 		       nvh->nvh_ipc_ctx.my_channel_id);
 
 		/* SEND APP_REGISTER_REQ TO PRIMARY CORE */
-		ret = nvfuse_send_msg_to_primary_core(send_ring, recv_ring, ipc_msg, APP_REGISTER_REQ);
+		ret = nvfuse_send_msg_to_primary_core(nvh, ipc_msg, APP_REGISTER_REQ);
 		if (ret) {
 			return ret;
 		}
@@ -1556,7 +2012,7 @@ s32 nvfuse_mount(struct nvfuse_handle *nvh)
 		sprintf(ipc_msg->superblock_copy_req.name, "%s_%d", nvh->nvh_params.appname,
 			nvh->nvh_ipc_ctx.my_channel_id);
 
-		ret = nvfuse_send_msg_to_primary_core(send_ring, recv_ring, ipc_msg, SUPERBLOCK_COPY_REQ);
+		ret = nvfuse_send_msg_to_primary_core(nvh, ipc_msg, SUPERBLOCK_COPY_REQ);
 		if (ret) {
 			return ret;
 		}
@@ -1605,6 +2061,14 @@ s32 nvfuse_mount(struct nvfuse_handle *nvh)
 		}
 	}
 
+	if (nvfuse_process_model_is_dataplane()) {
+		res = nvfuse_init_shared_cache(sb, nvh->nvh_params.shared_cache_size);
+		if (res < 0) {
+			dprintf_error(MOUNT, "initialization of shared cache \n");
+			return -1;
+		}
+	}
+
 	gettimeofday(&sb->sb_last_update, NULL);
 
 	nvfuse_set_cwd_ino(nvh, sb->sb_root_ino);
@@ -1642,6 +2106,16 @@ s32 nvfuse_mount(struct nvfuse_handle *nvh)
 	sb->sb_bg_search_ptr_for_inode = &sb->sb_bg_list;
 	sb->sb_bg_search_ptr_for_data = &sb->sb_bg_list;
 
+	SPINLOCK_INIT(&sb->sb_container_reserve_lock);
+	sb->sb_container_reserve_count = 0;
+	sb->sb_container_reserve_inflight = 0;
+	sb->sb_container_reserve_target = NVFUSE_CONTAINER_RESERVE_MIN;
+	sb->sb_container_reserve_exhausted = 0;
+
+	SPINLOCK_INIT(&sb->sb_rsv_lock);
+	INIT_LIST_HEAD(&sb->sb_rsv_list);
+	sb->sb_rsv_blocks = 0;
+
 	/* Effective for only multiple dataplane model */
 	if (spdk_process_is_primary()) {
 		/* the primary process makes use of all bgs */
@@ -1681,6 +2155,9 @@ s32 nvfuse_mount(struct nvfuse_handle *nvh)
 				bg_count++;
 			}
 		}
+
+		/* fill the reserve while the app starts up */
+		nvfuse_refill_container_reserve(sb);
 	}
 
 #if 0
@@ -1778,6 +2255,8 @@ s32 nvfuse_umount(struct nvfuse_handle *nvh)
 	gettimeofday(&sb->sb_time_end, NULL);
 	timeval_subtract(&sb->sb_time_total, &sb->sb_time_end, &sb->sb_time_start);
 
+	/* unused reservations must not stay marked in the on-disk bitmaps */
+	nvfuse_release_rsv_windows(sb);
 	nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_FORCE);
 
 	sb->sb_state = FS_STATE_UMOUNTED;
@@ -1786,15 +2265,8 @@ s32 nvfuse_umount(struct nvfuse_handle *nvh)
 		nvfuse_sync_superblock(sb);
 	}
 
-	/* deallocation of mempool for bptree*/
+	/* deallocation of mempools */
 	{
-		s32 type;
-
-		for (type = 0; type < BP_MEMPOOL_NUM; type++) {
-			spdk_mempool_free(sb->bp_mempool[type]);
-			dprintf_info(MOUNT, " free bp mempool %d (num = %d)\n", type, BP_MEMPOOL_NUM);
-		}
-
 		if (spdk_process_is_primary()) {
 			spdk_mempool_free(sb->bg_mempool);
 		}
@@ -1807,6 +2279,8 @@ s32 nvfuse_umount(struct nvfuse_handle *nvh)
 
 	if (nvfuse_process_model_is_dataplane()) {
 		if (!spdk_process_is_primary()) {
+			nvfuse_release_container_reserve(sb);
+
 			/* app unregistration with keeping allocated containers permanently */
 			nvfuse_send_app_unregister_req(nvh, APP_UNREGISTER_WITHOUT_DESTROYING_CONTAINERS);
 			nvfuse_put_channel_id(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
@@ -1968,6 +2442,9 @@ s32 nvfuse_scan_superblock(struct nvfuse_handle *nvh, struct nvfuse_superblock *
 
 	if (read_sb->sb_signature == NVFUSE_SB_SIGNATURE) {
 		nvfuse_copy_disk_sb_to_sb(cur_sb, read_sb);
+		/* file systems formatted before compact inodes record no size */
+		if (cur_sb->sb_inode_size == 0)
+			cur_sb->sb_inode_size = INODE_ENTRY_SIZE;
 		res = 0;
 	} else {
 		dprintf_error(MOUNT, " super block signature is mismatched. \n");
@@ -1980,6 +2457,7 @@ s32 nvfuse_scan_superblock(struct nvfuse_handle *nvh, struct nvfuse_superblock *
 	dprintf_info(MOUNT, "no of blocks = %ld \n", (unsigned long)cur_sb->sb_no_of_blocks);
 	dprintf_info(MOUNT, "no of used blocks = %ld \n", (unsigned long)cur_sb->sb_no_of_used_blocks);
 	dprintf_info(MOUNT, "no of inodes per bg = %d \n", cur_sb->sb_no_of_inodes_per_bg);
+	dprintf_info(MOUNT, "inode size = %d \n", cur_sb->sb_inode_size);
 	dprintf_info(MOUNT, "no of blocks per bg = %d \n", cur_sb->sb_no_of_blocks_per_bg);
 	dprintf_info(MOUNT, "no of free inodes = %d \n", cur_sb->sb_free_inodes);
 	dprintf_info(MOUNT, "no of free blocks = %ld \n", (unsigned long)cur_sb->sb_free_blocks);
@@ -2231,9 +2709,9 @@ s32 nvfuse_is_directio(struct nvfuse_superblock *sb, s32 fid)
 {
 	struct nvfuse_file_table *ft;
 
-	ft = sb->sb_file_table + fid;
+	ft = nvfuse_get_file_table(sb, fid);
 
-	if (ft->flags & O_DIRECT)
+	if (ft && (ft->flags & O_DIRECT))
 		return 1;
 
 	return 0;
@@ -2359,7 +2837,11 @@ s32 nvfuse_lseek(struct nvfuse_handle *nvh, s32 fd, u32 offset, s32 position)
 
 	sb = nvfuse_read_super(nvh);
 
-	of = sb->sb_file_table + fd;
+	of = nvfuse_get_file_table(sb, fd);
+	if (of == NULL) {
+		nvfuse_release_super(sb);
+		return NVFUSE_ERROR;
+	}
 
 	if (position == SEEK_SET)             /* SEEK_SET */
 		of->rwoffset = offset;
@@ -2503,6 +2985,57 @@ u32 nvfuse_free_dbitmap(struct nvfuse_superblock *sb, u32 bg_id, nvfuse_loff_t o
 	return 0;
 }
 
+/* allocate one run of up to num_blocks contiguous blocks, searching forward from goal up to the end of bg_id */
+u32 nvfuse_alloc_dbitmap_run(struct nvfuse_superblock *sb, u32 bg_id, u32 goal, u32 *start,
+			     u32 num_blocks)
+{
+	struct nvfuse_bg_descriptor *bd;
+	struct nvfuse_buffer_head *bd_bh, *bh;
+	struct nvfuse_buffer_cache *bd_bc, *bc;
+	u32 dtable_start;
+	u32 free_block;
+	u32 len = 0;
+	u32 i;
+	void *buf;
+
+	bd_bh = nvfuse_get_bh(sb, NULL, BD_INO, bg_id, READ, NVFUSE_TYPE_META);
+	bd_bc = (struct nvfuse_buffer_cache *)bd_bh->bh_bc;
+	bd = (struct nvfuse_bg_descriptor *)bd_bc->bc_buf;
+
+	bh = nvfuse_get_bh(sb, NULL, DBITMAP_INO, bg_id, READ, NVFUSE_TYPE_META);
+	bc = (struct nvfuse_buffer_cache *)bh->bh_bc;
+	buf = bc->bc_buf;
+
+	dtable_start = bd->bd_dtable_start % sb->sb_no_of_blocks_per_bg;
+	free_block = goal % sb->sb_no_of_blocks_per_bg;
+	if (free_block < dtable_start)
+		free_block = dtable_start;
+
+	/* first free block at or after the goal; neither search nor run wraps */
+	while (free_block < sb->sb_no_of_blocks_per_bg && ext2fs_test_bit(free_block, buf))
+		free_block++;
+
+	while (len < num_blocks && free_block + len < sb->sb_no_of_blocks_per_bg &&
+	       !ext2fs_test_bit(free_block + len, buf))
+		len++;
+
+	if (len) {
+		for (i = 0; i < len; i++)
+			ext2fs_set_bit(free_block + i, buf);
+		bd->bd_next_block = free_block + len - 1;
+		*start = bd->bd_bg_start + free_block;
+
+		nvfuse_release_bh(sb, bh, 0, DIRTY);
+		nvfuse_release_bh(sb, bd_bh, 0, DIRTY);
+		nvfuse_dec_free_blocks(sb, *start, len);
+	} else {
+		nvfuse_release_bh(sb, bh, 0, NVF_CLEAN);
+		nvfuse_release_bh(sb, bd_bh, 0, NVF_CLEAN);
+	}
+
+	return len;
+}
+
 s32 nvfuse_link(struct nvfuse_superblock *sb, u32 newino, s8 *new_filename, s32 ino)
 {
 	struct nvfuse_dir_entry *dir;
@@ -2771,7 +3304,7 @@ u32 nvfuse_get_pbn(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
 	case BLOCK_IO_INO: // direct translation lblk to pblk
 		return offset;
 	case ITABLE_INO: {
-		u32 bg_id = offset / (sb->sb_no_of_inodes_per_bg / INODE_ENTRY_NUM);
+		u32 bg_id = offset / (sb->sb_no_of_inodes_per_bg / INODE_ENTRY_NUM(sb));
 		struct nvfuse_bg_descriptor *bd = nvfuse_get_bd(sb, bg_id);
 		value = bd->bd_itable_start + (offset % bd->bd_itable_size);
 		return value;
@@ -2837,13 +3370,17 @@ void nvfuse_flush_dirty_data(struct nvfuse_superblock *sb)
 	struct list_head *dirty_head, *flushing_head;
 	struct list_head *temp, *ptr;
 	struct nvfuse_buffer_cache *bc;
+	struct nvfuse_buffer_cache *partial[AIO_MAX_QDEPTH];
 	s32 dirty_count = 0;
 	s32 flushing_count = 0;
+	s32 partial_count;
+	s32 i;
 
 	while ((dirty_count = nvfuse_get_dirty_count(sb)) != 0) {
 		dirty_head = &bm->bm_list[BUFFER_TYPE_DIRTY];
 		flushing_head = &bm->bm_list[BUFFER_TYPE_FLUSHING];
 		flushing_count = 0;
+		partial_count = 0;
 
 		/* collect dirty data */
 		SPINLOCK_LOCK(&bm->bm_lock);
@@ -2853,6 +3390,19 @@ void nvfuse_flush_dirty_data(struct nvfuse_superblock *sb)
 			SPINLOCK_LOCK(&bc->bc_lock);
 
 			assert(bc->bc_dirty);
+
+			/* partially written blocks are filled first, outside the manager lock */
+			if (!bc->bc_load) {
+				nvfuse_inc_bc_ref(bc);
+				nvfuse_move_buffer_list_nolock(sb, bc, BUFFER_TYPE_REF, 0);
+				SPINLOCK_UNLOCK(&bc->bc_lock);
+
+				partial[partial_count++] = bc;
+				if (partial_count >= AIO_MAX_QDEPTH)
+					break;
+				continue;
+			}
+
 			bc->bc_flush = 1;
 			//list_move(&bc->bc_list, flushing_head);
 			nvfuse_move_buffer_list_nolock(sb, bc, BUFFER_TYPE_FLUSHING, INSERT_HEAD);
@@ -2865,6 +3415,20 @@ void nvfuse_flush_dirty_data(struct nvfuse_superblock *sb)
 		}
 		SPINLOCK_UNLOCK(&bm->bm_lock);
 
+		/* filled blocks go back to the dirty list for the next round */
+		for (i = 0; i < partial_count; i++) {
+			bc = partial[i];
+			SPINLOCK_LOCK(&bc->bc_lock);
+			if (nvfuse_fill_bc(sb, bc)) {
+				dprintf_error(BUFFER, " Error: block read in %s\n", __FUNCTION__);
+				assert(0);
+			}
+			nvfuse_release_bc(sb, bc, INSERT_HEAD, DIRTY);
+		}
+
+		if (flushing_count == 0)
+			continue;
+
 		/* sync dirty data to SSD */
 		nvfuse_sync_dirty_data(sb, flushing_count);
 
@@ -2910,6 +3474,12 @@ void nvfuse_check_flush_dirty(struct nvfuse_superblock *sb, s32 force)
 	if (dirty_count == 0)
 		goto RES;
 
+	/* a thread already flushing covers a background flush of others */
+	if (force == DIRTY_FLUSH_FORCE)
+		SPINLOCK_LOCK(&sb->sb_flush_lock);
+	else if (!rte_spinlock_trylock(&sb->sb_flush_lock))
+		goto RES;
+
 	start_tsc = spdk_get_ticks();
 
 #if 1
@@ -2928,14 +3498,16 @@ void nvfuse_check_flush_dirty(struct nvfuse_superblock *sb, s32 force)
 	sb->nvme_io_tsc += (spdk_get_ticks() - start_tsc);
 	sb->nvme_io_count ++;
 
+	SPINLOCK_UNLOCK(&sb->sb_flush_lock);
+
 #ifdef DEBUG_FLUSH_DIRTY_INODE
 	/* FIXME: it is necessary to analyze why dirties are left here. */
-	if (sb->sb_ictxc->ictxc_list_count[BUFFER_TYPE_DIRTY]) {
+	if (nvfuse_get_ictx_list_count(sb, BUFFER_TYPE_DIRTY)) {
 		/* 
 		 * the reason is that some dirty inodes are not released. 
 		 * inode and its data block are in use and later inserted dirty list.
 		 */
-		dprintf_warn(INODE, " inode dirty count = %d, dirty inodes are not inserted to dirty list. \n", sb->sb_ictxc->ictxc_list_count[BUFFER_TYPE_DIRTY]);
+		dprintf_warn(INODE, " inode dirty count = %d, dirty inodes are not inserted to dirty list. \n", nvfuse_get_ictx_list_count(sb, BUFFER_TYPE_DIRTY));
 
 #ifdef DEBUG_INODE_LIST
 		dprintf_warn(INODE, " bc dirty count = %d \n", nvfuse_get_dirty_count(sb));
@@ -2953,6 +3525,71 @@ RES:
 	return;
 }
 
+/* mount generation, hints taken before a remount are dropped */
+static rte_atomic32_t nvfuse_mount_gen;
+
+void nvfuse_init_locks(struct nvfuse_superblock *sb)
+{
+	s32 i;
+
+	SPINLOCK_INIT(&sb->sb_lock);
+	SPINLOCK_INIT(&sb->sb_flush_lock);
+	rte_rwlock_init(&sb->sb_ns_lock);
+	for (i = 0; i < NVFUSE_INODE_RWLOCK_NUM; i++)
+		rte_rwlock_init(&sb->sb_inode_rwlock[i]);
+	rte_atomic32_init(&sb->sb_alloc_hint_seq);
+	sb->sb_alloc_hint_gen = rte_atomic32_add_return(&nvfuse_mount_gen, 1);
+}
+
+static __thread struct nvfuse_alloc_hint nvfuse_alloc_hint;
+
+/*
+ * returns the allocation hints of the calling thread. the block groups are
+ * split into NVFUSE_ALLOC_HOME_NUM ranges; the first thread gets the range
+ * holding the hints in the superblock and resumes from them, each later one
+ * the next range and starts from its beginning. threads beyond the number
+ * of ranges share them.
+ */
+struct nvfuse_alloc_hint *nvfuse_get_alloc_hint(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_alloc_hint *hint = &nvfuse_alloc_hint;
+	u32 nr_homes, home;
+	s32 seq;
+
+	if (likely(hint->sb == sb && hint->gen == sb->sb_alloc_hint_gen))
+		return hint;
+
+	seq = rte_atomic32_add_return(&sb->sb_alloc_hint_seq, 1) - 1;
+
+	hint->sb = sb;
+	hint->gen = sb->sb_alloc_hint_gen;
+	hint->last_allocated_ino = sb->sb_last_allocated_ino;
+	hint->last_allocated_bgid = sb->sb_last_allocated_bgid;
+	hint->last_allocated_bgid_by_ino = sb->sb_last_allocated_bgid_by_ino;
+
+	hint->home_start = 0;
+	hint->home_end = sb->sb_bg_num;
+
+	/* data plane processes take block groups from their own containers */
+	if (sb->sb_bg_num == 0 || nvfuse_process_model_is_dataplane())
+		return hint;
+
+	nr_homes = MIN(NVFUSE_ALLOC_HOME_NUM, sb->sb_bg_num);
+	home = (u32)(hint->last_allocated_ino / sb->sb_no_of_inodes_per_bg) % sb->sb_bg_num;
+	home = (home * nr_homes / sb->sb_bg_num + seq) % nr_homes;
+	hint->home_start = home * sb->sb_bg_num / nr_homes;
+	hint->home_end = (home + 1) * sb->sb_bg_num / nr_homes;
+
+	if (!nvfuse_bg_in_alloc_home(hint, hint->last_allocated_ino / sb->sb_no_of_inodes_per_bg))
+		hint->last_allocated_ino = hint->home_start * sb->sb_no_of_inodes_per_bg;
+	if (!nvfuse_bg_in_alloc_home(hint, hint->last_allocated_bgid)) {
+		hint->last_allocated_bgid = hint->home_start;
+		hint->last_allocated_bgid_by_ino = 0;
+	}
+
+	return hint;
+}
+
 struct nvfuse_superblock *nvfuse_read_super(struct nvfuse_handle *nvh)
 {
 	return &nvh->nvh_sb;
@@ -218,6 +218,7 @@ no_block:
 u32 nvfuse_alloc_free_block(struct nvfuse_superblock *sb, struct nvfuse_inode *inode,
 			    u32 *alloc_blks, u32 num_blocks)
 {
+	struct nvfuse_alloc_hint *hint;
 	s32 ret = 0;
 	u32 bg_id;
 	u32 next_id;
@@ -226,10 +227,14 @@ u32 nvfuse_alloc_free_block(struct nvfuse_superblock *sb, struct nvfuse_inode *i
 
 	//dprintf_info(INODE, " current free blocks = %ld \n", sb->asb.asb_free_blocks);
 
+	/* blocks parked in reservation windows go back before space runs short */
+	if (sb->sb_rsv_blocks && !nvfuse_check_free_block(sb, num_blocks))
+		nvfuse_release_rsv_windows(sb);
+
 	if (nvfuse_process_model_is_dataplane() && !nvfuse_check_free_block(sb, num_blocks)) {
 		s32 container_id;
 
-		container_id = nvfuse_alloc_container_from_primary_process(sb->sb_nvh, CONTAINER_NEW_ALLOC);
+		container_id = nvfuse_get_reserved_container(sb);
 		if (container_id > 0) {
 			/* insert allocated container to process */
 			nvfuse_add_bg(sb, container_id);
@@ -240,9 +245,13 @@ u32 nvfuse_alloc_free_block(struct nvfuse_superblock *sb, struct nvfuse_inode *i
 		}
 	}
 
+	hint = nvfuse_get_alloc_hint(sb);
 	bg_id = inode->i_ino / sb->sb_no_of_inodes_per_bg;
-	if (bg_id != sb->sb_last_allocated_bgid && inode->i_ino == sb->sb_last_allocated_bgid_by_ino) {
-		bg_id = sb->sb_last_allocated_bgid;
+	if (bg_id != hint->last_allocated_bgid && inode->i_ino == hint->last_allocated_bgid_by_ino) {
+		bg_id = hint->last_allocated_bgid;
+	} else if (nvfuse_process_model_is_standalone() && nvfuse_bg_in_alloc_home(hint, bg_id)) {
+		/* files of this thread share its data cursor, past the groups it filled */
+		bg_id = hint->last_allocated_bgid;
 	}
 
 	next_id = bg_id;
@@ -254,8 +263,8 @@ u32 nvfuse_alloc_free_block(struct nvfuse_superblock *sb, struct nvfuse_inode *i
 			cnt += ret;
 
 			/* retain hint information to rapidly find free blocks */
-			sb->sb_last_allocated_bgid = bg_id;
-			sb->sb_last_allocated_bgid_by_ino = inode->i_ino;
+			hint->last_allocated_bgid = bg_id;
+			hint->last_allocated_bgid_by_ino = inode->i_ino;
 
 			if (!num_blocks) {
 				break;
@@ -288,6 +297,117 @@ u32 nvfuse_alloc_free_block(struct nvfuse_superblock *sb, struct nvfuse_inode *i
 	return cnt;
 }
 
+/*
+ * Hand out blocks from the reservation window of a regular file, opening a
+ * new window next to its last allocation when the current one is used up.
+ * Appenders interleaving in one group thus keep their files contiguous.
+ * A window stays in the group of the last allocation, and a data plane
+ * only opens one in a container it owns. The caller holds the ictx lock.
+ */
+u32 nvfuse_alloc_rsv_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+			    u32 *alloc_blks, u32 num_blocks)
+{
+	u32 bg_id, size, start, len;
+	u32 cnt = 0;
+
+	if (ictx->ictx_inode->i_type != NVFUSE_TYPE_FILE)
+		return 0;
+
+	while (cnt < num_blocks) {
+		if (!ictx->ictx_rsv_len) {
+			if (!ictx->ictx_rsv_goal)
+				break;
+
+			size = MIN(MAX(ictx->ictx_rsv_size, num_blocks - cnt), NVFUSE_RSV_WINDOW_MAX);
+			/* windows never hold more than half of the free space */
+			if (!nvfuse_check_free_block(sb, 2 * (sb->sb_rsv_blocks + size)))
+				break;
+
+			/* the group of the last block, if it has room after that block */
+			bg_id = (ictx->ictx_rsv_goal - 1) / sb->sb_no_of_blocks_per_bg;
+			if (ictx->ictx_rsv_goal / sb->sb_no_of_blocks_per_bg != bg_id)
+				break;
+			if (bg_id >= sb->sb_bg_num || !nvfuse_get_free_blocks(sb, bg_id))
+				break;
+			if (nvfuse_process_model_is_dataplane() && !nvfuse_has_bg(sb, bg_id))
+				break;
+
+			len = nvfuse_alloc_dbitmap_run(sb, bg_id, ictx->ictx_rsv_goal, &start, size);
+			if (!len)
+				break;
+
+			ictx->ictx_rsv_start = start;
+			ictx->ictx_rsv_len = len;
+			/* the previous window was used up, so the next one is larger */
+			ictx->ictx_rsv_size = MIN(ictx->ictx_rsv_size * 2, NVFUSE_RSV_WINDOW_MAX);
+
+			SPINLOCK_LOCK(&sb->sb_rsv_lock);
+			list_add_tail(&ictx->ictx_rsv_list, &sb->sb_rsv_list);
+			sb->sb_rsv_blocks += len;
+			SPINLOCK_UNLOCK(&sb->sb_rsv_lock);
+		}
+
+		len = MIN(ictx->ictx_rsv_len, num_blocks - cnt);
+		for (start = 0; start < len; start++)
+			alloc_blks[cnt++] = ictx->ictx_rsv_start++;
+
+		SPINLOCK_LOCK(&sb->sb_rsv_lock);
+		ictx->ictx_rsv_len -= len;
+		sb->sb_rsv_blocks -= len;
+		if (!ictx->ictx_rsv_len)
+			list_del_init(&ictx->ictx_rsv_list);
+		SPINLOCK_UNLOCK(&sb->sb_rsv_lock);
+	}
+
+	return cnt;
+}
+
+/* give the unused part of a window back to the bitmap; the caller holds the ictx lock */
+void nvfuse_release_rsv_window(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx)
+{
+	pbno_t start;
+	u32 len;
+
+	if (!ictx->ictx_rsv_len)
+		return;
+
+	SPINLOCK_LOCK(&sb->sb_rsv_lock);
+	start = ictx->ictx_rsv_start;
+	len = ictx->ictx_rsv_len;
+	ictx->ictx_rsv_len = 0;
+	sb->sb_rsv_blocks -= len;
+	list_del_init(&ictx->ictx_rsv_list);
+	SPINLOCK_UNLOCK(&sb->sb_rsv_lock);
+
+	ictx->ictx_rsv_size = NVFUSE_RSV_WINDOW_MIN;
+	nvfuse_free_blocks(sb, start, len);
+}
+
+/* release the windows of every file not busy in another thread */
+void nvfuse_release_rsv_windows(struct nvfuse_superblock *sb)
+{
+	struct nvfuse_inode_ctx *ictx, *victim;
+
+	while (1) {
+		victim = NULL;
+
+		SPINLOCK_LOCK(&sb->sb_rsv_lock);
+		list_for_each_entry(ictx, &sb->sb_rsv_list, ictx_rsv_list) {
+			if (rte_spinlock_trylock(&ictx->ictx_lock)) {
+				victim = ictx;
+				break;
+			}
+		}
+		SPINLOCK_UNLOCK(&sb->sb_rsv_lock);
+
+		if (victim == NULL)
+			break;
+
+		nvfuse_release_rsv_window(sb, victim);
+		SPINLOCK_UNLOCK(&victim->ictx_lock);
+	}
+}
+
 void nvfuse_return_free_blocks(struct nvfuse_superblock *sb, u32 *blks, u32 num)
 {
 	u32 *end = blks + num;
@@ -298,7 +418,24 @@ void nvfuse_return_free_blocks(struct nvfuse_superblock *sb, u32 *blks, u32 num)
 	}
 }
 
-u32 nvfuse_alloc_free_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode *inode, u32 *blocks,
+/* reservation window first, then the regular allocator for whatever is left */
+static u32 nvfuse_alloc_inode_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+				     u32 *alloc_blks, u32 num_blocks)
+{
+	struct nvfuse_inode *inode = ictx->ictx_inode;
+	u32 cnt;
+
+	cnt = nvfuse_alloc_rsv_blocks(sb, ictx, alloc_blks, num_blocks);
+	if (cnt < num_blocks)
+		cnt += nvfuse_alloc_free_block(sb, inode, alloc_blks + cnt, num_blocks - cnt);
+
+	if (cnt && inode->i_type == NVFUSE_TYPE_FILE)
+		ictx->ictx_rsv_goal = alloc_blks[cnt - 1] + 1;
+
+	return cnt;
+}
+
+u32 nvfuse_alloc_free_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, u32 *blocks,
 			     u32 num_indirect_blocks, u32 num_blocks, u32 *direct_map, s32 *error)
 {
 	u32 new_blocks[2] = { 0, 0 };
@@ -308,7 +445,7 @@ u32 nvfuse_alloc_free_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode *
 	total_blocks = num_indirect_blocks + 1;
 
 	if (total_blocks) {
-		new_blocks[0] = nvfuse_alloc_free_block(sb, inode, blocks, total_blocks);
+		new_blocks[0] = nvfuse_alloc_inode_blocks(sb, ictx, blocks, total_blocks);
 		if (new_blocks[0] != total_blocks) {
 			dprintf_error(INODE, " Warning: it runs out of free blocks.\n");
 			nvfuse_print_bg_list(sb);
@@ -326,7 +463,7 @@ u32 nvfuse_alloc_free_blocks(struct nvfuse_superblock *sb, struct nvfuse_inode *
 
 	total_blocks =  num_blocks - 1;
 	if (total_blocks) {
-		new_blocks[1] = nvfuse_alloc_free_block(sb, inode, direct_map, total_blocks);
+		new_blocks[1] = nvfuse_alloc_inode_blocks(sb, ictx, direct_map, total_blocks);
 		if (new_blocks[1] != total_blocks) {
 			dprintf_warn(INODE, " Warning: it runs out of free blocks. (requested = %d, allocated = %d)\n",
 			       total_blocks, new_blocks[1]);
@@ -435,7 +572,7 @@ static int nvfuse_alloc_branch(struct nvfuse_superblock *sb, struct nvfuse_inode
 	u32 new_blocks[4] = { 0, };
 	u32 current_block;
 
-	num = nvfuse_alloc_free_blocks(sb, inode, new_blocks, indirect_blks, *blks, direct_map, &err);
+	num = nvfuse_alloc_free_blocks(sb, ictx, new_blocks, indirect_blks, *blks, direct_map, &err);
 	if (err) {
 		return err;
 	}
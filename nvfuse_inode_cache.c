@@ -35,53 +35,150 @@
 #include "list.h"
 #include "rbtree.h"
 
+#define ICTX_READ_ONCE(x) (*(volatile typeof(x) *)&(x))
+
+/*
+ * lookup may run without the shard lock. ictxs are never freed and an
+ * unlinked node keeps its next pointer, so a racing walk can only return a
+ * stale match or miss. callers validate a match under the ictx lock and
+ * retry a miss under the shard lock.
+ */
 struct nvfuse_inode_ctx *nvfuse_ictx_hash_lookup(struct nvfuse_ictx_manager *ictxc, inode_t ino)
 {
+	struct nvfuse_ictx_shard *shard;
 	struct hlist_node *node;
-	struct hlist_head *head;
 	struct nvfuse_inode_ctx *ictx;
+	s32 hops = 0;
 
-	head = &ictxc->ictxc_hash[ino % HASH_NUM];
-	hlist_for_each(node, head) {
+	shard = &ictxc->ictxc_shard[nvfuse_ictx_shard_id(ino)];
+	node = ICTX_READ_ONCE(shard->ictxc_hash[nvfuse_ictx_hash_id(ino)].first);
+	while (node) {
 		ictx = hlist_entry(node, struct nvfuse_inode_ctx, ictx_hash);
-		if (ictx->ictx_ino == ino)
+		if (ICTX_READ_ONCE(ictx->ictx_ino) == ino)
 			return ictx;
+
+		/* walk moved onto a chain that keeps changing */
+		if (++hops > NVFUSE_ICTXC_SIZE)
+			return NULL;
+
+		node = ICTX_READ_ONCE(node->next);
 	}
 
 	return NULL;
 }
 
-struct nvfuse_inode_ctx *nvfuse_replace_ictx(struct nvfuse_superblock *sb)
+/* link ictx to the given list of shard, shard lock must be held */
+static void nvfuse_ictx_link(struct nvfuse_ictx_shard *shard, struct nvfuse_inode_ctx *ictx,
+			     s32 type, s32 shard_id)
 {
-	struct nvfuse_ictx_manager *ictxc = sb->sb_ictxc;
-	struct nvfuse_inode_ctx *ictx;
-	s32 type = 0;
+	struct hlist_head *head;
+	struct hlist_node *first;
+	s32 hash_id;
 
-	assert(rte_spinlock_is_locked(&ictxc->ictxc_lock));
+	assert(rte_spinlock_is_locked(&shard->ictxc_lock));
 
-	if (ictxc->ictxc_list_count[BUFFER_TYPE_UNUSED]) {
-		type = BUFFER_TYPE_UNUSED;
-	} else if (ictxc->ictxc_list_count[BUFFER_TYPE_CLEAN]) {
-		type = BUFFER_TYPE_CLEAN;
-	} else {
-		type = BUFFER_TYPE_DIRTY;
-		dprintf_warn(BUFFER, " Warning: it runs out of clean buffers.\n");
-		dprintf_warn(BUFFER, " Warning: it needs to immediately flush dirty pages to disks.\n");
-		nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_FORCE);
+	if (type == BUFFER_TYPE_UNUSED)
+		hash_id = NVFUSE_ICTXC_HASH_NUM;
+	else
+		hash_id = nvfuse_ictx_hash_id(ictx->ictx_ino);
+
+	/* publish the node only after its next pointer is set up */
+	head = &shard->ictxc_hash[hash_id];
+	first = head->first;
+	ictx->ictx_hash.next = first;
+	ictx->ictx_hash.pprev = &head->first;
+	if (first)
+		first->pprev = &ictx->ictx_hash.next;
+	rte_smp_wmb();
+	head->first = &ictx->ictx_hash;
+	shard->ictxc_hash_count[hash_id]++;
+
+	list_add(&ictx->ictx_cache_list, &shard->ictxc_list[type]);
+	shard->ictxc_list_count[type]++;
+
+	ictx->ictx_type = type;
+	ictx->ictx_shard = shard_id;
+}
+
+/* unlink ictx from its list and hash of shard, shard lock must be held */
+static void nvfuse_ictx_unlink(struct nvfuse_ictx_shard *shard, struct nvfuse_inode_ctx *ictx)
+{
+	assert(rte_spinlock_is_locked(&shard->ictxc_lock));
+
+	list_del(&ictx->ictx_cache_list);
+	shard->ictxc_list_count[ictx->ictx_type]--;
+
+	/* next pointer is kept for lockless walkers */
+	__hlist_del(&ictx->ictx_hash);
+	if (ictx->ictx_type == BUFFER_TYPE_UNUSED)
+		shard->ictxc_hash_count[NVFUSE_ICTXC_HASH_NUM]--;
+	else
+		shard->ictxc_hash_count[nvfuse_ictx_hash_id(ictx->ictx_ino)]--;
+}
+
+/* pick a victim from one list of shard, shard lock must be held */
+static struct nvfuse_inode_ctx *nvfuse_ictx_shard_victim(struct nvfuse_ictx_shard *shard, s32 type)
+{
+	struct nvfuse_inode_ctx *ictx;
+	s32 pass;
+
+	/* second chance: an ictx hit since the last scan is skipped once */
+	for (pass = 0; pass < 2; pass++) {
+		list_for_each_entry_reverse(ictx, &shard->ictxc_list[type], ictx_cache_list) {
+			/* inodes in use keep their lock held */
+			if (!rte_spinlock_trylock(&ictx->ictx_lock))
+				continue;
+
+			/* FIXED: clean list is required for better performance. */
+			if (ictx->ictx_ref == 0 &&
+			    ictx->ictx_data_dirty_count == 0 &&
+			    ictx->ictx_meta_dirty_count == 0 &&
+			    ictx->ictx_rsv_len == 0) {
+				if (!ictx->ictx_referenced)
+					return ictx;
+				ictx->ictx_referenced = 0;
+			}
+
+			SPINLOCK_UNLOCK(&ictx->ictx_lock);
+		}
 	}
 
-	assert(ictxc->ictxc_list_count[type]);
+	return NULL;
+}
 
-	list_for_each_entry_reverse(ictx, &ictxc->ictxc_list[type], ictx_cache_list) {
-		SPINLOCK_LOCK(&ictx->ictx_lock);
+struct nvfuse_inode_ctx *nvfuse_replace_ictx(struct nvfuse_superblock *sb, s32 shard_id)
+{
+	struct nvfuse_ictx_manager *ictxc = sb->sb_ictxc;
+	struct nvfuse_ictx_shard *shard;
+	struct nvfuse_inode_ctx *ictx;
+	s32 max_type = BUFFER_TYPE_CLEAN;
+	s32 retry;
+	s32 type;
+	s32 i;
 
-		/* FIXED: clean list is required for better performance. */
-		if (ictx->ictx_ref == 0 &&
-		    ictx->ictx_data_dirty_count == 0 &&
-		    ictx->ictx_meta_dirty_count == 0)
-			goto VICTIM_FOUND;
+	for (retry = 0; retry < 2; retry++) {
+		/* start from the preferred shard and steal from the others if needed */
+		for (i = 0; i < NVFUSE_ICTXC_SHARD_NUM; i++) {
+			shard = &ictxc->ictxc_shard[(shard_id + i) & (NVFUSE_ICTXC_SHARD_NUM - 1)];
+
+			SPINLOCK_LOCK(&shard->ictxc_lock);
+			for (type = BUFFER_TYPE_UNUSED; type <= max_type; type++) {
+				if (type == BUFFER_TYPE_REF || !shard->ictxc_list_count[type])
+					continue;
+
+				ictx = nvfuse_ictx_shard_victim(shard, type);
+				if (ictx)
+					goto VICTIM_FOUND;
+			}
+			SPINLOCK_UNLOCK(&shard->ictxc_lock);
+		}
 
-		SPINLOCK_UNLOCK(&ictx->ictx_lock);
+		dprintf_warn(BUFFER, " Warning: it runs out of clean buffers.\n");
+		dprintf_warn(BUFFER, " Warning: it needs to immediately flush dirty pages to disks.\n");
+		/* idle files pinned by their reservation windows become victims again */
+		nvfuse_release_rsv_windows(sb);
+		nvfuse_check_flush_dirty(sb, DIRTY_FLUSH_FORCE);
+		max_type = BUFFER_TYPE_DIRTY;
 	}
 
 	/* TODO: error handling */
@@ -89,16 +186,12 @@ struct nvfuse_inode_ctx *nvfuse_replace_ictx(struct nvfuse_superblock *sb)
 	while (1) sleep(1);
 
 VICTIM_FOUND:
+	nvfuse_ictx_unlink(shard, ictx);
+	SPINLOCK_UNLOCK(&shard->ictxc_lock);
 
-	/* remove list */
-	list_del(&ictx->ictx_cache_list);
-	/* remove hlist */
-	hlist_del(&ictx->ictx_hash);
-	ictxc->ictxc_list_count[type]--;
-	if (type == BUFFER_TYPE_UNUSED)
-		ictxc->ictxc_hash_count[HASH_NUM]--;
-	else
-		ictxc->ictxc_hash_count[ictx->ictx_ino % HASH_NUM]--;
+	/* lockless lookups holding a stale pointer fail to validate from now on */
+	ictx->ictx_ino = 0;
+	ictx->ictx_type = BUFFER_TYPE_UNUSED;
 
 	SPINLOCK_UNLOCK(&ictx->ictx_lock);
 	return ictx;
@@ -108,10 +201,12 @@ struct nvfuse_inode_ctx *nvfuse_alloc_ictx(struct nvfuse_superblock *sb)
 {
 	struct nvfuse_ictx_manager *ictxc = sb->sb_ictxc;
 	struct nvfuse_inode_ctx *ictx;
+	s32 shard_id;
+
+	/* inode number is not known yet; spread victims over shards */
+	shard_id = rte_atomic32_add_return(&ictxc->ictxc_next_shard, 1) & (NVFUSE_ICTXC_SHARD_NUM - 1);
 
-	SPINLOCK_LOCK(&ictxc->ictxc_lock);
-	ictx = nvfuse_replace_ictx(sb);
-	SPINLOCK_UNLOCK(&ictxc->ictxc_lock);
+	ictx = nvfuse_replace_ictx(sb, shard_id);
 
 	nvfuse_init_ictx(ictx, 0);
 
@@ -121,19 +216,16 @@ struct nvfuse_inode_ctx *nvfuse_alloc_ictx(struct nvfuse_superblock *sb)
 void nvfuse_insert_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx)
 {
 	struct nvfuse_ictx_manager *ictxc = sb->sb_ictxc;
+	struct nvfuse_ictx_shard *shard;
 	inode_t ino = ictx->ictx_ino;
 	s32 type = BUFFER_TYPE_REF;
 
-	/* hash list insertion */
-	hlist_add_head(&ictx->ictx_hash, &ictxc->ictxc_hash[ino % HASH_NUM]);
-	ictxc->ictxc_hash_count[ino % HASH_NUM]++;
+	shard = &ictxc->ictxc_shard[nvfuse_ictx_shard_id(ino)];
 
-	/* list insertion */
-	list_add(&ictx->ictx_cache_list, &ictxc->ictxc_list[type]);
-	/* increase count of clean list */
-	ictxc->ictxc_list_count[type]++;
-	/* initialize key and type values*/
-	ictx->ictx_type = type;
+	/* hash list and list insertion */
+	SPINLOCK_LOCK(&shard->ictxc_lock);
+	nvfuse_ictx_link(shard, ictx, type, nvfuse_ictx_shard_id(ino));
+	SPINLOCK_UNLOCK(&shard->ictxc_lock);
 
 	if (type == BUFFER_TYPE_CLEAN && (ictx->ictx_data_dirty_count || ictx->ictx_meta_dirty_count)) {
 		assert(0);
@@ -142,8 +234,7 @@ void nvfuse_insert_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *i
 
 void nvfuse_init_ictx(struct nvfuse_inode_ctx *ictx, inode_t ino)
 {
-	SPINLOCK_INIT(&ictx->ictx_lock);
-
+	/* ictx_lock is initialized once at cache init; lockless lookups may spin on it */
 	INIT_LIST_HEAD(&ictx->ictx_meta_bh_head);
 	INIT_LIST_HEAD(&ictx->ictx_data_bh_head);
 #ifdef USE_RBNODE
@@ -158,6 +249,13 @@ void nvfuse_init_ictx(struct nvfuse_inode_ctx *ictx, inode_t ino)
 	ictx->ictx_status = INODE_STATE_NEW;
 	ictx->ictx_ref = 0;
 	ictx->ictx_type = 0;
+	ictx->ictx_referenced = 0;
+
+	INIT_LIST_HEAD(&ictx->ictx_rsv_list);
+	ictx->ictx_rsv_start = 0;
+	ictx->ictx_rsv_len = 0;
+	ictx->ictx_rsv_size = NVFUSE_RSV_WINDOW_MIN;
+	ictx->ictx_rsv_goal = 0;
 
 	ictx->ictx_inode = NULL;
 	ictx->ictx_bh = NULL;
@@ -166,30 +264,60 @@ void nvfuse_init_ictx(struct nvfuse_inode_ctx *ictx, inode_t ino)
 struct nvfuse_inode_ctx *nvfuse_get_ictx(struct nvfuse_superblock *sb, inode_t ino)
 {
 	struct nvfuse_ictx_manager *ictxc = sb->sb_ictxc;
+	struct nvfuse_ictx_shard *shard;
 	struct nvfuse_inode_ctx *ictx;
+	struct nvfuse_inode_ctx *new_ictx;
+	s32 shard_id = nvfuse_ictx_shard_id(ino);
+
+	shard = &ictxc->ictxc_shard[shard_id];
+
+	while (1) {
+		/* in case of cache hit, no shard lock is taken */
+		ictx = nvfuse_ictx_hash_lookup(ictxc, ino);
+		if (likely(ictx)) {
+			SPINLOCK_LOCK(&ictx->ictx_lock);
+			if (likely(ictx->ictx_ino == ino && ictx->ictx_type != BUFFER_TYPE_UNUSED)) {
+				ictx->ictx_referenced = 1;
+				break;
+			}
+			/* replaced while we were looking */
+			SPINLOCK_UNLOCK(&ictx->ictx_lock);
+		}
 
-	SPINLOCK_LOCK(&ictxc->ictxc_lock);
-
-	ictx = nvfuse_ictx_hash_lookup(sb->sb_ictxc, ino);
-	if (unlikely(!ictx)) { 
 		/* in case of cache misses */
-		ictx = nvfuse_replace_ictx(sb);
+		SPINLOCK_LOCK(&shard->ictxc_lock);
+		shard->ictxc_cache_miss++;
+		ictx = nvfuse_ictx_hash_lookup(ictxc, ino);
+		SPINLOCK_UNLOCK(&shard->ictxc_lock);
 		if (ictx) {
-			/* init ictx structure */
-			nvfuse_init_ictx(ictx, ino);
-			assert(ictx->ictx_ino == ino);
-
-			/* insert to ictx list and hash table */
-			nvfuse_insert_ictx(sb, ictx);
-		} else {
-			goto OUT;
+			/* raced with a walk or an insertion, look it up again */
+			continue;
 		}
-	}  
-	/* in case of cache hit */
-	/* ictx already in the ictx cache */
 
-	/* cache move to mru position */
-	list_move(&ictx->ictx_cache_list, &ictxc->ictxc_list[ictx->ictx_type]);
+		/* victim is taken without the shard lock as it may come from other shards */
+		new_ictx = nvfuse_replace_ictx(sb, shard_id);
+		/* init ictx structure */
+		nvfuse_init_ictx(new_ictx, ino);
+		assert(new_ictx->ictx_ino == ino);
+
+		SPINLOCK_LOCK(&shard->ictxc_lock);
+		ictx = nvfuse_ictx_hash_lookup(ictxc, ino);
+		if (unlikely(ictx)) {
+			/* other thread inserted the same inode in the meantime */
+			new_ictx->ictx_ino = 0;
+			nvfuse_ictx_link(shard, new_ictx, BUFFER_TYPE_UNUSED, shard_id);
+			SPINLOCK_UNLOCK(&shard->ictxc_lock);
+			continue;
+		}
+
+		/* lock before it becomes visible to lookups */
+		ictx = new_ictx;
+		SPINLOCK_LOCK(&ictx->ictx_lock);
+		/* insert to ictx list and hash table */
+		nvfuse_ictx_link(shard, ictx, BUFFER_TYPE_REF, shard_id);
+		SPINLOCK_UNLOCK(&shard->ictxc_lock);
+		break;
+	}
 
 	/* type and count debug */
 	if (ictx->ictx_type == BUFFER_TYPE_CLEAN && (ictx->ictx_data_dirty_count ||
@@ -197,14 +325,9 @@ struct nvfuse_inode_ctx *nvfuse_get_ictx(struct nvfuse_superblock *sb, inode_t i
 		assert(0);
 	}
 
-	/* lock ictx */
-	SPINLOCK_LOCK(&ictx->ictx_lock);
 	/* this inode context is locked until nvfuse_inode_release is called. */
 	set_bit(&ictx->ictx_status, INODE_STATE_LOCK);
 
-OUT:
-	SPINLOCK_UNLOCK(&ictxc->ictxc_lock);
-
 	return ictx;
 }
 
@@ -212,27 +335,20 @@ void nvfuse_move_ictx_list(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx
 			   s32 desired_type)
 {
 	struct nvfuse_ictx_manager *ictxc = sb->sb_ictxc;
+	struct nvfuse_ictx_shard *shard;
 
-	SPINLOCK_LOCK(&ictxc->ictxc_lock);
-
-	list_del(&ictx->ictx_cache_list);
-	ictxc->ictxc_list_count[ictx->ictx_type]--;
-
-	ictx->ictx_type = desired_type;
-
-	list_add(&ictx->ictx_cache_list, &ictxc->ictxc_list[ictx->ictx_type]);
-	ictxc->ictxc_list_count[ictx->ictx_type]++;
-
-	hlist_del(&ictx->ictx_hash);
-	if (desired_type == BUFFER_TYPE_UNUSED) {
-		hlist_add_head(&ictx->ictx_hash, &ictxc->ictxc_hash[HASH_NUM]);
-		ictxc->ictxc_hash_count[HASH_NUM]++;
-	} else {
-		hlist_add_head(&ictx->ictx_hash, &ictxc->ictxc_hash[ictx->ictx_ino % HASH_NUM]);
-		ictxc->ictxc_hash_count[ictx->ictx_ino % HASH_NUM]++;
+	/* staying on the same list only needs the second chance bit for replacement */
+	if (ictx->ictx_type == desired_type) {
+		ictx->ictx_referenced = 1;
+		return;
 	}
 
-	SPINLOCK_UNLOCK(&ictxc->ictxc_lock);
+	shard = &ictxc->ictxc_shard[ictx->ictx_shard];
+
+	SPINLOCK_LOCK(&shard->ictxc_lock);
+	nvfuse_ictx_unlink(shard, ictx);
+	nvfuse_ictx_link(shard, ictx, desired_type, ictx->ictx_shard);
+	SPINLOCK_UNLOCK(&shard->ictxc_lock);
 }
 
 void nvfuse_release_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx, s32 dirty)
@@ -275,42 +391,55 @@ void nvfuse_release_ictx(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *
 int nvfuse_init_ictx_cache(struct nvfuse_superblock *sb)
 {
 	struct nvfuse_ictx_manager *ictxc;
+	struct nvfuse_ictx_shard *shard;
+	s32 shard_id;
 	s32 i;
 
-	ictxc = (struct nvfuse_ictx_manager *)spdk_dma_malloc(sizeof(struct nvfuse_ictx_manager), 0, NULL);
+	ictxc = (struct nvfuse_ictx_manager *)spdk_dma_malloc(sizeof(struct nvfuse_ictx_manager), 64, NULL);
 	if (ictxc == NULL) {
 		dprintf_error(BUFFER, " %s:%d: nvfuse_malloc error \n", __FUNCTION__, __LINE__);
 		return -1;
 	}
 	memset(ictxc, 0x00, sizeof(struct nvfuse_ictx_manager));
 	sb->sb_ictxc = ictxc;
+	rte_atomic32_init(&ictxc->ictxc_next_shard);
 
-	SPINLOCK_INIT(&ictxc->ictxc_lock);
+	for (shard_id = 0; shard_id < NVFUSE_ICTXC_SHARD_NUM; shard_id++) {
+		shard = &ictxc->ictxc_shard[shard_id];
 
-	for (i = BUFFER_TYPE_UNUSED; i < BUFFER_TYPE_NUM; i++) {
-		INIT_LIST_HEAD(&ictxc->ictxc_list[i]);
-		ictxc->ictxc_list_count[i] = 0;
-	}
+		SPINLOCK_INIT(&shard->ictxc_lock);
+
+		for (i = BUFFER_TYPE_UNUSED; i < BUFFER_TYPE_NUM; i++) {
+			INIT_LIST_HEAD(&shard->ictxc_list[i]);
+			shard->ictxc_list_count[i] = 0;
+		}
+
+		for (i = 0; i < NVFUSE_ICTXC_HASH_NUM + 1; i++) {
+			INIT_HLIST_HEAD(&shard->ictxc_hash[i]);
+			shard->ictxc_hash_count[i] = 0;
+		}
 
-	for (i = 0; i < HASH_NUM + 1; i++) {
-		INIT_HLIST_HEAD(&ictxc->ictxc_hash[i]);
-		ictxc->ictxc_hash_count[i] = 0;
+		shard->ictxc_cache_size = NVFUSE_ICTXC_SIZE / NVFUSE_ICTXC_SHARD_NUM;
 	}
 
 	ictxc->ictx_buf = spdk_dma_malloc(sizeof(struct nvfuse_inode_ctx) * NVFUSE_ICTXC_SIZE, 0, NULL);
 
 	dprintf_info(BUFFER, " ictx cache size = %d \n", (int)sizeof(struct nvfuse_inode_ctx) * NVFUSE_ICTXC_SIZE);
 
-	/* alloc unsed list buffer cache */
+	/* alloc unsed list buffer cache, evenly distributed over shards */
 	for (i = 0; i < NVFUSE_ICTXC_SIZE; i++) {
 		struct nvfuse_inode_ctx *ictx;
 
 		ictx = ((struct nvfuse_inode_ctx *)ictxc->ictx_buf) + i;
+		memset(ictx, 0x00, sizeof(struct nvfuse_inode_ctx));
+		SPINLOCK_INIT(&ictx->ictx_lock);
 
-		list_add(&ictx->ictx_cache_list, &ictxc->ictxc_list[BUFFER_TYPE_UNUSED]);
-		hlist_add_head(&ictx->ictx_hash, &ictxc->ictxc_hash[HASH_NUM]);
-		ictxc->ictxc_hash_count[HASH_NUM]++;
-		ictxc->ictxc_list_count[BUFFER_TYPE_UNUSED]++;
+		shard_id = i & (NVFUSE_ICTXC_SHARD_NUM - 1);
+		shard = &ictxc->ictxc_shard[shard_id];
+
+		SPINLOCK_LOCK(&shard->ictxc_lock);
+		nvfuse_ictx_link(shard, ictx, BUFFER_TYPE_UNUSED, shard_id);
+		SPINLOCK_UNLOCK(&shard->ictxc_lock);
 	}
 
 	return 0;
@@ -383,19 +512,32 @@ void nvfuse_print_ictx_list(struct nvfuse_superblock *sb, s32 type)
 {
 	struct list_head *head;
 	struct nvfuse_inode_ctx *ictx;
-
-	head = &sb->sb_ictxc->ictxc_list[type];
+	s32 shard_id;
 
 	dprintf_debug(INODE, " print ictx list type (%s)\n", buffer_type_to_str(type));
-	list_for_each_entry(ictx, head, ictx_cache_list) {
-		nvfuse_print_ictx(ictx);
-		nvfuse_print_ictx_dirty_bhs(ictx);
+	for (shard_id = 0; shard_id < NVFUSE_ICTXC_SHARD_NUM; shard_id++) {
+		head = &sb->sb_ictxc->ictxc_shard[shard_id].ictxc_list[type];
+		list_for_each_entry(ictx, head, ictx_cache_list) {
+			nvfuse_print_ictx(ictx);
+			nvfuse_print_ictx_dirty_bhs(ictx);
+		}
 	}
 }
 
+s32 nvfuse_get_ictx_list_count(struct nvfuse_superblock *sb, s32 type)
+{
+	s32 count = 0;
+	s32 shard_id;
+
+	for (shard_id = 0; shard_id < NVFUSE_ICTXC_SHARD_NUM; shard_id++)
+		count += sb->sb_ictxc->ictxc_shard[shard_id].ictxc_list_count[type];
+
+	return count;
+}
+
 void nvfuse_print_ictx_list_count(struct nvfuse_superblock *sb, s32 type)
 {
-	dprintf_debug(INODE, " inode dirty count = %d \n", sb->sb_ictxc->ictxc_list_count[type]);
+	dprintf_debug(INODE, " inode dirty count = %d \n", nvfuse_get_ictx_list_count(sb, type));
 }
 
 /* uninitialization of inode context cache manager */
@@ -404,16 +546,19 @@ void nvfuse_deinit_ictx_cache(struct nvfuse_superblock *sb)
 	struct list_head *head;
 	struct list_head *ptr, *temp;
 	struct nvfuse_inode_ctx *ictx;
+	s32 shard_id;
 	s32 type;
 	s32 removed_count = 0;
 
 	/* dealloc buffer cache */
-	for (type = BUFFER_TYPE_UNUSED; type < BUFFER_TYPE_NUM; type++) {
-		head = &sb->sb_ictxc->ictxc_list[type];
-		list_for_each_safe(ptr, temp, head) {
-			ictx = (struct nvfuse_inode_ctx *)list_entry(ptr, struct nvfuse_inode_ctx, ictx_cache_list);
-			list_del(&ictx->ictx_cache_list);
-			removed_count++;
+	for (shard_id = 0; shard_id < NVFUSE_ICTXC_SHARD_NUM; shard_id++) {
+		for (type = BUFFER_TYPE_UNUSED; type < BUFFER_TYPE_NUM; type++) {
+			head = &sb->sb_ictxc->ictxc_shard[shard_id].ictxc_list[type];
+			list_for_each_safe(ptr, temp, head) {
+				ictx = (struct nvfuse_inode_ctx *)list_entry(ptr, struct nvfuse_inode_ctx, ictx_cache_list);
+				list_del(&ictx->ictx_cache_list);
+				removed_count++;
+			}
 		}
 	}
 	/* deallocate whole ictx buffer */
@@ -421,4 +566,3 @@ void nvfuse_deinit_ictx_cache(struct nvfuse_superblock *sb)
 	assert(removed_count == NVFUSE_ICTXC_SIZE);
 	spdk_dma_free(sb->sb_ictxc);
 }
-
@@ -140,6 +140,10 @@ s8 *nvfuse_ipc_opcode_decode(enum ipc_opcode opcode)
 		return "HEALTH_CHECK_REQ";
 	case HEALTH_CHECK_CPL:
 		return "HEALTH_CHECK_CPL";
+	case BUFFER_STAT_REQ:
+		return "BUFFER_STAT_REQ";
+	case BUFFER_STAT_CPL:
+		return "BUFFER_STAT_CPL";
 	default:
 		break;
 	}
@@ -254,6 +258,22 @@ void nvfuse_make_buffer_free_cpl(struct buffer_free_cpl *req, s32 ret)
 	req->tag2 = 0;
 }
 
+void nvfuse_make_buffer_stat_req(struct buffer_stat_req *req)
+{
+	req->opcode = BUFFER_STAT_REQ;
+	req->tag1 = 0;
+	req->tag2 = 0;
+}
+
+void nvfuse_make_buffer_stat_cpl(struct buffer_stat_cpl *req, s32 ret)
+{
+	req->opcode = BUFFER_STAT_CPL;
+	req->chan_id = req->chan_id;
+	req->ret = ret;
+	req->tag1 = 0;
+	req->tag2 = 0;
+}
+
 void nvfuse_make_container_alloc_req(struct container_alloc_req *req)
 {
 	req->opcode = CONTAINER_ALLOC_REQ;
@@ -570,6 +590,10 @@ int nvfuse_ipc_init(struct nvfuse_ipc_context *ipc_ctx)
 	if (ipc_ctx->message_pool == NULL)
 		rte_exit(EXIT_FAILURE, "Problem getting message pool\n");
 
+	SPINLOCK_INIT(&ipc_ctx->req_lock);
+	rte_atomic32_init(&ipc_ctx->req_count);
+	memset(ipc_ctx->req, 0x00, sizeof(ipc_ctx->req));
+
 	if (spdk_process_is_primary()) {
 		for (i = 0; i < NUM_STAT_TYPE; i++) {
 			ret = perf_stat_ring_create(&ipc_ctx->stat_ring[i], &ipc_ctx->stat_pool[i], i);
@@ -612,11 +636,8 @@ void nvfuse_ipc_exit(struct nvfuse_ipc_context *ipc_ctx)
 	}
 }
 
-int nvfuse_send_msg_to_primary_core(struct rte_ring *send_ring, struct rte_ring *recv_ring,
-				    union nvfuse_ipc_msg *ipc_msg, s32 opcode)
+static void nvfuse_make_ipc_req(union nvfuse_ipc_msg *ipc_msg, s32 opcode)
 {
-	int ret;
-
 	switch (opcode) {
 	case APP_REGISTER_REQ:
 		nvfuse_make_app_register_req(&ipc_msg->app_register_req);
@@ -633,6 +654,9 @@ int nvfuse_send_msg_to_primary_core(struct rte_ring *send_ring, struct rte_ring
 	case BUFFER_FREE_REQ:
 		nvfuse_make_buffer_free_req(&ipc_msg->buffer_free_req);
 		break;
+	case BUFFER_STAT_REQ:
+		nvfuse_make_buffer_stat_req(&ipc_msg->buffer_stat_req);
+		break;
 	case CONTAINER_ALLOC_REQ:
 		nvfuse_make_container_alloc_req(&ipc_msg->container_alloc_req);
 		break;
@@ -652,6 +676,46 @@ int nvfuse_send_msg_to_primary_core(struct rte_ring *send_ring, struct rte_ring
 		fprintf(stderr, " Error: invalid opcode = %d (%s)",
 			opcode, nvfuse_ipc_opcode_decode(opcode));
 	}
+}
+
+/*
+ * queues ipc_msg to the primary without waiting for it. the primary answers
+ * in the same message buffer, so completions are matched by pointer and the
+ * slot index is handed out as the request id. with a callback, the
+ * completion goes to cb from nvfuse_ipc_poll() and the message is put back
+ * to the mempool afterwards; otherwise the caller keeps the message and
+ * collects the result with nvfuse_ipc_wait(). returns -EAGAIN when all
+ * slots of the channel are in use.
+ */
+s32 nvfuse_ipc_send_async(struct nvfuse_handle *nvh, union nvfuse_ipc_msg *ipc_msg, s32 opcode,
+			  nvfuse_ipc_cb_t cb, void *arg)
+{
+	struct nvfuse_ipc_context *ipc_ctx = &nvh->nvh_ipc_ctx;
+	struct nvfuse_ipc_req *req = NULL;
+	struct rte_ring *send_ring;
+	s32 req_id;
+
+	nvfuse_make_ipc_req(ipc_msg, opcode);
+
+	SPINLOCK_LOCK(&ipc_ctx->req_lock);
+	for (req_id = 0; req_id < NVFUSE_IPC_MAX_OUTSTANDING; req_id++) {
+		if (ipc_ctx->req[req_id].msg == NULL) {
+			req = &ipc_ctx->req[req_id];
+			break;
+		}
+	}
+	if (req == NULL) {
+		SPINLOCK_UNLOCK(&ipc_ctx->req_lock);
+		return -EAGAIN;
+	}
+	req->msg = ipc_msg;
+	req->cb = cb;
+	req->arg = arg;
+	req->start_tsc = spdk_get_ticks();
+	req->opcode = opcode;
+	req->done = 0;
+	rte_atomic32_inc(&ipc_ctx->req_count);
+	SPINLOCK_UNLOCK(&ipc_ctx->req_lock);
 
 	switch (ipc_msg->opcode) {
 	case CONTAINER_ALLOC_REQ:
@@ -659,6 +723,7 @@ int nvfuse_send_msg_to_primary_core(struct rte_ring *send_ring, struct rte_ring
 	case HEALTH_CHECK_REQ:
 	case BUFFER_ALLOC_REQ:
 	case BUFFER_FREE_REQ:
+	case BUFFER_STAT_REQ:
 		break;
 	default:
 		dprintf_info(IPC, " %ld send req (%p:%d:%s) to primary core\n",
@@ -667,43 +732,155 @@ int nvfuse_send_msg_to_primary_core(struct rte_ring *send_ring, struct rte_ring
 		       nvfuse_ipc_opcode_decode(ipc_msg->opcode));
 	}
 
+	send_ring = nvfuse_ipc_get_sendq(ipc_ctx, ipc_ctx->my_channel_id);
 	if (rte_ring_enqueue(send_ring, ipc_msg) < 0) {
 		printf("Failed to send message - message discarded\n");
+		SPINLOCK_LOCK(&ipc_ctx->req_lock);
+		req->msg = NULL;
+		rte_atomic32_dec(&ipc_ctx->req_count);
+		SPINLOCK_UNLOCK(&ipc_ctx->req_lock);
 		return -1;
 	}
 
-	//rte_ring_dump(stdout, recv_ring);
-	nvfuse_try_ring_dequeue(recv_ring, &ipc_msg, 0);
+	return req_id;
+}
 
-	switch (ipc_msg->opcode) {
-	case CONTAINER_ALLOC_CPL:
-	case CONTAINER_RELEASE_CPL:
-	case HEALTH_CHECK_CPL:
-	case BUFFER_ALLOC_CPL:
-	case BUFFER_FREE_CPL:
-		break;
-	default:
-		dprintf_info(IPC, " %ld recv cpl (%d:%s, ret = %d) from primary core\n",
-		       spdk_get_ticks(),
-		       ipc_msg->opcode, nvfuse_ipc_opcode_decode(ipc_msg->opcode), ipc_msg->ret);
-		fflush(stdout);
+/*
+ * reaps completions from the primary. callbacks run without req_lock held,
+ * so they may queue new requests. returns the number of completions.
+ */
+s32 nvfuse_ipc_poll(struct nvfuse_handle *nvh)
+{
+	struct nvfuse_ipc_context *ipc_ctx = &nvh->nvh_ipc_ctx;
+	struct nvfuse_superblock *sb = &nvh->nvh_sb;
+	struct nvfuse_ipc_req cbs[NVFUSE_IPC_MAX_OUTSTANDING];
+	struct rte_ring *recv_ring;
+	union nvfuse_ipc_msg *ipc_msg;
+	void *ptr;
+	s32 nr_cbs = 0;
+	s32 nr_cpls = 0;
+	s32 i;
+
+	if (rte_atomic32_read(&ipc_ctx->req_count) == 0)
+		return 0;
+
+	recv_ring = nvfuse_ipc_get_recvq(ipc_ctx, ipc_ctx->my_channel_id);
+
+	SPINLOCK_LOCK(&ipc_ctx->req_lock);
+	while (rte_ring_dequeue(recv_ring, &ptr) == 0) {
+		ipc_msg = (union nvfuse_ipc_msg *)ptr;
+
+		for (i = 0; i < NVFUSE_IPC_MAX_OUTSTANDING; i++) {
+			if (ipc_ctx->req[i].msg == ipc_msg)
+				break;
+		}
+		if (i == NVFUSE_IPC_MAX_OUTSTANDING) {
+			dprintf_error(IPC, " unexpected cpl (%p:%d:%s) from primary core\n",
+				      ipc_msg, ipc_msg->opcode, nvfuse_ipc_opcode_decode(ipc_msg->opcode));
+			continue;
+		}
+
+		switch (ipc_msg->opcode) {
+		case CONTAINER_ALLOC_CPL:
+		case CONTAINER_RELEASE_CPL:
+		case HEALTH_CHECK_CPL:
+		case BUFFER_ALLOC_CPL:
+		case BUFFER_FREE_CPL:
+		case BUFFER_STAT_CPL:
+			break;
+		default:
+			dprintf_info(IPC, " %ld recv cpl (%d:%s, ret = %d) from primary core\n",
+			       spdk_get_ticks(),
+			       ipc_msg->opcode, nvfuse_ipc_opcode_decode(ipc_msg->opcode), ipc_msg->ret);
+		}
+
+		nr_cpls++;
+		if (ipc_ctx->req[i].cb) {
+			cbs[nr_cbs++] = ipc_ctx->req[i];
+			ipc_ctx->req[i].msg = NULL;
+			rte_atomic32_dec(&ipc_ctx->req_count);
+		} else {
+			ipc_ctx->req[i].done = 1;
+		}
+	}
+	SPINLOCK_UNLOCK(&ipc_ctx->req_lock);
+
+	for (i = 0; i < nr_cbs; i++) {
+		sb->perf_stat_ipc.stat_ipc.total_tsc[cbs[i].opcode] += (spdk_get_ticks() - cbs[i].start_tsc);
+		sb->perf_stat_ipc.stat_ipc.total_count[cbs[i].opcode]++;
+
+		cbs[i].cb(cbs[i].msg, cbs[i].arg);
+		rte_mempool_put(nvfuse_ipc_mempool(ipc_ctx), cbs[i].msg);
 	}
-	//rte_ring_dump(stdout, recv_ring);
-	ret = ipc_msg->ret;
+
+	return nr_cpls;
+}
+
+/* spins until request req_id completes and returns the primary's ret */
+s32 nvfuse_ipc_wait(struct nvfuse_handle *nvh, s32 req_id)
+{
+	struct nvfuse_ipc_context *ipc_ctx = &nvh->nvh_ipc_ctx;
+	struct nvfuse_ipc_req *req = &ipc_ctx->req[req_id];
+	s32 ret;
+
+	assert(req->msg && req->cb == NULL);
+
+	while (!((volatile struct nvfuse_ipc_req *)req)->done)
+		nvfuse_ipc_poll(nvh);
+
+	SPINLOCK_LOCK(&ipc_ctx->req_lock);
+	ret = req->msg->ret;
+	req->msg = NULL;
+	rte_atomic32_dec(&ipc_ctx->req_count);
+	SPINLOCK_UNLOCK(&ipc_ctx->req_lock);
+
 	return ret;
 }
 
+static void nvfuse_ipc_drop_cpl(union nvfuse_ipc_msg *ipc_msg, void *arg)
+{
+}
+
+/*
+ * detaches arg from the outstanding async requests made with it, e.g., when
+ * arg is freed before the primary answers. their completions are dropped.
+ */
+void nvfuse_ipc_forget(struct nvfuse_handle *nvh, void *arg)
+{
+	struct nvfuse_ipc_context *ipc_ctx = &nvh->nvh_ipc_ctx;
+	s32 i;
+
+	SPINLOCK_LOCK(&ipc_ctx->req_lock);
+	for (i = 0; i < NVFUSE_IPC_MAX_OUTSTANDING; i++) {
+		if (ipc_ctx->req[i].msg && ipc_ctx->req[i].cb && ipc_ctx->req[i].arg == arg) {
+			ipc_ctx->req[i].cb = nvfuse_ipc_drop_cpl;
+			ipc_ctx->req[i].arg = NULL;
+		}
+	}
+	SPINLOCK_UNLOCK(&ipc_ctx->req_lock);
+}
+
+int nvfuse_send_msg_to_primary_core(struct nvfuse_handle *nvh, union nvfuse_ipc_msg *ipc_msg,
+				    s32 opcode)
+{
+	s32 req_id;
+
+	/* the channel may be full of async requests, reap them first */
+	while ((req_id = nvfuse_ipc_send_async(nvh, ipc_msg, opcode, NULL, NULL)) == -EAGAIN)
+		nvfuse_ipc_poll(nvh);
+
+	if (req_id < 0)
+		return -1;
+
+	return nvfuse_ipc_wait(nvh, req_id);
+}
+
 s32 nvfuse_send_app_unregister_req(struct nvfuse_handle *nvh, s32 destroy_containers)
 {
-	struct rte_ring *send_ring, *recv_ring;
 	struct rte_mempool *mempool;
 	union nvfuse_ipc_msg *ipc_msg;
 	s32 ret;
 
-	/* INITIALIZATION OF TX/RX RING BUFFERS */
-	send_ring = nvfuse_ipc_get_sendq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-	recv_ring = nvfuse_ipc_get_recvq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-
 	/* initialization of memory pool */
 	mempool = nvfuse_ipc_mempool(&nvh->nvh_ipc_ctx);
 
@@ -720,7 +897,7 @@ s32 nvfuse_send_app_unregister_req(struct nvfuse_handle *nvh, s32 destroy_contai
 	ipc_msg->app_unregister_req.destroy_containers = destroy_containers;
 
 	/* SEND APP_UNREGISTER_REQ TO PRIMARY CORE */
-	ret = nvfuse_send_msg_to_primary_core(send_ring, recv_ring, ipc_msg, APP_UNREGISTER_REQ);
+	ret = nvfuse_send_msg_to_primary_core(nvh, ipc_msg, APP_UNREGISTER_REQ);
 	if (ret) {
 		fprintf(stderr, " Failed to unreigster app from control plane \n");
 	}
@@ -733,7 +910,6 @@ s32 nvfuse_send_alloc_buffer_req(struct nvfuse_handle *nvh, s32 buffer_size)
 {
 	struct nvfuse_superblock *sb = &nvh->nvh_sb;
 	struct nvfuse_buffer_manager *bm = sb->sb_bm;
-	struct rte_ring *send_ring, *recv_ring;
 	struct rte_mempool *mempool;
 	union nvfuse_ipc_msg *ipc_msg;
 	s32 remain_buffers;
@@ -747,10 +923,6 @@ s32 nvfuse_send_alloc_buffer_req(struct nvfuse_handle *nvh, s32 buffer_size)
 
 	assert(buffer_size > 0);
 
-	/* INITIALIZATION OF TX/RX RING BUFFERS */
-	send_ring = nvfuse_ipc_get_sendq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-	recv_ring = nvfuse_ipc_get_recvq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-
 	/* initialization of memory pool */
 	mempool = nvfuse_ipc_mempool(&nvh->nvh_ipc_ctx);
 
@@ -769,7 +941,7 @@ s32 nvfuse_send_alloc_buffer_req(struct nvfuse_handle *nvh, s32 buffer_size)
 	{
 		u64 start_tsc = spdk_get_ticks();
 		/* SEND BUFFER_ALLOC_REQ TO PRIMARY CORE */
-		ret = nvfuse_send_msg_to_primary_core(send_ring, recv_ring, ipc_msg, BUFFER_ALLOC_REQ);
+		ret = nvfuse_send_msg_to_primary_core(nvh, ipc_msg, BUFFER_ALLOC_REQ);
 		if (ret == 0) {
 			//printf("Failed to get buffer\n");
 			ret = -1;
@@ -790,15 +962,10 @@ s32 nvfuse_send_alloc_buffer_req(struct nvfuse_handle *nvh, s32 buffer_size)
 s32 nvfuse_send_dealloc_buffer_req(struct nvfuse_handle *nvh, s32 buffer_size)
 {
 	struct nvfuse_superblock *sb = &nvh->nvh_sb;
-	struct rte_ring *send_ring, *recv_ring;
 	struct rte_mempool *mempool;
 	union nvfuse_ipc_msg *ipc_msg;
 	s32 ret;
 
-	/* INITIALIZATION OF TX/RX RING BUFFERS */
-	send_ring = nvfuse_ipc_get_sendq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-	recv_ring = nvfuse_ipc_get_recvq(&nvh->nvh_ipc_ctx, nvh->nvh_ipc_ctx.my_channel_id);
-
 	/* initialization of memory pool */
 	mempool = nvfuse_ipc_mempool(&nvh->nvh_ipc_ctx);
 
@@ -817,7 +984,7 @@ s32 nvfuse_send_dealloc_buffer_req(struct nvfuse_handle *nvh, s32 buffer_size)
 		u64 start_tsc = spdk_get_ticks();
 
 		/* SEND BUFFER_DEALLOC_REQ TO PRIMARY CORE */
-		ret = nvfuse_send_msg_to_primary_core(send_ring, recv_ring, ipc_msg, BUFFER_FREE_REQ);
+		ret = nvfuse_send_msg_to_primary_core(nvh, ipc_msg, BUFFER_FREE_REQ);
 		if (ret < 0) {
 			rte_panic("Failed to dealloc buffer\n");
 		}
@@ -829,3 +996,95 @@ s32 nvfuse_send_dealloc_buffer_req(struct nvfuse_handle *nvh, s32 buffer_size)
 	rte_mempool_put(mempool, ipc_msg);
 	return ret;
 }
+
+/*
+ * asks for buffer_size pages without waiting. the number of pages granted
+ * (0 if denied) is passed to cb as ipc_msg->ret. returns the request id, or
+ * a negative value if nothing was sent.
+ */
+s32 nvfuse_send_alloc_buffer_req_async(struct nvfuse_handle *nvh, s32 buffer_size,
+				       nvfuse_ipc_cb_t cb, void *arg)
+{
+	struct nvfuse_buffer_manager *bm = nvh->nvh_sb.sb_bm;
+	struct rte_mempool *mempool;
+	union nvfuse_ipc_msg *ipc_msg;
+	s32 remain_buffers;
+	s32 req_id;
+
+	remain_buffers = NVFUSE_MAX_BUFFER_SIZE_DATA * 256 - bm->bm_cache_size;
+
+	buffer_size = (buffer_size <= remain_buffers) ? buffer_size : remain_buffers;
+	if (buffer_size <= 0)
+		return -1;
+
+	mempool = nvfuse_ipc_mempool(&nvh->nvh_ipc_ctx);
+	if (rte_mempool_get(mempool, (void *)&ipc_msg) < 0) {
+		rte_panic("Failed to get message buffer\n");
+		return -1;
+	}
+
+	memset(ipc_msg->bytes, 0x00, NVFUSE_IPC_MSG_SIZE);
+	ipc_msg->chan_id = nvh->nvh_ipc_ctx.my_channel_id;
+	ipc_msg->buffer_alloc_req.buffer_size = buffer_size; // in 4K page unit
+
+	req_id = nvfuse_ipc_send_async(nvh, ipc_msg, BUFFER_ALLOC_REQ, cb, arg);
+	if (req_id < 0)
+		rte_mempool_put(mempool, ipc_msg);
+
+	return req_id;
+}
+
+/* gives buffer_size pages back without waiting */
+s32 nvfuse_send_dealloc_buffer_req_async(struct nvfuse_handle *nvh, s32 buffer_size,
+		nvfuse_ipc_cb_t cb, void *arg)
+{
+	struct rte_mempool *mempool;
+	union nvfuse_ipc_msg *ipc_msg;
+	s32 req_id;
+
+	mempool = nvfuse_ipc_mempool(&nvh->nvh_ipc_ctx);
+	if (rte_mempool_get(mempool, (void *)&ipc_msg) < 0) {
+		rte_panic("Failed to get message buffer\n");
+		return -1;
+	}
+
+	memset(ipc_msg->bytes, 0x00, NVFUSE_IPC_MSG_SIZE);
+	ipc_msg->chan_id = nvh->nvh_ipc_ctx.my_channel_id;
+	ipc_msg->buffer_free_req.buffer_size = buffer_size; // in 4K page unit
+
+	req_id = nvfuse_ipc_send_async(nvh, ipc_msg, BUFFER_FREE_REQ, cb, arg);
+	if (req_id < 0)
+		rte_mempool_put(mempool, ipc_msg);
+
+	return req_id;
+}
+
+/*
+ * reports the buffer usage of this data plane. the pages it should give
+ * back, if any, are passed to cb as ipc_msg->ret.
+ */
+s32 nvfuse_send_buffer_stat_req_async(struct nvfuse_handle *nvh, s32 misses, s32 interval_ms,
+				      nvfuse_ipc_cb_t cb, void *arg)
+{
+	struct rte_mempool *mempool;
+	union nvfuse_ipc_msg *ipc_msg;
+	s32 req_id;
+
+	mempool = nvfuse_ipc_mempool(&nvh->nvh_ipc_ctx);
+	if (rte_mempool_get(mempool, (void *)&ipc_msg) < 0) {
+		rte_panic("Failed to get message buffer\n");
+		return -1;
+	}
+
+	memset(ipc_msg->bytes, 0x00, NVFUSE_IPC_MSG_SIZE);
+	ipc_msg->chan_id = nvh->nvh_ipc_ctx.my_channel_id;
+	ipc_msg->buffer_stat_req.buffer_size = nvh->nvh_sb.sb_bm->bm_cache_size;
+	ipc_msg->buffer_stat_req.misses = misses;
+	ipc_msg->buffer_stat_req.interval_ms = interval_ms;
+
+	req_id = nvfuse_ipc_send_async(nvh, ipc_msg, BUFFER_STAT_REQ, cb, arg);
+	if (req_id < 0)
+		rte_mempool_put(mempool, ipc_msg);
+
+	return req_id;
+}
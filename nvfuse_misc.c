@@ -129,20 +129,10 @@ void *nvfuse_aio_test_alloc_req(struct nvfuse_handle *nvh, void *_user_ctx)
 	return areq;
 }
 
+/* latency is recorded by the aio queue when the request completes */
 void nvfuse_aio_test_callback(void *arg)
 {
 	struct nvfuse_aio_req *areq = (struct nvfuse_aio_req *)arg;
-	struct nvfuse_aio_queue *aioq = areq->queue;
-
-#ifdef SPDK_ENABLED
-	u64 latency_tsc;
-	latency_tsc = areq->complete_tsc - areq->submit_tsc;
-	aioq->aio_stat->aio_lat_total_tsc += latency_tsc;
-	aioq->aio_stat->aio_lat_total_count++;
-	aioq->aio_stat->aio_lat_min_tsc = MIN(latency_tsc, aioq->aio_stat->aio_lat_min_tsc);
-	aioq->aio_stat->aio_lat_max_tsc = MAX(latency_tsc, aioq->aio_stat->aio_lat_max_tsc);
-	aioq->aio_stat->aio_total_size += areq->bytes;
-#endif
 
 	free(areq);
 }
@@ -703,7 +693,7 @@ s32 nvfuse_type(struct nvfuse_handle *nvh, s8 *str)
 	fid = nvfuse_openfile_path(nvh, str, O_RDWR | O_CREAT, 0);
 
 	if (fid != -1) {
-		size = sb->sb_file_table[fid].size;
+		size = nvfuse_get_file_table(sb, fid)->size;
 
 		for (i = size; i >= read_block_size;
 		     i -= read_block_size, offset += read_block_size) {
@@ -738,7 +728,7 @@ s32 nvfuse_rdfile(struct nvfuse_handle *nvh, s8 *str)
 	fid = nvfuse_openfile_path(nvh, str, O_RDWR, 0);
 
 	if (fid != -1) {
-		size = sb->sb_file_table[fid].size;
+		size = nvfuse_get_file_table(sb, fid)->size;
 
 
 		for (i = size; i >= read_block_size;
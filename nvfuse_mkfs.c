@@ -41,6 +41,7 @@ s32 nvfuse_alloc_root_inode_direct(struct io_target *target,
 	void *bd_buf;
 	void *buf;
 	u32 ino = 0;
+	u32 entry, block;
 
 	bd_buf = nvfuse_alloc_aligned_buffer(CLUSTER_SIZE);
 	if (bd_buf == NULL) {
@@ -78,40 +79,14 @@ s32 nvfuse_alloc_root_inode_direct(struct io_target *target,
 	sb_disk->sb_free_blocks--;
 	nvfuse_write_cluster(buf, bd->bd_dbitmap_start, target);
 
-	// root inode allocation
-#if (INODE_ENTRY_SIZE == 128)
-	nvfuse_read_cluster(buf, bd->bd_itable_start, target);
-	memset(buf, 0x0, CLUSTER_SIZE);
-	inode = (struct nvfuse_inode *)buf;
-	for (ino = 0; ino < NUM_RESV_INO; ino++) {
-		inode[ino].i_ino = ino;
-		
-		if (ino != ROOT_INO)
-			continue;
-
-		//root inode
-		inode[ino].i_ino = ROOT_INO;
-		inode[ino].i_type = NVFUSE_TYPE_DIRECTORY;
-		inode[ino].i_size = DIR_ENTRY_SIZE * DIR_ENTRY_NUM;
-		inode[ino].i_version = 1;
-		inode[ino].i_ptr = 1;
-		inode[ino].i_gid = 0;
-		inode[ino].i_uid = 0;
-		inode[ino].i_mode = 0600 | S_IFDIR;
-		inode[ino].i_atime = time(NULL);
-		inode[ino].i_ctime = time(NULL);
-		inode[ino].i_mtime = time(NULL);
-		inode[ino].i_links_count = 2;
-		inode[ino].i_blocks[0] = bd->bd_dtable_start;
-	}
-	nvfuse_write_cluster(buf, bd->bd_itable_start, target);
-#elif (INODE_ENTRY_SIZE == 4096)
+	// root inode allocation, reserved inodes share the first itable blocks
 	for (ino = 0; ino < NUM_RESV_INO; ino++) {
-		nvfuse_read_cluster(buf, bd->bd_itable_start + ino, target);
-		memset(buf, 0x0, CLUSTER_SIZE);
+		entry = ino % INODE_ENTRY_NUM(sb_disk);
+		if (entry == 0)
+			memset(buf, 0x0, CLUSTER_SIZE);
 
 		if (ino == ROOT_INO) {
-			inode = (struct nvfuse_inode *)buf;
+			inode = INODE_ENTRY(sb_disk, buf, entry);
 			//root inode
 			inode->i_ino = ROOT_INO;
 			inode->i_type = NVFUSE_TYPE_DIRECTORY;
@@ -128,14 +103,12 @@ s32 nvfuse_alloc_root_inode_direct(struct io_target *target,
 			inode->i_blocks[0] = bd->bd_dtable_start;
 		}
 
-		dprintf_debug(FORMAT, " write inode = %d on %d block \n", ino, bd->bd_itable_start + ino);
-
-		nvfuse_write_cluster(buf, bd->bd_itable_start + ino, target);
+		if (entry + 1 == INODE_ENTRY_NUM(sb_disk) || ino + 1 == NUM_RESV_INO) {
+			block = bd->bd_itable_start + ino / INODE_ENTRY_NUM(sb_disk);
+			dprintf_debug(FORMAT, " write inode = %d on %d block \n", ino, block);
+			nvfuse_write_cluster(buf, block, target);
+		}
 	}
-#else
-	dprintf_error(FORMAT, " Unsupported inode size = %d \n", INODE_ENTRY_SIZE);
-	assert(0);
-#endif
 
 	// root data block allocation
 	nvfuse_read_cluster(buf, bd->bd_dtable_start, target);
@@ -160,7 +133,8 @@ s32 nvfuse_alloc_root_inode_direct(struct io_target *target,
 	return 0;
 }
 
-void nvfuse_make_bg_descriptor(struct nvfuse_bg_descriptor *bd, u32 bg_id, u32 bg_start, u32 bg_size)
+void nvfuse_make_bg_descriptor(struct nvfuse_bg_descriptor *bd, u32 bg_id, u32 bg_start, u32 bg_size,
+			       u32 inode_size)
 {
 	bd->bd_magic	= NVFUSE_BD_MAGIC;
 	bd->bd_owner	= 0;
@@ -176,7 +150,7 @@ void nvfuse_make_bg_descriptor(struct nvfuse_bg_descriptor *bd, u32 bg_id, u32 b
 	bd->bd_dbitmap_start	= NVFUSE_DBITMAP_OFFSET;
 	bd->bd_dbitmap_size	= NVFUSE_DBITMAP_SIZE;
 	bd->bd_itable_start	= bd->bd_dbitmap_start + bd->bd_dbitmap_size;
-	bd->bd_itable_size	= bd->bd_max_inodes * INODE_ENTRY_SIZE / CLUSTER_SIZE;
+	bd->bd_itable_size	= bd->bd_max_inodes * inode_size / CLUSTER_SIZE;
 	bd->bd_dtable_start	= bd->bd_itable_start + bd->bd_itable_size;
 	bd->bd_dtable_size	= bg_size - bd->bd_dtable_start;
 
@@ -195,7 +169,8 @@ void nvfuse_make_bg_descriptor(struct nvfuse_bg_descriptor *bd, u32 bg_id, u32 b
 void nvfuse_print_bd(struct nvfuse_bg_descriptor *bd)
 {
 	dprintf_info(FORMAT, " magic = %x bytes \n", bd->bd_magic);
-	dprintf_info(FORMAT, " inode size = %u bytes \n", INODE_ENTRY_SIZE);
+	dprintf_info(FORMAT, " inode size = %u bytes \n",
+		     bd->bd_itable_size * CLUSTER_SIZE / bd->bd_max_inodes);
 	dprintf_info(FORMAT, " bd_bg_start = %u\n", bd->bd_bd_start);
 	dprintf_info(FORMAT, " bd_ibitmap_start = %u\n", bd->bd_ibitmap_start);
 	dprintf_info(FORMAT, " bd_ibitmap_size = %u blocks \n", bd->bd_ibitmap_size);
@@ -238,7 +213,7 @@ s32 nvfuse_format_write_bd(struct nvfuse_handle *nvh,
 		bd = (struct nvfuse_bg_descriptor *)bd_buf;
 
 		/* make bg descriptor */
-		nvfuse_make_bg_descriptor(bd, bg_id, bg_start, bg_size);
+		nvfuse_make_bg_descriptor(bd, bg_id, bg_start, bg_size, sb_disk->sb_inode_size);
 
 		sb_disk->sb_free_inodes += bd->bd_free_inodes;
 		sb_disk->sb_free_blocks += bd->bd_free_blocks;
@@ -302,7 +277,7 @@ s32 nvfuse_format_metadata_zeroing(struct nvfuse_handle *nvh,
 		bd = (struct nvfuse_bg_descriptor *)bd_buf;
 
 		/* make bg descriptor */
-		nvfuse_make_bg_descriptor(bd, bg_id, bg_start, bg_size);
+		nvfuse_make_bg_descriptor(bd, bg_id, bg_start, bg_size, sb_disk->sb_inode_size);
 
 		/* Initialize ibitmap table */
 		memset(buf, 0x00, CLUSTER_SIZE);
@@ -425,6 +400,13 @@ s32 nvfuse_format(struct nvfuse_handle *nvh)
 	memset(buf, 0x00, CLUSTER_SIZE);
 	nvfuse_sb_disk = (struct nvfuse_superblock *) buf;
 
+	/* every bg descriptor sizes its inode table from this */
+	if (nvh->nvh_params.inode_size == INODE_ENTRY_SIZE_SMALL)
+		nvfuse_sb_disk->sb_inode_size = INODE_ENTRY_SIZE_SMALL;
+	else
+		nvfuse_sb_disk->sb_inode_size = INODE_ENTRY_SIZE;
+	dprintf_info(FORMAT, " inode size = %d bytes \n", nvfuse_sb_disk->sb_inode_size);
+
 	dprintf_info(FORMAT, " spdk: io_target = %p\n", target);
 	num_sectors = nvh->total_blkcount;
 	num_clu = num_sectors / SECTORS_PER_CLUSTER;
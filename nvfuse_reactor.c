@@ -64,6 +64,9 @@ void reactor_bio_cb(struct spdk_bdev_io *bdev_io, enum spdk_bdev_io_status succe
 		req->ret = 0;
 	}
 
+	if (req->req_type == SPDK_BDEV_IO_TYPE_WRITE && target->write_notify)
+		target->write_notify(target->write_notify_arg, req->offset, req->bytes);
+
 	//dprintf_info(REACTOR, " current queue depth = %d \n", target->current_queue_depth);
 	target->current_queue_depth--;
 	target->io_completed++;
@@ -276,8 +279,18 @@ int32_t reactor_submit_reqs(struct io_target *target, struct reactor_task *task,
 {
 	struct spdk_event *event;
 	struct io_job *req;
+	int room;
 	int i;
 
+	/* all or nothing, so that a caller can take its reqs back on failure */
+	pthread_mutex_lock(&task->sq_mutex);
+	room = task->qdepth - 1 - reactor_sq_size(task);
+	pthread_mutex_unlock(&task->sq_mutex);
+	if (count > room) {
+		dprintf_error(REACTOR, " SQ is full\n");
+		return -1;
+	}
+
 	for (i = 0; i < count; i++) {
 
 		req = reqs[i];
@@ -473,6 +486,8 @@ struct io_target *reactor_construct_targets(void)
 		target->io_completed = 0;
 		target->current_queue_depth = 0;
 		target->offset_in_ios = 0;
+		target->write_notify = NULL;
+		target->write_notify_arg = NULL;
 
 		target->is_draining = false;
 		target->run_timer = NULL;
@@ -40,6 +40,56 @@
                                 !IS_XATTR_LAST_ENTRY(entry);\
                                 entry = XATTR_NEXT_ENTRY(entry))
 
+/*
+ * nvfuse_xattr_base()
+ *
+ * Return the extended attribute space of the inode. Compact inodes have
+ * no inline space, so their entries are kept in a separate block, which
+ * is allocated on demand if create is set. *bh must be released by the
+ * caller when it is not NULL. Inline file data is spilled to a data
+ * block when create is set.
+ */
+static void *nvfuse_xattr_base(struct nvfuse_superblock *sb, struct nvfuse_inode_ctx *ictx,
+		struct nvfuse_buffer_head **bh, s32 create)
+{
+	struct nvfuse_inode *inode = ictx->ictx_inode;
+	u32 blk;
+
+	*bh = NULL;
+
+	if (!NVFUSE_INODE_IS_COMPACT(sb)) {
+#ifdef NVFUSE_USE_INLINE_DATA
+		/* the inline area holds file data, move it out first */
+		if (NVFUSE_INODE_HAS_INLINE_DATA(inode)) {
+			if (!create || nvfuse_spill_inline_data(sb, ictx))
+				return NULL;
+		}
+#endif
+		return (void *)&(inode->xattr[0]);
+	}
+
+	if (inode->i_xattr_blk) {
+		*bh = nvfuse_get_bh(sb, ictx, BLOCK_IO_INO, inode->i_xattr_blk, READ, NVFUSE_TYPE_META);
+		return *bh ? (*bh)->bh_buf : NULL;
+	}
+
+	if (!create)
+		return NULL;
+
+	if (nvfuse_alloc_free_block(sb, inode, &blk, 1) != 1)
+		return NULL;
+
+	*bh = nvfuse_get_bh(sb, ictx, BLOCK_IO_INO, blk, WRITE, NVFUSE_TYPE_META);
+	if (*bh == NULL) {
+		nvfuse_free_blocks(sb, blk, 1);
+		return NULL;
+	}
+	memset((*bh)->bh_buf, 0x00, CLUSTER_SIZE);
+	inode->i_xattr_blk = blk;
+
+	return (*bh)->bh_buf;
+}
+
 /*
  * nvfuse_set_xattr()
  *
@@ -55,10 +105,10 @@ s32 nvfuse_set_xattr(struct nvfuse_handle *nvh, const char *path,
 {	
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_inode_ctx *ictx;
-	struct nvfuse_inode *inode;
 	struct nvfuse_superblock *sb;
 	char filename[FNAME_SIZE];
 	struct nvfuse_xattr_entry *last, *here;
+	struct nvfuse_buffer_head *xattr_bh;
 	void *base_addr;
 	u32 name_len;
 	u32 value_len, free;
@@ -124,15 +174,18 @@ s32 nvfuse_set_xattr(struct nvfuse_handle *nvh, const char *path,
 		goto RET;
 	}
 
-	inode = ictx->ictx_inode;
-
 	/* Write new entry*/
 	if(value) {
 		char *pval;
 		bool is_found = 0;
 
 		// Get xattr address in Inode to extended attribute space base_addr.
-		base_addr = (void *)&(inode->xattr[0]);
+		base_addr = nvfuse_xattr_base(sb, ictx, &xattr_bh, 1);
+		if (base_addr == NULL) {
+			res = -1;
+			nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+			goto RELEASE_SUPER;
+		}
 		list_for_each_xattr(here, base_addr) {
 		if (here->e_name_len != name_len)
 				continue;
@@ -157,6 +210,7 @@ s32 nvfuse_set_xattr(struct nvfuse_handle *nvh, const char *path,
 				printf("insufficienty xattr free space to create\n");	//
 				#endif
 	                        res = -1;
+				nvfuse_release_bh(sb, xattr_bh, 0, NVF_CLEAN);
 				nvfuse_release_inode(sb, ictx, NVF_CLEAN);
 				goto RELEASE_SUPER;
 			}
@@ -182,6 +236,7 @@ s32 nvfuse_set_xattr(struct nvfuse_handle *nvh, const char *path,
 				printf("insufficienty xattr free space to replace\n");	//
 				#endif
                                 res = -1;
+				nvfuse_release_bh(sb, xattr_bh, 0, NVF_CLEAN);
 				nvfuse_release_inode(sb, ictx, NVF_CLEAN);
 				goto RELEASE_SUPER;
 			}
@@ -215,6 +270,7 @@ s32 nvfuse_set_xattr(struct nvfuse_handle *nvh, const char *path,
 //		printf("\n");
 		#endif
 
+	nvfuse_release_bh(sb, xattr_bh, 0, DIRTY);
 	nvfuse_release_inode(sb, ictx, DIRTY);
 
 	#ifdef BUFFER_FLUSH
@@ -246,10 +302,10 @@ s32 nvfuse_remove_xattr(struct nvfuse_handle *nvh, const char *path,
 {
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_inode_ctx *ictx;
-	struct nvfuse_inode *inode;
 	struct nvfuse_superblock *sb;
 	char filename[FNAME_SIZE];
 	struct nvfuse_xattr_entry *last, *here;
+	struct nvfuse_buffer_head *xattr_bh;
 	void *base_addr;
 	u32 name_len;
 	bool is_found = 0;
@@ -298,10 +354,13 @@ s32 nvfuse_remove_xattr(struct nvfuse_handle *nvh, const char *path,
 		goto RET;
 	}
 
-	inode = ictx->ictx_inode;
-
 	// Get xattr address in Inode to extended attribute space base_addr.
-	base_addr = (void *)&(inode->xattr[0]);
+	base_addr = nvfuse_xattr_base(sb, ictx, &xattr_bh, 0);
+	if (base_addr == NULL) {
+		res = -1;
+		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
+		goto RELEASE_SUPER;
+	}
 
 	/* find entry with wanted name */
 	list_for_each_xattr(here,base_addr) {
@@ -315,6 +374,7 @@ s32 nvfuse_remove_xattr(struct nvfuse_handle *nvh, const char *path,
 
 	if(is_found != 1) {
 		res = -1;
+		nvfuse_release_bh(sb, xattr_bh, 0, NVF_CLEAN);
 		nvfuse_release_inode(sb, ictx, NVF_CLEAN);
 		goto RELEASE_SUPER;
 	}
@@ -335,6 +395,7 @@ s32 nvfuse_remove_xattr(struct nvfuse_handle *nvh, const char *path,
 		memset(last, 0, shrinksize);
 	}
 
+	nvfuse_release_bh(sb, xattr_bh, 0, DIRTY);
 	nvfuse_release_inode(sb, ictx, DIRTY);
 
 	#ifdef BUFFER_FLUSH
@@ -363,10 +424,10 @@ s32 nvfuse_get_xattr(struct nvfuse_handle *nvh, const char *path,
 {
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_inode_ctx *ictx;
-	struct nvfuse_inode *inode;
 	struct nvfuse_superblock *sb;
 	char filename[FNAME_SIZE];
 	struct nvfuse_xattr_entry *last;
+	struct nvfuse_buffer_head *xattr_bh;
 	void *base_addr;
 	u32 name_len;
 	bool is_found = 0;
@@ -417,10 +478,12 @@ s32 nvfuse_get_xattr(struct nvfuse_handle *nvh, const char *path,
 		goto RET;
 	}
 	
-	inode = ictx->ictx_inode;
-	
 	// Get xattr address in Inode to extended attribute space base_addr.
-	base_addr = (void *)&(inode->xattr[0]);
+	base_addr = nvfuse_xattr_base(sb, ictx, &xattr_bh, 0);
+	if (base_addr == NULL) {
+		res = -1;
+		goto RELEASE;
+	}
 	list_for_each_xattr(last, base_addr) {
 		if (last->e_name_len != name_len)
 			continue;
@@ -452,6 +515,7 @@ s32 nvfuse_get_xattr(struct nvfuse_handle *nvh, const char *path,
 
 RELEASE:
 
+	nvfuse_release_bh(sb, xattr_bh, 0, NVF_CLEAN);
 	nvfuse_release_inode(sb, ictx, NVF_CLEAN);
 	nvfuse_release_super(sb);
 
@@ -471,10 +535,10 @@ s32 nvfuse_list_xattr(struct nvfuse_handle *nvh, const char *path,
 {
 	struct nvfuse_dir_entry dir_entry;
 	struct nvfuse_inode_ctx *ictx;
-	struct nvfuse_inode *inode;
 	struct nvfuse_superblock *sb;
 	char filename[FNAME_SIZE];
 	struct nvfuse_xattr_entry *last;
+	struct nvfuse_buffer_head *xattr_bh;
 	void *base_addr;
 	size_t rest = buf_size;
 	s32 res = 0;
@@ -505,13 +569,13 @@ s32 nvfuse_list_xattr(struct nvfuse_handle *nvh, const char *path,
 		goto RET;
 	}
 
-	inode = ictx->ictx_inode;
-	
 	// Get xattr address in Inode to extended attribute space base_addr.
-	base_addr = (void *)&(inode->xattr[0]);
+	base_addr = nvfuse_xattr_base(sb, ictx, &xattr_bh, 0);
 
 	/* Find entry*/
 	memset(buffer, 0x00, buf_size);
+	if (base_addr == NULL)
+		goto RELEASE;
 	list_for_each_xattr(last, base_addr) {
 				
 		if(last->e_name_len + 1 > rest) {
@@ -533,6 +597,7 @@ s32 nvfuse_list_xattr(struct nvfuse_handle *nvh, const char *path,
 
 RELEASE:		
 
+	nvfuse_release_bh(sb, xattr_bh, 0, NVF_CLEAN);
 	nvfuse_release_inode(sb, ictx, NVF_CLEAN);
 	nvfuse_release_super(sb);
 